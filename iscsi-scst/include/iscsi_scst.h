@@ -188,6 +188,10 @@ struct iscsi_kern_initiator_info {
 #define	MIN_NR_QUEUED_CMNDS	1
 #define	MAX_NR_QUEUED_CMNDS	2048
 
+#define	DEFAULT_NR_CONNECTIONS	1
+#define	MIN_NR_CONNECTIONS	1
+#define	MAX_NR_CONNECTIONS	16
+
 #define DEFAULT_RSP_TIMEOUT	90
 #define MIN_RSP_TIMEOUT		2
 #define MAX_RSP_TIMEOUT		65535
@@ -78,9 +78,117 @@ static ssize_t iscsi_open_state_show(struct kobject *kobj,
 static struct kobj_attribute iscsi_open_state_attr =
 	__ATTR(open_state, S_IRUGO, iscsi_open_state_show, NULL);
 
+static ssize_t iscsi_busy_poll_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	unsigned int usecs = READ_ONCE(iscsi_busy_poll_usecs);
+
+	return sprintf(buf, "%u\n%s", usecs,
+		       usecs != 0 ? SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static ssize_t iscsi_busy_poll_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int val;
+	int res;
+
+	res = kstrtouint(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+#if !defined(CONFIG_NET_RX_BUSY_POLL) || \
+	LINUX_VERSION_CODE < KERNEL_VERSION(4, 12, 0)
+	if (val != 0) {
+		PRINT_ERROR("Busy polling is not supported by this kernel");
+		res = -EINVAL;
+		goto out;
+	}
+#endif
+
+	WRITE_ONCE(iscsi_busy_poll_usecs, val);
+	res = count;
+
+out:
+	return res;
+}
+
+static struct kobj_attribute iscsi_busy_poll_attr =
+	__ATTR(busy_poll, S_IRUGO | S_IWUSR, iscsi_busy_poll_show,
+	       iscsi_busy_poll_store);
+
+static ssize_t iscsi_rss_placement_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	bool enabled = READ_ONCE(iscsi_rss_placement);
+
+	return sprintf(buf, "%d\n%s", enabled,
+		       enabled ? SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static ssize_t iscsi_rss_placement_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long val;
+	int res;
+
+	res = kstrtoul(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtoul() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+	WRITE_ONCE(iscsi_rss_placement, val != 0);
+	res = count;
+
+out:
+	return res;
+}
+
+static struct kobj_attribute iscsi_rss_placement_attr =
+	__ATTR(rss_placement, S_IRUGO | S_IWUSR, iscsi_rss_placement_show,
+	       iscsi_rss_placement_store);
+
+static ssize_t iscsi_adaptive_r2t_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	bool enabled = READ_ONCE(iscsi_adaptive_r2t);
+
+	return sprintf(buf, "%d\n%s", enabled,
+		       enabled ? "" : SCST_SYSFS_KEY_MARK "\n");
+}
+
+static ssize_t iscsi_adaptive_r2t_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long val;
+	int res;
+
+	res = kstrtoul(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtoul() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+	WRITE_ONCE(iscsi_adaptive_r2t, val != 0);
+	res = count;
+
+out:
+	return res;
+}
+
+static struct kobj_attribute iscsi_adaptive_r2t_attr =
+	__ATTR(adaptive_r2t, S_IRUGO | S_IWUSR, iscsi_adaptive_r2t_show,
+	       iscsi_adaptive_r2t_store);
+
 const struct attribute *iscsi_attrs[] = {
 	&iscsi_version_attr.attr,
 	&iscsi_open_state_attr.attr,
+	&iscsi_busy_poll_attr.attr,
+	&iscsi_rss_placement_attr.attr,
+	&iscsi_adaptive_r2t_attr.attr,
 	NULL,
 };
 
@@ -218,6 +218,89 @@ static ssize_t iscsi_conn_state_show(struct kobject *kobj,
 static struct kobj_attribute iscsi_conn_state_attr =
 	__ATTR(state, S_IRUGO, iscsi_conn_state_show, NULL);
 
+static ssize_t iscsi_conn_thread_cpus_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int pos;
+	struct iscsi_conn *conn;
+	struct iscsi_thread_pool *p;
+
+	TRACE_ENTRY();
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+	p = conn->conn_thr_pool;
+
+	if (p == NULL)
+		pos = sprintf(buf, "none\n");
+	else
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 0, 0)
+		pos = cpulist_scnprintf(buf, SCST_SYSFS_BLOCK_SIZE,
+					&p->cpu_mask);
+#else
+		pos = scnprintf(buf, SCST_SYSFS_BLOCK_SIZE, "%*pbl",
+				cpumask_pr_args(&p->cpu_mask));
+#endif
+	if (conn->own_thr_pool)
+		pos += scnprintf(buf + pos, SCST_SYSFS_BLOCK_SIZE - pos,
+				 " (incoming CPU)");
+	pos += scnprintf(buf + pos, SCST_SYSFS_BLOCK_SIZE - pos, "\n");
+
+	TRACE_EXIT_RES(pos);
+	return pos;
+}
+
+static struct kobj_attribute iscsi_conn_thread_cpus_attr =
+	__ATTR(thread_cpus, S_IRUGO, iscsi_conn_thread_cpus_show, NULL);
+
+static ssize_t iscsi_conn_timeouts_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int pos;
+	struct iscsi_conn *conn;
+
+	TRACE_ENTRY();
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	spin_lock_bh(&conn->write_list_lock);
+	pos = sprintf(buf, "rsp %lu\nnop_in %lu\ntm_data_wait %lu\n"
+		"waiting %u\n", conn->rsp_timeouts, conn->nop_in_timeouts,
+		conn->tm_data_wait_timeouts, conn->rsp_wheel.count);
+	spin_unlock_bh(&conn->write_list_lock);
+
+	TRACE_EXIT_RES(pos);
+	return pos;
+}
+
+static struct kobj_attribute iscsi_conn_timeouts_attr =
+	__ATTR(timeouts, S_IRUGO, iscsi_conn_timeouts_show, NULL);
+
+static ssize_t iscsi_conn_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct iscsi_conn *conn;
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	return iscsi_stats_show(&conn->conn_stats, buf);
+}
+
+static ssize_t iscsi_conn_stats_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct iscsi_conn *conn;
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	iscsi_stats_reset(&conn->conn_stats);
+
+	return count;
+}
+
+static struct kobj_attribute iscsi_conn_stats_attr =
+	__ATTR(stats, S_IRUGO | S_IWUSR, iscsi_conn_stats_show,
+	       iscsi_conn_stats_store);
+
 static void conn_sysfs_del(struct iscsi_conn *conn)
 {
 	DECLARE_COMPLETION_ONSTACK(c);
@@ -308,6 +391,30 @@ restart:
 		goto out_err;
 	}
 
+	res = sysfs_create_file(&conn->conn_kobj,
+			&iscsi_conn_thread_cpus_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			iscsi_conn_thread_cpus_attr.attr.name, addr);
+		goto out_err;
+	}
+
+	res = sysfs_create_file(&conn->conn_kobj,
+			&iscsi_conn_timeouts_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			iscsi_conn_timeouts_attr.attr.name, addr);
+		goto out_err;
+	}
+
+	res = sysfs_create_file(&conn->conn_kobj,
+			&iscsi_conn_stats_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			iscsi_conn_stats_attr.attr.name, addr);
+		goto out_err;
+	}
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -513,11 +620,194 @@ static void iscsi_write_space_ready(struct sock *sk)
 	return;
 }
 
+static void conn_rsp_wheel_init(struct iscsi_timeout_wheel *tw)
+{
+	int lvl, i;
+
+	tw->clk = jiffies & ~(ISCSI_TW_GRAN(0) - 1);
+	tw->count = 0;
+	for (lvl = 0; lvl < ISCSI_TW_LEVELS; lvl++) {
+		bitmap_zero(tw->pending[lvl], ISCSI_TW_SIZE);
+		for (i = 0; i < ISCSI_TW_SIZE; i++)
+			INIT_LIST_HEAD(&tw->buckets[lvl][i]);
+	}
+	return;
+}
+
+/*
+ * Puts cmnd in the bucket for timeout time expires and returns the time the
+ * bucket is due. write_list_lock supposed to be held.
+ */
+static unsigned long conn_rsp_wheel_queue(struct iscsi_timeout_wheel *tw,
+	struct iscsi_cmnd *cmnd, unsigned long expires)
+{
+	unsigned long delta, due;
+	int lvl, idx;
+
+	if (time_before(expires, tw->clk))
+		expires = tw->clk;
+	delta = expires - tw->clk;
+
+	if (delta < ISCSI_TW_GRAN(1)) {
+		lvl = 0;
+		due = (expires & ~(ISCSI_TW_GRAN(0) - 1)) + ISCSI_TW_GRAN(0);
+	} else {
+		lvl = 1;
+		/* Too far ones will be requeued when their bucket cascades */
+		if (delta >= ISCSI_TW_SIZE * ISCSI_TW_GRAN(1))
+			expires = tw->clk +
+				(ISCSI_TW_SIZE - 1) * ISCSI_TW_GRAN(1);
+		due = (expires & ~(ISCSI_TW_GRAN(1) - 1)) + ISCSI_TW_GRAN(0);
+	}
+	idx = (expires >> ISCSI_TW_SHIFT(lvl)) & ISCSI_TW_MASK;
+
+	list_add_tail(&cmnd->write_timeout_list_entry,
+		&tw->buckets[lvl][idx]);
+	set_bit(idx, tw->pending[lvl]);
+	cmnd->on_rsp_wheel = 1;
+
+	return due;
+}
+
+/*
+ * Returns the time the first not empty bucket of the wheel is due.
+ * write_list_lock supposed to be held and the wheel not empty.
+ */
+static unsigned long conn_rsp_wheel_next(struct iscsi_timeout_wheel *tw)
+{
+	unsigned long res = tw->clk + ISCSI_TW_SIZE * ISCSI_TW_GRAN(1);
+	int lvl, start, d, idx;
+
+	for (lvl = 0; lvl < ISCSI_TW_LEVELS; lvl++) {
+		start = (tw->clk >> ISCSI_TW_SHIFT(lvl)) & ISCSI_TW_MASK;
+		for (d = 0; d < ISCSI_TW_SIZE; d++) {
+			unsigned long due;
+
+			idx = (start + d) & ISCSI_TW_MASK;
+			if (!test_bit(idx, tw->pending[lvl]))
+				continue;
+			if (list_empty(&tw->buckets[lvl][idx])) {
+				clear_bit(idx, tw->pending[lvl]);
+				continue;
+			}
+			if (lvl == 0)
+				due = tw->clk + (d + 1) * ISCSI_TW_GRAN(0);
+			else
+				due = (tw->clk & ~(ISCSI_TW_GRAN(1) - 1)) +
+					d * ISCSI_TW_GRAN(1) + ISCSI_TW_GRAN(0);
+			if (time_before(due, res))
+				res = due;
+			break;
+		}
+	}
+
+	return res;
+}
+
+/*
+ * Moves commands from all the buckets, which are due at time j, to
+ * rsp_expired_list. Returns the number of moved commands.
+ * write_list_lock supposed to be held.
+ */
+static int conn_rsp_wheel_expire(struct iscsi_conn *conn, unsigned long j)
+{
+	struct iscsi_timeout_wheel *tw = &conn->rsp_wheel;
+	struct iscsi_cmnd *cmnd, *t;
+	int idx, res = 0;
+	LIST_HEAD(list);
+
+	while ((tw->count != 0) &&
+	       time_after_eq(j, tw->clk + ISCSI_TW_GRAN(0))) {
+		if ((tw->clk & (ISCSI_TW_GRAN(1) - 1)) == 0) {
+			idx = (tw->clk >> ISCSI_TW_SHIFT(1)) & ISCSI_TW_MASK;
+			list_splice_init(&tw->buckets[1][idx], &list);
+			clear_bit(idx, tw->pending[1]);
+			list_for_each_entry_safe(cmnd, t, &list,
+					write_timeout_list_entry) {
+				list_del(&cmnd->write_timeout_list_entry);
+				conn_rsp_wheel_queue(tw, cmnd,
+					iscsi_get_timeout_time(cmnd));
+			}
+		}
+
+		idx = (tw->clk >> ISCSI_TW_SHIFT(0)) & ISCSI_TW_MASK;
+		list_for_each_entry(cmnd, &tw->buckets[0][idx],
+				write_timeout_list_entry) {
+			cmnd->on_rsp_wheel = 0;
+			tw->count--;
+			res++;
+			if (cmnd_opcode(cmnd) == ISCSI_OP_NOP_OUT)
+				conn->nop_in_timeouts++;
+			else
+				conn->rsp_timeouts++;
+		}
+		list_splice_tail_init(&tw->buckets[0][idx],
+			&conn->rsp_expired_list);
+		clear_bit(idx, tw->pending[0]);
+
+		tw->clk += ISCSI_TW_GRAN(0);
+	}
+
+	return res;
+}
+
+/* write_list_lock supposed to be held */
+void conn_rsp_timer_arm(struct iscsi_conn *conn, unsigned long expires)
+{
+	lockdep_assert_held(&conn->write_list_lock);
+
+	if (!timer_pending(&conn->rsp_timer) ||
+	    time_after(conn->rsp_timer.expires, expires)) {
+		TRACE_DBG("Mod timer on %ld (conn %p)", expires, conn);
+		mod_timer(&conn->rsp_timer, expires);
+	}
+	return;
+}
+
+/*
+ * Starts tracking timeout of not aborted cmnd. write_list_lock supposed to
+ * be held.
+ */
+void conn_rsp_wheel_add(struct iscsi_conn *conn, struct iscsi_cmnd *cmnd)
+{
+	struct iscsi_timeout_wheel *tw = &conn->rsp_wheel;
+	unsigned long due;
+
+	lockdep_assert_held(&conn->write_list_lock);
+
+	if (tw->count == 0)
+		tw->clk = jiffies & ~(ISCSI_TW_GRAN(0) - 1);
+
+	due = conn_rsp_wheel_queue(tw, cmnd, iscsi_get_timeout_time(cmnd));
+	tw->count++;
+
+	conn_rsp_timer_arm(conn, due);
+	return;
+}
+
+/*
+ * Stops tracking timeout of cmnd, which can be on rsp_wheel,
+ * rsp_expired_list or tm_timeout_list. write_list_lock supposed to be held.
+ */
+void conn_rsp_wheel_del(struct iscsi_conn *conn, struct iscsi_cmnd *cmnd)
+{
+	lockdep_assert_held(&conn->write_list_lock);
+
+	list_del(&cmnd->write_timeout_list_entry);
+	if (cmnd->on_rsp_wheel) {
+		cmnd->on_rsp_wheel = 0;
+		conn->rsp_wheel.count--;
+	}
+	return;
+}
+
 static void conn_rsp_timer_fn(struct timer_list *timer)
 {
 	struct iscsi_conn *conn = container_of(timer, typeof(*conn), rsp_timer);
-	struct iscsi_cmnd *cmnd;
+	struct iscsi_cmnd *cmnd, *expired = NULL;
 	unsigned long j = jiffies;
+	unsigned long next = j + ISCSI_TW_SIZE * ISCSI_TW_GRAN(1);
+	bool rearm = false;
 
 	TRACE_ENTRY();
 
@@ -525,47 +815,64 @@ static void conn_rsp_timer_fn(struct timer_list *timer)
 
 	spin_lock_bh(&conn->write_list_lock);
 
-	if (!list_empty(&conn->write_timeout_list)) {
-		unsigned long timeout_time;
-
-		cmnd = list_first_entry(&conn->write_timeout_list,
+	conn_rsp_wheel_expire(conn, j);
+	if (!list_empty(&conn->rsp_expired_list))
+		expired = list_first_entry(&conn->rsp_expired_list,
 				struct iscsi_cmnd, write_timeout_list_entry);
 
-		timeout_time = iscsi_get_timeout_time(cmnd) +
-				ISCSI_ADD_SCHED_TIME;
+	list_for_each_entry(cmnd, &conn->tm_timeout_list,
+			write_timeout_list_entry) {
+		unsigned long timeout_time = iscsi_get_timeout_time(cmnd);
 
-		if (unlikely(time_after_eq(j, iscsi_get_timeout_time(cmnd)))) {
-			if (!conn->closing) {
-				PRINT_ERROR("Timeout %ld sec sending data/waiting for reply to/from initiator %s (SID %llx), closing connection %p",
-					iscsi_get_timeout(cmnd)/HZ,
-					conn->session->initiator_name,
-					(unsigned long long)conn->session->sid,
-					conn);
-				/*
-				 * We must call mark_conn_closed() outside of
-				 * write_list_lock or we will have a circular
-				 * locking dependency with rd_lock.
-				 */
-				spin_unlock_bh(&conn->write_list_lock);
-				mark_conn_closed(conn);
-				goto out;
-			}
-		} else if (!timer_pending(&conn->rsp_timer) ||
-			    time_after(conn->rsp_timer.expires, timeout_time)) {
-			TRACE_DBG("Restarting timer on %ld (conn %p)",
-				timeout_time, conn);
+		if (time_after_eq(j, timeout_time)) {
+			if (expired == NULL)
+				expired = cmnd;
+			continue;
+		}
+		timeout_time += ISCSI_ADD_SCHED_TIME;
+		if (time_before(timeout_time, next))
+			next = timeout_time;
+		rearm = true;
+	}
+
+	if (unlikely(expired != NULL)) {
+		if (!conn->closing) {
+			PRINT_ERROR("Timeout %ld sec sending data/waiting for reply to/from initiator %s (SID %llx), closing connection %p",
+				iscsi_get_timeout(expired)/HZ,
+				conn->session->initiator_name,
+				(unsigned long long)conn->session->sid,
+				conn);
 			/*
-			 * Timer might have been restarted while we were
-			 * entering here.
-			 *
-			 * Since we have not empty write_timeout_list, we are
-			 * safe to restart the timer, because we not race with
-			 * del_timer_sync() in conn_free().
+			 * We must call mark_conn_closed() outside of
+			 * write_list_lock or we will have a circular
+			 * locking dependency with rd_lock.
 			 */
-			mod_timer(&conn->rsp_timer, timeout_time);
+			spin_unlock_bh(&conn->write_list_lock);
+			mark_conn_closed(conn);
+			goto out;
 		}
 	}
 
+	if (conn->rsp_wheel.count != 0) {
+		unsigned long due = conn_rsp_wheel_next(&conn->rsp_wheel);
+
+		if (time_before(due, next))
+			next = due;
+		rearm = true;
+	}
+
+	if (rearm) {
+		/*
+		 * Timer might have been restarted while we were entering here.
+		 *
+		 * Since we have not empty rsp_wheel or tm_timeout_list, we are
+		 * safe to restart the timer, because we not race with
+		 * del_timer_sync() in conn_free().
+		 */
+		TRACE_DBG("Restarting timer on %ld (conn %p)", next, conn);
+		conn_rsp_timer_arm(conn, next);
+	}
+
 	spin_unlock_bh(&conn->write_list_lock);
 
 	if (unlikely(conn->conn_tm_active)) {
@@ -639,11 +946,11 @@ again:
 	spin_lock(&conn->write_list_lock);
 
 	aborted_cmds_pending = false;
-	list_for_each_entry(cmnd, &conn->write_timeout_list,
+	list_for_each_entry(cmnd, &conn->tm_timeout_list,
 				write_timeout_list_entry) {
 		/*
 		 * This should not happen, because DATA OUT commands can't get
-		 * into write_timeout_list.
+		 * into tm_timeout_list.
 		 */
 		sBUG_ON(cmnd->cmd_req != NULL);
 
@@ -672,6 +979,8 @@ again:
 			    (time_after_eq(j, cmnd->write_start +
 					   ISCSI_TM_DATA_WAIT_TIMEOUT) ||
 			     force)) {
+				if (!force)
+					conn->tm_data_wait_timeouts++;
 				spin_unlock(&conn->write_list_lock);
 				spin_unlock_bh(&conn->conn_thr_pool->rd_lock);
 				iscsi_fail_data_waiting_cmnd(cmnd);
@@ -683,13 +992,8 @@ cont:
 	}
 
 	if (aborted_cmds_pending) {
-		if (!force &&
-		    (!timer_pending(&conn->rsp_timer) ||
-		     time_after(conn->rsp_timer.expires, timeout_time))) {
-			TRACE_MGMT_DBG("Mod timer on %ld (conn %p)",
-				timeout_time, conn);
-			mod_timer(&conn->rsp_timer, timeout_time);
-		}
+		if (!force)
+			conn_rsp_timer_arm(conn, timeout_time);
 	} else {
 		TRACE_MGMT_DBG("Clearing conn_tm_active for conn %p", conn);
 		conn->conn_tm_active = 0;
@@ -757,6 +1061,54 @@ int conn_activate(struct iscsi_conn *conn)
 	return 0;
 }
 
+/*
+ * Whether to serve each new connection by a thread pool bound to the CPU
+ * that receives its packets (SO_INCOMING_CPU), i.e. the CPU RSS/RPS has
+ * mapped the connection's flow to.
+ */
+bool iscsi_rss_placement;
+
+/* target_mutex supposed to be locked */
+static void conn_rss_place(struct iscsi_conn *conn)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	struct iscsi_thread_pool *sess_pool = conn->session->sess_thr_pool;
+	struct iscsi_thread_pool *p;
+	int cpu;
+
+	if (!READ_ONCE(iscsi_rss_placement) || (sess_pool == NULL) ||
+	    sess_pool->dedicated)
+		goto out;
+
+	cpu = READ_ONCE(conn->sock->sk->sk_incoming_cpu);
+	if ((cpu < 0) || (cpu >= nr_cpu_ids) || !cpu_online(cpu)) {
+		TRACE_DBG("No incoming CPU for conn %p (%d)", conn, cpu);
+		goto out;
+	}
+
+	/* Stay within the cpu_mask configured for the initiator group */
+	if (!cpumask_test_cpu(cpu, &sess_pool->cpu_mask))
+		goto out;
+
+	if ((iscsi_threads_pool_get(false, cpumask_of(cpu), &p) != 0) ||
+	    (p == NULL))
+		goto out;
+
+	if (!cpumask_equal(&p->cpu_mask, cpumask_of(cpu))) {
+		/* Out of memory fallback to a pool we don't hold a ref on */
+		goto out;
+	}
+
+	TRACE_MGMT_DBG("Placing conn %p on thread pool %p of CPU %d", conn,
+		p, cpu);
+	conn->conn_thr_pool = p;
+	conn->own_thr_pool = true;
+
+out:
+#endif
+	return;
+}
+
 /*
  * Note: the code below passes a kernel space pointer (&opt) to setsockopt()
  * while the declaration of setsockopt specifies that it expects a user space
@@ -774,12 +1126,16 @@ static int conn_setup_sock(struct iscsi_conn *conn)
 
 	conn->sock = SOCKET_I(file_inode(conn->file));
 
+#ifndef MSG_SPLICE_PAGES
 	if (conn->sock->ops->sendpage == NULL) {
 		PRINT_ERROR("Socket for sid %llx doesn't support sendpage()",
 			    (unsigned long long)session->sid);
 		res = -EINVAL;
 		goto out;
 	}
+#endif
+
+	conn_rss_place(conn);
 
 #if 0
 	conn->sock->sk->sk_allocation = GFP_NOIO;
@@ -798,6 +1154,9 @@ out:
 
 void iscsi_tcp_conn_free(struct iscsi_conn *conn)
 {
+	if (conn->own_thr_pool)
+		iscsi_threads_pool_put(conn->conn_thr_pool);
+
 	fput(conn->file);
 	conn->file = NULL;
 	conn->sock = NULL;
@@ -827,7 +1186,9 @@ void conn_free(struct iscsi_conn *conn)
 	sBUG_ON(atomic_read(&conn->conn_ref_cnt) != 0);
 	sBUG_ON(!list_empty(&conn->cmd_list));
 	sBUG_ON(!list_empty(&conn->write_list));
-	sBUG_ON(!list_empty(&conn->write_timeout_list));
+	sBUG_ON(conn->rsp_wheel.count != 0);
+	sBUG_ON(!list_empty(&conn->rsp_expired_list));
+	sBUG_ON(!list_empty(&conn->tm_timeout_list));
 	sBUG_ON(conn->conn_reinst_successor != NULL);
 	sBUG_ON(!test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags));
 
@@ -847,6 +1208,8 @@ void conn_free(struct iscsi_conn *conn)
 
 	list_del(&conn->conn_list_entry);
 
+	iscsi_stats_free(&conn->conn_stats);
+
 	conn->transport->iscsit_conn_free(conn);
 
 	if (list_empty(&session->conn_list)) {
@@ -877,12 +1240,18 @@ int iscsi_init_conn(struct iscsi_session *session,
 	if (res != 0)
 		return res;
 
+	res = iscsi_stats_init(&conn->conn_stats);
+	if (res != 0)
+		return res;
+
 	conn->target = session->target;
 	spin_lock_init(&conn->cmd_list_lock);
 	INIT_LIST_HEAD(&conn->cmd_list);
 	spin_lock_init(&conn->write_list_lock);
 	INIT_LIST_HEAD(&conn->write_list);
-	INIT_LIST_HEAD(&conn->write_timeout_list);
+	conn_rsp_wheel_init(&conn->rsp_wheel);
+	INIT_LIST_HEAD(&conn->rsp_expired_list);
+	INIT_LIST_HEAD(&conn->tm_timeout_list);
 	timer_setup(&conn->rsp_timer, conn_rsp_timer_fn, 0);
 	init_waitqueue_head(&conn->read_state_waitQ);
 	init_completion(&conn->ready_to_free);
@@ -966,7 +1335,10 @@ out:
 	return res;
 
 out_fput:
+	if (conn->own_thr_pool)
+		iscsi_threads_pool_put(conn->conn_thr_pool);
 	fput(conn->file);
+	iscsi_stats_free(&conn->conn_stats);
 
 out_free_iov:
 	free_page((unsigned long)conn->read_iov);
@@ -978,6 +1350,19 @@ out_err:
 	goto out;
 }
 
+/* target_mutex supposed to be locked */
+static int session_active_conns(struct iscsi_session *session)
+{
+	struct iscsi_conn *conn;
+	int res = 0;
+
+	list_for_each_entry(conn, &session->conn_list, conn_list_entry) {
+		if (!test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags))
+			res++;
+	}
+	return res;
+}
+
 /* target_mutex supposed to be locked */
 int __add_conn(struct iscsi_session *session, struct iscsi_kern_conn_info *info)
 {
@@ -993,7 +1378,15 @@ int __add_conn(struct iscsi_session *session, struct iscsi_kern_conn_info *info)
 	    !test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags)) {
 		/* conn reinstatement */
 		reinstatement = true;
-	} else if (!list_empty(&session->conn_list)) {
+	} else if (conn != NULL) {
+		err = -EEXIST;
+		goto out;
+	} else if (session_active_conns(session) >=
+		   session->sess_params.max_connections) {
+		/* MC/S: MaxConnections has been negotiated for the session */
+		PRINT_ERROR("Session %#Lx already has the maximum number of connections (%d)",
+			(unsigned long long)session->sid,
+			session->sess_params.max_connections);
 		err = -EEXIST;
 		goto out;
 	}
@@ -141,6 +141,7 @@ int digest_rx_header(struct iscsi_cmnd *cmnd)
 	crc = digest_header(&cmnd->pdu);
 	if (unlikely(crc != cmnd->hdigest)) {
 		PRINT_ERROR("%s", "RX header digest failed");
+		iscsi_conn_stat_inc(cmnd->conn, hdigest_errors);
 		return -EIO;
 	} else {
 		TRACE_DBG("RX header digest OK for cmd %p", cmnd);
@@ -213,6 +214,7 @@ int digest_rx_data(struct iscsi_cmnd *cmnd)
 		TRACE_MGMT_DBG("Calculated crc %x, ddigest %x, offset %d", crc,
 			cmnd->ddigest, offset);
 		iscsi_dump_pdu(&cmnd->pdu);
+		iscsi_conn_stat_inc(cmnd->conn, ddigest_errors);
 		res = -EIO;
 	} else
 		TRACE_DBG("RX data digest OK for cmd %p", cmnd);
@@ -221,27 +223,53 @@ out:
 	return res;
 }
 
-void digest_tx_data(struct iscsi_cmnd *cmnd)
+/*
+ * Checks the data digest of cmnd against crc, which was computed over its
+ * data while the data was received. Unlike digest_rx_data() it can also
+ * check prelim completed commands and residual overflows, because crc
+ * covers the received bytes and not the buffer they ended up in.
+ */
+int digest_rx_data_crc(struct iscsi_cmnd *cmnd, u32 crc)
 {
-	struct iscsi_data_in_hdr *hdr;
-	u32 offset;
+	__be32 digest;
+	int res = 0;
 
-	TRACE_DBG("%s:%d req %p, own_sg %d, sg %p, sgcnt %d cmnd %p, own_sg %d, sg %p, sgcnt %d",
-		  __func__, __LINE__,
-		cmnd->parent_req, cmnd->parent_req->own_sg,
-		cmnd->parent_req->sg, cmnd->parent_req->sg_cnt,
-		cmnd, cmnd->own_sg, cmnd->sg, cmnd->sg_cnt);
+	/* The padding has been received through the same pass */
+	digest = (__force __be32)~cpu_to_le32(crc);
 
-	switch (cmnd_opcode(cmnd)) {
-	case ISCSI_OP_SCSI_DATA_IN:
-		hdr = (struct iscsi_data_in_hdr *)&cmnd->pdu.bhs;
-		offset = be32_to_cpu(hdr->buffer_offset);
-		break;
-	default:
-		offset = 0;
+#ifdef CONFIG_SCST_ISCSI_DEBUG_DIGEST_FAILURES
+	if (((scst_random() % 100000) == 752)) {
+		PRINT_INFO("%s", "Simulating digest failure");
+		digest = 0;
 	}
+#endif
+
+	if (unlikely(digest != cmnd->ddigest)) {
+		PRINT_ERROR("RX data digest failed");
+		TRACE_MGMT_DBG("Calculated crc %x, ddigest %x", digest,
+			cmnd->ddigest);
+		iscsi_dump_pdu(&cmnd->pdu);
+		iscsi_conn_stat_inc(cmnd->conn, ddigest_errors);
+		res = -EIO;
+	} else
+		TRACE_DBG("RX data digest OK for cmd %p", cmnd);
+
+	return res;
+}
+
+/*
+ * Sets the data digest of cmnd from crc, which was computed over its data
+ * while the data was sent, and the zero padding.
+ */
+void digest_tx_data_crc(struct iscsi_cmnd *cmnd, u32 crc)
+{
+	static const u32 padding;
+	int pad_bytes = ((cmnd->pdu.datasize + 3) & -4) - cmnd->pdu.datasize;
+
+	if (pad_bytes)
+		crc = digest_crc_update(crc, &padding, pad_bytes);
 
-	cmnd->ddigest = digest_data(cmnd, cmnd->pdu.datasize, offset, 0);
-	TRACE_DBG("TX data digest for cmd %p: %x (offset %d, opcode %x)", cmnd,
-		cmnd->ddigest, offset, cmnd_opcode(cmnd));
+	cmnd->ddigest = (__force __be32)~cpu_to_le32(crc);
+	TRACE_DBG("TX data digest for cmd %p: %x (opcode %x)", cmnd,
+		cmnd->ddigest, cmnd_opcode(cmnd));
 }
@@ -18,6 +18,8 @@
 #ifndef __ISCSI_DIGEST_H__
 #define __ISCSI_DIGEST_H__
 
+#include <linux/crc32c.h>
+
 extern void digest_alg_available(int *val);
 
 extern int digest_init(struct iscsi_conn *conn);
@@ -26,6 +28,26 @@ extern int digest_rx_header(struct iscsi_cmnd *cmnd);
 extern int digest_rx_data(struct iscsi_cmnd *cmnd);
 
 extern void digest_tx_header(struct iscsi_cmnd *cmnd);
-extern void digest_tx_data(struct iscsi_cmnd *cmnd);
+
+extern int digest_rx_data_crc(struct iscsi_cmnd *cmnd, u32 crc);
+extern void digest_tx_data_crc(struct iscsi_cmnd *cmnd, u32 crc);
+
+/*
+ * Incremental data digest, for computing it in the same pass that copies
+ * the data to or from the socket, while the data is cache hot. Start with
+ * DIGEST_CRC_INIT, update for each piece of data and finish with
+ * digest_rx_data_crc(), which expects the padding to be digested as well, or
+ * with digest_tx_data_crc(), which adds the padding itself.
+ */
+#define DIGEST_CRC_INIT		(~0U)
+
+static inline u32 digest_crc_update(u32 crc, const void *buf, size_t len)
+{
+#if defined(CONFIG_LIBCRC32C_MODULE) || defined(CONFIG_LIBCRC32C)
+	return crc32c(crc, buf, len);
+#else
+	return crc;
+#endif
+}
 
 #endif /* __ISCSI_DIGEST_H__ */
@@ -0,0 +1,141 @@
+/*
+ *  iSCSI data digest microbenchmark.
+ *
+ *  Compares computing the CRC32C data digest in a separate pass after the
+ *  data has been copied into the command buffer with computing it in the
+ *  same pass as the copy, chunk by chunk, as the iSCSI-SCST receive and
+ *  transmit paths do. Results are reported in the kernel log and the module
+ *  refuses to stay loaded, so it can be run again with other parameters:
+ *
+ *  insmod iscsi-scst-digest-bench.ko [iterations=N] [chunk_size=N]
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/crc32c.h>
+
+#define DIGEST_BENCH_MAX_SIZE	(256 * 1024)
+
+static unsigned int iterations = 1000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Number of iterations per data size");
+
+/* Close to what one skb fragment or one TCP segment carries */
+static unsigned int chunk_size = 1448;
+module_param(chunk_size, uint, 0444);
+MODULE_PARM_DESC(chunk_size, "Copy granularity in bytes");
+
+static const unsigned int digest_bench_sizes[] = {
+	4096, 8192, 16384, 65536, 262144,
+};
+
+/* Copy everything first, then digest the destination, as digest_data() */
+static u32 digest_bench_two_pass(void *dst, const void *src,
+	unsigned int size)
+{
+	unsigned int done;
+
+	for (done = 0; done < size; done += chunk_size)
+		memcpy(dst + done, src + done, min(chunk_size, size - done));
+
+	return crc32c(~0, dst, size);
+}
+
+/* Digest each chunk right after copying it, as the rx actor does */
+static u32 digest_bench_fused(void *dst, const void *src, unsigned int size)
+{
+	unsigned int done;
+	u32 crc = ~0;
+
+	for (done = 0; done < size; done += chunk_size) {
+		unsigned int l = min(chunk_size, size - done);
+
+		memcpy(dst + done, src + done, l);
+		crc = crc32c(crc, dst + done, l);
+	}
+
+	return crc;
+}
+
+static u64 digest_bench_run(u32 (*fn)(void *, const void *, unsigned int),
+	void *dst, const void *src, unsigned int size, u32 *crc)
+{
+	ktime_t start;
+	unsigned int i;
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++)
+		*crc = fn(dst, src, size);
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int __init digest_bench_init(void)
+{
+	void *src, *dst;
+	unsigned int i;
+	int res = -ENOMEM;
+
+	if ((iterations == 0) || (chunk_size == 0))
+		return -EINVAL;
+
+	src = vmalloc(DIGEST_BENCH_MAX_SIZE);
+	dst = vmalloc(DIGEST_BENCH_MAX_SIZE);
+	if ((src == NULL) || (dst == NULL))
+		goto out_free;
+
+	get_random_bytes(src, DIGEST_BENCH_MAX_SIZE);
+
+	pr_info("iscsi-scst digest bench: %u iterations, %u byte chunks\n",
+		iterations, chunk_size);
+	pr_info("%10s %14s %14s %8s\n", "size", "two-pass MB/s",
+		"fused MB/s", "speedup");
+
+	for (i = 0; i < ARRAY_SIZE(digest_bench_sizes); i++) {
+		unsigned int size = digest_bench_sizes[i];
+		u64 bytes = (u64)size * iterations;
+		u64 t2, tf;
+		u32 crc2, crcf;
+
+		t2 = digest_bench_run(digest_bench_two_pass, dst, src, size,
+				      &crc2);
+		tf = digest_bench_run(digest_bench_fused, dst, src, size,
+				      &crcf);
+		if (crc2 != crcf) {
+			pr_err("CRC mismatch for size %u: %x != %x\n", size,
+			       crc2, crcf);
+			res = -EIO;
+			goto out_free;
+		}
+
+		pr_info("%10u %14llu %14llu %7llu%%\n", size,
+			div64_u64(bytes * 1000, max_t(u64, t2, 1)),
+			div64_u64(bytes * 1000, max_t(u64, tf, 1)),
+			div64_u64(t2 * 100, max_t(u64, tf, 1)));
+	}
+
+	/* Nothing to keep loaded */
+	res = -EAGAIN;
+
+out_free:
+	vfree(dst);
+	vfree(src);
+	return res;
+}
+
+module_init(digest_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iSCSI-SCST data digest microbenchmark");
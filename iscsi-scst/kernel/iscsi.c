@@ -95,7 +95,7 @@ static void req_del_from_write_timeout_list(struct iscsi_cmnd *req)
 	if (unlikely(!req->on_write_timeout_list))
 		goto out_unlock;
 
-	list_del(&req->write_timeout_list_entry);
+	conn_rsp_wheel_del(conn, req);
 	req->on_write_timeout_list = 0;
 
 out_unlock:
@@ -792,18 +792,10 @@ static void iscsi_cmnds_init_write(struct list_head *send, int flags)
 
 	sBUG_ON(list_empty(send));
 
-	if (!(conn->ddigest_type & DIGEST_NONE)) {
-		list_for_each(pos, send) {
-			rsp = list_entry(pos, struct iscsi_cmnd,
-						write_list_entry);
-
-			if (rsp->pdu.datasize != 0) {
-				TRACE_DBG("Doing data digest (%p:%x)", rsp,
-					cmnd_opcode(rsp));
-				digest_tx_data(rsp);
-			}
-		}
-	}
+	/*
+	 * Data digests are computed by write_data() while the data is being
+	 * sent.
+	 */
 
 	spin_lock_bh(&conn->write_list_lock);
 	list_for_each_safe(pos, next, send) {
@@ -953,64 +945,96 @@ out:
 }
 EXPORT_SYMBOL(iscsi_set_resid);
 
+/*
+ * Sets the data size of the Data-In PDU of rsp, which starts at offset,
+ * and, if it is the last one of the sequence, the final and status fields.
+ */
+static void data_in_set_size(struct iscsi_cmnd *rsp, u32 offset)
+{
+	struct iscsi_data_in_hdr *rsp_hdr =
+		(struct iscsi_data_in_hdr *)&rsp->pdu.bhs;
+	u32 size = rsp->bufflen - offset;
+
+	if (size > rsp->data_in_pdusize) {
+		TRACE_DBG("pdusize %d, offset %d, size %d",
+			rsp->data_in_pdusize, offset, size);
+		rsp->pdu.datasize = rsp->data_in_pdusize;
+		return;
+	}
+
+	TRACE_DBG("offset %d, size %d", offset, size);
+	rsp->pdu.datasize = size;
+	if (rsp->data_in_send_status) {
+		TRACE_DBG("status %x", rsp->data_in_status);
+
+		rsp_hdr->flags = ISCSI_FLG_FINAL | ISCSI_FLG_STATUS;
+		rsp_hdr->cmd_status = rsp->data_in_status;
+
+		iscsi_set_resid(rsp);
+	}
+	return;
+}
+
+/*
+ * Queues a single response for all Data-In PDUs of req. Only the BHS of
+ * the first PDU is built here, the following ones are built in place by
+ * cmnd_data_in_next() in the write thread after the previous PDU has been
+ * sent, so a large READ doesn't need a response per PDU.
+ */
 static void send_data_rsp(struct iscsi_cmnd *req, u8 status, int send_status)
 {
 	struct iscsi_cmnd *rsp;
 	struct iscsi_scsi_cmd_hdr *req_hdr = cmnd_hdr(req);
 	struct iscsi_data_in_hdr *rsp_hdr;
-	u32 pdusize, size, offset, sn;
-	LIST_HEAD(send);
 
 	TRACE_DBG("req %p", req);
 
-	pdusize = req->conn->session->sess_params.max_xmit_data_length;
-	size = req->bufflen;
-	offset = 0;
-	sn = 0;
-
-	while (1) {
-		rsp = iscsi_alloc_rsp(req);
-		TRACE_DBG("rsp %p", rsp);
-		rsp->sg = req->sg;
-		rsp->sg_cnt = req->sg_cnt;
-		rsp->bufflen = req->bufflen;
-		rsp_hdr = (struct iscsi_data_in_hdr *)&rsp->pdu.bhs;
-
-		rsp_hdr->opcode = ISCSI_OP_SCSI_DATA_IN;
-		rsp_hdr->itt = req_hdr->itt;
-		rsp_hdr->ttt = ISCSI_RESERVED_TAG;
-		rsp_hdr->buffer_offset = cpu_to_be32(offset);
-		rsp_hdr->data_sn = cpu_to_be32(sn);
-
-		if (size <= pdusize) {
-			TRACE_DBG("offset %d, size %d", offset, size);
-			rsp->pdu.datasize = size;
-			if (send_status) {
-				TRACE_DBG("status %x", status);
+	rsp = iscsi_alloc_rsp(req);
+	TRACE_DBG("rsp %p", rsp);
+	rsp->sg = req->sg;
+	rsp->sg_cnt = req->sg_cnt;
+	rsp->bufflen = req->bufflen;
+	rsp->data_in_seq = 1;
+	rsp->data_in_send_status = !!send_status;
+	rsp->data_in_status = status;
+	rsp->data_in_pdusize =
+		req->conn->session->sess_params.max_xmit_data_length;
+	rsp_hdr = (struct iscsi_data_in_hdr *)&rsp->pdu.bhs;
+
+	rsp_hdr->opcode = ISCSI_OP_SCSI_DATA_IN;
+	rsp_hdr->itt = req_hdr->itt;
+	rsp_hdr->ttt = ISCSI_RESERVED_TAG;
+	rsp_hdr->buffer_offset = cpu_to_be32(0);
+	rsp_hdr->data_sn = cpu_to_be32(0);
 
-				rsp_hdr->flags = ISCSI_FLG_FINAL |
-					ISCSI_FLG_STATUS;
-				rsp_hdr->cmd_status = status;
+	data_in_set_size(rsp, 0);
 
-				iscsi_set_resid(rsp);
-			}
-			list_add_tail(&rsp->write_list_entry, &send);
-			break;
-		}
+	iscsi_cmnd_init_write(rsp, 0);
+	return;
+}
 
-		TRACE_DBG("pdusize %d, offset %d, size %d", pdusize, offset,
-			size);
+/*
+ * Turns the just sent Data-In PDU of rsp into the next PDU of its Data-In
+ * sequence. Returns false, if rsp isn't a Data-In sequence or the sent
+ * PDU was its last one. Called from the write thread.
+ */
+bool cmnd_data_in_next(struct iscsi_cmnd *rsp)
+{
+	struct iscsi_data_in_hdr *rsp_hdr =
+		(struct iscsi_data_in_hdr *)&rsp->pdu.bhs;
+	u32 offset;
 
-		rsp->pdu.datasize = pdusize;
+	if (!rsp->data_in_seq)
+		return false;
 
-		size -= pdusize;
-		offset += pdusize;
-		sn++;
+	offset = be32_to_cpu(rsp_hdr->buffer_offset) + rsp->pdu.datasize;
+	if (offset >= rsp->bufflen)
+		return false;
 
-		list_add_tail(&rsp->write_list_entry, &send);
-	}
-	iscsi_cmnds_init_write(&send, 0);
-	return;
+	rsp_hdr->buffer_offset = cpu_to_be32(offset);
+	be32_add_cpu(&rsp_hdr->data_sn, 1);
+	data_in_set_size(rsp, offset);
+	return true;
 }
 
 static void iscsi_tcp_set_sense_data(struct iscsi_cmnd *rsp,
@@ -1315,18 +1339,31 @@ static void update_stat_sn(struct iscsi_cmnd *cmnd)
 	return;
 }
 
-static struct iscsi_cmnd *cmnd_find_itt_get(struct iscsi_conn *conn, __be32 itt)
+/*
+ * ITTs are unique session-wide and with MC/S the task may have been received
+ * on another connection than the one looking it up, so search all of them.
+ */
+static struct iscsi_cmnd *cmnd_find_itt_get(struct iscsi_session *session,
+	__be32 itt)
 {
+	struct iscsi_conn *conn;
 	struct iscsi_cmnd *cmnd, *found_cmnd = NULL;
 
-	spin_lock_bh(&conn->cmd_list_lock);
-	list_for_each_entry(cmnd, &conn->cmd_list, cmd_list_entry) {
-		if ((cmnd->pdu.bhs.itt == itt) && !cmnd_get_check(cmnd)) {
-			found_cmnd = cmnd;
-			break;
+	mutex_lock(&session->target->target_mutex);
+	list_for_each_entry(conn, &session->conn_list, conn_list_entry) {
+		spin_lock_bh(&conn->cmd_list_lock);
+		list_for_each_entry(cmnd, &conn->cmd_list, cmd_list_entry) {
+			if ((cmnd->pdu.bhs.itt == itt) &&
+			    !cmnd_get_check(cmnd)) {
+				found_cmnd = cmnd;
+				break;
+			}
 		}
+		spin_unlock_bh(&conn->cmd_list_lock);
+		if (found_cmnd != NULL)
+			break;
 	}
-	spin_unlock_bh(&conn->cmd_list_lock);
+	mutex_unlock(&session->target->target_mutex);
 
 	return found_cmnd;
 }
@@ -1366,14 +1403,15 @@ static struct iscsi_cmnd *cmnd_find_data_wait_hash(struct iscsi_conn *conn,
 	return res;
 }
 
-static inline u32 get_next_ttt(struct iscsi_conn *conn)
+/*
+ * Must be called under cmnd_data_wait_hash_lock, since with MC/S the read
+ * threads of several connections allocate TTTs from the same session.
+ */
+static inline u32 get_next_ttt(struct iscsi_session *session)
 {
 	u32 ttt;
-	struct iscsi_session *session = conn->session;
-
-	/* Not compatible with MC/S! */
 
-	iscsi_extracheck_is_rd_thread(conn);
+	lockdep_assert_held(&session->cmnd_data_wait_hash_lock);
 
 	if (unlikely(session->next_ttt == ISCSI_RESERVED_TAG_CPU32))
 		session->next_ttt++;
@@ -1398,14 +1436,6 @@ static int cmnd_insert_data_wait_hash(struct iscsi_cmnd *cmnd)
 		goto out;
 	}
 
-	/*
-	 * We don't need TTT, because ITT/buffer_offset pair is sufficient
-	 * to find out the original request and buffer for Data-Out PDUs, but
-	 * crazy iSCSI spec requires us to send this superfluous field in
-	 * R2T PDUs and some initiators may rely on it.
-	 */
-	cmnd->target_task_tag = get_next_ttt(cmnd->conn);
-
 	TRACE_DBG("%p:%x", cmnd, itt);
 	if (unlikely(itt == ISCSI_RESERVED_TAG)) {
 		PRINT_ERROR("ITT is RESERVED_TAG (conn %p)", cmnd->conn);
@@ -1417,6 +1447,14 @@ static int cmnd_insert_data_wait_hash(struct iscsi_cmnd *cmnd)
 
 	spin_lock(&session->cmnd_data_wait_hash_lock);
 
+	/*
+	 * We don't need TTT, because ITT/buffer_offset pair is sufficient
+	 * to find out the original request and buffer for Data-Out PDUs, but
+	 * crazy iSCSI spec requires us to send this superfluous field in
+	 * R2T PDUs and some initiators may rely on it.
+	 */
+	cmnd->target_task_tag = get_next_ttt(session);
+
 	head = &session->cmnd_data_wait_hash[cmnd_hashfn((__force u32)itt)];
 
 	tmp = __cmnd_find_data_wait_hash(cmnd->conn, itt);
@@ -1678,12 +1716,143 @@ out:
 	return res;
 }
 
+/*
+ * Whether to adapt R2T burst length and number of outstanding R2Ts to the
+ * backend write completion rate and SGV pool memory headroom.
+ */
+bool iscsi_adaptive_r2t = true;
+
+/* How often the adaptive R2T parameters are reevaluated */
+#define ISCSI_R2T_ADAPT_PERIOD		(HZ / 10)
+/* Smallest burst the adaptive R2T scheduler shrinks to */
+#define ISCSI_R2T_MIN_BURST		(64 * 1024)
+/* SGV pool headroom, in percent, below which R2Ts are shrunk */
+#define ISCSI_R2T_LOW_HEADROOM		10
+/* SGV pool headroom, in percent, above which R2Ts may grow */
+#define ISCSI_R2T_HIGH_HEADROOM		25
+
+void iscsi_r2t_sched_init(struct iscsi_session *sess)
+{
+	struct iscsi_r2t_sched *s = &sess->r2t_sched;
+
+	spin_lock_init(&s->r2t_lock);
+	s->period_start = jiffies;
+	/* burst and outstanding are set from the negotiated params later */
+	return;
+}
+
+/*
+ * Reevaluates the R2T burst length and the number of outstanding R2Ts per
+ * command once per ISCSI_R2T_ADAPT_PERIOD. Multiplicative decrease if the
+ * backend reported BUSY or TASK SET FULL, if R2T'ed writes are started
+ * much faster than the backend completes them or if the SGV pool is close
+ * to its limit. Additive increase otherwise. The outstanding count is
+ * reduced before the burst length and restored after it, because larger
+ * bursts are cheaper to handle.
+ *
+ * Called under r2t_lock.
+ */
+static void iscsi_r2t_adapt(struct iscsi_session *sess)
+{
+	struct iscsi_r2t_sched *s = &sess->r2t_sched;
+	unsigned int max_burst = sess->sess_params.max_burst_length;
+	unsigned int max_outstanding = sess->sess_params.max_outstanding_r2t;
+	unsigned int min_burst = min_t(unsigned int, ISCSI_R2T_MIN_BURST,
+				       max_burst);
+	bool lagging;
+	int headroom;
+
+	lockdep_assert_held(&s->r2t_lock);
+
+	if ((s->burst == 0) || (s->burst > max_burst))
+		s->burst = max_burst;
+	if ((s->outstanding == 0) || (s->outstanding > max_outstanding))
+		s->outstanding = max_outstanding;
+
+	if (time_before(jiffies, s->period_start + ISCSI_R2T_ADAPT_PERIOD))
+		return;
+
+	if (!READ_ONCE(iscsi_adaptive_r2t)) {
+		s->burst = max_burst;
+		s->outstanding = max_outstanding;
+		goto out_reset;
+	}
+
+	headroom = sgv_pool_headroom();
+	lagging = (s->period_requested > 2 * s->period_completed) &&
+		  (s->period_requested > (u64)max_burst * max_outstanding);
+
+	if (s->period_congested || lagging ||
+	    (headroom < ISCSI_R2T_LOW_HEADROOM)) {
+		if (s->outstanding > 1)
+			s->outstanding = max(s->outstanding / 2, 1U);
+		else
+			s->burst = max(s->burst / 2, min_burst);
+	} else if (headroom >= ISCSI_R2T_HIGH_HEADROOM) {
+		if (s->burst < max_burst)
+			s->burst = min(s->burst + min_burst, max_burst);
+		else if (s->outstanding < max_outstanding)
+			s->outstanding++;
+	}
+
+	TRACE_DBG("sess %p: burst %u, outstanding %u (headroom %d, requested %llu, completed %llu, congested %d)",
+		sess, s->burst, s->outstanding, headroom,
+		(unsigned long long)s->period_requested,
+		(unsigned long long)s->period_completed, s->period_congested);
+
+out_reset:
+	s->period_start = jiffies;
+	s->period_requested = 0;
+	s->period_completed = 0;
+	s->period_congested = false;
+	return;
+}
+
+/* Accounts the end of a Data-Out burst solicited by an R2T of req */
+static void iscsi_r2t_data_received(struct iscsi_cmnd *req)
+{
+	struct iscsi_r2t_sched *s = &req->conn->session->r2t_sched;
+	s64 wait;
+
+	if (ktime_to_ns(req->r2t_start) == 0)
+		return;
+
+	wait = ktime_to_ns(ktime_sub(ktime_get(), req->r2t_start));
+
+	spin_lock_bh(&s->r2t_lock);
+	s->data_out_bursts++;
+	s->data_out_wait_ns += wait;
+	spin_unlock_bh(&s->r2t_lock);
+	return;
+}
+
+/* Accounts completion by the backend of a write command req */
+static void iscsi_r2t_cmnd_done(struct iscsi_cmnd *req, int status)
+{
+	struct iscsi_r2t_sched *s = &req->conn->session->r2t_sched;
+	bool congested = (status == SAM_STAT_BUSY) ||
+			 (status == SAM_STAT_TASK_SET_FULL);
+
+	if ((ktime_to_ns(req->r2t_start) == 0) && !congested)
+		return;
+
+	spin_lock_bh(&s->r2t_lock);
+	if (congested)
+		s->period_congested = true;
+	else
+		s->period_completed += cmnd_write_size(req);
+	spin_unlock_bh(&s->r2t_lock);
+	return;
+}
+
 static void send_r2t(struct iscsi_cmnd *req)
 {
 	struct iscsi_session *sess = req->conn->session;
 	struct iscsi_cmnd *rsp;
 	struct iscsi_r2t_hdr *rsp_hdr;
+	struct iscsi_r2t_sched *s = &sess->r2t_sched;
 	u32 offset, burst;
+	unsigned int max_outstanding, sent = 0, sent_bytes = 0;
 	LIST_HEAD(send);
 
 	TRACE_ENTRY();
@@ -1705,10 +1874,18 @@ static void send_r2t(struct iscsi_cmnd *req)
 	EXTRACHECKS_BUG_ON(req->outstanding_r2t >
 			   sess->sess_params.max_outstanding_r2t);
 
-	if (req->outstanding_r2t == sess->sess_params.max_outstanding_r2t)
+	spin_lock_bh(&s->r2t_lock);
+	iscsi_r2t_adapt(sess);
+	burst = s->burst;
+	max_outstanding = s->outstanding;
+	if ((ktime_to_ns(req->r2t_start) == 0) &&
+	    (req->outstanding_r2t < max_outstanding))
+		s->period_requested += cmnd_write_size(req);
+	spin_unlock_bh(&s->r2t_lock);
+
+	if (req->outstanding_r2t >= max_outstanding)
 		goto out;
 
-	burst = sess->sess_params.max_burst_length;
 	offset = be32_to_cpu(cmnd_hdr(req)->data_length) -
 			req->r2t_len_to_send;
 
@@ -1740,10 +1917,21 @@ static void send_r2t(struct iscsi_cmnd *req)
 
 		list_add_tail(&rsp->write_list_entry, &send);
 		req->outstanding_r2t++;
+		sent++;
+		sent_bytes += be32_to_cpu(rsp_hdr->data_length);
 
-	} while (req->outstanding_r2t < sess->sess_params.max_outstanding_r2t &&
+	} while (req->outstanding_r2t < max_outstanding &&
 		 req->r2t_len_to_send != 0);
 
+	req->r2t_start = ktime_get();
+
+	iscsi_conn_stat_add(req->conn, r2ts, sent);
+
+	spin_lock_bh(&s->r2t_lock);
+	s->r2ts_sent += sent;
+	s->r2t_bytes += sent_bytes;
+	spin_unlock_bh(&s->r2t_lock);
+
 	iscsi_cmnds_init_write(&send, ISCSI_INIT_WRITE_WAKE);
 
 out:
@@ -2184,6 +2372,18 @@ static int data_out_start(struct iscsi_cmnd *cmnd)
 	update_stat_sn(cmnd);
 
 	orig_req = cmnd_find_data_wait_hash(conn, req_hdr->itt);
+	if (unlikely(orig_req != NULL && orig_req->conn != conn)) {
+		/*
+		 * Connection allegiance: with MC/S all Data-Out PDUs of a
+		 * command must arrive on the connection the command was
+		 * received on, because R2Ts and the data receiving state of
+		 * the command belong to that connection's read thread.
+		 */
+		PRINT_ERROR("Data-Out PDU for ITT %x received on conn %p (cid %u) instead of conn %p (cid %u)",
+			req_hdr->itt, conn, conn->cid, orig_req->conn,
+			orig_req->conn->cid);
+		orig_req = NULL;
+	}
 	cmnd->cmd_req = orig_req;
 	if (unlikely(orig_req == NULL)) {
 		/*
@@ -2302,6 +2502,8 @@ static void data_out_end(struct iscsi_cmnd *cmnd)
 	if (!(req_hdr->flags & ISCSI_FLG_FINAL))
 		goto out_put;
 
+	iscsi_r2t_data_received(req);
+
 	if (req->r2t_len_to_receive == 0) {
 		if (!req->pending)
 			iscsi_restart_cmnd(req);
@@ -2357,22 +2559,23 @@ static void __cmnd_abort(struct iscsi_cmnd *cmnd)
 	TRACE_MGMT_DBG("Setting conn_tm_active for conn %p", conn);
 	conn->conn_tm_active = 1;
 
-	spin_unlock_bh(&conn->conn_thr_pool->rd_lock);
-
 	/*
 	 * We need the lock to sync with req_add_to_write_timeout_list() and
-	 * close races for rsp_timer.expires.
+	 * close races for rsp_timer.expires. Aborted commands are moved out
+	 * of rsp_wheel, because their timeout gets shorter and
+	 * iscsi_check_tm_data_wait_timeouts() needs to find them, hence
+	 * under rd_lock as well.
 	 */
-	spin_lock_bh(&conn->write_list_lock);
-	if (!timer_pending(&conn->rsp_timer) ||
-	    time_after(conn->rsp_timer.expires, timeout_time)) {
-		TRACE_MGMT_DBG("Mod timer on %ld (conn %p)", timeout_time,
-			conn);
-		mod_timer(&conn->rsp_timer, timeout_time);
-	} else
-		TRACE_MGMT_DBG("Timer for conn %p is going to fire on %ld (timeout time %ld)",
-			       conn, conn->rsp_timer.expires, timeout_time);
-	spin_unlock_bh(&conn->write_list_lock);
+	spin_lock(&conn->write_list_lock);
+	if (cmnd->on_write_timeout_list) {
+		conn_rsp_wheel_del(conn, cmnd);
+		list_add_tail(&cmnd->write_timeout_list_entry,
+			&conn->tm_timeout_list);
+	}
+	conn_rsp_timer_arm(conn, timeout_time);
+	spin_unlock(&conn->write_list_lock);
+
+	spin_unlock_bh(&conn->conn_thr_pool->rd_lock);
 
 	return;
 }
@@ -2394,7 +2597,7 @@ static int cmnd_abort_pre_checks(struct iscsi_cmnd *req, int *status)
 		goto out;
 	}
 
-	cmnd = cmnd_find_itt_get(req->conn, req_hdr->rtt);
+	cmnd = cmnd_find_itt_get(req->conn->session, req_hdr->rtt);
 	if (cmnd) {
 		struct iscsi_scsi_cmd_hdr *hdr = cmnd_hdr(cmnd);
 
@@ -2593,7 +2796,12 @@ again:
 			if (!cmnd_get_check(cmnd)) {
 				spin_unlock_bh(&conn->cmd_list_lock);
 
-				/* ToDo: this is racy for MC/S */
+				/*
+				 * Not racy with MC/S: Data-Out PDUs of cmnd
+				 * are accepted only on its own conn, and only
+				 * the read and close threads of conn, which
+				 * we are, unpend its commands.
+				 */
 				iscsi_fail_data_waiting_cmnd(cmnd);
 
 				cmnd_put(cmnd);
@@ -2830,21 +3038,64 @@ static void nop_out_exec(struct iscsi_cmnd *req)
 
 static void logout_exec(struct iscsi_cmnd *req)
 {
+	struct iscsi_conn *conn = req->conn;
+	struct iscsi_session *session = conn->session;
 	struct iscsi_logout_req_hdr *req_hdr;
 	struct iscsi_cmnd *rsp;
 	struct iscsi_logout_rsp_hdr *rsp_hdr;
+	struct iscsi_conn *c;
+	int reason;
+	u16 cid;
+
+	req_hdr = (struct iscsi_logout_req_hdr *)&req->pdu.bhs;
+	reason = req_hdr->flags & ISCSI_LOGOUT_REASON_MASK;
+	cid = be16_to_cpu(req_hdr->cid);
 
-	PRINT_INFO("Logout received from initiator %s",
-		req->conn->session->initiator_name);
+	PRINT_INFO("Logout received from initiator %s (reason %d, cid %u)",
+		session->initiator_name, reason, cid);
 	TRACE_DBG("%p", req);
 
-	req_hdr = (struct iscsi_logout_req_hdr *)&req->pdu.bhs;
 	rsp = iscsi_alloc_main_rsp(req);
 	rsp_hdr = (struct iscsi_logout_rsp_hdr *)&rsp->pdu.bhs;
 	rsp_hdr->opcode = ISCSI_OP_LOGOUT_RSP;
 	rsp_hdr->flags = ISCSI_FLG_FINAL;
 	rsp_hdr->itt = req_hdr->itt;
-	rsp->should_close_conn = 1;
+
+	switch (reason) {
+	case ISCSI_LOGOUT_CLOSE_SESSION:
+		/* All connections of the session, see cmnd_tx_end() */
+		rsp->should_close_conn = 1;
+		rsp->should_close_sess = 1;
+		break;
+	case ISCSI_LOGOUT_CLOSE_CONNECTION:
+		if (cid == conn->cid) {
+			rsp->should_close_conn = 1;
+			break;
+		}
+		/*
+		 * With MC/S the initiator may log out another connection of
+		 * the session. It doesn't get a response, so close it now.
+		 */
+		mutex_lock(&session->target->target_mutex);
+		c = conn_lookup(session, cid);
+		if (c != NULL) {
+			PRINT_INFO("Closing connection %u at initiator's %s request",
+				   cid, session->initiator_name);
+			mark_conn_closed(c);
+		} else
+			rsp_hdr->response = ISCSI_LOGOUT_RSP_CID_NOT_FOUND;
+		mutex_unlock(&session->target->target_mutex);
+		break;
+	case ISCSI_LOGOUT_REMOVE_CONN_FOR_RECOVERY:
+		/* ErrorRecoveryLevel is always 0 */
+		rsp_hdr->response = ISCSI_LOGOUT_RSP_RECOVERY_NOT_SUPPORTED;
+		break;
+	default:
+		PRINT_ERROR("Unknown logout reason %d from initiator %s",
+			    reason, session->initiator_name);
+		rsp_hdr->response = ISCSI_LOGOUT_RSP_CLEANUP_FAILED;
+		break;
+	}
 
 	req_cmnd_release(req);
 
@@ -3019,6 +3270,15 @@ void cmnd_tx_end(struct iscsi_cmnd *cmnd)
 			mutex_lock(&target->target_mutex);
 			target_del_all_sess(target, 0);
 			mutex_unlock(&target->target_mutex);
+		} else if (cmnd->should_close_sess) {
+			struct iscsi_session *session = conn->session;
+
+			PRINT_INFO("Closing session at initiator's %s request",
+				   session->initiator_name);
+
+			mutex_lock(&session->target->target_mutex);
+			target_del_session(session->target, session, 0);
+			mutex_unlock(&session->target->target_mutex);
 		} else {
 			PRINT_INFO("Closing connection at initiator's %s request",
 				   conn->session->initiator_name);
@@ -3030,16 +3290,147 @@ void cmnd_tx_end(struct iscsi_cmnd *cmnd)
 	return;
 }
 
+/*
+ * With MC/S the command with the expected CmdSN can be pending on another
+ * connection than the one whose read thread advanced exp_cmd_sn. Such a
+ * command must be executed by the read thread of its own connection, because
+ * its R2Ts and Data-Out PDUs belong to that connection, so wake that thread
+ * up. Must be called under sn_lock.
+ */
+void iscsi_kick_pending_cmnds(struct iscsi_session *session,
+	struct iscsi_conn *conn)
+{
+	struct iscsi_cmnd *cmnd;
+
+	lockdep_assert_held(&session->sn_lock);
+
+	if (list_empty(&session->pending_list))
+		return;
+
+	cmnd = list_first_entry(&session->pending_list, struct iscsi_cmnd,
+				pending_list_entry);
+	if ((cmnd->pdu.bhs.sn == session->exp_cmd_sn) &&
+	    (cmnd->conn != conn) && !cmnd->conn->closing) {
+		TRACE_DBG("Kicking conn %p for pending cmd %p (cmd_sn %u)",
+			cmnd->conn, cmnd, cmnd->pdu.bhs.sn);
+		iscsi_make_conn_rd_active(cmnd->conn);
+	}
+	return;
+}
+
+/*
+ * Executes the commands starting with cmnd, which has the expected CmdSN,
+ * followed by the pending commands of the same connection with subsequent
+ * CmdSNs. Called under sn_lock, which it drops.
+ */
+static void iscsi_exec_in_order(struct iscsi_conn *conn,
+	struct iscsi_cmnd *cmnd)
+	__releases(&session->sn_lock)
+{
+	struct iscsi_session *session = conn->session;
+	u32 cmd_sn = cmnd->pdu.bhs.sn;
+
+	while (1) {
+		session->exp_cmd_sn = ++cmd_sn;
+
+		if (unlikely(session->tm_active > 0)) {
+			if (before(cmd_sn, session->tm_sn)) {
+				spin_unlock(&session->sn_lock);
+
+				spin_lock_bh(&conn->cmd_list_lock);
+				__cmnd_abort(cmnd);
+				spin_unlock_bh(&conn->cmd_list_lock);
+
+				spin_lock(&session->sn_lock);
+			}
+			iscsi_check_send_delayed_tm_resp(session);
+		}
+
+		spin_unlock(&session->sn_lock);
+
+		iscsi_cmnd_exec(cmnd);
+
+		spin_lock(&session->sn_lock);
+
+		if (list_empty(&session->pending_list))
+			break;
+		cmnd = list_first_entry(&session->pending_list,
+				  struct iscsi_cmnd,
+				  pending_list_entry);
+		if (cmnd->pdu.bhs.sn != cmd_sn)
+			break;
+
+		if (unlikely(cmnd->conn != conn)) {
+			iscsi_kick_pending_cmnds(session, conn);
+			break;
+		}
+
+		list_del(&cmnd->pending_list_entry);
+		cmnd->pending = 0;
+
+		TRACE_MGMT_DBG("Processing pending cmd %p (cmd_sn %u)",
+			cmnd, cmd_sn);
+	}
+
+	spin_unlock(&session->sn_lock);
+	return;
+}
+
+/*
+ * Executes the pending command with the expected CmdSN if it was received on
+ * conn and another connection's read thread has filled the CmdSN gap in front
+ * of it. Called from the read thread of conn.
+ */
+void iscsi_push_pending_cmnds(struct iscsi_conn *conn)
+{
+	struct iscsi_session *session = conn->session;
+	struct iscsi_cmnd *cmnd;
+
+	iscsi_extracheck_is_rd_thread(conn);
+
+	/* Racy, but a kick always comes after the gap is filled */
+	if (list_empty(&session->pending_list))
+		goto out;
+
+	spin_lock(&session->sn_lock);
+
+	if (list_empty(&session->pending_list))
+		goto out_unlock;
+
+	cmnd = list_first_entry(&session->pending_list, struct iscsi_cmnd,
+				pending_list_entry);
+	if ((cmnd->conn != conn) ||
+	    (cmnd->pdu.bhs.sn != session->exp_cmd_sn))
+		goto out_unlock;
+
+	list_del(&cmnd->pending_list_entry);
+	cmnd->pending = 0;
+
+	TRACE_MGMT_DBG("Processing pending cmd %p (cmd_sn %u) on conn %p",
+		cmnd, cmnd->pdu.bhs.sn, conn);
+
+	iscsi_exec_in_order(conn, cmnd);
+
+out:
+	return;
+
+out_unlock:
+	spin_unlock(&session->sn_lock);
+	goto out;
+}
+
 /*
  * Push the command for execution. This functions reorders the commands.
  * Called from the read thread.
  *
- * Basically, since we don't support MC/S and TCP guarantees data delivery
- * order, all that SN's stuff isn't needed at all (commands delivery order is
- * a natural commands execution order), but insane iSCSI spec requires
- * us to check it and we have to, because some crazy initiators can rely
- * on the SN's based order and reorder requests during sending. For all other
- * normal initiators all that code is a NOP.
+ * With a single connection TCP guarantees data delivery order, so commands
+ * delivery order is a natural commands execution order and all that SN's
+ * stuff is a NOP for normal initiators, but the iSCSI spec requires us to
+ * check it, because some initiators reorder requests during sending. With
+ * MC/S the commands of a session arrive on several connections, so the
+ * CmdSN order has to be restored session-wide: a command is executed only
+ * after all commands with lower CmdSN, whatever connection they came on.
+ * Commands ahead of their turn wait in the session's pending_list.
  */
 static void iscsi_push_cmnd(struct iscsi_cmnd *cmnd)
 {
@@ -3065,44 +3456,8 @@ static void iscsi_push_cmnd(struct iscsi_cmnd *cmnd)
 
 	cmd_sn = cmnd->pdu.bhs.sn;
 	if (cmd_sn == session->exp_cmd_sn) {
-		while (1) {
-			session->exp_cmd_sn = ++cmd_sn;
-
-			if (unlikely(session->tm_active > 0)) {
-				if (before(cmd_sn, session->tm_sn)) {
-					struct iscsi_conn *conn = cmnd->conn;
-
-					spin_unlock(&session->sn_lock);
-
-					spin_lock_bh(&conn->cmd_list_lock);
-					__cmnd_abort(cmnd);
-					spin_unlock_bh(&conn->cmd_list_lock);
-
-					spin_lock(&session->sn_lock);
-				}
-				iscsi_check_send_delayed_tm_resp(session);
-			}
-
-			spin_unlock(&session->sn_lock);
-
-			iscsi_cmnd_exec(cmnd);
-
-			spin_lock(&session->sn_lock);
-
-			if (list_empty(&session->pending_list))
-				break;
-			cmnd = list_first_entry(&session->pending_list,
-					  struct iscsi_cmnd,
-					  pending_list_entry);
-			if (cmnd->pdu.bhs.sn != cmd_sn)
-				break;
-
-			list_del(&cmnd->pending_list_entry);
-			cmnd->pending = 0;
-
-			TRACE_MGMT_DBG("Processing pending cmd %p (cmd_sn %u)",
-				cmnd, cmd_sn);
-		}
+		iscsi_exec_in_order(cmnd->conn, cmnd);
+		goto out;
 	} else {
 		int drop = 0;
 
@@ -3322,8 +3677,8 @@ static ssize_t iscsi_tcp_get_initiator_ip(struct iscsi_conn *conn,
 static int iscsi_alloc_data_buf(struct scst_cmd *cmd)
 {
 	/*
-	 * sock->ops->sendpage() is async zero copy operation,
-	 * so we must be sure not to free and reuse
+	 * sock->ops->sendpage() and sendmsg(MSG_SPLICE_PAGES) are async
+	 * zero copy operations, so we must be sure not to free and reuse
 	 * the command's buffer before the sending was completed
 	 * by the network layers. It is possible only if we
 	 * don't use SGV cache.
@@ -3406,7 +3761,9 @@ static void iscsi_try_local_processing(struct iscsi_cmnd *req)
 			rc = iscsi_send(conn);
 			if (rc <= 0)
 				break;
-		} while (req->not_processed_rsp_cnt != 0);
+		} while ((req->not_processed_rsp_cnt != 0) ||
+			 ((conn->write_cmnd != NULL) &&
+			  (conn->write_cmnd->parent_req == req)));
 
 		spin_lock_bh(&p->wr_lock);
 #ifdef CONFIG_SCST_EXTRACHECKS
@@ -3555,6 +3912,9 @@ static int iscsi_xmit_response(struct scst_cmd *scst_cmd)
 	if (likely(req->dec_active_cmds))
 		iscsi_dec_active_cmds(req);
 
+	if (cmnd_hdr(req)->flags & ISCSI_CMD_WRITE)
+		iscsi_r2t_cmnd_done(req, status);
+
 	if (req->bufflen != 0) {
 		/*
 		 * Check above makes sure that is_send_status is set,
@@ -4292,6 +4652,109 @@ out_free:
 	goto out_unlock;
 }
 
+/* Protects base and reset_time of all iscsi_stats_set's */
+static DEFINE_SPINLOCK(iscsi_stats_lock);
+
+int iscsi_stats_init(struct iscsi_stats_set *s)
+{
+	s->pcpu = alloc_percpu(struct iscsi_stats);
+	if (s->pcpu == NULL)
+		return -ENOMEM;
+
+	memset(&s->base, 0, sizeof(s->base));
+	s->reset_time = jiffies;
+	return 0;
+}
+
+void iscsi_stats_free(struct iscsi_stats_set *s)
+{
+	free_percpu(s->pcpu);
+	s->pcpu = NULL;
+}
+EXPORT_SYMBOL(iscsi_stats_free);
+
+static void iscsi_stats_sum(struct iscsi_stats_set *s, struct iscsi_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		const struct iscsi_stats *c = per_cpu_ptr(s->pcpu, cpu);
+
+		sum->rx_pdus += READ_ONCE(c->rx_pdus);
+		sum->rx_bytes += READ_ONCE(c->rx_bytes);
+		sum->tx_pdus += READ_ONCE(c->tx_pdus);
+		sum->tx_bytes += READ_ONCE(c->tx_bytes);
+		sum->r2ts += READ_ONCE(c->r2ts);
+		sum->hdigest_errors += READ_ONCE(c->hdigest_errors);
+		sum->ddigest_errors += READ_ONCE(c->ddigest_errors);
+		sum->tx_stalls += READ_ONCE(c->tx_stalls);
+		sum->rd_time_ns += READ_ONCE(c->rd_time_ns);
+		sum->wr_time_ns += READ_ONCE(c->wr_time_ns);
+	}
+	return;
+}
+
+/*
+ * Prints the counters accumulated since the last reset together with the
+ * time they were accumulated for, so rates can be computed from two
+ * consecutive snapshots. The per CPU counters are only read, so taking a
+ * snapshot does not disturb the I/O paths.
+ */
+ssize_t iscsi_stats_show(struct iscsi_stats_set *s, char *buf)
+{
+	struct iscsi_stats sum, base;
+	unsigned long reset_time;
+
+	iscsi_stats_sum(s, &sum);
+
+	spin_lock(&iscsi_stats_lock);
+	base = s->base;
+	reset_time = s->reset_time;
+	spin_unlock(&iscsi_stats_lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+		"rx_pdus %llu\n"
+		"rx_bytes %llu\n"
+		"tx_pdus %llu\n"
+		"tx_bytes %llu\n"
+		"r2ts %llu\n"
+		"hdigest_errors %llu\n"
+		"ddigest_errors %llu\n"
+		"tx_stalls %llu\n"
+		"rd_time_us %llu\n"
+		"wr_time_us %llu\n"
+		"elapsed_ms %u\n",
+		sum.rx_pdus - base.rx_pdus,
+		sum.rx_bytes - base.rx_bytes,
+		sum.tx_pdus - base.tx_pdus,
+		sum.tx_bytes - base.tx_bytes,
+		sum.r2ts - base.r2ts,
+		sum.hdigest_errors - base.hdigest_errors,
+		sum.ddigest_errors - base.ddigest_errors,
+		sum.tx_stalls - base.tx_stalls,
+		div_u64(sum.rd_time_ns - base.rd_time_ns, NSEC_PER_USEC),
+		div_u64(sum.wr_time_ns - base.wr_time_ns, NSEC_PER_USEC),
+		jiffies_to_msecs(jiffies - reset_time));
+}
+
+/*
+ * Resets the counters by remembering their current values instead of
+ * zeroing them, which would race with the CPUs updating them.
+ */
+void iscsi_stats_reset(struct iscsi_stats_set *s)
+{
+	struct iscsi_stats sum;
+
+	iscsi_stats_sum(s, &sum);
+
+	spin_lock(&iscsi_stats_lock);
+	s->base = sum;
+	s->reset_time = jiffies;
+	spin_unlock(&iscsi_stats_lock);
+	return;
+}
+
 static int __init iscsi_init(void)
 {
 	int err = 0;
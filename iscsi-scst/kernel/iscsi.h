@@ -21,6 +21,9 @@
 #include <linux/mm.h>
 #include <linux/net.h>
 #include <linux/module.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#endif
 #include <net/sock.h>
 
 #ifdef INSIDE_KERNEL_TREE
@@ -134,13 +137,59 @@ struct iscsi_target {
 #define	cmnd_hashfn(itt)	hash_long(itt, ISCSI_HASH_ORDER)
 #endif
 
+/* Per CPU performance counters of a connection or a session */
+struct iscsi_stats {
+	u64 rx_pdus;
+	u64 rx_bytes;
+	u64 tx_pdus;
+	u64 tx_bytes;
+	u64 r2ts;
+	u64 hdigest_errors;
+	u64 ddigest_errors;
+	u64 tx_stalls;		/* socket send buffer was full */
+	u64 rd_time_ns;		/* time spent in process_read_io() */
+	u64 wr_time_ns;		/* time spent in iscsi_send() */
+};
+
+struct iscsi_stats_set {
+	struct iscsi_stats __percpu *pcpu;
+	/* Both protected by iscsi_stats_lock */
+	struct iscsi_stats base;	/* values at the last reset */
+	unsigned long reset_time;
+};
+
+/*
+ * Adaptive R2T scheduling state of a session. The R2T burst length and the
+ * number of outstanding R2Ts per command are shrunk when the backend does
+ * not keep up with the incoming write data or the SGV pool memory runs low
+ * and grown back up to the negotiated MaxBurstLength and MaxOutstandingR2T
+ * otherwise. See iscsi_r2t_adapt().
+ */
+struct iscsi_r2t_sched {
+	spinlock_t r2t_lock;
+
+	/* All protected by r2t_lock */
+	unsigned int burst;
+	unsigned int outstanding;
+	unsigned long period_start;
+	u64 period_requested;	/* R2T'ed writes started in this period */
+	u64 period_completed;	/* R2T'ed writes completed in this period */
+	bool period_congested;	/* BUSY or TASK SET FULL returned */
+
+	/* Statistics, all protected by r2t_lock */
+	u64 r2ts_sent;
+	u64 r2t_bytes;
+	u64 data_out_bursts;
+	u64 data_out_wait_ns;
+};
+
 struct iscsi_session {
 	struct iscsi_target *target;
 	struct scst_session *scst_sess;
 
 	struct list_head pending_list; /* protected by sn_lock */
 
-	/* Unprotected, since accessed only from a single read thread */
+	/* Protected by cmnd_data_wait_hash_lock */
 	u32 next_ttt;
 
 	/* Read only, if there are connection(s) */
@@ -177,11 +226,39 @@ struct iscsi_session {
 
 	struct iscsi_thread_pool *sess_thr_pool;
 
+	struct iscsi_r2t_sched r2t_sched;
+
+	struct iscsi_stats_set sess_stats;
+
 	/* All don't need any protection */
 	char *initiator_name;
 	u64 sid;
 };
 
+/*
+ * Hierarchical timing wheel keeping commands until they time out. Level 0
+ * has ISCSI_TW_SIZE buckets ISCSI_TW_GRAN jiffies (about 0.5-1 sec) each,
+ * level 1 has ISCSI_TW_SIZE buckets covering the whole level 0 each. Level
+ * 1 buckets are cascaded into level 0 when level 0 reaches their start.
+ * Adding and deleting is O(1) and expiring touches only the due buckets.
+ */
+#define ISCSI_TW_BITS		6
+#define ISCSI_TW_SIZE		(1 << ISCSI_TW_BITS)
+#define ISCSI_TW_MASK		(ISCSI_TW_SIZE - 1)
+#define ISCSI_TW_LEVELS		2
+#define ISCSI_TW_SHIFT(lvl)	(ilog2(HZ) + (lvl) * ISCSI_TW_BITS)
+#define ISCSI_TW_GRAN(lvl)	(1UL << ISCSI_TW_SHIFT(lvl))
+
+struct iscsi_timeout_wheel {
+	/* Start of the next level 0 bucket to expire */
+	unsigned long clk;
+	/* Number of commands in the buckets */
+	unsigned int count;
+	/* Set bits for possibly not empty buckets */
+	unsigned long pending[ISCSI_TW_LEVELS][BITS_TO_LONGS(ISCSI_TW_SIZE)];
+	struct list_head buckets[ISCSI_TW_LEVELS][ISCSI_TW_SIZE];
+};
+
 #define ISCSI_CONN_IOV_MAX			(PAGE_SIZE/sizeof(struct iovec))
 
 #define ISCSI_CONN_RD_STATE_IDLE		0
@@ -216,13 +293,28 @@ struct iscsi_conn {
 	spinlock_t write_list_lock;
 	/* List of data pdus to be sent. Protected by write_list_lock */
 	struct list_head write_list;
-	/* List of data pdus being sent. Protected by write_list_lock */
-	struct list_head write_timeout_list;
+
+	/*
+	 * Requests waiting for their data to be sent or received, by timeout
+	 * time, except aborted ones. Protected by write_list_lock.
+	 */
+	struct iscsi_timeout_wheel rsp_wheel;
+	/* Requests from rsp_wheel that timed out. Protected by write_list_lock */
+	struct list_head rsp_expired_list;
+	/* Aborted requests waiting for data. Protected by write_list_lock */
+	struct list_head tm_timeout_list;
 
 	/* Protected by write_list_lock */
 	struct timer_list rsp_timer;
 	unsigned int data_rsp_timeout; /* in jiffies */
 
+	struct iscsi_stats_set conn_stats;
+
+	/* Timeout statistics, protected by write_list_lock */
+	unsigned long rsp_timeouts;
+	unsigned long nop_in_timeouts;
+	unsigned long tm_data_wait_timeouts;
+
 	/*
 	 * All 2 protected by wr_lock. Modified independently to the
 	 * above field, hence the alignment.
@@ -247,6 +339,8 @@ struct iscsi_conn {
 	u32 write_size;
 	u32 write_offset;
 	int write_state;
+	/* Data digest of write_cmnd, computed while its data is being sent */
+	u32 write_ddigest_crc;
 
 	/* Both don't need any protection */
 	struct file *file;
@@ -265,6 +359,8 @@ struct iscsi_conn {
 	int ddigest_type;
 
 	struct iscsi_thread_pool *conn_thr_pool;
+	/* Set if conn_thr_pool is referenced by conn instead of its session */
+	bool own_thr_pool;
 
 	/* All 6 protected by rd_lock */
 	unsigned short rd_state;
@@ -298,6 +394,10 @@ struct iscsi_conn {
 #endif
 	struct task_struct *rx_task;
 	uint32_t rpadding;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	/* Data digest of read_cmnd, computed while its data is being copied */
+	u32 read_ddigest_crc;
+#endif
 
 	struct iscsi_target *target;
 
@@ -383,6 +483,7 @@ struct iscsi_cmnd {
 	unsigned int hashed:1;
 	unsigned int should_close_conn:1;
 	unsigned int should_close_all_conn:1;
+	unsigned int should_close_sess:1;
 	unsigned int pending:1;
 	unsigned int own_sg:1;
 	unsigned int on_write_list:1;
@@ -451,8 +552,9 @@ struct iscsi_cmnd {
 		struct list_head write_timeout_list_entry;
 	};
 
-	/* Both protected by conn->write_list_lock */
+	/* All protected by conn->write_list_lock */
 	unsigned int on_write_timeout_list:1;
+	unsigned int on_rsp_wheel:1;
 	unsigned long write_start;
 
 	/*
@@ -492,6 +594,15 @@ struct iscsi_cmnd {
 		struct {
 			struct scatterlist rsp_sg[2];
 			struct iscsi_sense_data sense_hdr;
+
+			/*
+			 * Set for a response, which sends all Data-In PDUs of
+			 * its request, see cmnd_data_in_next().
+			 */
+			unsigned int data_in_seq:1;
+			unsigned int data_in_send_status:1;
+			u8 data_in_status;
+			u32 data_in_pdusize;
 		};
 	};
 
@@ -506,6 +617,7 @@ struct iscsi_cmnd {
 	unsigned int r2t_len_to_receive;
 	unsigned int r2t_len_to_send;
 	unsigned int outstanding_r2t;
+	ktime_t r2t_start; /* when the last R2Ts for this cmd were sent */
 	u32 target_task_tag;
 	__be32 hdigest;
 	__be32 ddigest;
@@ -543,6 +655,7 @@ extern int cmnd_rx_continue(struct iscsi_cmnd *req);
 extern void cmnd_rx_end(struct iscsi_cmnd *cmnd);
 extern void cmnd_tx_start(struct iscsi_cmnd *cmnd);
 extern void cmnd_tx_end(struct iscsi_cmnd *cmnd);
+extern bool cmnd_data_in_next(struct iscsi_cmnd *rsp);
 extern void req_cmnd_release_force(struct iscsi_cmnd *req);
 extern void rsp_cmnd_release(struct iscsi_cmnd *cmnd);
 extern void iscsi_drop_delayed_tm_rsp(struct iscsi_cmnd *tm_rsp);
@@ -551,6 +664,9 @@ extern void conn_abort(struct iscsi_conn *conn);
 extern void iscsi_restart_cmnd(struct iscsi_cmnd *cmnd);
 extern void iscsi_fail_data_waiting_cmnd(struct iscsi_cmnd *cmnd);
 extern void iscsi_send_nop_in(struct iscsi_conn *conn);
+extern void iscsi_kick_pending_cmnds(struct iscsi_session *session,
+	struct iscsi_conn *conn);
+extern void iscsi_push_pending_cmnds(struct iscsi_conn *conn);
 extern int iscsi_preliminary_complete(struct iscsi_cmnd *req,
 	struct iscsi_cmnd *orig_req, bool get_data);
 extern int set_scst_preliminary_status_rsp(struct iscsi_cmnd *req,
@@ -558,6 +674,13 @@ extern int set_scst_preliminary_status_rsp(struct iscsi_cmnd *req,
 extern int iscsi_threads_pool_get(bool dedicated, const cpumask_t *cpu_mask,
 	struct iscsi_thread_pool **out_pool);
 extern void iscsi_threads_pool_put(struct iscsi_thread_pool *p);
+extern unsigned int iscsi_busy_poll_usecs;
+extern bool iscsi_adaptive_r2t;
+extern void iscsi_r2t_sched_init(struct iscsi_session *sess);
+extern int iscsi_stats_init(struct iscsi_stats_set *s);
+extern void iscsi_stats_free(struct iscsi_stats_set *s);
+extern ssize_t iscsi_stats_show(struct iscsi_stats_set *s, char *buf);
+extern void iscsi_stats_reset(struct iscsi_stats_set *s);
 
 /* conn.c */
 extern struct kobj_type iscsi_conn_ktype;
@@ -568,6 +691,7 @@ extern int __add_conn(struct iscsi_session *session,
 extern int __del_conn(struct iscsi_session *session,
 		      struct iscsi_kern_conn_info *info);
 extern void conn_free(struct iscsi_conn *conn);
+extern bool iscsi_rss_placement;
 extern void iscsi_make_conn_rd_active(struct iscsi_conn *conn);
 #define ISCSI_CONN_ACTIVE_CLOSE		1
 #define ISCSI_CONN_DELETING		2
@@ -577,6 +701,12 @@ extern void iscsi_make_conn_wr_active(struct iscsi_conn *conn);
 extern void iscsi_check_tm_data_wait_timeouts(struct iscsi_conn *conn,
 	bool force);
 extern void __iscsi_write_space_ready(struct iscsi_conn *conn);
+extern void conn_rsp_timer_arm(struct iscsi_conn *conn,
+	unsigned long expires);
+extern void conn_rsp_wheel_add(struct iscsi_conn *conn,
+	struct iscsi_cmnd *cmnd);
+extern void conn_rsp_wheel_del(struct iscsi_conn *conn,
+	struct iscsi_cmnd *cmnd);
 
 /* nthread.c */
 extern int iscsi_send(struct iscsi_conn *conn);
@@ -784,6 +914,15 @@ static inline unsigned long iscsi_get_timeout_time(struct iscsi_cmnd *req)
 	return req->write_start + iscsi_get_timeout(req);
 }
 
+/* Accounts val in field of the per CPU counters of conn and its session */
+#define iscsi_conn_stat_add(conn, field, val)				\
+do {									\
+	this_cpu_add((conn)->conn_stats.pcpu->field, (val));		\
+	this_cpu_add((conn)->session->sess_stats.pcpu->field, (val));	\
+} while (0)
+
+#define iscsi_conn_stat_inc(conn, field) iscsi_conn_stat_add(conn, field, 1)
+
 static inline int test_write_ready(struct iscsi_conn *conn)
 {
 	/*
@@ -421,6 +421,12 @@ struct iscsi_logout_req_hdr {
 	u32 rsvd4[4];
 } __packed;
 
+#define ISCSI_LOGOUT_REASON_MASK		0x7f
+
+#define ISCSI_LOGOUT_CLOSE_SESSION		0x00
+#define ISCSI_LOGOUT_CLOSE_CONNECTION		0x01
+#define ISCSI_LOGOUT_REMOVE_CONN_FOR_RECOVERY	0x02
+
 struct iscsi_logout_rsp_hdr {
 	u8  opcode;
 	u8  flags;
@@ -440,6 +446,11 @@ struct iscsi_logout_rsp_hdr {
 	u32 rsvd5;
 } __packed;
 
+#define ISCSI_LOGOUT_RSP_SUCCESS		0x00
+#define ISCSI_LOGOUT_RSP_CID_NOT_FOUND		0x01
+#define ISCSI_LOGOUT_RSP_RECOVERY_NOT_SUPPORTED	0x02
+#define ISCSI_LOGOUT_RSP_CLEANUP_FAILED		0x03
+
 struct iscsi_snack_req_hdr {
 	u8  opcode;
 	u8  flags;
@@ -275,6 +275,7 @@ cleanup_iscsi_conn:
 	conn->rd_state = 0;
 	if (conn->nop_in_interval > 0)
 		cancel_delayed_work_sync(&conn->nop_in_delayed_work);
+	iscsi_stats_free(&conn->conn_stats);
 cleanup_conn:
 	conn->session = NULL;
 	isert_close_connection(conn);
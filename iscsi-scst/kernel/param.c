@@ -117,7 +117,8 @@ static void sess_params_check(struct iscsi_kern_params_info *info)
 
 	CHECK_PARAM(info, iparams, initial_r2t, 0, 1);
 	CHECK_PARAM(info, iparams, immediate_data, 0, 1);
-	CHECK_PARAM(info, iparams, max_connections, 1, 1);
+	CHECK_PARAM(info, iparams, max_connections, MIN_NR_CONNECTIONS,
+		    MAX_NR_CONNECTIONS);
 	CHECK_PARAM(info, iparams, max_recv_data_length, 512, max_len);
 	CHECK_PARAM(info, iparams, max_xmit_data_length, 512, max_len);
 	CHECK_PARAM(info, iparams, max_burst_length, 512, max_len);
@@ -228,8 +229,8 @@ static void tgt_params_check(struct iscsi_session *session,
 		MAX_NOP_IN_TIMEOUT);
 
 	/*
-	 * We adjust too long timeout in req_add_to_write_timeout_list()
-	 * only for NOPs, so check and warn if this assumption isn't honored.
+	 * Check and warn if NOP-Ins are going to time out later than data
+	 * transfers.
 	 */
 	if (!info->partial || (info->partial & 1 << key_rsp_timeout))
 		rsp_timeout = iparams[key_rsp_timeout];
@@ -78,6 +78,12 @@ static int iscsi_session_alloc(struct iscsi_target *target,
 
 	session->next_ttt = 1;
 
+	iscsi_r2t_sched_init(session);
+
+	err = iscsi_stats_init(&session->sess_stats);
+	if (err != 0)
+		goto err;
+
 	session->scst_sess = scst_register_session(target->scst_tgt, 0,
 		name, session, NULL, NULL);
 	if (session->scst_sess == NULL) {
@@ -108,6 +114,7 @@ err_unreg:
 
 err:
 	if (session) {
+		iscsi_stats_free(&session->sess_stats);
 		kfree(session->initiator_name);
 		kmem_cache_free(iscsi_sess_cache, session);
 	}
@@ -274,6 +281,7 @@ static void __session_free(struct iscsi_session *session)
 {
 	if (session->sess_thr_pool)
 		iscsi_threads_pool_put(session->sess_thr_pool);
+	iscsi_stats_free(&session->sess_stats);
 	kfree(session->initiator_name);
 	kmem_cache_free(iscsi_sess_cache, session);
 }
@@ -453,6 +461,7 @@ static struct kobj_attribute iscsi_sess_attr_##name =				\
 
 ISCSI_SESS_BOOL_PARAM_ATTR(initial_r2t, InitialR2T);
 ISCSI_SESS_BOOL_PARAM_ATTR(immediate_data, ImmediateData);
+ISCSI_SESS_INT_PARAM_ATTR(max_connections, MaxConnections);
 ISCSI_SESS_INT_PARAM_ATTR(max_recv_data_length, MaxRecvDataSegmentLength);
 ISCSI_SESS_INT_PARAM_ATTR(max_xmit_data_length, MaxXmitDataSegmentLength);
 ISCSI_SESS_INT_PARAM_ATTR(max_burst_length, MaxBurstLength);
@@ -534,9 +543,72 @@ out:
 static struct kobj_attribute iscsi_sess_thread_pid =
 	__ATTR(thread_pid, S_IRUGO, iscsi_sess_thread_pid_show, NULL);
 
+static ssize_t iscsi_sess_r2t_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *scst_sess = container_of(kobj, struct scst_session,
+						      sess_kobj);
+	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
+	struct iscsi_r2t_sched *s = &sess->r2t_sched;
+	u64 r2ts_sent, r2t_bytes, bursts, wait_ns;
+	unsigned int burst, outstanding;
+
+	spin_lock_bh(&s->r2t_lock);
+	r2ts_sent = s->r2ts_sent;
+	r2t_bytes = s->r2t_bytes;
+	bursts = s->data_out_bursts;
+	wait_ns = s->data_out_wait_ns;
+	burst = s->burst;
+	outstanding = s->outstanding;
+	spin_unlock_bh(&s->r2t_lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+		"r2ts_sent %llu\n"
+		"avg_burst %llu\n"
+		"avg_data_out_wait_us %llu\n"
+		"cur_burst %u\n"
+		"cur_outstanding %u\n",
+		(unsigned long long)r2ts_sent,
+		(unsigned long long)(r2ts_sent ?
+			div64_u64(r2t_bytes, r2ts_sent) : 0),
+		(unsigned long long)(bursts ?
+			div64_u64(wait_ns, bursts * NSEC_PER_USEC) : 0),
+		burst, outstanding);
+}
+
+static struct kobj_attribute iscsi_sess_r2t_stats =
+	__ATTR(r2t_stats, S_IRUGO, iscsi_sess_r2t_stats_show, NULL);
+
+static ssize_t iscsi_sess_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *scst_sess = container_of(kobj, struct scst_session,
+						      sess_kobj);
+	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
+
+	return iscsi_stats_show(&sess->sess_stats, buf);
+}
+
+static ssize_t iscsi_sess_stats_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_session *scst_sess = container_of(kobj, struct scst_session,
+						      sess_kobj);
+	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
+
+	iscsi_stats_reset(&sess->sess_stats);
+
+	return count;
+}
+
+static struct kobj_attribute iscsi_sess_stats =
+	__ATTR(stats, S_IRUGO | S_IWUSR, iscsi_sess_stats_show,
+	       iscsi_sess_stats_store);
+
 const struct attribute *iscsi_sess_attrs[] = {
 	&iscsi_sess_attr_initial_r2t.attr,
 	&iscsi_sess_attr_immediate_data.attr,
+	&iscsi_sess_attr_max_connections.attr,
 	&iscsi_sess_attr_max_recv_data_length.attr,
 	&iscsi_sess_attr_max_xmit_data_length.attr,
 	&iscsi_sess_attr_max_burst_length.attr,
@@ -547,6 +619,8 @@ const struct attribute *iscsi_sess_attrs[] = {
 	&iscsi_attr_sess_sid.attr,
 	&iscsi_sess_attr_reinstating.attr,
 	&iscsi_sess_thread_pid.attr,
+	&iscsi_sess_r2t_stats.attr,
+	&iscsi_sess_stats.attr,
 	NULL,
 };
 
@@ -340,18 +340,25 @@ static inline void chap_calc_digest_sha1(char chap_id, const char *secret, int s
 
 /*
  * To generate challenge for CHAP, use stronger random number generator as
- * opposed to simple rand().
+ * opposed to simple rand(). Whole challenges are read at once, because
+ * opening /dev/urandom per byte adds up during login storms.
  */
-static int chap_rand(void)
+static void chap_rand_bytes(void *buf, int len)
 {
 	int fd;
-	int r;
 
 	fd = open("/dev/urandom", O_RDONLY);
 	assert(fd != -1);
-	if (read(fd, &r, sizeof(r)) < sizeof(r)) {
+	if (read(fd, buf, len) < len) {
 	}
 	close(fd);
+}
+
+static int chap_rand(void)
+{
+	int r;
+
+	chap_rand_bytes(&r, sizeof(r));
 	return r;
 }
 
@@ -395,11 +402,13 @@ static int chap_initiator_auth_create_challenge(struct connection *conn)
 	if (!conn->auth.chap.challenge)
 		return CHAP_TARGET_ERROR;
 
+	chap_rand_bytes(conn->auth.chap.challenge,
+			conn->auth.chap.challenge_size);
+
 	p = text;
 	strcpy(p, "0x");
 	p += 2;
 	for (i = 0; i < conn->auth.chap.challenge_size; i++) {
-		conn->auth.chap.challenge[i] = chap_rand();
 		sprintf(p, "%.2hhx", conn->auth.chap.challenge[i]);
 		p += 2;
 	}
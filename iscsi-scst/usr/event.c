@@ -1039,43 +1039,13 @@ out_free_server:
 }
 
 
-int handle_iscsi_events(int fd, bool wait)
+static void handle_iscsi_event(int fd, const struct iscsi_kern_event *event)
 {
 	struct session *session;
 	struct connection *conn;
-	struct iscsi_kern_event event;
 	struct target *target;
 	int rc;
 
-	/*
-	 * The way of handling errors by exit() is one of the worst possible,
-	 * but IET developers thought it's OK. ToDo: fix somewhen.
-	 */
-
-	STATIC_ASSERT(sizeof(event) % NLMSG_ALIGNTO == 0);
-
-retry:
-	if ((rc = nl_read(fd, &event, sizeof(event), wait)) < 0) {
-		if (errno == EAGAIN)
-			return EAGAIN;
-		if (errno == EINTR)
-			goto retry;
-		log_error("read netlink fd (%d) failed: %s", fd, strerror(errno));
-		exit(1);
-	} else if (rc == 0) {
-		/*
-		 * EOF on nl_fd --
-		 * We arrive here after the kernel module closes the other end
-		 * of nl_fd during shutdown of the kernel modules.  The daemon
-		 * thread is expected to exit when this happens.
-		 */
-		log_info("kernel module shutdown -- daemon exits");
-		exit(1);
-	}
-
-	log_debug(1, "target %u, session %#" PRIx64 ", conn %u, code %u, cookie %d",
-		  event.tid, event.sid, event.cid, event.code, event.cookie);
-
 	/*
 	 * Let's always report errors through send_mgmt_cmd_res(). If the error
 	 * was returned by the corresponding ioctl(), it will lead to blank
@@ -1084,33 +1054,33 @@ retry:
 	 * at all.
 	 */
 
-	switch (event.code) {
+	switch (event->code) {
 	case E_ADD_TARGET:
-		rc = handle_e_add_target(fd, &event);
+		rc = handle_e_add_target(fd, event);
 		if (rc != 0)
-			send_mgmt_cmd_res(event.tid, event.cookie, E_ADD_TARGET, rc, NULL);
+			send_mgmt_cmd_res(event->tid, event->cookie, E_ADD_TARGET, rc, NULL);
 		break;
 
 	case E_DEL_TARGET:
-		rc = handle_e_del_target(fd, &event);
+		rc = handle_e_del_target(fd, event);
 		if (rc != 0)
-			send_mgmt_cmd_res(event.tid, event.cookie, E_DEL_TARGET, rc, NULL);
+			send_mgmt_cmd_res(event->tid, event->cookie, E_DEL_TARGET, rc, NULL);
 		break;
 
 	case E_MGMT_CMD:
-		rc = handle_e_mgmt_cmd(fd, &event);
+		rc = handle_e_mgmt_cmd(fd, event);
 		if (rc != 0)
-			send_mgmt_cmd_res(event.tid, event.cookie, E_MGMT_CMD, rc, NULL);
+			send_mgmt_cmd_res(event->tid, event->cookie, E_MGMT_CMD, rc, NULL);
 		break;
 
 	case E_ENABLE_TARGET:
-		target = target_find_by_id(event.tid);
+		target = target_find_by_id(event->tid);
 		if (target == NULL) {
-			log_error("Target %d not found", event.tid);
+			log_error("Target %d not found", event->tid);
 			rc = -ENOENT;
 		} else
 			rc = 0;
-		rc |= send_mgmt_cmd_res(event.tid, event.cookie, E_ENABLE_TARGET, rc, NULL);
+		rc |= send_mgmt_cmd_res(event->tid, event->cookie, E_ENABLE_TARGET, rc, NULL);
 		if (rc == 0) {
 			target->tgt_enabled = 1;
 			isns_target_register(target->name);
@@ -1118,13 +1088,13 @@ retry:
 		break;
 
 	case E_DISABLE_TARGET:
-		target = target_find_by_id(event.tid);
+		target = target_find_by_id(event->tid);
 		if (target == NULL) {
-			log_error("Target %d not found", event.tid);
+			log_error("Target %d not found", event->tid);
 			rc = -ENOENT;
 		} else
 			rc = 0;
-		rc |= send_mgmt_cmd_res(event.tid, event.cookie, E_DISABLE_TARGET, rc, NULL);
+		rc |= send_mgmt_cmd_res(event->tid, event->cookie, E_DISABLE_TARGET, rc, NULL);
 		if (rc == 0) {
 			target->tgt_enabled = 0;
 			isns_target_deregister(target->name);
@@ -1132,29 +1102,29 @@ retry:
 		break;
 
 	case E_GET_ATTR_VALUE:
-		rc = handle_e_get_attr_value(fd, &event);
+		rc = handle_e_get_attr_value(fd, event);
 		if (rc != 0)
-			send_mgmt_cmd_res(event.tid, event.cookie, E_GET_ATTR_VALUE, rc, NULL);
+			send_mgmt_cmd_res(event->tid, event->cookie, E_GET_ATTR_VALUE, rc, NULL);
 		break;
 
 	case E_SET_ATTR_VALUE:
-		rc = handle_e_set_attr_value(fd, &event);
+		rc = handle_e_set_attr_value(fd, event);
 		if (rc != 0)
-			send_mgmt_cmd_res(event.tid, event.cookie, E_SET_ATTR_VALUE, rc, NULL);
+			send_mgmt_cmd_res(event->tid, event->cookie, E_SET_ATTR_VALUE, rc, NULL);
 		break;
 
 	case E_CONN_CLOSE:
-		session = session_find_id(event.tid, event.sid);
+		session = session_find_id(event->tid, event->sid);
 		if (session == NULL) {
-			log_error("Session %#" PRIx64 " not found", event.sid);
-			goto retry;
+			log_error("Session %#" PRIx64 " not found", event->sid);
+			break;
 		}
 
-		conn = conn_find(session, event.cid);
+		conn = conn_find(session, event->cid);
 		if (conn == NULL) {
 			log_error("Connection %x for session %#" PRIx64 " not "
-				"found", event.cid, event.sid);
-			goto retry;
+				"found", event->cid, event->sid);
+			break;
 		}
 
 		conn_free(conn);
@@ -1164,18 +1134,87 @@ retry:
 		break;
 
 	default:
-		log_error("Unknown event %u", event.code);
+		log_error("Unknown event %u", event->code);
 		/* We might be out of sync in size */
 		exit(-1);
 		break;
 	}
+}
+
+/* Returns 0, if an event has been read, or EAGAIN */
+static int read_iscsi_event(int fd, struct iscsi_kern_event *event, bool wait)
+{
+	int rc;
+
+	/*
+	 * The way of handling errors by exit() is one of the worst possible,
+	 * but IET developers thought it's OK. ToDo: fix somewhen.
+	 */
+
+	STATIC_ASSERT(sizeof(*event) % NLMSG_ALIGNTO == 0);
+
+retry:
+	if ((rc = nl_read(fd, event, sizeof(*event), wait)) < 0) {
+		if (errno == EAGAIN)
+			return EAGAIN;
+		if (errno == EINTR)
+			goto retry;
+		log_error("read netlink fd (%d) failed: %s", fd, strerror(errno));
+		exit(1);
+	} else if (rc == 0) {
+		/*
+		 * EOF on nl_fd --
+		 * We arrive here after the kernel module closes the other end
+		 * of nl_fd during shutdown of the kernel modules.  The daemon
+		 * thread is expected to exit when this happens.
+		 */
+		log_info("kernel module shutdown -- daemon exits");
+		exit(1);
+	}
+
+	log_debug(1, "target %u, session %#" PRIx64 ", conn %u, code %u, cookie %d",
+		  event->tid, event->sid, event->cid, event->code, event->cookie);
+
+	return 0;
+}
+
+/*
+ * Handles one pending event without waiting for it. Must be called with
+ * iscsid_mutex held, e.g. from target_del(), which runs under it.
+ */
+int __handle_iscsi_events(int fd)
+{
+	struct iscsi_kern_event event;
+	int rc;
+
+	rc = read_iscsi_event(fd, &event, false);
+	if (rc == 0)
+		handle_iscsi_event(fd, &event);
+
+	return rc;
+}
+
+/* Must be called without iscsid_mutex held, which it takes itself */
+int handle_iscsi_events(int fd, bool wait)
+{
+	struct iscsi_kern_event event;
+	int rc;
+
+	/* Don't sleep in nl_read() with the lock held */
+	rc = read_iscsi_event(fd, &event, wait);
+	if (rc != 0)
+		return rc;
+
+	iscsid_lock();
+	handle_iscsi_event(fd, &event);
+	iscsid_unlock();
 
 	return 0;
 }
 
 int nl_open(void)
 {
-	int nl_fd, res;
+	int nl_fd, res, size;
 
 	nl_fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_ISCSI_SCST);
 	if (nl_fd == -1) {
@@ -1193,6 +1232,17 @@ int nl_open(void)
 	dest_addr.nl_pid = 0; /* kernel */
 	dest_addr.nl_groups = 0; /* unicast */
 
+	/*
+	 * Leave room for the events of many connections, e.g. when they all
+	 * are closed at once, so the kernel doesn't block on sending them.
+	 */
+	size = NL_RCVBUF_SIZE;
+	if (setsockopt(nl_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+			sizeof(size)) != 0 &&
+	    setsockopt(nl_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+		log_warning("Unable to set netlink receive buffer size (%s)",
+			strerror(errno));
+
 	res = nl_write(nl_fd, NULL, 0);
 	if (res < 0) {
 		log_error("%s %d\n", __func__, res);
@@ -24,6 +24,7 @@
 #include <getopt.h>
 #include <netdb.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include <sys/poll.h>
 #include <sys/socket.h>
@@ -50,6 +51,36 @@ static int incoming_cnt;
 int ctrl_fd, ipc_fd, nl_fd;
 int conn_blocked;
 
+/*
+ * Login workers. Each of them owns up to INCOMING_MAX connections in the
+ * login phase and does their socket I/O, so many parallel logins don't
+ * serialize on the main event loop. Everything that touches the targets,
+ * sessions, accounts or the kernel module, i.e. cmnd_execute() and the
+ * connection teardown, runs under iscsid_mutex, which the main loop holds
+ * while it handles IPC, netlink and iSNS events.
+ */
+struct login_worker {
+	pthread_t thread;
+	/* Pipe, through which the main loop hands over new connections */
+	int queue[2];
+	/* Accessed with atomic builtins: increased by main, decreased here */
+	int conn_cnt;
+	struct pollfd poll_array[INCOMING_MAX + 1];
+	struct connection *incoming[INCOMING_MAX];
+};
+
+#define LOGIN_THREADS_MAX	64
+
+/* Must be big enough for a login storm not to overflow the accept queue */
+#define LISTEN_BACKLOG		4096
+
+/* Max netlink events handled per poll() wakeup of the main loop */
+#define NL_EVENTS_BATCH		64
+
+int login_threads;
+static struct login_worker *login_workers;
+static pthread_mutex_t iscsid_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 struct iscsi_init_params iscsi_init_params;
 
 static const char program_name[] = "iscsi-scstd";
@@ -62,6 +93,7 @@ static struct option const long_options[] = {
 	{"gid", required_argument, 0, 'g'},
 	{"address", required_argument, 0, 'a'},
 	{"port", required_argument, 0, 'p'},
+	{"login-threads", required_argument, 0, 't'},
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
 	{0, 0, 0, 0},
@@ -85,12 +117,30 @@ iSCSI target daemon.\n\
   -g, --gid=gid           run as gid, default is current user group\n\
   -a, --address=address   listen on specified local address instead of all\n\
   -p, --port=port         listen on specified port instead of 3260\n\
+  -t, --login-threads=n   process logins in n worker threads, default 0,\n\
+                          i.e. in the main event loop\n\
   -h, --help              display this help and exit\n\
 ");
 	}
 	exit(1);
 }
 
+void iscsid_lock(void)
+{
+	int rc;
+
+	rc = pthread_mutex_lock(&iscsid_mutex);
+	assert(rc == 0);
+}
+
+void iscsid_unlock(void)
+{
+	int rc;
+
+	rc = pthread_mutex_unlock(&iscsid_mutex);
+	assert(rc == 0);
+}
+
 const char *get_error_str(int error)
 {
 	if (error == EAI_SYSTEM)
@@ -149,7 +199,7 @@ static void create_listen_socket(struct pollfd *array)
 			continue;
 		}
 
-		if (listen(sock, INCOMING_MAX)) {
+		if (listen(sock, LISTEN_BACKLOG)) {
 			log_error("Unable to listen to server socket (%s)!", strerror(errno));
 			close(sock);
 			continue;
@@ -171,18 +221,7 @@ static void create_listen_socket(struct pollfd *array)
 
 static struct connection *alloc_and_init_conn(int fd)
 {
-	struct pollfd *pollfd;
 	struct connection *conn = NULL;
-	int i;
-
-	for (i = 0; i < INCOMING_MAX; i++) {
-		if (!incoming[i])
-			break;
-	}
-	if (i >= INCOMING_MAX) {
-		log_error("Unable to find incoming slot? %d\n", i);
-		goto out;
-	}
 
 	conn = conn_alloc();
 	if (!conn) {
@@ -191,12 +230,6 @@ static struct connection *alloc_and_init_conn(int fd)
 	}
 
 	conn->fd = fd;
-	incoming[i] = conn;
-
-	pollfd = &poll_array[POLL_INCOMING + i];
-	pollfd->fd = fd;
-	pollfd->events = POLLIN;
-	pollfd->revents = 0;
 
 	conn_read_pdu(conn);
 	set_non_blocking(fd);
@@ -205,6 +238,79 @@ out:
 	return conn;
 }
 
+static bool incoming_full(void)
+{
+	int i;
+
+	if (login_threads == 0)
+		return incoming_cnt >= INCOMING_MAX;
+
+	for (i = 0; i < login_threads; i++) {
+		if (__atomic_load_n(&login_workers[i].conn_cnt,
+				    __ATOMIC_RELAXED) < INCOMING_MAX)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Starts polling conn either in the main event loop or, if there are login
+ * workers, in the least loaded of them.
+ */
+static int incoming_add(struct connection *conn)
+{
+	struct login_worker *w = NULL;
+	struct pollfd *pollfd;
+	int i, cnt, min_cnt = INCOMING_MAX;
+
+	if (login_threads == 0) {
+		for (i = 0; i < INCOMING_MAX; i++) {
+			if (!incoming[i])
+				break;
+		}
+		if (i >= INCOMING_MAX) {
+			log_error("Unable to find incoming slot? %d\n", i);
+			return -1;
+		}
+
+		incoming[i] = conn;
+
+		pollfd = &poll_array[POLL_INCOMING + i];
+		pollfd->fd = conn->fd;
+		pollfd->events = POLLIN;
+		pollfd->revents = 0;
+
+		incoming_cnt++;
+		return 0;
+	}
+
+	for (i = 0; i < login_threads; i++) {
+		cnt = __atomic_load_n(&login_workers[i].conn_cnt,
+				      __ATOMIC_RELAXED);
+		if (cnt < min_cnt) {
+			min_cnt = cnt;
+			w = &login_workers[i];
+		}
+	}
+	if (w == NULL) {
+		log_error("All %d login threads are busy", login_threads);
+		return -1;
+	}
+
+	__atomic_add_fetch(&w->conn_cnt, 1, __ATOMIC_RELAXED);
+
+	/* Writes of a pointer to a pipe are atomic */
+	if (write(w->queue[1], &conn, sizeof(conn)) != sizeof(conn)) {
+		log_error("Unable to pass conn to login thread: %s",
+			strerror(errno));
+		__atomic_sub_fetch(&w->conn_cnt, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int transmit_iser(int fd, bool start)
 {
 	int opt = start;
@@ -355,7 +461,9 @@ static void iser_accept(int fd)
 	conn->getsockname = iser_getsockname;
 	conn->is_discovery = iser_is_discovery;
 	conn->is_iser = true;
-	incoming_cnt++;
+
+	if (incoming_add(conn) != 0)
+		goto out_free;
 
 out:
 	return;
@@ -474,7 +582,8 @@ static void accept_connection(int listen)
 	conn->is_discovery = tcp_is_discovery;
 	conn_read_pdu(conn);
 
-	incoming_cnt++;
+	if (incoming_add(conn) != 0)
+		goto out_free;
 
 out:
 	return;
@@ -562,8 +671,10 @@ again:
 			pollfd->events = POLLOUT;
 
 			log_pdu(2, &conn->req);
+			iscsid_lock();
 			if (!cmnd_execute(conn))
 				conn->state = STATE_EXIT;
+			iscsid_unlock();
 
 			if (conn->state == STATE_EXIT) {
 				/* We need to send response */
@@ -622,6 +733,7 @@ again:
 			/* fall-through */
 		case IOSTATE_WRITE_DATA:
 			conn->uncork_transmit(pollfd->fd);
+			iscsid_lock();
 			cmnd_finish(conn);
 
 			switch (conn->state) {
@@ -641,6 +753,7 @@ again:
 				pollfd->events = POLLIN;
 				break;
 			}
+			iscsid_unlock();
 			break;
 		}
 
@@ -654,6 +767,153 @@ out:
 	return;
 }
 
+/*
+ * Handles the events of the connections in slots, whose pollfds are in
+ * pollfds, and frees those, which are done. cnt is the number of used slots.
+ */
+static void incoming_handle(struct connection **slots, struct pollfd *pollfds,
+	int *cnt)
+{
+	int i;
+
+	for (i = 0; i < INCOMING_MAX; i++) {
+		struct connection *conn = slots[i];
+		struct pollfd *pollfd = &pollfds[i];
+
+		if (!conn || !pollfd->revents)
+			continue;
+
+		pollfd->revents = 0;
+
+		event_conn(conn, pollfd);
+
+		if ((conn->state == STATE_CLOSE) ||
+		    (conn->state == STATE_EXIT) ||
+		    (conn->state == STATE_DROP)) {
+			struct session *sess = conn->sess;
+
+			log_debug(1, "closing conn %p state=0x%x fd=%u",
+				  conn, conn->state, pollfd->fd);
+			iscsid_lock();
+			conn_free_pdu(conn);
+			close(pollfd->fd);
+			pollfd->fd = -1;
+			slots[i] = NULL;
+			__atomic_sub_fetch(cnt, 1, __ATOMIC_RELAXED);
+			if (conn->state != STATE_CLOSE) {
+				if (conn->passed_to_kern) {
+					kernel_conn_destroy(conn->tid,
+						conn->sess->sid.id64,
+						conn->cid);
+				} else {
+					/*
+					 * Check if session could not be established,
+					 * but sessions count was already incremented
+					 */
+					if (!sess && conn->sessions_count_incremented)
+						conn->target->sessions_count--;
+					log_debug(1, "conn %p freed (sess %p, empty %d)",
+						conn, sess,
+						sess ? list_empty(&sess->conn_list) : -1);
+					conn_free(conn);
+					if (sess && list_empty(&sess->conn_list))
+						session_free(sess);
+				}
+			}
+			iscsid_unlock();
+		}
+	}
+}
+
+/* Takes over the connections, which the main loop passed to worker w */
+static void login_worker_receive(struct login_worker *w)
+{
+	struct connection *conn;
+	int i = 0;
+
+	while (read(w->queue[0], &conn, sizeof(conn)) == sizeof(conn)) {
+		/* conn_cnt guarantees a free slot */
+		for (; i < INCOMING_MAX; i++) {
+			if (!w->incoming[i])
+				break;
+		}
+		sBUG_ON(i >= INCOMING_MAX);
+
+		w->incoming[i] = conn;
+		w->poll_array[i].fd = conn->fd;
+		w->poll_array[i].events = POLLIN;
+		w->poll_array[i].revents = 0;
+	}
+}
+
+static void *login_worker_fn(void *arg)
+{
+	struct login_worker *w = arg;
+	struct pollfd *queue_pollfd = &w->poll_array[INCOMING_MAX];
+	int res;
+
+	while (1) {
+		res = poll(w->poll_array, INCOMING_MAX + 1, -1);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error("%s: poll() failed: %s", __func__,
+				strerror(errno));
+			exit(1);
+		}
+
+		if (queue_pollfd->revents) {
+			queue_pollfd->revents = 0;
+			login_worker_receive(w);
+		}
+
+		incoming_handle(w->incoming, w->poll_array, &w->conn_cnt);
+	}
+
+	return NULL;
+}
+
+static void login_workers_start(void)
+{
+	struct login_worker *w;
+	int i, j, rc;
+
+	if (login_threads == 0)
+		return;
+
+	login_workers = calloc(login_threads, sizeof(*login_workers));
+	if (login_workers == NULL) {
+		log_error("Unable to allocate %d login threads", login_threads);
+		exit(1);
+	}
+
+	for (i = 0; i < login_threads; i++) {
+		w = &login_workers[i];
+
+		if (pipe(w->queue) != 0) {
+			log_error("pipe() failed: %s", strerror(errno));
+			exit(1);
+		}
+		set_non_blocking(w->queue[0]);
+
+		for (j = 0; j < INCOMING_MAX; j++) {
+			w->poll_array[j].fd = -1;
+			w->poll_array[j].events = 0;
+		}
+		w->poll_array[INCOMING_MAX].fd = w->queue[0];
+		w->poll_array[INCOMING_MAX].events = POLLIN;
+
+		rc = pthread_create(&w->thread, NULL, login_worker_fn, w);
+		if (rc != 0) {
+			log_error("Unable to create login thread: %s",
+				strerror(rc));
+			exit(1);
+		}
+	}
+
+	log_info("Processing logins in %d threads", login_threads);
+}
+
 static void event_loop(void)
 {
 	int res, i;
@@ -672,6 +932,8 @@ static void event_loop(void)
 		incoming[i] = NULL;
 	}
 
+	login_workers_start();
+
 	close(init_report_pipe[0]);
 	res = 0;
 
@@ -687,7 +949,9 @@ static void event_loop(void)
 		}
 		res = poll(poll_array, POLL_MAX, isns_timeout);
 		if (res == 0) {
+			iscsid_lock();
 			isns_handle(1);
+			iscsid_unlock();
 			continue;
 		} else if (res < 0) {
 			if (errno == EINTR)
@@ -714,12 +978,24 @@ static void event_loop(void)
 
 		for (i = 0; i < LISTEN_MAX; i++) {
 			if (poll_array[POLL_LISTEN + i].revents
-			    && incoming_cnt < INCOMING_MAX)
+			    && !incoming_full())
 				accept_connection(poll_array[POLL_LISTEN + i].fd);
 		}
 
-		if (poll_array[POLL_NL].revents)
-			handle_iscsi_events(nl_fd, false);
+		/*
+		 * Handle a batch of netlink events at once. During a login
+		 * storm, e.g. after a switch reboot, the kernel sends a
+		 * connection close event for each of the old connections and
+		 * blocks, when the socket buffer is full.
+		 */
+		if (poll_array[POLL_NL].revents) {
+			for (i = 0; i < NL_EVENTS_BATCH; i++) {
+				if (handle_iscsi_events(nl_fd, false) != 0)
+					break;
+			}
+		}
+
+		iscsid_lock();
 
 		if (poll_array[POLL_IPC].revents)
 			iscsi_adm_request_handle(ipc_fd);
@@ -733,54 +1009,13 @@ static void event_loop(void)
 		if (poll_array[POLL_SCN].revents)
 			isns_scn_handle(0);
 
+		iscsid_unlock();
+
 		if (poll_array[POLL_ISER_LISTEN].revents)
 			iser_accept(poll_array[POLL_ISER_LISTEN].fd);
 
-		for (i = 0; i < INCOMING_MAX; i++) {
-			struct connection *conn = incoming[i];
-			struct pollfd *pollfd = &poll_array[POLL_INCOMING + i];
-
-			if (!conn || !pollfd->revents)
-				continue;
-
-			pollfd->revents = 0;
-
-			event_conn(conn, pollfd);
-
-			if ((conn->state == STATE_CLOSE) ||
-			    (conn->state == STATE_EXIT) ||
-			    (conn->state == STATE_DROP)) {
-				struct session *sess = conn->sess;
-
-				log_debug(1, "closing conn %p state=0x%x fd=%u",
-					  conn, conn->state, pollfd->fd);
-				conn_free_pdu(conn);
-				close(pollfd->fd);
-				pollfd->fd = -1;
-				incoming[i] = NULL;
-				incoming_cnt--;
-				if (conn->state != STATE_CLOSE) {
-					if (conn->passed_to_kern) {
-						kernel_conn_destroy(conn->tid,
-							conn->sess->sid.id64,
-							conn->cid);
-					} else {
-						/*
-						 * Check if session could not be established,
-						 * but sessions count was already incremented
-						 */
-						if (!sess && conn->sessions_count_incremented)
-							conn->target->sessions_count--;
-						log_debug(1, "conn %p freed (sess %p, empty %d)",
-							conn, sess,
-							sess ? list_empty(&sess->conn_list) : -1);
-						conn_free(conn);
-						if (sess && list_empty(&sess->conn_list))
-							session_free(sess);
-					}
-				}
-			}
-		}
+		incoming_handle(incoming, &poll_array[POLL_INCOMING],
+				&incoming_cnt);
 	}
 }
 
@@ -851,7 +1086,7 @@ int main(int argc, char **argv)
 	int rc = sigaction(SIGPIPE, &act, NULL);
 	assert(rc == 0);
 
-	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:vh", long_options, &longindex)) >= 0) {
+	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:t:vh", long_options, &longindex)) >= 0) {
 		switch (ch) {
 		case 'c':
 			config = optarg;
@@ -878,6 +1113,16 @@ int main(int argc, char **argv)
 		case 'p':
 			server_port = (uint16_t)strtoul(optarg, NULL, 0);
 			break;
+		case 't':
+			login_threads = strtol(optarg, NULL, 0);
+			if ((login_threads < 0) ||
+			    (login_threads > LOGIN_THREADS_MAX)) {
+				fprintf(stderr, "Invalid number of login "
+					"threads %s (max %d)\n", optarg,
+					LOGIN_THREADS_MAX);
+				exit(-1);
+			}
+			break;
 		case 'v':
 			printf("%s version %s\n", program_name, ISCSI_VERSION_STRING);
 			exit(0);
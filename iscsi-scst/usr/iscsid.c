@@ -262,6 +262,7 @@ static void text_scan_security(struct connection *conn)
 
 #define ISCSI_SESS_REINSTATEMENT	1
 #define ISCSI_CONN_REINSTATEMENT	2
+#define ISCSI_CONN_ADDITION		3
 
 /*
  * Returns above ISCSI_*_REINSTATEMENT for session reinstatement,
@@ -309,9 +310,21 @@ static int login_check_reinstatement(struct connection *conn)
 				conn->sess = session;
 				list_add_tail(&conn->clist, &session->conn_list);
 				res = ISCSI_CONN_REINSTATEMENT;
+			} else if (session_conns_count(session) <
+				   session->max_connections) {
+				/* MC/S: kernel will add conn to the session */
+				log_debug(1, "Conn %x addition detected (tid %d, "
+					"sid %#" PRIx64 " initiator %s)",
+					conn->cid, conn->tid, req->sid.id64,
+					conn->initiator);
+				conn->sess = session;
+				list_add_tail(&conn->clist, &session->conn_list);
+				res = ISCSI_CONN_ADDITION;
 			} else {
-				log_error("Only a single connection supported "
-					"(initiator %s)", conn->initiator);
+				log_error("Too many connections for session "
+					"sid %#" PRIx64 " (max %d, initiator %s)",
+					req->sid.id64, session->max_connections,
+					conn->initiator);
 				/* Fail the login */
 				login_rsp_ini_err(conn, ISCSI_STATUS_TOO_MANY_CONN);
 				res = -1;
@@ -615,7 +628,8 @@ static void login_start(struct connection *conn)
 		else if (rc == ISCSI_SESS_REINSTATEMENT) {
 			target->sessions_count++;
 			conn->sessions_count_incremented = 1;
-		} else if (rc != ISCSI_CONN_REINSTATEMENT) {
+		} else if ((rc != ISCSI_CONN_REINSTATEMENT) &&
+			   (rc != ISCSI_CONN_ADDITION)) {
 			if ((target->target_params[key_max_sessions] == 0) ||
 			    (target->sessions_count < target->target_params[key_max_sessions])) {
 				target->sessions_count++;
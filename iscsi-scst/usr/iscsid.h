@@ -75,6 +75,9 @@ struct session {
 	struct target *target;
 	union iscsi_sid sid;
 
+	/* Negotiated on the leading connection */
+	int max_connections;
+
 	struct __qelem conn_list;
 };
 
@@ -257,7 +260,10 @@ extern void conn_free_rsp_buf_list(struct connection *conn);
 
 /* iscsi_scstd.c */
 extern uint16_t server_port;
+extern int login_threads;
 extern struct iscsi_init_params iscsi_init_params;
+extern void iscsid_lock(void);
+extern void iscsid_unlock(void);
 extern void isns_set_fd(int isns, int scn_listen, int scn);
 extern const char *get_error_str(int error);
 
@@ -303,6 +309,7 @@ extern struct session *session_find_id(u32 tid, u64 sid);
 extern int session_create(struct connection *conn);
 extern void session_free(struct session *session);
 extern struct connection *conn_find(struct session *session, u16 cid);
+extern int session_conns_count(struct session *session);
 
 /* target.c */
 extern struct __qelem targets_list;
@@ -347,7 +354,10 @@ extern int kernel_conn_create(u32 tid, u64 sid, u32 cid, u32 stat_sn, u32 exp_st
 extern int kernel_conn_destroy(u32 tid, u64 sid, u32 cid);
 
 /* event.c */
+#define NL_RCVBUF_SIZE		(1024 * 1024)
+
 extern int handle_iscsi_events(int fd, bool wait);
+extern int __handle_iscsi_events(int fd);
 extern int nl_open(void);
 
 /* config.c */
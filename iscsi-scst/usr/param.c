@@ -369,7 +369,7 @@ struct iscsi_key session_keys[] = {
 	/* name,  rfc_def, local_def, min, max, show_in_sysfs, ops */
 	{"InitialR2T", 1, 0, 0, 1, 1, &or_ops},
 	{"ImmediateData", 1, 1, 0, 1, 1, &and_ops},
-	{"MaxConnections", 1, 1, 1, 1, 0, &minimum_ops},
+	{"MaxConnections", 1, DEFAULT_NR_CONNECTIONS, MIN_NR_CONNECTIONS, MAX_NR_CONNECTIONS, 1, &minimum_ops},
 	{"MaxRecvDataSegmentLength", 8192, -1, 512, -1, 1, &minimum_ops},
 	{"MaxXmitDataSegmentLength", 8192, -1, 512, -1, 1, &minimum_ops},
 	{"MaxBurstLength", 262144, -1, 512, -1, 1, &minimum_ops},
@@ -114,7 +114,7 @@ static bool session_id_exists(u32 tid, u64 sid, struct session *exclude)
 
 int session_create(struct connection *conn)
 {
-	/* We are single threaded, so it doesn't need any protection */
+	/* Protected by iscsid_mutex */
 	static u16 tsih = 1;
 	struct session *session;
 	int res = 0;
@@ -127,6 +127,7 @@ int session_create(struct connection *conn)
 
 	session->sid = conn->sid;
 	session->sid.id.tsih = tsih;
+	session->max_connections = conn->session_params[key_max_connections].val;
 	INIT_LIST_HEAD(&session->conn_list);
 
 	list_add_tail(&conn->clist, &session->conn_list);
@@ -200,3 +201,14 @@ struct connection *conn_find(struct session *session, u16 cid)
 
 	return NULL;
 }
+
+int session_conns_count(struct session *session)
+{
+	struct connection *conn;
+	int res = 0;
+
+	list_for_each_entry(conn, &session->conn_list, clist)
+		res++;
+
+	return res;
+}
@@ -354,8 +354,11 @@ int target_del(u32 tid, u32 cookie)
 		return -ENOENT;
 
 	while (1) {
-		/* We might need to handle session(s) removal event(s) from the kernel */
-		while (handle_iscsi_events(nl_fd, false) == 0)
+		/*
+		 * We might need to handle session(s) removal event(s) from the
+		 * kernel. We are called under iscsid_mutex.
+		 */
+		while (__handle_iscsi_events(nl_fd) == 0)
 			;
 
 		/* Someone else may have already freed the target object by now. */
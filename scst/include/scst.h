@@ -2005,6 +2005,7 @@ int scst_set_thr_cpu_mask(struct scst_cmd_threads *cmd_threads,
 			  cpumask_t *cpu_mask);
 
 struct scst_pr_dlm_data;
+struct scst_pr_snapshot;
 
 /*
  * DLM lock status block with completion for notifying completion of
@@ -2637,12 +2638,32 @@ struct scst_dev_registrant {
 	/* List entry for dev_registrants_list */
 	struct list_head dev_registrants_list_entry;
 
+	/*
+	 * List entries for dev_registrants_tid_hash and
+	 * dev_registrants_key_hash
+	 */
+	struct list_head tid_hash_list_entry;
+	struct list_head key_hash_list_entry;
+
 	/* 2 auxiliary fields used to rollback changes for errors, etc. */
 	struct list_head aux_list_entry;
 	__be64 rollback_key;
 
-	/* For registrant information managed via the DLM. */
+	/*
+	 * Key of this registrant as last recorded in the PR journal and
+	 * whether it has been recorded there at all. Protected by
+	 * dev_pr_mutex.
+	 */
+	__be64 journal_key;
+	unsigned int journaled:1;
+
+	/*
+	 * For registrant information managed via the DLM. dlm_lkf holds the
+	 * flags of a lock request that has been submitted for this registrant
+	 * but that has not yet completed, or zero if there is no such request.
+	 */
 	int dlm_idx;
+	int dlm_lkf;
 	struct scst_lksb lksb;
 	char lvb[PR_DLM_LVB_LEN];
 };
@@ -2973,6 +2994,28 @@ struct scst_device {
 	/* List of dev's registrants */
 	struct list_head dev_registrants_list;
 
+	/*
+	 * dev's registrants hashed by transport ID and relative target port
+	 * and by reservation key.
+	 */
+#define	SCST_PR_REG_HASH_SHIFT 6
+#define	SCST_PR_REG_HASH_SIZE (1 << SCST_PR_REG_HASH_SHIFT)
+	struct list_head dev_registrants_tid_hash[SCST_PR_REG_HASH_SIZE];
+	struct list_head dev_registrants_key_hash[SCST_PR_REG_HASH_SIZE];
+
+	/*
+	 * Incremented on every modification of the PR data, invalidates
+	 * tgt_dev->pr_verdict of all tgt_devs of this device.
+	 */
+	unsigned long pr_verdict_gen;
+
+	/*
+	 * Immutable copy of the reservation state, republished via RCU on
+	 * every modification of the PR data, so that the I/O path can check
+	 * commands without dev_pr_mutex. NULL if its allocation failed.
+	 */
+	struct scst_pr_snapshot __rcu *pr_snapshot;
+
 	/* End of persistent reservation fields protected by dev_pr_mutex. */
 
 	/* NUMA node id of this device, if any (default - NUMA_NO_NODE) */
@@ -2993,6 +3036,33 @@ struct scst_device {
 	 */
 	char *pr_file_name;
 	char *pr_file_name1;
+	char *pr_journal_name;
+
+	/*
+	 * PR journal state. The journal file, its size and the reservation
+	 * state last recorded in it are protected by dev_pr_mutex. Replacing
+	 * pr_journal_file additionally requires pr_journal_sync_mutex, which
+	 * also protects pr_journal_synced_seq.
+	 */
+	struct file *pr_journal_file;
+	loff_t pr_journal_size;
+	unsigned int pr_journal_need_compact:1;
+	unsigned int pr_journal_rsv_stale:1;
+	uint8_t pr_journal_is_set;
+	uint8_t pr_journal_aptpl;
+	uint8_t pr_journal_type;
+	uint8_t pr_journal_scope;
+	struct scst_dev_registrant *pr_journal_holder;
+
+	/* Records of removed registrants not yet written to the journal */
+	uint8_t *pr_journal_buf;
+	int pr_journal_buf_len;
+	int pr_journal_buf_size;
+
+	/* Sequence numbers of the last written and the last fsynced batch */
+	unsigned int pr_journal_seq;
+	unsigned int pr_journal_synced_seq;
+	struct mutex pr_journal_sync_mutex;
 
 	/**************************************************************/
 
@@ -3158,6 +3228,13 @@ struct scst_tgt_dev {
 	/* Reference to registrant to find quicker */
 	struct scst_dev_registrant *registrant;
 
+	/*
+	 * Cached result of the PR checks for this I_T nexus: the value of
+	 * dev->pr_verdict_gen it is valid for, shifted left by
+	 * SCST_PR_VERDICT_SHIFT, ORed with one of SCST_PR_VERDICT_* values.
+	 */
+	unsigned long pr_verdict;
+
 	/* List entry in dev->dev_tgt_dev_list */
 	struct list_head dev_tgt_dev_list_entry;
 
@@ -3319,6 +3396,19 @@ struct scst_acn {
 	struct kobj_attribute *acn_attr;
 };
 
+/**
+ * enum scst_stpg_mode - How a device group processes SET TARGET PORT GROUPS
+ * @SCST_STPG_MODE_BLOCK: Block all devices of the device group until the
+ *   STPG user space event has been processed.
+ * @SCST_STPG_MODE_TRANSITIONING: Do not block any devices but report the
+ *   transitioning state for the LUNs of the target groups that are being
+ *   changed until user space has set their new state.
+ */
+enum scst_stpg_mode {
+	SCST_STPG_MODE_BLOCK,
+	SCST_STPG_MODE_TRANSITIONING,
+};
+
 /**
  * struct scst_dev_group - A group of SCST devices (struct scst_device).
  * @name:        Name of this device group.
@@ -3330,6 +3420,8 @@ struct scst_acn {
  * @tg_kobj:     Sysfs target groups directory.
  * @stpg_transport_id Initiator transport ID for STPG originating I_T nexus, if any
  * @stpg_rel_tgt_id Relative target ID for STPG originating I_T nexus, if any
+ * @stpg_mode:   How SET TARGET PORT GROUPS transitions are performed.
+ * @stpg_start:  Time at which the STPG transition in progress started.
  *
  * Each device is member of zero or one device groups. With each device group
  * there are zero or more target groups associated.
@@ -3344,6 +3436,8 @@ struct scst_dev_group {
 	struct kobject		*tg_kobj;
 	uint8_t			*stpg_transport_id;
 	uint16_t		stpg_rel_tgt_id;
+	enum scst_stpg_mode	stpg_mode;
+	ktime_t			stpg_start;
 };
 
 /**
@@ -3364,6 +3458,13 @@ struct scst_dg_dev {
  * @entry:       Entry in scst_dev_group.tg_list.
  * @tgt_list:    list of scst_tg_tgt elements; protected by scst_mutex.
  * @kobj:        For making this object visible in sysfs.
+ * @stpg_transitioning: Whether the LUNs of this target group are in the
+ *               transitioning state because of an STPG that is being
+ *               processed in SCST_STPG_MODE_TRANSITIONING mode.
+ * @stpg_count:  Number of STPG transitions of this target group.
+ * @stpg_last_us: Duration of the most recent STPG transition.
+ * @stpg_max_us: Duration of the longest STPG transition.
+ * @stpg_total_us: Total duration of all STPG transitions.
  *
  * Such a group is either a primary target port group or a secondary
  * port group. See also SPC-4 for more information.
@@ -3377,6 +3478,11 @@ struct scst_target_group {
 	struct list_head	entry;
 	struct list_head	tgt_list;
 	struct kobject		kobj;
+	bool			stpg_transitioning;
+	unsigned int		stpg_count;
+	uint64_t		stpg_last_us;
+	uint64_t		stpg_max_us;
+	uint64_t		stpg_total_us;
 };
 
 /**
@@ -91,6 +91,8 @@ void sgv_pool_put(struct sgv_pool *pool);
 
 void sgv_pool_flush(struct sgv_pool *pool);
 
+int sgv_pool_headroom(void);
+
 void sgv_pool_set_allocator(struct sgv_pool *pool,
 	struct page *(*alloc_pages_fn)(struct scatterlist *, gfp_t, void *),
 	void (*free_pages_fn)(struct scatterlist *, int, void *));
@@ -55,6 +55,25 @@
 #define SCST_USER_MAX_PARTIAL_TRANSFERS_OPT		\
 		SCST_USER_PARTIAL_TRANSFERS_SUPPORTED
 
+/* Values for scst_user_dev_desc.queue_policy */
+#define SCST_USER_QUEUE_BY_INITIATOR	0
+#define SCST_USER_QUEUE_BY_SESSION	1
+#define SCST_USER_MAX_QUEUE_POLICY	SCST_USER_QUEUE_BY_SESSION
+
+#define SCST_USER_MAX_QUEUES		64
+
+/*
+ * Bits of scst_user_opt.internal_cmds, commands without data, which are
+ * no-ops for the handler, so scst_user completes them itself
+ */
+#define SCST_USER_INTERNAL_TUR		0x01
+#define SCST_USER_INTERNAL_SYNC_CACHE	0x02
+#define SCST_USER_INTERNAL_START_STOP	0x04
+#define SCST_USER_INTERNAL_CMDS_MASK	0x07
+
+/* Max scst_user_opt.compl_coalesce_usecs */
+#define SCST_USER_MAX_COMPL_COALESCE_USECS	10000
+
 #ifndef __KERNEL__
 #define aligned_u64 uint64_t __attribute__((aligned(8)))
 #endif
@@ -99,6 +118,16 @@ struct scst_user_opt {
 	uint8_t has_own_order_mgmt;
 
 	uint8_t ext_copy_remap_supported;
+
+	uint8_t internal_cmds;
+
+	/*
+	 * Completions coalescing window: replied commands are completed
+	 * together, once compl_coalesce_cmds of them are collected or
+	 * compl_coalesce_usecs passed. 0 usecs means no window.
+	 */
+	uint16_t compl_coalesce_cmds;
+	uint16_t compl_coalesce_usecs;
 };
 
 struct scst_user_dev_desc {
@@ -112,6 +141,8 @@ struct scst_user_dev_desc {
 	struct scst_user_opt opt;
 	uint32_t block_size;
 	uint8_t enable_pr_cmds_notifications;
+	uint8_t queue_policy;
+	uint16_t queues_num; /* 0 means 1 */
 	char name[SCST_MAX_NAME];
 	char sgv_name[SCST_MAX_NAME];
 };
@@ -287,9 +318,14 @@ struct scst_user_scsi_cmd_reply_exec {
 #define SCST_EXEC_REPLY_BACKGROUND	0
 #define SCST_EXEC_REPLY_COMPLETED	1
 #define SCST_EXEC_REPLY_DO_WRITE_SAME	2
+#define SCST_EXEC_REPLY_COMPLETED_REG_BUF 3
 	uint8_t reply_type;
 
 	uint8_t status;
+
+	/* For SCST_EXEC_REPLY_COMPLETED_REG_BUF */
+	uint32_t buf_id;
+	uint32_t buf_off;
 	union {
 		struct {
 			uint8_t sense_len;
@@ -357,6 +393,83 @@ struct scst_user_get_multi {
 	struct scst_user_get_cmd cmds[0]; /* out */
 };
 
+/* Values for scst_user_rings_desc.flags */
+#define SCST_USER_RINGS_POLL		1
+
+/* Values for scst_user_ring.flags of the replies ring */
+#define SCST_USER_RINGS_NEED_WAKEUP	1
+
+/* Values for the SCST_USER_RINGS_ENTER argument */
+#define SCST_USER_RINGS_ENTER_WAIT	1
+#define SCST_USER_RINGS_ENTER_WAKEUP	2
+
+#define SCST_USER_RINGS_MAX_ENTRIES	4096
+
+/* Be careful adding new members here, this structure is allocated on stack! */
+struct scst_user_rings_desc {
+	uint32_t entries; /* in */
+	uint32_t flags; /* in */
+	int32_t eventfd; /* in */
+	uint32_t poll_idle_ms; /* in */
+	uint32_t mmap_len; /* out */
+	uint32_t cmds_off; /* out */
+	uint32_t replies_off; /* out */
+};
+
+/* Be careful adding new members here, this structure is allocated on stack! */
+struct scst_user_queue_desc {
+	uint32_t queue; /* in */
+	int32_t cpu; /* out, -1 if no preference */
+};
+
+/* Be careful adding new members here, this structure is allocated on stack! */
+struct scst_user_arena_desc {
+	aligned_u64 pbuf; /* in, page aligned */
+	aligned_u64 len; /* in, page aligned */
+};
+
+#define SCST_USER_MAX_REG_BUFS		4096
+
+/* Be careful adding new members here, this structure is allocated on stack! */
+struct scst_user_reg_buf_desc {
+	aligned_u64 pbuf; /* in */
+	aligned_u64 len; /* in */
+	uint32_t buf_id; /* out, in for SCST_USER_UNREGISTER_BUFFER */
+};
+
+#define SCST_USER_MAX_CACHED_RESPS	64
+#define SCST_USER_MAX_CACHED_RESP_LEN	4096
+
+/* Be careful adding new members here, this structure is allocated on stack! */
+struct scst_user_cached_resp {
+	uint8_t cdb[SCST_MAX_CDB_SIZE]; /* in */
+	uint8_t cdb_mask[SCST_MAX_CDB_SIZE]; /* in, cdb_mask[0] must be 0xFF */
+	aligned_u64 pbuf; /* in, the response data */
+	uint32_t len; /* in */
+};
+
+/*
+ * Indexes of a ring, which run freely and are masked by mask to get the
+ * entry. Only the producer writes tail, only the consumer writes head.
+ */
+struct scst_user_ring {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t mask;
+	uint32_t flags;
+	uint32_t pad[12];
+};
+
+/*
+ * Start of the area mapped by mmap() of the device or queue fd. It's
+ * followed by the commands ring entries, struct scst_user_get_cmd each, and
+ * by the replies ring entries, struct scst_user_reply_cmd each.
+ */
+struct scst_user_rings {
+	struct scst_user_ring cmds; /* produced by SCST */
+	struct scst_user_ring replies; /* produced by the user space */
+};
+
 #define SCST_USER_REGISTER_DEVICE	_IOW('u', 1, struct scst_user_dev_desc)
 #define SCST_USER_UNREGISTER_DEVICE	_IO('u', 2)
 #define SCST_USER_SET_OPTIONS		_IOW('u', 3, struct scst_user_opt)
@@ -368,6 +481,17 @@ struct scst_user_get_multi {
 #define SCST_USER_GET_EXTENDED_CDB	_IOWR('u', 9, struct scst_user_get_ext_cdb)
 #define SCST_USER_PREALLOC_BUFFER	_IOWR('u', 10, union scst_user_prealloc_buffer)
 #define SCST_USER_REPLY_AND_GET_MULTI	_IOWR('u', 11, struct scst_user_get_multi)
+#define SCST_USER_SETUP_RINGS		_IOWR('u', 12, struct scst_user_rings_desc)
+#define SCST_USER_RINGS_ENTER		_IO('u', 13)
+#define SCST_USER_OPEN_QUEUE		_IOWR('u', 14, struct scst_user_queue_desc)
+#define SCST_USER_REGISTER_ARENA	_IOW('u', 15, struct scst_user_arena_desc)
+#define SCST_USER_REGISTER_BUFFER	\
+	_IOWR('u', 16, struct scst_user_reg_buf_desc)
+#define SCST_USER_UNREGISTER_BUFFER	\
+	_IOW('u', 17, struct scst_user_reg_buf_desc)
+#define SCST_USER_SET_CACHED_RESP	\
+	_IOW('u', 18, struct scst_user_cached_resp)
+#define SCST_USER_CLEAR_CACHED_RESPS	_IO('u', 19)
 
 /* Values for scst_user_get_cmd.subcode */
 #define SCST_USER_ATTACH_SESS		\
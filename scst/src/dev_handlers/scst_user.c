@@ -23,6 +23,12 @@
 #include <linux/eventpoll.h>
 #include <linux/stddef.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/eventfd.h>
+#include <linux/log2.h>
+#include <linux/jhash.h>
+#include <linux/anon_inodes.h>
+#include <linux/hrtimer.h>
 
 #define LOG_PREFIX		DEV_USER_NAME
 
@@ -38,6 +44,33 @@
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
+#else
+static inline void mmgrab(struct mm_struct *mm)
+{
+	atomic_inc(&mm->mm_count);
+}
+
+static inline bool mmget_not_zero(struct mm_struct *mm)
+{
+	return atomic_inc_not_zero(&mm->mm_users);
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+#include <linux/mmu_context.h>
+#define kthread_use_mm(mm)	use_mm(mm)
+#define kthread_unuse_mm(mm)	unuse_mm(mm)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+	enum hrtimer_restart (*function)(struct hrtimer *),
+	clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
 #endif
 
 #ifndef INSIDE_KERNEL_TREE
@@ -52,7 +85,21 @@ for details.
 #define DEV_USER_CMD_HASH_ORDER		6
 #define DEV_USER_ATTACH_TIMEOUT		(5*HZ)
 
-struct scst_user_dev {
+/*
+ * The queue index is kept in the high bits of the command handles, so
+ * replies can be matched to their queue without any shared lookup.
+ */
+#define DEV_USER_QUEUE_SHIFT		24
+#define DEV_USER_QUEUE_H_MASK		((1 << DEV_USER_QUEUE_SHIFT) - 1)
+
+struct scst_user_dev;
+
+/*
+ * A commands queue of the device. Each queue has its own SCST commands
+ * threads, ready list and handles, so handler threads working with
+ * different queues don't share any lock.
+ */
+struct scst_user_queue {
 	/*
 	 * Must be kept here, because it's needed on the cleanup time,
 	 * when corresponding scst_dev is already dead.
@@ -62,6 +109,94 @@ struct scst_user_dev {
 	/* Protected by udev_cmd_threads.cmd_list_lock */
 	struct list_head ready_cmd_list;
 
+	/* Both protected by udev_cmd_threads.cmd_list_lock */
+	unsigned int handle_counter;
+	struct list_head ucmd_hash[1 << DEV_USER_CMD_HASH_ORDER];
+
+	struct scst_user_dev *dev;
+	unsigned int idx;
+	/* CPU user space is advised to serve this queue on or -1 */
+	int cpu;
+	/* Number of sessions assigned to this queue */
+	atomic_t sess_count;
+
+	/*
+	 * Shared commands and replies rings, see dev_user_setup_rings().
+	 * Set once, then all protected by rings_mutex.
+	 */
+	struct mutex rings_mutex;
+	struct scst_user_rings *rings;
+	struct scst_user_get_cmd *ring_cmds;
+	struct scst_user_reply_cmd *ring_replies;
+	unsigned int ring_entries;
+	unsigned int rings_size;
+	/* Own copies of the indexes written by us, user space can spoil them */
+	uint32_t ring_cmds_tail;
+	uint32_t ring_replies_head;
+	struct eventfd_ctx *rings_eventfd;
+	struct task_struct *rings_poller;
+	struct mm_struct *rings_mm;
+	unsigned long rings_poll_idle;
+
+	/*
+	 * Replied commands waiting to be completed together, see
+	 * dev_user_replies_done(). Protected by done_lock.
+	 */
+	spinlock_t done_lock;
+	struct list_head done_cmd_list;
+	int done_cmds_num;
+	struct hrtimer done_timer;
+};
+
+/*
+ * Data buffers memory registered by SCST_USER_REGISTER_ARENA. Its pages are
+ * pinned once, so buffers inside it are mapped without get_user_pages().
+ */
+struct dev_user_arena {
+	unsigned long start;
+	unsigned long pages_num;
+	struct page *pages[];
+};
+
+/*
+ * Buffer registered by SCST_USER_REGISTER_BUFFER. Commands, whose data is
+ * sent from it, hold references on it, so it stays pinned until the last
+ * of them is freed, even if it is unregistered earlier.
+ */
+struct dev_user_reg_buf {
+	atomic_t refcnt;
+	unsigned long start;
+	unsigned long len;
+	unsigned long pages_num;
+	struct page *pages[];
+};
+
+/* Number of SCST_USER_INTERNAL_* bits */
+#define DEV_USER_INTERNAL_CMDS		3
+
+/*
+ * Response uploaded by SCST_USER_SET_CACHED_RESP. Commands, which are
+ * answered from it, hold references on it, so it can be replaced or
+ * cleared while they are being processed.
+ */
+struct dev_user_cached_resp {
+	atomic_t refcnt;
+	uint8_t cdb[SCST_MAX_CDB_SIZE];
+	uint8_t cdb_mask[SCST_MAX_CDB_SIZE];
+	int cdb_len; /* up to the last byte with not zero mask */
+	int len;
+	uint8_t data[];
+};
+
+struct scst_user_dev {
+	/* Set once on registration, queues[0] is served by the device fd */
+	struct scst_user_queue *queues;
+	unsigned int queues_num;
+	uint8_t queue_policy;
+
+	/* The device fd, queue fds hold references on it */
+	struct file *dev_file;
+
 	/*
 	 * Don't need any protection or assignment in SCST_USER_SET_OPTIONS
 	 * supposed to be serialized by the caller
@@ -77,6 +212,7 @@ struct scst_user_dev {
 	unsigned int d_sense:1;
 	unsigned int has_own_order_mgmt:1;
 	unsigned int ext_copy_remap_supported:1;
+	uint8_t internal_cmds;
 
 	int (*generic_parse)(struct scst_cmd *cmd);
 
@@ -86,6 +222,32 @@ struct scst_user_dev {
 	struct sgv_pool *pool;
 	struct sgv_pool *pool_clust;
 
+	/* Set once by SCST_USER_REGISTER_ARENA, freed on release */
+	struct dev_user_arena *arena;
+
+	/*
+	 * SCST_USER_REGISTER_BUFFER buffers indexed by id, allocated on the
+	 * first registration. Protected by reg_bufs_lock.
+	 */
+	spinlock_t reg_bufs_lock;
+	struct dev_user_reg_buf **reg_bufs;
+
+	/*
+	 * SCST_USER_SET_CACHED_RESP responses, protected by
+	 * cached_resps_lock. Commands check cached_resps_num without the
+	 * lock, so devices without them pay nothing.
+	 */
+	spinlock_t cached_resps_lock;
+	int cached_resps_num;
+	struct dev_user_cached_resp *cached_resps[SCST_USER_MAX_CACHED_RESPS];
+
+	/* Completions coalescing window, see dev_user_replies_done() */
+	uint16_t compl_coalesce_cmds;
+	uint16_t compl_coalesce_usecs;
+
+	/* Commands completed internally, by SCST_USER_INTERNAL_* bit number */
+	atomic_long_t internal_done[DEV_USER_INTERNAL_CMDS];
+
 	uint8_t parse_type;
 	uint8_t on_free_cmd_type;
 	uint8_t memory_reuse_type;
@@ -94,10 +256,6 @@ struct scst_user_dev {
 
 	struct scst_dev_type devtype;
 
-	/* Both protected by udev_cmd_threads.cmd_list_lock */
-	unsigned int handle_counter;
-	struct list_head ucmd_hash[1 << DEV_USER_CMD_HASH_ORDER];
-
 	struct scst_device *sdev;
 
 	int virt_id;
@@ -112,6 +270,7 @@ struct scst_user_dev {
 struct scst_user_cmd {
 	struct scst_cmd *cmd;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 
 	/*
 	 * Note, gcc reported to have a long standing bug, when it uses 64-bit
@@ -123,6 +282,7 @@ struct scst_user_cmd {
 	unsigned int buf_dirty:1;
 	unsigned int background_exec:1;
 	unsigned int aborted:1;
+	unsigned int arena_mapped:1; /* data_pages point into dev->arena */
 
 	struct scst_user_cmd *buf_ucmd;
 
@@ -135,6 +295,13 @@ struct scst_user_cmd {
 	struct page **data_pages;
 	struct sgv_pool_obj *sgv;
 
+	/* Set, if cmd->sg was built over a registered buffer */
+	struct dev_user_reg_buf *reg_buf;
+	struct scatterlist *reg_sg;
+
+	/* Set, if the command is answered in the kernel from it */
+	struct dev_user_cached_resp *cached_resp;
+
 	/*
 	 * Special flags, which can be accessed asynchronously (hence "long").
 	 * Protected by udev_cmd_threads.cmd_list_lock.
@@ -148,6 +315,9 @@ struct scst_user_cmd {
 
 	struct list_head ready_cmd_list_entry;
 
+	/* Protected by q->done_lock */
+	struct list_head done_cmd_list_entry;
+
 	unsigned int h;
 	struct list_head hash_list_entry;
 
@@ -188,11 +358,23 @@ static int __dev_user_set_opt(struct scst_user_dev *dev,
 	const struct scst_user_opt *opt);
 static int dev_user_set_opt(struct file *file, const struct scst_user_opt *opt);
 static int dev_user_get_opt(struct file *file, void __user *arg);
+static int dev_user_setup_rings(struct file *file, void __user *arg);
+static int dev_user_rings_enter(struct file *file, unsigned long flags);
+static int dev_user_open_queue(struct file *file, void __user *arg);
+static int dev_user_register_arena(struct file *file, void __user *arg);
+static int dev_user_register_buffer(struct file *file, void __user *arg);
+static int dev_user_unregister_buffer(struct file *file, void __user *arg);
+static int dev_user_set_cached_resp(struct file *file, void __user *arg);
+static int dev_user_clear_cached_resps(struct file *file);
 
 static __poll_t dev_user_poll(struct file *filp, poll_table *wait);
+static int dev_user_mmap(struct file *file, struct vm_area_struct *vma);
 static long dev_user_ioctl(struct file *file, unsigned int cmd,
 	unsigned long arg);
+static long dev_user_queue_ioctl(struct file *file, unsigned int cmd,
+	unsigned long arg);
 static int dev_user_release(struct inode *inode, struct file *file);
+static int dev_user_queue_release(struct inode *inode, struct file *file);
 static int dev_user_exit_dev(struct scst_user_dev *dev);
 
 
@@ -222,9 +404,21 @@ static const struct file_operations dev_user_fops = {
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= dev_user_ioctl,
 #endif
+	.mmap		= dev_user_mmap,
 	.release	= dev_user_release,
 };
 
+/* For the fds returned by SCST_USER_OPEN_QUEUE */
+static const struct file_operations dev_user_queue_fops = {
+	.poll		= dev_user_poll,
+	.unlocked_ioctl	= dev_user_queue_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= dev_user_queue_ioctl,
+#endif
+	.mmap		= dev_user_mmap,
+	.release	= dev_user_queue_release,
+};
+
 static struct scst_dev_type dev_user_devtype = {
 	.no_mgmt =	1,
 	.name =		DEV_USER_NAME,
@@ -316,18 +510,38 @@ static inline int dev_user_check_reg(struct scst_user_dev *dev)
 	return 0;
 }
 
+/*
+ * Returns the queue served by file: queues[0] for the device fd or the
+ * queue of a queue fd. NULL, if the device isn't registered.
+ */
+static inline struct scst_user_queue *dev_user_file_queue(struct file *file)
+{
+	struct scst_user_dev *dev;
+
+	if (file->f_op == &dev_user_queue_fops)
+		return file->private_data;
+
+	dev = file->private_data;
+	return (dev != NULL) ? &dev->queues[0] : NULL;
+}
+
+static inline int dev_user_check_queue(struct scst_user_queue *q)
+{
+	return dev_user_check_reg((q != NULL) ? q->dev : NULL);
+}
+
 static inline int scst_user_cmd_hashfn(int h)
 {
 	return h & ((1 << DEV_USER_CMD_HASH_ORDER) - 1);
 }
 
-static inline struct scst_user_cmd *__ucmd_find_hash(struct scst_user_dev *dev,
-	unsigned int h)
+static inline struct scst_user_cmd *__ucmd_find_hash(
+	struct scst_user_queue *q, unsigned int h)
 {
 	struct list_head *head;
 	struct scst_user_cmd *ucmd;
 
-	head = &dev->ucmd_hash[scst_user_cmd_hashfn(h)];
+	head = &q->ucmd_hash[scst_user_cmd_hashfn(h)];
 	list_for_each_entry(ucmd, head, hash_list_entry) {
 		if (ucmd->h == h) {
 			TRACE_DBG("Found ucmd %p", ucmd);
@@ -337,23 +551,43 @@ static inline struct scst_user_cmd *__ucmd_find_hash(struct scst_user_dev *dev,
 	return NULL;
 }
 
+/* Returns the queue, which command handle h belongs to, or NULL */
+static inline struct scst_user_queue *dev_user_h_queue(
+	struct scst_user_dev *dev, unsigned int h)
+{
+	unsigned int idx = h >> DEV_USER_QUEUE_SHIFT;
+
+	if (unlikely(idx >= dev->queues_num))
+		return NULL;
+	return &dev->queues[idx];
+}
+
+static inline struct scst_user_queue *dev_user_tgt_dev_queue(
+	struct scst_tgt_dev *tgt_dev)
+{
+	return container_of(tgt_dev->active_cmd_threads,
+			    struct scst_user_queue, udev_cmd_threads);
+}
+
 static void cmd_insert_hash(struct scst_user_cmd *ucmd)
 {
 	struct list_head *head;
-	struct scst_user_dev *dev = ucmd->dev;
+	struct scst_user_queue *q = ucmd->q;
 	struct scst_user_cmd *u;
 	unsigned long flags;
 
-	spin_lock_irqsave(&dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock, flags);
 	do {
-		ucmd->h = dev->handle_counter++;
-		u = __ucmd_find_hash(dev, ucmd->h);
+		ucmd->h = (q->idx << DEV_USER_QUEUE_SHIFT) |
+			  (q->handle_counter++ & DEV_USER_QUEUE_H_MASK);
+		u = __ucmd_find_hash(q, ucmd->h);
 	} while (u != NULL);
-	head = &dev->ucmd_hash[scst_user_cmd_hashfn(ucmd->h)];
+	head = &q->ucmd_hash[scst_user_cmd_hashfn(ucmd->h)];
 	list_add_tail(&ucmd->hash_list_entry, head);
-	spin_unlock_irqrestore(&dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock, flags);
 
-	TRACE_DBG("Inserted ucmd %p, h=%d (dev %s)", ucmd, ucmd->h, dev->name);
+	TRACE_DBG("Inserted ucmd %p, h=%d (dev %s, queue %d)", ucmd, ucmd->h,
+		q->dev->name, q->idx);
 	return;
 }
 
@@ -361,9 +595,9 @@ static inline void cmd_remove_hash(struct scst_user_cmd *ucmd)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&ucmd->dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_lock_irqsave(&ucmd->q->udev_cmd_threads.cmd_list_lock, flags);
 	list_del(&ucmd->hash_list_entry);
-	spin_unlock_irqrestore(&ucmd->dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_unlock_irqrestore(&ucmd->q->udev_cmd_threads.cmd_list_lock, flags);
 
 	TRACE_DBG("Removed ucmd %p, h=%d", ucmd, ucmd->h);
 	return;
@@ -448,8 +682,18 @@ static void dev_user_unmap_buf(struct scst_user_cmd *ucmd)
 
 	TRACE_ENTRY();
 
-	TRACE_MEM("Unmapping data pages (ucmd %p, ubuff %lx, num %d)", ucmd,
-		ucmd->ubuff, ucmd->num_data_pages);
+	TRACE_MEM("Unmapping data pages (ucmd %p, ubuff %lx, num %d, arena %d)",
+		ucmd, ucmd->ubuff, ucmd->num_data_pages, ucmd->arena_mapped);
+
+	if (ucmd->arena_mapped) {
+		/* The arena keeps the pages pinned */
+		if (ucmd->buf_dirty) {
+			for (i = 0; i < ucmd->num_data_pages; i++)
+				SetPageDirty(ucmd->data_pages[i]);
+		}
+		ucmd->arena_mapped = 0;
+		goto out;
+	}
 
 	for (i = 0; i < ucmd->num_data_pages; i++) {
 		struct page *page = ucmd->data_pages[i];
@@ -461,6 +705,8 @@ static void dev_user_unmap_buf(struct scst_user_cmd *ucmd)
 	}
 
 	kfree(ucmd->data_pages);
+
+out:
 	ucmd->data_pages = NULL;
 
 	TRACE_EXIT();
@@ -702,7 +948,7 @@ out:
 	return res;
 }
 
-static struct scst_user_cmd *dev_user_alloc_ucmd(struct scst_user_dev *dev,
+static struct scst_user_cmd *dev_user_alloc_ucmd(struct scst_user_queue *q,
 	gfp_t gfp_mask)
 {
 	struct scst_user_cmd *ucmd = NULL;
@@ -715,7 +961,8 @@ static struct scst_user_cmd *dev_user_alloc_ucmd(struct scst_user_dev *dev,
 			"user cmd (gfp_mask %x)", gfp_mask);
 		goto out;
 	}
-	ucmd->dev = dev;
+	ucmd->dev = q->dev;
+	ucmd->q = q;
 	atomic_set(&ucmd->ucmd_ref, 1);
 
 	cmd_insert_hash(ucmd);
@@ -727,6 +974,41 @@ out:
 	return ucmd;
 }
 
+static void dev_user_put_cached_resp(struct dev_user_cached_resp *cr)
+{
+	if (atomic_dec_and_test(&cr->refcnt))
+		kfree(cr);
+	return;
+}
+
+/* Returns referenced cached response matching cmd's CDB or NULL */
+static struct dev_user_cached_resp *dev_user_find_cached_resp(
+	struct scst_user_dev *dev, const struct scst_cmd *cmd)
+{
+	struct dev_user_cached_resp *cr, *res = NULL;
+	unsigned long flags;
+	int i, j;
+
+	spin_lock_irqsave(&dev->cached_resps_lock, flags);
+	for (i = 0; i < dev->cached_resps_num; i++) {
+		cr = dev->cached_resps[i];
+		if ((cr->cdb[0] != cmd->cdb[0]) || (cr->cdb_len > cmd->cdb_len))
+			continue;
+		for (j = 1; j < cr->cdb_len; j++) {
+			if ((cmd->cdb[j] & cr->cdb_mask[j]) != cr->cdb[j])
+				break;
+		}
+		if (j == cr->cdb_len) {
+			atomic_inc(&cr->refcnt);
+			res = cr;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dev->cached_resps_lock, flags);
+
+	return res;
+}
+
 static int dev_user_parse(struct scst_cmd *cmd)
 {
 	int rc, res = SCST_CMD_STATE_DEFAULT;
@@ -738,7 +1020,8 @@ static int dev_user_parse(struct scst_cmd *cmd)
 	TRACE_ENTRY();
 
 	if (cmd->dh_priv == NULL) {
-		ucmd = dev_user_alloc_ucmd(dev, gfp_mask);
+		ucmd = dev_user_alloc_ucmd(dev_user_tgt_dev_queue(cmd->tgt_dev),
+					   gfp_mask);
 		if (unlikely(ucmd == NULL)) {
 			if (atomic) {
 				res = SCST_CMD_STATE_NEED_THREAD_CTX;
@@ -834,6 +1117,15 @@ done:
 		cmd->data_direction = SCST_DATA_NONE;
 	}
 
+	if ((READ_ONCE(dev->cached_resps_num) != 0) &&
+	    !(cmd->data_direction & SCST_DATA_WRITE) &&
+	    (ucmd->cached_resp == NULL)) {
+		ucmd->cached_resp = dev_user_find_cached_resp(dev, cmd);
+		if (ucmd->cached_resp != NULL)
+			TRACE_DBG("ucmd %p will be answered from cached "
+				"response %p", ucmd, ucmd->cached_resp);
+	}
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -854,8 +1146,13 @@ static int dev_user_alloc_data_buf(struct scst_cmd *cmd)
 			   (ucmd->state != UCMD_STATE_PARSING) &&
 			   (ucmd->state != UCMD_STATE_BUF_ALLOCING));
 
+	/* The response is copied to the buffer SCST allocates itself */
+	if (ucmd->cached_resp != NULL)
+		goto out;
+
 	res = dev_user_alloc_space(ucmd);
 
+out:
 	TRACE_EXIT_RES(res);
 	return res;
 }
@@ -901,6 +1198,88 @@ out:
 	return;
 }
 
+/* Completes the command executed without the user space */
+static void dev_user_internal_done(struct scst_cmd *cmd)
+{
+	cmd->completed = 1;
+	cmd->scst_cmd_done(cmd, SCST_CMD_STATE_DEFAULT, SCST_CONTEXT_SAME);
+	return;
+}
+
+/* Completes the command with its cached response without the user space */
+static void dev_user_exec_cached(struct scst_user_cmd *ucmd)
+{
+	struct scst_cmd *cmd = ucmd->cmd;
+	struct dev_user_cached_resp *cr = ucmd->cached_resp;
+	int len = 0;
+
+	TRACE_ENTRY();
+
+	if (cmd->data_direction & SCST_DATA_READ) {
+		len = min_t(int, cr->len, cmd->bufflen);
+		sg_copy_from_buffer(cmd->sg, cmd->sg_cnt, cr->data, len);
+	}
+	if (len < cmd->bufflen)
+		scst_set_resp_data_len(cmd, len);
+
+	TRACE_DBG("Answered ucmd %p from cached response %p (len %d)", ucmd,
+		cr, len);
+
+	ucmd->cached_resp = NULL;
+	dev_user_put_cached_resp(cr);
+
+	dev_user_internal_done(cmd);
+
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Completes cmd with GOOD status, if the handler declared it a no-op by
+ * SCST_USER_INTERNAL_* options. UAs and reservations were already checked
+ * by SCST. Returns true, if cmd was completed.
+ */
+static bool dev_user_exec_internal(struct scst_user_cmd *ucmd)
+{
+	struct scst_cmd *cmd = ucmd->cmd;
+	struct scst_user_dev *dev = ucmd->dev;
+	int bit;
+	bool res = false;
+
+	if (cmd->data_direction != SCST_DATA_NONE)
+		goto out;
+
+	switch (cmd->cdb[0]) {
+	case TEST_UNIT_READY:
+		bit = SCST_USER_INTERNAL_TUR;
+		break;
+	case SYNCHRONIZE_CACHE:
+	case SYNCHRONIZE_CACHE_16:
+		bit = SCST_USER_INTERNAL_SYNC_CACHE;
+		break;
+	case START_STOP:
+		if (cmd->dev->type != TYPE_DISK)
+			goto out;
+		bit = SCST_USER_INTERNAL_START_STOP;
+		break;
+	default:
+		goto out;
+	}
+
+	if (!(dev->internal_cmds & bit))
+		goto out;
+
+	TRACE_DBG("Internally completing ucmd %p (op %s)", ucmd,
+		scst_get_opcode_name(cmd));
+
+	atomic_long_inc(&dev->internal_done[__ffs(bit)]);
+	dev_user_internal_done(cmd);
+	res = true;
+
+out:
+	return res;
+}
+
 static enum scst_exec_res dev_user_exec(struct scst_cmd *cmd)
 {
 	struct scst_user_cmd *ucmd = cmd->dh_priv;
@@ -908,6 +1287,14 @@ static enum scst_exec_res dev_user_exec(struct scst_cmd *cmd)
 
 	TRACE_ENTRY();
 
+	if (ucmd->cached_resp != NULL) {
+		dev_user_exec_cached(ucmd);
+		goto out;
+	}
+
+	if ((ucmd->dev->internal_cmds != 0) && dev_user_exec_internal(ucmd))
+		goto out;
+
 	TRACE_DBG("Preparing EXEC for user space (ucmd=%p, h=%d, lba %lld, "
 		"bufflen %d, data_len %lld, ubuff %lx)", ucmd, ucmd->h,
 		(long long)cmd->lba, cmd->bufflen, (long long)cmd->data_len,
@@ -946,6 +1333,7 @@ static enum scst_exec_res dev_user_exec(struct scst_cmd *cmd)
 
 	dev_user_add_to_ready(ucmd);
 
+out:
 	TRACE_EXIT_RES(res);
 	return res;
 }
@@ -981,6 +1369,70 @@ static void dev_user_ext_copy_remap(struct scst_cmd *cmd,
 	return;
 }
 
+/*
+ * Pins pages_num user pages starting at start for long. Returns the number of
+ * pinned pages, which can be less than pages_num, or error, if none pinned.
+ */
+static long dev_user_pin_pages(unsigned long start, unsigned long pages_num,
+	struct page **pages)
+{
+	struct task_struct *tsk = current;
+	unsigned long pinned = 0;
+	long rc = 0;
+
+	while (pinned < pages_num) {
+		down_read(&tsk->mm->mmap_sem);
+		rc = get_user_pages(start + (pinned << PAGE_SHIFT),
+				    pages_num - pinned, FOLL_WRITE,
+				    &pages[pinned], NULL);
+		up_read(&tsk->mm->mmap_sem);
+		if (rc <= 0)
+			break;
+		pinned += rc;
+		cond_resched();
+	}
+
+	return (pinned > 0) ? pinned : rc;
+}
+
+static void dev_user_unpin_pages(struct page **pages, unsigned long pinned)
+{
+	unsigned long i;
+
+	for (i = 0; i < pinned; i++)
+		put_page(pages[i]);
+	return;
+}
+
+static void dev_user_put_reg_buf(struct dev_user_reg_buf *rb)
+{
+	if (atomic_dec_and_test(&rb->refcnt)) {
+		TRACE_MEM("Freeing registered buffer %lx (len %lu)", rb->start,
+			rb->len);
+		dev_user_unpin_pages(rb->pages, rb->pages_num);
+		vfree(rb);
+	}
+	return;
+}
+
+static void dev_user_unmap_reg_buf(struct scst_user_cmd *ucmd)
+{
+	struct scst_cmd *cmd = ucmd->cmd;
+
+	TRACE_MEM("Unmapping registered buffer (ucmd %p, sg %p)", ucmd,
+		ucmd->reg_sg);
+
+	if (cmd->sg == ucmd->reg_sg) {
+		cmd->sg = NULL;
+		cmd->sg_cnt = 0;
+	}
+	kfree(ucmd->reg_sg);
+	ucmd->reg_sg = NULL;
+	dev_user_put_reg_buf(ucmd->reg_buf);
+	ucmd->reg_buf = NULL;
+	return;
+}
+
 static void dev_user_free_sgv(struct scst_user_cmd *ucmd)
 {
 	if (ucmd->sgv != NULL) {
@@ -1006,6 +1458,15 @@ static void dev_user_on_free_cmd(struct scst_cmd *cmd)
 	TRACE_MEM("ucmd %p, cmd %p, buff_cached %d, ubuff %lx", ucmd, ucmd->cmd,
 		ucmd->buff_cached, ucmd->ubuff);
 
+	if (ucmd->reg_sg != NULL)
+		dev_user_unmap_reg_buf(ucmd);
+
+	/* Not executed, e.g. aborted */
+	if (ucmd->cached_resp != NULL) {
+		dev_user_put_cached_resp(ucmd->cached_resp);
+		ucmd->cached_resp = NULL;
+	}
+
 	ucmd->cmd = NULL;
 	if ((cmd->data_direction & SCST_DATA_WRITE) && ucmd->buf_ucmd != NULL)
 		ucmd->buf_ucmd->buf_dirty = 1;
@@ -1134,12 +1595,12 @@ static inline bool dev_user_mgmt_ucmd(struct scst_user_cmd *ucmd)
 /* Supposed to be called under cmd_list_lock */
 static inline void dev_user_add_to_ready_head(struct scst_user_cmd *ucmd)
 {
-	struct scst_user_dev *dev = ucmd->dev;
+	struct scst_user_queue *q = ucmd->q;
 	struct list_head *entry;
 
 	TRACE_ENTRY();
 
-	__list_for_each(entry, &dev->ready_cmd_list) {
+	__list_for_each(entry, &q->ready_cmd_list) {
 		struct scst_user_cmd *u = list_entry(entry,
 			struct scst_user_cmd, ready_cmd_list_entry);
 		/*
@@ -1159,7 +1620,7 @@ static inline void dev_user_add_to_ready_head(struct scst_user_cmd *ucmd)
 	TRACE_DBG("Adding ucmd %p (state %d) to tail "
 		"of mgmt ready cmd list", ucmd, ucmd->state);
 	list_add_tail(&ucmd->ready_cmd_list_entry,
-		&dev->ready_cmd_list);
+		&q->ready_cmd_list);
 
 out:
 	TRACE_EXIT();
@@ -1168,7 +1629,7 @@ out:
 
 static void dev_user_add_to_ready(struct scst_user_cmd *ucmd)
 {
-	struct scst_user_dev *dev = ucmd->dev;
+	struct scst_user_queue *q = ucmd->q;
 	unsigned long flags;
 	/*
 	 * Note, a separate softIRQ check is required for real-time kernels
@@ -1182,7 +1643,7 @@ static void dev_user_add_to_ready(struct scst_user_cmd *ucmd)
 	if (ucmd->cmd)
 		do_wake |= ucmd->cmd->preprocessing_only;
 
-	spin_lock_irqsave(&dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock, flags);
 
 	ucmd->this_state_unjammed = 0;
 
@@ -1210,7 +1671,7 @@ static void dev_user_add_to_ready(struct scst_user_cmd *ucmd)
 		} else {
 			TRACE_DBG("Adding ucmd %p to ready cmd list", ucmd);
 			list_add_tail(&ucmd->ready_cmd_list_entry,
-				      &dev->ready_cmd_list);
+				      &q->ready_cmd_list);
 		}
 		do_wake |= ((ucmd->state == UCMD_STATE_ON_CACHE_FREEING) ||
 			    (ucmd->state == UCMD_STATE_ON_FREEING) ||
@@ -1218,11 +1679,11 @@ static void dev_user_add_to_ready(struct scst_user_cmd *ucmd)
 	}
 
 	if (do_wake) {
-		TRACE_DBG("Waking up dev %p", dev);
-		wake_up(&dev->udev_cmd_threads.cmd_list_waitQ);
+		TRACE_DBG("Waking up dev %p (queue %d)", ucmd->dev, q->idx);
+		wake_up(&q->udev_cmd_threads.cmd_list_waitQ);
 	}
 
-	spin_unlock_irqrestore(&dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock, flags);
 
 	TRACE_EXIT();
 	return;
@@ -1234,6 +1695,7 @@ static int dev_user_map_buf(struct scst_user_cmd *ucmd, unsigned long ubuff,
 	int res = 0, rc;
 	int i;
 	struct task_struct *tsk = current;
+	struct dev_user_arena *arena;
 
 	TRACE_ENTRY();
 
@@ -1244,6 +1706,20 @@ static int dev_user_map_buf(struct scst_user_cmd *ucmd, unsigned long ubuff,
 
 	ucmd->num_data_pages = num_pg;
 
+	arena = READ_ONCE(ucmd->dev->arena);
+	if ((arena != NULL) && (ubuff >= arena->start)) {
+		unsigned long first = (ubuff - arena->start) >> PAGE_SHIFT;
+
+		if ((first < arena->pages_num) &&
+		    (num_pg <= arena->pages_num - first)) {
+			TRACE_MEM("Mapping arena buffer (ucmd %p, ubuff %lx, "
+				"num_pg %d)", ucmd, ubuff, num_pg);
+			ucmd->data_pages = &arena->pages[first];
+			ucmd->arena_mapped = 1;
+			goto out_mapped;
+		}
+	}
+
 	ucmd->data_pages = kmalloc_array(ucmd->num_data_pages,
 					 sizeof(*ucmd->data_pages),
 					 GFP_KERNEL);
@@ -1269,6 +1745,7 @@ static int dev_user_map_buf(struct scst_user_cmd *ucmd, unsigned long ubuff,
 	if (rc < ucmd->num_data_pages)
 		goto out_unmap;
 
+out_mapped:
 	ucmd->ubuff = ubuff;
 	ucmd->first_page_offset = (ubuff & ~PAGE_MASK);
 
@@ -1726,54 +2203,262 @@ out_busy:
 	goto out_compl;
 }
 
-static int dev_user_process_reply_exec(struct scst_user_cmd *ucmd,
-	struct scst_user_reply_cmd *reply)
+static struct dev_user_reg_buf *dev_user_get_reg_buf(
+	struct scst_user_dev *dev, uint32_t id)
 {
-	int res = 0;
-	struct scst_user_scsi_cmd_reply_exec *ereply =
-		&reply->exec_reply;
+	struct dev_user_reg_buf *rb = NULL;
+
+	spin_lock(&dev->reg_bufs_lock);
+	if ((dev->reg_bufs != NULL) && (id < SCST_USER_MAX_REG_BUFS)) {
+		rb = dev->reg_bufs[id];
+		if (rb != NULL)
+			atomic_inc(&rb->refcnt);
+	}
+	spin_unlock(&dev->reg_bufs_lock);
+
+	return rb;
+}
+
+/*
+ * Replaces cmd->sg by sg over the registered buffer's pages holding the
+ * READ data, so it is sent to the initiator without copying it to the
+ * buffer provided by SCST. Physically contiguous pages are merged.
+ */
+static int dev_user_map_reg_buf(struct scst_user_cmd *ucmd,
+	const struct scst_user_scsi_cmd_reply_exec *ereply)
+{
+	int res = 0, i, sg_cnt;
 	struct scst_cmd *cmd = ucmd->cmd;
+	struct scst_user_dev *dev = ucmd->dev;
+	struct dev_user_reg_buf *rb;
+	struct scatterlist *sg, *cur;
+	unsigned long offs, first;
+	int num_pg, len = ereply->resp_data_len;
 
 	TRACE_ENTRY();
 
-	if (ereply->reply_type == SCST_EXEC_REPLY_COMPLETED) {
-		if (ucmd->background_exec) {
-			TRACE_DBG("Background ucmd %p finished", ucmd);
-			ucmd_put(ucmd);
-			goto out;
-		}
-		if (unlikely(ereply->resp_data_len > cmd->bufflen))
-			goto out_inval;
-		if (unlikely((cmd->data_direction != SCST_DATA_READ) &&
-			     (ereply->resp_data_len != 0)))
-			goto out_inval;
-	} else if (ereply->reply_type == SCST_EXEC_REPLY_BACKGROUND) {
-		if (unlikely(ucmd->background_exec))
-			goto out_inval;
-		if (unlikely((cmd->data_direction & SCST_DATA_READ) ||
-			     (cmd->resp_data_len != 0)))
-			goto out_inval;
-		/*
-		 * background_exec assignment must be after ucmd get.
-		 * Otherwise, due to reorder, in dev_user_process_reply()
-		 * it is possible that ucmd is destroyed before it "got" here.
-		 */
-		ucmd_get(ucmd);
-		ucmd->background_exec = 1;
-		TRACE_DBG("Background ucmd %p", ucmd);
-		goto out_compl;
-	} else if (ereply->reply_type == SCST_EXEC_REPLY_DO_WRITE_SAME) {
-		res = dev_user_process_ws_reply(ucmd, ereply);
+	if (unlikely(dev->on_free_cmd_type != SCST_USER_ON_FREE_CMD_CALL)) {
+		PRINT_ERROR("Registered buffers replies require "
+			"SCST_USER_ON_FREE_CMD_CALL (dev %s)", dev->name);
+		res = -EINVAL;
 		goto out;
-	} else
-		goto out_inval;
-
-	TRACE_DBG("ucmd %p, status %d, resp_data_len %d", ucmd,
-		ereply->status, ereply->resp_data_len);
+	}
 
-	cmd->atomic = 0;
+	rb = dev_user_get_reg_buf(dev, ereply->buf_id);
+	if (unlikely(rb == NULL)) {
+		PRINT_ERROR("Invalid registered buffer id %u (dev %s)",
+			ereply->buf_id, dev->name);
+		res = -EINVAL;
+		goto out;
+	}
 
-	if (ereply->resp_data_len != 0) {
+	if (unlikely((ereply->buf_off > rb->len) ||
+		     (len > rb->len - ereply->buf_off))) {
+		PRINT_ERROR("Data (offset %u, len %d) beyond registered buffer "
+			"%u (len %lu, dev %s)", ereply->buf_off, len,
+			ereply->buf_id, rb->len, dev->name);
+		res = -EINVAL;
+		goto out_put;
+	}
+
+	offs = (rb->start & ~PAGE_MASK) + ereply->buf_off;
+	first = offs >> PAGE_SHIFT;
+	offs &= ~PAGE_MASK;
+	num_pg = (offs + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+	sg_cnt = 1;
+	for (i = 1; i < num_pg; i++) {
+		if (page_to_pfn(rb->pages[first + i]) !=
+		    page_to_pfn(rb->pages[first + i - 1]) + 1)
+			sg_cnt++;
+	}
+
+	if (unlikely(sg_cnt > cmd->tgt_dev->max_sg_cnt)) {
+		PRINT_ERROR("Registered buffer data needs %d SG entries, but "
+			"only %d available (dev %s)", sg_cnt,
+			cmd->tgt_dev->max_sg_cnt, dev->name);
+		res = -EINVAL;
+		goto out_put;
+	}
+
+	sg = kmalloc_array(sg_cnt, sizeof(*sg), GFP_KERNEL);
+	if (unlikely(sg == NULL)) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate %d SG entries",
+			sg_cnt);
+		res = -ENOMEM;
+		goto out_put;
+	}
+	sg_init_table(sg, sg_cnt);
+
+	cur = sg;
+	for (i = 0; i < num_pg; i++) {
+		struct page *page = rb->pages[first + i];
+		int l = min_t(int, len, PAGE_SIZE - offs);
+
+		flush_dcache_page(page);
+		if ((i == 0) || (page_to_pfn(page) !=
+				 page_to_pfn(rb->pages[first + i - 1]) + 1)) {
+			if (i != 0)
+				cur = sg_next(cur);
+			sg_set_page(cur, page, l, offs);
+		} else
+			cur->length += l;
+		len -= l;
+		offs = 0;
+	}
+
+	TRACE_MEM("Mapped registered buffer %u (ucmd %p, off %u, sg_cnt %d)",
+		ereply->buf_id, ucmd, ereply->buf_off, sg_cnt);
+
+	/* The SCST provided buffer, if any, is freed with ucmd as usual */
+	scst_check_restore_sg_buff(cmd);
+	cmd->sg = sg;
+	cmd->sg_cnt = sg_cnt;
+	ucmd->reg_sg = sg;
+	ucmd->reg_buf = rb;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_put:
+	dev_user_put_reg_buf(rb);
+	goto out;
+}
+
+/*
+ * Completes the replied commands collected on q. The list is detached
+ * first, because completed commands can be freed at any moment.
+ */
+static void dev_user_flush_done(struct scst_user_queue *q,
+	enum scst_exec_context context)
+{
+	struct scst_user_cmd *ucmd, *t;
+	unsigned long flags;
+	LIST_HEAD(done_list);
+
+	spin_lock_irqsave(&q->done_lock, flags);
+	list_splice_init(&q->done_cmd_list, &done_list);
+	q->done_cmds_num = 0;
+	spin_unlock_irqrestore(&q->done_lock, flags);
+
+	list_for_each_entry_safe(ucmd, t, &done_list, done_cmd_list_entry) {
+		struct scst_cmd *cmd = ucmd->cmd;
+
+		TRACE_DBG("Completing ucmd %p (cmd %p)", ucmd, cmd);
+		list_del(&ucmd->done_cmd_list_entry);
+		cmd->scst_cmd_done(cmd, SCST_CMD_STATE_DEFAULT, context);
+		/* !! At this point cmd and ucmd can be already freed !! */
+	}
+	return;
+}
+
+static enum hrtimer_restart dev_user_done_timer_fn(struct hrtimer *timer)
+{
+	struct scst_user_queue *q = container_of(timer,
+		struct scst_user_queue, done_timer);
+
+	/* Timer context, so let SCST threads do the rest */
+	dev_user_flush_done(q, SCST_CONTEXT_THREAD);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called at the end of each call processing replies. Hands the commands
+ * completed by it to SCST together, so the target driver gets them in
+ * one go, or, if the device has a coalescing window, keeps collecting them
+ * until the window is full or expires.
+ */
+static void dev_user_replies_done(struct scst_user_dev *dev)
+{
+	int i, cmds, usecs;
+
+	cmds = READ_ONCE(dev->compl_coalesce_cmds);
+	usecs = READ_ONCE(dev->compl_coalesce_usecs);
+
+	for (i = 0; i < dev->queues_num; i++) {
+		struct scst_user_queue *q = &dev->queues[i];
+		int num = READ_ONCE(q->done_cmds_num);
+
+		if (num == 0)
+			continue;
+
+		if ((usecs == 0) || ((cmds != 0) && (num >= cmds))) {
+			dev_user_flush_done(q, SCST_CONTEXT_DIRECT);
+			continue;
+		}
+
+		/* Not restarted, so no command waits longer than the window */
+		spin_lock_irq(&q->done_lock);
+		if (!hrtimer_is_queued(&q->done_timer))
+			hrtimer_start(&q->done_timer,
+				ns_to_ktime((u64)usecs * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+		spin_unlock_irq(&q->done_lock);
+	}
+	return;
+}
+
+static int dev_user_process_reply_exec(struct scst_user_cmd *ucmd,
+	struct scst_user_reply_cmd *reply)
+{
+	int res = 0;
+	struct scst_user_scsi_cmd_reply_exec *ereply =
+		&reply->exec_reply;
+	struct scst_cmd *cmd = ucmd->cmd;
+
+	TRACE_ENTRY();
+
+	if (ereply->reply_type == SCST_EXEC_REPLY_COMPLETED) {
+		if (ucmd->background_exec) {
+			TRACE_DBG("Background ucmd %p finished", ucmd);
+			ucmd_put(ucmd);
+			goto out;
+		}
+		if (unlikely(ereply->resp_data_len > cmd->bufflen))
+			goto out_inval;
+		if (unlikely((cmd->data_direction != SCST_DATA_READ) &&
+			     (ereply->resp_data_len != 0)))
+			goto out_inval;
+	} else if (ereply->reply_type == SCST_EXEC_REPLY_BACKGROUND) {
+		if (unlikely(ucmd->background_exec))
+			goto out_inval;
+		if (unlikely((cmd->data_direction & SCST_DATA_READ) ||
+			     (cmd->resp_data_len != 0)))
+			goto out_inval;
+		/*
+		 * background_exec assignment must be after ucmd get.
+		 * Otherwise, due to reorder, in dev_user_process_reply()
+		 * it is possible that ucmd is destroyed before it "got" here.
+		 */
+		ucmd_get(ucmd);
+		ucmd->background_exec = 1;
+		TRACE_DBG("Background ucmd %p", ucmd);
+		goto out_compl;
+	} else if (ereply->reply_type == SCST_EXEC_REPLY_DO_WRITE_SAME) {
+		res = dev_user_process_ws_reply(ucmd, ereply);
+		goto out;
+	} else if (ereply->reply_type == SCST_EXEC_REPLY_COMPLETED_REG_BUF) {
+		if (unlikely(ucmd->background_exec ||
+			     (cmd->data_direction != SCST_DATA_READ) ||
+			     (ereply->resp_data_len <= 0) ||
+			     (ereply->resp_data_len > cmd->bufflen)))
+			goto out_inval;
+	} else
+		goto out_inval;
+
+	TRACE_DBG("ucmd %p, status %d, resp_data_len %d", ucmd,
+		ereply->status, ereply->resp_data_len);
+
+	cmd->atomic = 0;
+
+	if (ereply->reply_type == SCST_EXEC_REPLY_COMPLETED_REG_BUF) {
+		res = dev_user_map_reg_buf(ucmd, ereply);
+		if (unlikely(res != 0))
+			goto out_intern_fail_res_set;
+		cmd->may_need_dma_sync = 1;
+		scst_set_resp_data_len(cmd, ereply->resp_data_len);
+	} else if (ereply->resp_data_len != 0) {
 		if (ucmd->ubuff == 0) {
 			int pages, rc;
 
@@ -1843,8 +2528,11 @@ static int dev_user_process_reply_exec(struct scst_user_cmd *ucmd,
 
 out_compl:
 	cmd->completed = 1;
-	cmd->scst_cmd_done(cmd, SCST_CMD_STATE_DEFAULT, SCST_CONTEXT_DIRECT);
-	/* !! At this point cmd can be already freed !! */
+	/* Completed by dev_user_replies_done() together with the others */
+	spin_lock_irq(&ucmd->q->done_lock);
+	list_add_tail(&ucmd->done_cmd_list_entry, &ucmd->q->done_cmd_list);
+	ucmd->q->done_cmds_num++;
+	spin_unlock_irq(&ucmd->q->done_lock);
 
 out:
 	TRACE_DBG("%s", "EXEC finished");
@@ -1878,14 +2566,22 @@ static int dev_user_process_reply(struct scst_user_dev *dev,
 	struct scst_user_reply_cmd *reply)
 {
 	int res = 0;
+	struct scst_user_queue *q;
 	struct scst_user_cmd *ucmd;
 	int state;
 
 	TRACE_ENTRY();
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	q = dev_user_h_queue(dev, reply->cmd_h);
+	if (unlikely(q == NULL)) {
+		TRACE_MGMT_DBG("cmd_h %d not found", reply->cmd_h);
+		res = -ESRCH;
+		goto out;
+	}
+
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
-	ucmd = __ucmd_find_hash(dev, reply->cmd_h);
+	ucmd = __ucmd_find_hash(q, reply->cmd_h);
 	if (unlikely(ucmd == NULL)) {
 		TRACE_MGMT_DBG("cmd_h %d not found", reply->cmd_h);
 		res = -ESRCH;
@@ -1928,7 +2624,7 @@ static int dev_user_process_reply(struct scst_user_dev *dev,
 	ucmd->sent_to_user = 0;
 
 unlock_process:
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 	switch (state) {
 	case UCMD_STATE_PARSING:
@@ -1989,11 +2685,11 @@ out_wrong_state:
 	dev_user_unjam_cmd(ucmd, 0, NULL);
 
 out_unlock_put:
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 	goto out_put;
 
 out_unlock:
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 	goto out;
 }
 
@@ -2001,14 +2697,16 @@ static int dev_user_reply_cmd(struct file *file, void __user *arg)
 {
 	int res = 0, rc;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 	struct scst_user_reply_cmd reply;
 
 	TRACE_ENTRY();
 
-	dev = file->private_data;
-	res = dev_user_check_reg(dev);
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
 	if (unlikely(res != 0))
 		goto out;
+	dev = q->dev;
 
 	rc = copy_from_user(&reply, arg, sizeof(reply));
 	if (unlikely(rc != 0)) {
@@ -2022,6 +2720,7 @@ static int dev_user_reply_cmd(struct file *file, void __user *arg)
 	TRACE_BUFFER("Reply", &reply, sizeof(reply));
 
 	res = dev_user_process_reply(dev, &reply);
+	dev_user_replies_done(dev);
 	if (unlikely(res < 0))
 		goto out;
 
@@ -2034,16 +2733,18 @@ static int dev_user_get_ext_cdb(struct file *file, void __user *arg)
 {
 	int res = 0, rc;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 	struct scst_user_cmd *ucmd;
 	struct scst_cmd *cmd = NULL;
 	struct scst_user_get_ext_cdb get;
 
 	TRACE_ENTRY();
 
-	dev = file->private_data;
-	res = dev_user_check_reg(dev);
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
 	if (unlikely(res != 0))
 		goto out;
+	dev = q->dev;
 
 	rc = copy_from_user(&get, arg, sizeof(get));
 	if (unlikely(rc != 0)) {
@@ -2056,9 +2757,16 @@ static int dev_user_get_ext_cdb(struct file *file, void __user *arg)
 
 	TRACE_BUFFER("Get ext cdb", &get, sizeof(get));
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	q = dev_user_h_queue(dev, get.cmd_h);
+	if (unlikely(q == NULL)) {
+		TRACE_MGMT_DBG("cmd_h %d not found", get.cmd_h);
+		res = -ESRCH;
+		goto out;
+	}
+
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
-	ucmd = __ucmd_find_hash(dev, get.cmd_h);
+	ucmd = __ucmd_find_hash(q, get.cmd_h);
 	if (unlikely(ucmd == NULL)) {
 		TRACE_MGMT_DBG("cmd_h %d not found", get.cmd_h);
 		res = -ESRCH;
@@ -2082,7 +2790,7 @@ static int dev_user_get_ext_cdb(struct file *file, void __user *arg)
 		goto out_unlock;
 	}
 
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 	if (cmd == NULL)
 		goto out_put;
@@ -2116,27 +2824,27 @@ out:
 	return res;
 
 out_unlock:
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 	goto out;
 }
 
-static int dev_user_process_scst_commands(struct scst_user_dev *dev)
-	__releases(&dev->udev_cmd_threads.cmd_list_lock)
-	__acquires(&dev->udev_cmd_threads.cmd_list_lock)
+static int dev_user_process_scst_commands(struct scst_user_queue *q)
+	__releases(&q->udev_cmd_threads.cmd_list_lock)
+	__acquires(&q->udev_cmd_threads.cmd_list_lock)
 {
 	int res = 0;
 
 	TRACE_ENTRY();
 
-	while (!list_empty(&dev->udev_cmd_threads.active_cmd_list)) {
+	while (!list_empty(&q->udev_cmd_threads.active_cmd_list)) {
 		struct scst_cmd *cmd = list_entry(
-			dev->udev_cmd_threads.active_cmd_list.next, typeof(*cmd),
+			q->udev_cmd_threads.active_cmd_list.next, typeof(*cmd),
 			cmd_list_entry);
 		TRACE_DBG("Deleting cmd %p from active cmd list", cmd);
 		list_del(&cmd->cmd_list_entry);
-		spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+		spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 		scst_process_active_cmd(cmd, false);
-		spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+		spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 		res++;
 	}
 
@@ -2146,8 +2854,8 @@ static int dev_user_process_scst_commands(struct scst_user_dev *dev)
 
 /* Called under udev_cmd_threads.cmd_list_lock and IRQ off */
 static struct scst_user_cmd *__dev_user_get_next_cmd(struct list_head *cmd_list)
-	__releases(&dev->udev_cmd_threads.cmd_list_lock)
-	__acquires(&dev->udev_cmd_threads.cmd_list_lock)
+	__releases(&q->udev_cmd_threads.cmd_list_lock)
+	__acquires(&q->udev_cmd_threads.cmd_list_lock)
 {
 	struct scst_user_cmd *u;
 
@@ -2164,12 +2872,12 @@ again:
 
 		if (u->cmd != NULL) {
 			if (u->state == UCMD_STATE_EXECING) {
-				struct scst_user_dev *dev = u->dev;
+				struct scst_user_queue *q = u->q;
 				int rc;
 
 				EXTRACHECKS_BUG_ON(u->jammed);
 
-				spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+				spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 				rc = scst_check_local_events(u->cmd);
 				if (unlikely(rc != 0)) {
@@ -2181,11 +2889,11 @@ again:
 					 * !! already freed		   !!
 					 */
 					spin_lock_irq(
-						&dev->udev_cmd_threads.cmd_list_lock);
+						&q->udev_cmd_threads.cmd_list_lock);
 					goto again;
 				}
 
-				spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+				spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 			} else if (unlikely(test_bit(SCST_CMD_ABORTED,
 					&u->cmd->cmd_flags))) {
 				switch (u->state) {
@@ -2205,31 +2913,33 @@ again:
 	return u;
 }
 
-static inline int test_cmd_threads(struct scst_user_dev *dev, bool can_block)
+static inline int test_cmd_threads(struct scst_user_queue *q, bool can_block)
 {
-	int res = !list_empty(&dev->udev_cmd_threads.active_cmd_list) ||
-		  !list_empty(&dev->ready_cmd_list) ||
+	struct scst_user_dev *dev = q->dev;
+	int res = !list_empty(&q->udev_cmd_threads.active_cmd_list) ||
+		  !list_empty(&q->ready_cmd_list) ||
 		  !can_block || !dev->blocking || dev->cleanup_done ||
 		  signal_pending(current);
 	return res;
 }
 
 /* Called under udev_cmd_threads.cmd_list_lock and IRQ off */
-static int dev_user_get_next_cmd(struct scst_user_dev *dev,
+static int dev_user_get_next_cmd(struct scst_user_queue *q,
 	struct scst_user_cmd **ucmd, bool can_block)
 {
+	struct scst_user_dev *dev = q->dev;
 	int res = 0;
 
 	TRACE_ENTRY();
 
 	while (1) {
-		wait_event_locked(dev->udev_cmd_threads.cmd_list_waitQ,
-				  test_cmd_threads(dev, can_block), lock_irq,
-				  dev->udev_cmd_threads.cmd_list_lock);
+		wait_event_locked(q->udev_cmd_threads.cmd_list_waitQ,
+				  test_cmd_threads(q, can_block), lock_irq,
+				  q->udev_cmd_threads.cmd_list_lock);
 
-		dev_user_process_scst_commands(dev);
+		dev_user_process_scst_commands(q);
 
-		*ucmd = __dev_user_get_next_cmd(&dev->ready_cmd_list);
+		*ucmd = __dev_user_get_next_cmd(&q->ready_cmd_list);
 		if (*ucmd != NULL)
 			break;
 
@@ -2251,7 +2961,7 @@ static int dev_user_get_next_cmd(struct scst_user_dev *dev,
 }
 
 /* No locks */
-static int dev_user_get_cmd_to_user(struct scst_user_dev *dev,
+static int dev_user_get_cmd_to_user(struct scst_user_queue *q,
 	void __user *where, bool can_block)
 {
 	int res;
@@ -2259,9 +2969,9 @@ static int dev_user_get_cmd_to_user(struct scst_user_dev *dev,
 
 	TRACE_ENTRY();
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 again:
-	res = dev_user_get_next_cmd(dev, &ucmd, can_block);
+	res = dev_user_get_next_cmd(q, &ucmd, can_block);
 	if (res == 0) {
 		int len, rc;
 		/*
@@ -2274,7 +2984,7 @@ again:
 			/* Oops, this ucmd is already being destroyed. Retry. */
 			goto again;
 		}
-		spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+		spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 		EXTRACHECKS_BUG_ON(ucmd->user_cmd_payload_len == 0);
 
@@ -2288,10 +2998,10 @@ again:
 				"%p back to head of ready cmd list", res, ucmd);
 			res = -EFAULT;
 			/* Requeue ucmd back */
-			spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 			list_add(&ucmd->ready_cmd_list_entry,
-				&dev->ready_cmd_list);
-			spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+				&q->ready_cmd_list);
+			spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 		}
 #ifdef CONFIG_SCST_EXTRACHECKS
 		else
@@ -2299,7 +3009,83 @@ again:
 #endif
 		ucmd_put(ucmd);
 	} else
-		spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+		spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/* How many ready commands are taken at once by dev_user_get_cmds_to_user() */
+#define DEV_USER_GET_CMDS_CHUNK	16
+
+/*
+ * No locks. Copies up to cnt ready commands to where[], taking them off the
+ * ready list by chunks under a single lock acquisition each. Only for the
+ * first command it waits, if allowed. Returns the number of copied commands
+ * or a negative error code, if none was copied.
+ */
+static int dev_user_get_cmds_to_user(struct scst_user_queue *q,
+	struct scst_user_get_cmd __user *where, int cnt)
+{
+	int res = 0, done = 0, n, i, j, rc;
+	struct scst_user_cmd *ucmds[DEV_USER_GET_CMDS_CHUNK];
+	struct scst_user_cmd *ucmd;
+	bool more = true;
+
+	TRACE_ENTRY();
+
+	while (more && (done < cnt)) {
+		n = 0;
+		spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
+		while ((n < ARRAY_SIZE(ucmds)) && (done + n < cnt)) {
+			rc = dev_user_get_next_cmd(q, &ucmd, done + n == 0);
+			if (rc != 0) {
+				if (done + n == 0)
+					res = rc;
+				more = false;
+				break;
+			}
+			/* See the comment in dev_user_get_cmd_to_user() */
+			if (unlikely(ucmd_get_check(ucmd)))
+				continue;
+			ucmds[n++] = ucmd;
+		}
+		spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+
+		for (i = 0; i < n; i++) {
+			int len;
+
+			ucmd = ucmds[i];
+			EXTRACHECKS_BUG_ON(ucmd->user_cmd_payload_len == 0);
+
+			len = ucmd->user_cmd_payload_len;
+			TRACE_BUFFER("UCMD", &ucmd->user_cmd, len);
+			rc = copy_to_user(&where[done], &ucmd->user_cmd, len);
+			if (unlikely(rc != 0)) {
+				PRINT_ERROR("Copy to user failed (%d), requeuing "
+					"%d ucmds back to head of ready cmd list",
+					rc, n - i);
+				res = -EFAULT;
+				spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
+				for (j = n - 1; j >= i; j--)
+					list_add(&ucmds[j]->ready_cmd_list_entry,
+						&q->ready_cmd_list);
+				spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+				for (j = i; j < n; j++)
+					ucmd_put(ucmds[j]);
+				goto out;
+			}
+#ifdef CONFIG_SCST_EXTRACHECKS
+			ucmd->user_cmd_payload_len = 0;
+#endif
+			ucmd_put(ucmd);
+			done++;
+		}
+	}
+
+out:
+	if (done > 0)
+		res = done;
 
 	TRACE_EXIT_RES(res);
 	return res;
@@ -2309,15 +3095,17 @@ static int dev_user_reply_get_cmd(struct file *file, void __user *arg)
 {
 	int res = 0, rc;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 	struct scst_user_reply_cmd reply;
 	uint64_t ureply;
 
 	TRACE_ENTRY();
 
-	dev = file->private_data;
-	res = dev_user_check_reg(dev);
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
 	if (unlikely(res != 0))
 		goto out;
+	dev = q->dev;
 
 	/* get_user() can't be used with 64-bit values on x86_32 */
 	rc = copy_from_user(&ureply, (uint64_t __user *)
@@ -2345,115 +3133,1077 @@ static int dev_user_reply_get_cmd(struct file *file, void __user *arg)
 		TRACE_BUFFER("Reply", &reply, sizeof(reply));
 
 		res = dev_user_process_reply(dev, &reply);
+		dev_user_replies_done(dev);
 		if (unlikely(res < 0))
 			goto out;
 	}
 
-	res = dev_user_get_cmd_to_user(dev, arg, true);
+	res = dev_user_get_cmd_to_user(q, arg, true);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static int dev_user_reply_get_multi(struct file *file, void __user *arg)
+{
+	int res = 0, rc;
+	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
+	struct scst_user_reply_cmd __user *replies;
+	int16_t i, replies_cnt, replies_done = 0, cmds_cnt = 0;
+
+	TRACE_ENTRY();
+
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
+	if (unlikely(res != 0))
+		goto out;
+	dev = q->dev;
+
+	res = get_user(replies_cnt, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->replies_cnt);
+	if (unlikely(res < 0)) {
+		PRINT_ERROR("%s", "Unable to get replies_cnt");
+		goto out;
+	}
+
+	res = get_user(cmds_cnt, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
+	if (unlikely(res < 0)) {
+		PRINT_ERROR("%s", "Unable to get cmds_cnt");
+		goto out;
+	}
+
+	TRACE_DBG("replies %d, space %d (dev %s)",
+		replies_cnt, cmds_cnt, dev->name);
+
+	if (replies_cnt == 0)
+		goto get_cmds;
+
+	/* get_user() can't be used with 64-bit values on x86_32 */
+	rc = copy_from_user(&replies, (uint64_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->preplies, sizeof(replies));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("%s", "Unable to get preply");
+		res = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < replies_cnt; i++) {
+		struct scst_user_reply_cmd reply;
+
+		rc = copy_from_user(&reply, &replies[i], sizeof(reply));
+		if (unlikely(rc != 0)) {
+			PRINT_ERROR("Unable to get reply %d", i);
+			res = -EFAULT;
+			goto out_part_replies_done;
+		}
+
+		TRACE_BUFFER("Reply", &reply, sizeof(reply));
+
+		res = dev_user_process_reply(dev, &reply);
+		if (unlikely(res < 0))
+			goto out_part_replies_done;
+
+		replies_done++;
+	}
+
+	dev_user_replies_done(dev);
+
+	TRACE_DBG("Returning %d replies_done", replies_done);
+	res = put_user(replies_done, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->replies_done);
+	if (unlikely(res < 0))
+		goto out;
+
+get_cmds:
+	i = 0;
+	if (cmds_cnt > 0) {
+		rc = dev_user_get_cmds_to_user(q,
+			((struct scst_user_get_multi __user *)arg)->cmds, cmds_cnt);
+		if (rc < 0)
+			res = rc;
+		else
+			i = rc;
+	}
+
+	TRACE_DBG("Returning %d cmds_ret", i);
+	rc = put_user(i, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
+	if (unlikely(rc < 0)) {
+		res = rc; /* this error is more important */
+		goto out;
+	}
 
 out:
 	TRACE_EXIT_RES(res);
 	return res;
+
+out_part_replies_done:
+	dev_user_replies_done(dev);
+	TRACE_DBG("Partial returning %d replies_done", replies_done);
+	put_user(replies_done, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->replies_done);
+	rc = put_user(0, (int16_t __user *)
+		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
+	goto out;
+}
+
+static void dev_user_signal_eventfd(struct eventfd_ctx *ctx)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	eventfd_signal(ctx);
+#else
+	eventfd_signal(ctx, 1);
+#endif
+}
+
+/*
+ * Processes replies queued on the replies ring. Called under rings_mutex.
+ * Returns the number of processed replies.
+ */
+static int dev_user_rings_get_replies(struct scst_user_queue *q)
+{
+	struct scst_user_dev *dev = q->dev;
+	struct scst_user_rings *rings = q->rings;
+	uint32_t head = q->ring_replies_head;
+	uint32_t tail = smp_load_acquire(&rings->replies.tail);
+	int res = 0, rc;
+
+	TRACE_ENTRY();
+
+	if (unlikely(tail - head > q->ring_entries)) {
+		PRINT_ERROR("Invalid replies ring tail %u (head %u, dev %s), "
+			"ignoring", tail, head, dev->name);
+		goto out;
+	}
+
+	while (head != tail) {
+		struct scst_user_reply_cmd reply;
+
+		/* User space can modify the entry at any time */
+		memcpy(&reply, &q->ring_replies[head & (q->ring_entries - 1)],
+			sizeof(reply));
+		head++;
+
+		TRACE_BUFFER("Reply", &reply, sizeof(reply));
+
+		rc = dev_user_process_reply(dev, &reply);
+		if (unlikely(rc < 0))
+			TRACE_DBG("Reply for cmd_h %d failed: %d", reply.cmd_h,
+				rc);
+		res++;
+	}
+
+	dev_user_replies_done(dev);
+
+	q->ring_replies_head = head;
+	smp_store_release(&rings->replies.head, head);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Moves ready commands to the commands ring until it's full. Called under
+ * rings_mutex. Returns the number of posted commands.
+ */
+static int dev_user_rings_put_cmds(struct scst_user_queue *q)
+{
+	struct scst_user_rings *rings = q->rings;
+	uint32_t tail = q->ring_cmds_tail;
+	struct scst_user_cmd *ucmd;
+	int res = 0;
+
+	TRACE_ENTRY();
+
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
+	while (tail - smp_load_acquire(&rings->cmds.head) < q->ring_entries) {
+		dev_user_process_scst_commands(q);
+
+		ucmd = __dev_user_get_next_cmd(&q->ready_cmd_list);
+		if (ucmd == NULL)
+			break;
+
+		/* See the comment in dev_user_get_cmd_to_user() */
+		if (unlikely(ucmd_get_check(ucmd)))
+			continue;
+		spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+
+		EXTRACHECKS_BUG_ON(ucmd->user_cmd_payload_len == 0);
+
+		TRACE_DBG("ucmd %p, payload_len %d, ring tail %u", ucmd,
+			ucmd->user_cmd_payload_len, tail);
+		TRACE_BUFFER("UCMD", &ucmd->user_cmd,
+			ucmd->user_cmd_payload_len);
+		memcpy(&q->ring_cmds[tail & (q->ring_entries - 1)],
+			&ucmd->user_cmd, ucmd->user_cmd_payload_len);
+		tail++;
+		smp_store_release(&rings->cmds.tail, tail);
+#ifdef CONFIG_SCST_EXTRACHECKS
+		ucmd->user_cmd_payload_len = 0;
+#endif
+		ucmd_put(ucmd);
+		res++;
+
+		spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
+	}
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+
+	q->ring_cmds_tail = tail;
+
+	if ((res > 0) && (q->rings_eventfd != NULL))
+		dev_user_signal_eventfd(q->rings_eventfd);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static inline bool dev_user_rings_cmds_queued(struct scst_user_queue *q)
+{
+	return READ_ONCE(q->rings->cmds.head) != READ_ONCE(q->ring_cmds_tail);
+}
+
+static inline int test_rings_cmds(struct scst_user_queue *q)
+{
+	struct scst_user_dev *dev = q->dev;
+
+	return dev_user_rings_cmds_queued(q) ||
+	       !list_empty(&q->udev_cmd_threads.active_cmd_list) ||
+	       !list_empty(&q->ready_cmd_list) ||
+	       !dev->blocking || dev->cleanup_done || signal_pending(current);
+}
+
+/*
+ * Commands are worth to look at only if there is space for them, otherwise
+ * the handler will wake up the poller when it replies.
+ */
+static inline int test_rings_poller(struct scst_user_queue *q)
+{
+	bool cmds_space = q->ring_cmds_tail -
+		READ_ONCE(q->rings->cmds.head) < q->ring_entries;
+
+	return (READ_ONCE(q->rings->replies.tail) != q->ring_replies_head) ||
+	       (cmds_space &&
+		(!list_empty(&q->udev_cmd_threads.active_cmd_list) ||
+		 !list_empty(&q->ready_cmd_list))) ||
+	       kthread_should_stop();
+}
+
+/*
+ * Kernel side of the SCST_USER_RINGS_POLL mode: processes replies and posts
+ * commands without any system calls from the user space handler. After
+ * rings_poll_idle without work it sets SCST_USER_RINGS_NEED_WAKEUP and
+ * sleeps, then the handler has to wake it up by SCST_USER_RINGS_ENTER.
+ */
+static int dev_user_rings_poller(void *arg)
+{
+	struct scst_user_queue *q = arg;
+	struct scst_user_dev *dev = q->dev;
+	struct scst_user_rings *rings = q->rings;
+	unsigned long idle_end = jiffies + q->rings_poll_idle;
+
+	TRACE_ENTRY();
+
+	TRACE_MGMT_DBG("Rings poller for dev %s (queue %d) started",
+		dev->name, q->idx);
+
+	while (!kthread_should_stop()) {
+		int n;
+
+		if (test_rings_poller(q)) {
+			/*
+			 * Replies processing and, on some architectures, the
+			 * dcache flushing need the handler's mm. Don't pin it
+			 * while idle, because the mm pins the rings mapping,
+			 * which pins the file, whose release stops us.
+			 */
+			if (!mmget_not_zero(q->rings_mm)) {
+				TRACE_MGMT_DBG("Handler of dev %s is exiting",
+					dev->name);
+				schedule_timeout_interruptible(HZ);
+				continue;
+			}
+			kthread_use_mm(q->rings_mm);
+
+			mutex_lock(&q->rings_mutex);
+			n = dev_user_rings_get_replies(q);
+			n += dev_user_rings_put_cmds(q);
+			mutex_unlock(&q->rings_mutex);
+
+			kthread_unuse_mm(q->rings_mm);
+			mmput(q->rings_mm);
+
+			if (n > 0)
+				idle_end = jiffies + q->rings_poll_idle;
+		}
+
+		if (time_before(jiffies, idle_end)) {
+			cond_resched();
+			continue;
+		}
+
+		WRITE_ONCE(rings->replies.flags, SCST_USER_RINGS_NEED_WAKEUP);
+		/* Pairs with the barrier the handler must have after tail update */
+		smp_mb();
+		wait_event_interruptible(q->udev_cmd_threads.cmd_list_waitQ,
+			test_rings_poller(q));
+		WRITE_ONCE(rings->replies.flags, 0);
+		idle_end = jiffies + q->rings_poll_idle;
+	}
+
+	TRACE_MGMT_DBG("Rings poller for dev %s (queue %d) finished",
+		dev->name, q->idx);
+
+	TRACE_EXIT();
+	return 0;
+}
+
+static int dev_user_setup_rings(struct file *file, void __user *arg)
+{
+	int res, rc;
+	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
+	struct scst_user_rings_desc desc;
+	struct scst_user_rings *rings;
+	struct eventfd_ctx *eventfd = NULL;
+	struct task_struct *t;
+	unsigned int cmds_off, replies_off, size;
+
+	TRACE_ENTRY();
+
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
+	if (unlikely(res != 0))
+		goto out;
+	dev = q->dev;
+
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	TRACE_BUFFER("desc", &desc, sizeof(desc));
+
+	if ((desc.entries == 0) ||
+	    (desc.entries > SCST_USER_RINGS_MAX_ENTRIES) ||
+	    !is_power_of_2(desc.entries) ||
+	    (desc.flags & ~SCST_USER_RINGS_POLL)) {
+		PRINT_ERROR("Invalid rings entries %u or flags %x (dev %s)",
+			desc.entries, desc.flags, dev->name);
+		res = -EINVAL;
+		goto out;
+	}
+
+	cmds_off = sizeof(*rings);
+	replies_off = ALIGN(cmds_off +
+		desc.entries * sizeof(struct scst_user_get_cmd),
+		SMP_CACHE_BYTES);
+	size = PAGE_ALIGN(replies_off +
+		desc.entries * sizeof(struct scst_user_reply_cmd));
+
+	if (desc.eventfd >= 0) {
+		eventfd = eventfd_ctx_fdget(desc.eventfd);
+		if (IS_ERR(eventfd)) {
+			res = PTR_ERR(eventfd);
+			PRINT_ERROR("Invalid rings eventfd %d (dev %s)",
+				desc.eventfd, dev->name);
+			goto out;
+		}
+	}
+
+	/* Zeroed and suitable for remap_vmalloc_range() */
+	rings = vmalloc_user(size);
+	if (rings == NULL) {
+		PRINT_ERROR("Unable to allocate %u bytes of rings (dev %s)",
+			size, dev->name);
+		res = -ENOMEM;
+		goto out_put_eventfd;
+	}
+	rings->cmds.mask = desc.entries - 1;
+	rings->replies.mask = desc.entries - 1;
+
+	mutex_lock(&q->rings_mutex);
+
+	if (q->rings != NULL) {
+		PRINT_ERROR("Rings of dev %s (queue %d) already set up",
+			dev->name, q->idx);
+		res = -EBUSY;
+		goto out_unlock_free;
+	}
+
+	q->ring_cmds = (void *)rings + cmds_off;
+	q->ring_replies = (void *)rings + replies_off;
+	q->ring_entries = desc.entries;
+	q->rings_size = size;
+	q->rings_eventfd = eventfd;
+	q->rings = rings;
+
+	if (desc.flags & SCST_USER_RINGS_POLL) {
+		q->rings_mm = current->mm;
+		mmgrab(q->rings_mm);
+		q->rings_poll_idle = msecs_to_jiffies(desc.poll_idle_ms);
+
+		t = kthread_run(dev_user_rings_poller, q, "scst_usr_poll%d",
+				q->idx);
+		if (IS_ERR(t)) {
+			res = PTR_ERR(t);
+			PRINT_ERROR("kthread_run() failed: %d", res);
+			mmdrop(q->rings_mm);
+			q->rings_mm = NULL;
+			q->rings = NULL;
+			q->rings_eventfd = NULL;
+			goto out_unlock_free;
+		}
+		q->rings_poller = t;
+	}
+
+	mutex_unlock(&q->rings_mutex);
+
+	PRINT_INFO("Set up %u entries rings for dev %s, queue %d (poll %d, "
+		"idle %u ms)", desc.entries, dev->name, q->idx,
+		q->rings_poller != NULL, desc.poll_idle_ms);
+
+	desc.mmap_len = size;
+	desc.cmds_off = cmds_off;
+	desc.replies_off = replies_off;
+
+	/* The rings stay set up on failure, closing the fd frees them */
+	rc = copy_to_user(arg, &desc, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d bytes to user", rc);
+		res = -EFAULT;
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_unlock_free:
+	mutex_unlock(&q->rings_mutex);
+	vfree(rings);
+
+out_put_eventfd:
+	if (eventfd != NULL)
+		eventfd_ctx_put(eventfd);
+	goto out;
+}
+
+/* Must be called after the poller has been stopped and the fds released */
+static void dev_user_free_rings(struct scst_user_queue *q)
+{
+	TRACE_ENTRY();
+
+	if (q->rings == NULL)
+		goto out;
+
+	vfree(q->rings);
+	q->rings = NULL;
+
+	if (q->rings_eventfd != NULL)
+		eventfd_ctx_put(q->rings_eventfd);
+	if (q->rings_mm != NULL)
+		mmdrop(q->rings_mm);
+
+out:
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Without the poller processes the queued replies and posts ready commands,
+ * waiting for them, if SCST_USER_RINGS_ENTER_WAIT is set and the commands
+ * ring is empty. With the poller only wakes it up. Returns the number of
+ * posted commands.
+ */
+static int dev_user_rings_enter(struct file *file, unsigned long flags)
+{
+	int res;
+	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
+
+	TRACE_ENTRY();
+
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
+	if (unlikely(res != 0))
+		goto out;
+	dev = q->dev;
+
+	while (1) {
+		mutex_lock(&q->rings_mutex);
+
+		if (unlikely(q->rings == NULL)) {
+			mutex_unlock(&q->rings_mutex);
+			res = -EINVAL;
+			goto out;
+		}
+
+		if (q->rings_poller != NULL) {
+			mutex_unlock(&q->rings_mutex);
+			if (flags & SCST_USER_RINGS_ENTER_WAKEUP)
+				wake_up(&q->udev_cmd_threads.cmd_list_waitQ);
+			res = 0;
+			goto out;
+		}
+
+		dev_user_rings_get_replies(q);
+		res = dev_user_rings_put_cmds(q);
+
+		mutex_unlock(&q->rings_mutex);
+
+		if ((res != 0) || !(flags & SCST_USER_RINGS_ENTER_WAIT) ||
+		    dev_user_rings_cmds_queued(q))
+			break;
+
+		if (!dev->blocking || dev->cleanup_done) {
+			res = -EAGAIN;
+			TRACE_DBG("No ready commands, returning %d", res);
+			break;
+		}
+
+		wait_event_interruptible(q->udev_cmd_threads.cmd_list_waitQ,
+			test_rings_cmds(q));
+
+		if (signal_pending(current)) {
+			res = -EINTR;
+			TRACE_DBG("Signal pending, returning %d", res);
+			break;
+		}
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static int dev_user_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int res;
+	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
+
+	TRACE_ENTRY();
+
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
+	if (unlikely(res != 0))
+		goto out;
+	dev = q->dev;
+
+	mutex_lock(&q->rings_mutex);
+
+	if (q->rings == NULL) {
+		PRINT_ERROR("Rings of dev %s (queue %d) not set up",
+			dev->name, q->idx);
+		res = -ENODEV;
+		goto out_unlock;
+	}
+
+	if ((vma->vm_pgoff != 0) ||
+	    (vma->vm_end - vma->vm_start > q->rings_size)) {
+		PRINT_ERROR("Invalid rings mapping offset %lu or length %lu "
+			"(dev %s)", vma->vm_pgoff, vma->vm_end - vma->vm_start,
+			dev->name);
+		res = -EINVAL;
+		goto out_unlock;
+	}
+
+	res = remap_vmalloc_range(vma, q->rings, 0);
+
+out_unlock:
+	mutex_unlock(&q->rings_mutex);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Returns a new fd serving the requested queue. It holds a reference on the
+ * device fd, so the device stays registered until all its fds are closed.
+ */
+static int dev_user_open_queue(struct file *file, void __user *arg)
+{
+	int res, rc;
+	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
+	struct scst_user_queue_desc desc;
+
+	TRACE_ENTRY();
+
+	dev = file->private_data;
+	res = dev_user_check_reg(dev);
+	if (unlikely(res != 0))
+		goto out;
+
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	if (desc.queue >= dev->queues_num) {
+		PRINT_ERROR("Invalid queue %u (dev %s, %d queues)", desc.queue,
+			dev->name, dev->queues_num);
+		res = -EINVAL;
+		goto out;
+	}
+	q = &dev->queues[desc.queue];
+
+	desc.cpu = q->cpu;
+	rc = copy_to_user(arg, &desc, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d bytes to user", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	get_file(dev->dev_file);
+	res = anon_inode_getfd("[scst_user_queue]", &dev_user_queue_fops, q,
+			       O_RDWR | O_CLOEXEC);
+	if (res < 0) {
+		PRINT_ERROR("Unable to get fd for queue %d of dev %s: %d",
+			q->idx, dev->name, res);
+		fput(dev->dev_file);
+		goto out;
+	}
+
+	TRACE_MGMT_DBG("Opened queue %d of dev %s (fd %d, cpu %d)", q->idx,
+		dev->name, res, q->cpu);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Pins the whole arena once. Afterwards dev_user_map_buf() maps buffers
+ * inside it by indexing its pages instead of get_user_pages() for each of
+ * them. Backed by huge pages, the arena also gives the clustered SGV pool
+ * physically contiguous pages, so sg lists shrink to a few entries.
+ */
+static int dev_user_register_arena(struct file *file, void __user *arg)
+{
+	int res, rc;
+	struct scst_user_dev *dev;
+	struct scst_user_arena_desc desc;
+	struct dev_user_arena *arena;
+	unsigned long pages_num;
+	long pinned;
+
+	TRACE_ENTRY();
+
+	dev = file->private_data;
+	res = dev_user_check_reg(dev);
+	if (unlikely(res != 0))
+		goto out;
+
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	TRACE_BUFFER("desc", &desc, sizeof(desc));
+
+	pages_num = desc.len >> PAGE_SHIFT;
+	if ((desc.pbuf == 0) || (desc.len == 0) ||
+	    !PAGE_ALIGNED(desc.pbuf) || !PAGE_ALIGNED(desc.len) ||
+	    (desc.pbuf + desc.len < desc.pbuf) ||
+	    (pages_num > (ULONG_MAX - sizeof(*arena)) /
+			 sizeof(arena->pages[0]))) {
+		PRINT_ERROR("Invalid arena %llx, len %lld (dev %s)",
+			(unsigned long long)desc.pbuf,
+			(unsigned long long)desc.len, dev->name);
+		res = -EINVAL;
+		goto out;
+	}
+
+	if (READ_ONCE(dev->arena) != NULL) {
+		PRINT_ERROR("Arena of dev %s already registered", dev->name);
+		res = -EBUSY;
+		goto out;
+	}
+
+	arena = vmalloc(sizeof(*arena) + pages_num * sizeof(arena->pages[0]));
+	if (arena == NULL) {
+		PRINT_ERROR("Unable to allocate arena pages array (dev %s, "
+			"%lu pages)", dev->name, pages_num);
+		res = -ENOMEM;
+		goto out;
+	}
+	arena->start = desc.pbuf;
+	arena->pages_num = pages_num;
+
+	pinned = dev_user_pin_pages(arena->start, pages_num, arena->pages);
+	if (pinned != (long)pages_num) {
+		PRINT_ERROR("Failed to pin arena of dev %s (%lu pages, rc %ld)",
+			dev->name, pages_num, pinned);
+		res = (pinned < 0) ? pinned : -EFAULT;
+		goto out_unpin;
+	}
+
+	/* Concurrent registrations race only here */
+	if (cmpxchg(&dev->arena, NULL, arena) != NULL) {
+		PRINT_ERROR("Arena of dev %s already registered", dev->name);
+		res = -EBUSY;
+		goto out_unpin;
+	}
+
+	PRINT_INFO("Registered %lu pages arena for dev %s", pages_num,
+		dev->name);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_unpin:
+	if (pinned > 0)
+		dev_user_unpin_pages(arena->pages, pinned);
+	vfree(arena);
+	goto out;
+}
+
+/* Must be called after all buffers have been unmapped */
+static void dev_user_free_arena(struct scst_user_dev *dev)
+{
+	struct dev_user_arena *arena = dev->arena;
+
+	TRACE_ENTRY();
+
+	if (arena == NULL)
+		goto out;
+
+	TRACE_MGMT_DBG("Freeing %lu pages arena of dev %s", arena->pages_num,
+		dev->name);
+
+	dev->arena = NULL;
+	dev_user_unpin_pages(arena->pages, arena->pages_num);
+	vfree(arena);
+
+out:
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Pins a buffer of the handler's own, so READ data in it can be sent by
+ * SCST_EXEC_REPLY_COMPLETED_REG_BUF replies without copying.
+ */
+static int dev_user_register_buffer(struct file *file, void __user *arg)
+{
+	int res, rc, id;
+	struct scst_user_dev *dev;
+	struct scst_user_reg_buf_desc desc;
+	struct dev_user_reg_buf *rb, **reg_bufs;
+	unsigned long pages_num;
+	long pinned;
+
+	TRACE_ENTRY();
+
+	dev = file->private_data;
+	res = dev_user_check_reg(dev);
+	if (unlikely(res != 0))
+		goto out;
+
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	TRACE_BUFFER("desc", &desc, sizeof(desc));
+
+	if ((desc.pbuf == 0) || (desc.len == 0) ||
+	    (desc.len > INT_MAX - PAGE_SIZE) ||
+	    (desc.pbuf + desc.len < desc.pbuf)) {
+		PRINT_ERROR("Invalid buffer %llx, len %lld (dev %s)",
+			(unsigned long long)desc.pbuf,
+			(unsigned long long)desc.len, dev->name);
+		res = -EINVAL;
+		goto out;
+	}
+	pages_num = calc_num_pg(desc.pbuf, desc.len);
+
+	if (dev->reg_bufs == NULL) {
+		reg_bufs = vzalloc(SCST_USER_MAX_REG_BUFS * sizeof(*reg_bufs));
+		if (reg_bufs == NULL) {
+			res = -ENOMEM;
+			goto out;
+		}
+		spin_lock(&dev->reg_bufs_lock);
+		if (dev->reg_bufs == NULL) {
+			dev->reg_bufs = reg_bufs;
+			reg_bufs = NULL;
+		}
+		spin_unlock(&dev->reg_bufs_lock);
+		vfree(reg_bufs);
+	}
+
+	rb = vmalloc(sizeof(*rb) + pages_num * sizeof(rb->pages[0]));
+	if (rb == NULL) {
+		PRINT_ERROR("Unable to allocate registered buffer pages array "
+			"(dev %s, %lu pages)", dev->name, pages_num);
+		res = -ENOMEM;
+		goto out;
+	}
+	atomic_set(&rb->refcnt, 1);
+	rb->start = desc.pbuf;
+	rb->len = desc.len;
+	rb->pages_num = pages_num;
+
+	pinned = dev_user_pin_pages(rb->start & PAGE_MASK, pages_num,
+				    rb->pages);
+	if (pinned != (long)pages_num) {
+		PRINT_ERROR("Failed to pin buffer %lx of dev %s (%lu pages, "
+			"rc %ld)", rb->start, dev->name, pages_num, pinned);
+		res = (pinned < 0) ? pinned : -EFAULT;
+		if (pinned > 0)
+			dev_user_unpin_pages(rb->pages, pinned);
+		vfree(rb);
+		goto out;
+	}
+
+	spin_lock(&dev->reg_bufs_lock);
+	for (id = 0; id < SCST_USER_MAX_REG_BUFS; id++) {
+		if (dev->reg_bufs[id] == NULL) {
+			dev->reg_bufs[id] = rb;
+			break;
+		}
+	}
+	spin_unlock(&dev->reg_bufs_lock);
+
+	if (id == SCST_USER_MAX_REG_BUFS) {
+		PRINT_ERROR("Too many registered buffers (dev %s)", dev->name);
+		res = -ENOSPC;
+		dev_user_put_reg_buf(rb);
+		goto out;
+	}
+
+	TRACE_MEM("Registered buffer %d: %lx, len %lu (dev %s)", id,
+		rb->start, rb->len, dev->name);
+
+	desc.buf_id = id;
+	rc = copy_to_user(arg, &desc, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d bytes to user", rc);
+		res = -EFAULT;
+		spin_lock(&dev->reg_bufs_lock);
+		dev->reg_bufs[id] = NULL;
+		spin_unlock(&dev->reg_bufs_lock);
+		dev_user_put_reg_buf(rb);
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static int dev_user_unregister_buffer(struct file *file, void __user *arg)
+{
+	int res, rc;
+	struct scst_user_dev *dev;
+	struct scst_user_reg_buf_desc desc;
+	struct dev_user_reg_buf *rb = NULL;
+
+	TRACE_ENTRY();
+
+	dev = file->private_data;
+	res = dev_user_check_reg(dev);
+	if (unlikely(res != 0))
+		goto out;
+
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	spin_lock(&dev->reg_bufs_lock);
+	if ((dev->reg_bufs != NULL) && (desc.buf_id < SCST_USER_MAX_REG_BUFS)) {
+		rb = dev->reg_bufs[desc.buf_id];
+		dev->reg_bufs[desc.buf_id] = NULL;
+	}
+	spin_unlock(&dev->reg_bufs_lock);
+
+	if (rb == NULL) {
+		PRINT_ERROR("Invalid registered buffer id %u (dev %s)",
+			desc.buf_id, dev->name);
+		res = -EINVAL;
+		goto out;
+	}
+
+	TRACE_MEM("Unregistered buffer %u (dev %s)", desc.buf_id, dev->name);
+
+	/* Commands still sending data from it keep it pinned */
+	dev_user_put_reg_buf(rb);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/* Must be called after all commands have been freed */
+static void dev_user_free_reg_bufs(struct scst_user_dev *dev)
+{
+	int i;
+
+	TRACE_ENTRY();
+
+	if (dev->reg_bufs == NULL)
+		goto out;
+
+	for (i = 0; i < SCST_USER_MAX_REG_BUFS; i++) {
+		if (dev->reg_bufs[i] != NULL)
+			dev_user_put_reg_buf(dev->reg_bufs[i]);
+	}
+	vfree(dev->reg_bufs);
+	dev->reg_bufs = NULL;
+
+out:
+	TRACE_EXIT();
+	return;
 }
 
-static int dev_user_reply_get_multi(struct file *file, void __user *arg)
+static int dev_user_set_cached_resp(struct file *file, void __user *arg)
 {
-	int res = 0, rc;
+	int res, rc, i, j;
 	struct scst_user_dev *dev;
-	struct scst_user_reply_cmd __user *replies;
-	int16_t i, replies_cnt, replies_done = 0, cmds_cnt = 0;
+	struct scst_user_cached_resp desc;
+	struct dev_user_cached_resp *cr, *old = NULL;
 
 	TRACE_ENTRY();
 
-	dev = (struct scst_user_dev *)file->private_data;
+	dev = file->private_data;
 	res = dev_user_check_reg(dev);
 	if (unlikely(res != 0))
 		goto out;
 
-	res = get_user(replies_cnt, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->replies_cnt);
-	if (unlikely(res < 0)) {
-		PRINT_ERROR("%s", "Unable to get replies_cnt");
+	rc = copy_from_user(&desc, arg, sizeof(desc));
+	if (unlikely(rc != 0)) {
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
+		res = -EFAULT;
 		goto out;
 	}
 
-	res = get_user(cmds_cnt, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
-	if (unlikely(res < 0)) {
-		PRINT_ERROR("%s", "Unable to get cmds_cnt");
+	if (unlikely((desc.cdb_mask[0] != 0xFF) ||
+		     (desc.len > SCST_USER_MAX_CACHED_RESP_LEN))) {
+		PRINT_ERROR("Invalid cached response (opcode %x, mask %x, len "
+			"%u, dev %s)", desc.cdb[0], desc.cdb_mask[0], desc.len,
+			dev->name);
+		res = -EINVAL;
 		goto out;
 	}
 
-	TRACE_DBG("replies %d, space %d (dev %s)",
-		replies_cnt, cmds_cnt, dev->name);
-
-	if (replies_cnt == 0)
-		goto get_cmds;
+	cr = kzalloc(sizeof(*cr) + desc.len, GFP_KERNEL);
+	if (cr == NULL) {
+		PRINT_ERROR("Unable to allocate cached response (len %u)",
+			desc.len);
+		res = -ENOMEM;
+		goto out;
+	}
+	atomic_set(&cr->refcnt, 1);
+	for (i = 0; i < SCST_MAX_CDB_SIZE; i++) {
+		cr->cdb_mask[i] = desc.cdb_mask[i];
+		cr->cdb[i] = desc.cdb[i] & desc.cdb_mask[i];
+		if (desc.cdb_mask[i] != 0)
+			cr->cdb_len = i + 1;
+	}
+	cr->len = desc.len;
 
-	/* get_user() can't be used with 64-bit values on x86_32 */
-	rc = copy_from_user(&replies, (uint64_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->preplies, sizeof(replies));
+	rc = copy_from_user(cr->data, (void __user *)(unsigned long)desc.pbuf,
+			    desc.len);
 	if (unlikely(rc != 0)) {
-		PRINT_ERROR("%s", "Unable to get preply");
+		PRINT_ERROR("Failed to copy %d user's bytes", rc);
 		res = -EFAULT;
-		goto out;
+		goto out_free;
 	}
 
-	for (i = 0; i < replies_cnt; i++) {
-		struct scst_user_reply_cmd reply;
+	spin_lock_irq(&dev->cached_resps_lock);
+	for (i = 0; i < dev->cached_resps_num; i++) {
+		struct dev_user_cached_resp *c = dev->cached_resps[i];
 
-		rc = copy_from_user(&reply, &replies[i], sizeof(reply));
-		if (unlikely(rc != 0)) {
-			PRINT_ERROR("Unable to get reply %d", i);
-			res = -EFAULT;
-			goto out_part_replies_done;
+		for (j = 0; j < SCST_MAX_CDB_SIZE; j++) {
+			if ((c->cdb[j] != cr->cdb[j]) ||
+			    (c->cdb_mask[j] != cr->cdb_mask[j]))
+				break;
 		}
+		if (j == SCST_MAX_CDB_SIZE)
+			break;
+	}
+	if (i < dev->cached_resps_num)
+		old = dev->cached_resps[i];
+	else if (i == SCST_USER_MAX_CACHED_RESPS)
+		res = -ENOSPC;
+	else
+		dev->cached_resps_num++;
+	if (res == 0)
+		dev->cached_resps[i] = cr;
+	spin_unlock_irq(&dev->cached_resps_lock);
 
-		TRACE_BUFFER("Reply", &reply, sizeof(reply));
+	if (res != 0) {
+		PRINT_ERROR("Too many cached responses (dev %s)", dev->name);
+		goto out_free;
+	}
 
-		res = dev_user_process_reply(dev, &reply);
-		if (unlikely(res < 0))
-			goto out_part_replies_done;
+	TRACE_DBG("Cached response %p for opcode %x (len %d, dev %s)", cr,
+		cr->cdb[0], cr->len, dev->name);
 
-		replies_done++;
-	}
+	/* Commands already answered from it keep it */
+	if (old != NULL)
+		dev_user_put_cached_resp(old);
 
-	TRACE_DBG("Returning %d replies_done", replies_done);
-	res = put_user(replies_done, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->replies_done);
-	if (unlikely(res < 0))
-		goto out;
+out:
+	TRACE_EXIT_RES(res);
+	return res;
 
-get_cmds:
-	for (i = 0; i < cmds_cnt; i++) {
-		res = dev_user_get_cmd_to_user(dev,
-			&((struct scst_user_get_multi __user *)arg)->cmds[i], i == 0);
-		if (res != 0) {
-			if ((res == -EAGAIN) && (i > 0))
-				res = 0;
-			break;
-		}
+out_free:
+	kfree(cr);
+	goto out;
+}
+
+static void __dev_user_clear_cached_resps(struct scst_user_dev *dev)
+{
+	int i;
+
+	spin_lock_irq(&dev->cached_resps_lock);
+	for (i = 0; i < dev->cached_resps_num; i++) {
+		dev_user_put_cached_resp(dev->cached_resps[i]);
+		dev->cached_resps[i] = NULL;
 	}
+	dev->cached_resps_num = 0;
+	spin_unlock_irq(&dev->cached_resps_lock);
+	return;
+}
 
-	TRACE_DBG("Returning %d cmds_ret", i);
-	rc = put_user(i, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
-	if (unlikely(rc < 0)) {
-		res = rc; /* this error is more important */
+static int dev_user_clear_cached_resps(struct file *file)
+{
+	int res;
+	struct scst_user_dev *dev;
+
+	TRACE_ENTRY();
+
+	dev = file->private_data;
+	res = dev_user_check_reg(dev);
+	if (unlikely(res != 0))
 		goto out;
-	}
+
+	__dev_user_clear_cached_resps(dev);
+
+	TRACE_DBG("Cached responses cleared (dev %s)", dev->name);
 
 out:
 	TRACE_EXIT_RES(res);
 	return res;
-
-out_part_replies_done:
-	TRACE_DBG("Partial returning %d replies_done", replies_done);
-	put_user(replies_done, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->replies_done);
-	rc = put_user(0, (int16_t __user *)
-		&((struct scst_user_get_multi __user *)arg)->cmds_cnt);
-	goto out;
 }
 
 static long dev_user_ioctl(struct file *file, unsigned int cmd,
@@ -2551,6 +4301,46 @@ static long dev_user_ioctl(struct file *file, unsigned int cmd,
 		res = dev_user_prealloc_buffer(file, (void __user *)arg);
 		break;
 
+	case SCST_USER_SETUP_RINGS:
+		TRACE_DBG("%s", "SETUP_RINGS");
+		res = dev_user_setup_rings(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_RINGS_ENTER:
+		TRACE_DBG("%s", "RINGS_ENTER");
+		res = dev_user_rings_enter(file, arg);
+		break;
+
+	case SCST_USER_OPEN_QUEUE:
+		TRACE_DBG("%s", "OPEN_QUEUE");
+		res = dev_user_open_queue(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_REGISTER_ARENA:
+		TRACE_DBG("%s", "REGISTER_ARENA");
+		res = dev_user_register_arena(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_REGISTER_BUFFER:
+		TRACE_DBG("%s", "REGISTER_BUFFER");
+		res = dev_user_register_buffer(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_UNREGISTER_BUFFER:
+		TRACE_DBG("%s", "UNREGISTER_BUFFER");
+		res = dev_user_unregister_buffer(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_SET_CACHED_RESP:
+		TRACE_DBG("%s", "SET_CACHED_RESP");
+		res = dev_user_set_cached_resp(file, (void __user *)arg);
+		break;
+
+	case SCST_USER_CLEAR_CACHED_RESPS:
+		TRACE_DBG("%s", "CLEAR_CACHED_RESPS");
+		res = dev_user_clear_cached_resps(file);
+		break;
+
 	default:
 		PRINT_ERROR("Invalid ioctl cmd %x", cmd);
 		res = -EINVAL;
@@ -2562,42 +4352,73 @@ out:
 	return res;
 }
 
+/* Queue fds serve only commands, the device is managed via its own fd */
+static long dev_user_queue_ioctl(struct file *file, unsigned int cmd,
+	unsigned long arg)
+{
+	long res;
+
+	TRACE_ENTRY();
+
+	switch (cmd) {
+	case SCST_USER_REPLY_AND_GET_CMD:
+	case SCST_USER_REPLY_CMD:
+	case SCST_USER_REPLY_AND_GET_MULTI:
+	case SCST_USER_GET_EXTENDED_CDB:
+	case SCST_USER_PREALLOC_BUFFER:
+	case SCST_USER_SETUP_RINGS:
+	case SCST_USER_RINGS_ENTER:
+		res = dev_user_ioctl(file, cmd, arg);
+		break;
+
+	default:
+		PRINT_ERROR("Invalid queue ioctl cmd %x", cmd);
+		res = -EINVAL;
+		break;
+	}
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 static __poll_t dev_user_poll(struct file *file, poll_table *wait)
 {
 	__poll_t res;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 
 	TRACE_ENTRY();
 
 	res = EPOLLNVAL;
-	dev = file->private_data;
-	if (unlikely(dev_user_check_reg(dev) != 0))
+	q = dev_user_file_queue(file);
+	if (unlikely(dev_user_check_queue(q) != 0))
 		goto out;
+	dev = q->dev;
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
-	if (!list_empty(&dev->ready_cmd_list) ||
-	    !list_empty(&dev->udev_cmd_threads.active_cmd_list)) {
+	if (!list_empty(&q->ready_cmd_list) ||
+	    !list_empty(&q->udev_cmd_threads.active_cmd_list)) {
 		res = EPOLLIN | EPOLLRDNORM;
 		goto out_unlock;
 	}
 
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 	TRACE_DBG("Before poll_wait() (dev %s)", dev->name);
-	poll_wait(file, &dev->udev_cmd_threads.cmd_list_waitQ, wait);
+	poll_wait(file, &q->udev_cmd_threads.cmd_list_waitQ, wait);
 	TRACE_DBG("After poll_wait() (dev %s)", dev->name);
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
-	if (!list_empty(&dev->ready_cmd_list) ||
-	    !list_empty(&dev->udev_cmd_threads.active_cmd_list)) {
+	if (!list_empty(&q->ready_cmd_list) ||
+	    !list_empty(&q->udev_cmd_threads.active_cmd_list)) {
 		res = EPOLLIN | EPOLLRDNORM;
 		goto out_unlock;
 	}
 
 out_unlock:
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 out:
 	TRACE_EXIT_HRES((__force unsigned int)res);
@@ -2610,11 +4431,11 @@ out:
  */
 static void dev_user_unjam_cmd(struct scst_user_cmd *ucmd, int busy,
 	unsigned long *flags)
-	__releases(&dev->udev_cmd_threads.cmd_list_lock)
-	__acquires(&dev->udev_cmd_threads.cmd_list_lock)
+	__releases(&q->udev_cmd_threads.cmd_list_lock)
+	__acquires(&q->udev_cmd_threads.cmd_list_lock)
 {
 	int state = ucmd->state;
-	struct scst_user_dev *dev = ucmd->dev;
+	struct scst_user_queue *q = ucmd->q;
 
 	TRACE_ENTRY();
 
@@ -2651,10 +4472,10 @@ static void dev_user_unjam_cmd(struct scst_user_cmd *ucmd, int busy,
 	case UCMD_STATE_EXECING:
 	case UCMD_STATE_EXT_COPY_REMAPPING:
 		if (flags != NULL)
-			spin_unlock_irqrestore(&dev->udev_cmd_threads.cmd_list_lock,
+			spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock,
 					       *flags);
 		else
-			spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 		TRACE_MGMT_DBG("EXEC: unjamming ucmd %p", ucmd);
 
@@ -2678,10 +4499,10 @@ static void dev_user_unjam_cmd(struct scst_user_cmd *ucmd, int busy,
 		/* !! At this point cmd and ucmd can be already freed !! */
 
 		if (flags != NULL)
-			spin_lock_irqsave(&dev->udev_cmd_threads.cmd_list_lock,
+			spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock,
 					  *flags);
 		else
-			spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 		break;
 
 	case UCMD_STATE_ON_FREEING:
@@ -2691,10 +4512,10 @@ static void dev_user_unjam_cmd(struct scst_user_cmd *ucmd, int busy,
 	case UCMD_STATE_ATTACH_SESS:
 	case UCMD_STATE_DETACH_SESS:
 		if (flags != NULL)
-			spin_unlock_irqrestore(&dev->udev_cmd_threads.cmd_list_lock,
+			spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock,
 					       *flags);
 		else
-			spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 		switch (state) {
 		case UCMD_STATE_ON_FREEING:
@@ -2720,10 +4541,10 @@ static void dev_user_unjam_cmd(struct scst_user_cmd *ucmd, int busy,
 		}
 
 		if (flags != NULL)
-			spin_lock_irqsave(&dev->udev_cmd_threads.cmd_list_lock,
+			spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock,
 					  *flags);
 		else
-			spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 		break;
 
 	default:
@@ -2737,25 +4558,20 @@ out:
 	return;
 }
 
-static int dev_user_unjam_dev(struct scst_user_dev *dev)
-	__releases(&dev->udev_cmd_threads.cmd_list_lock)
-	__acquires(&dev->udev_cmd_threads.cmd_list_lock)
+static int dev_user_unjam_queue(struct scst_user_queue *q)
+	__releases(&q->udev_cmd_threads.cmd_list_lock)
+	__acquires(&q->udev_cmd_threads.cmd_list_lock)
 {
 	int i, res = 0;
 	struct scst_user_cmd *ucmd;
 
 	TRACE_ENTRY();
 
-	TRACE_MGMT_DBG("Unjamming dev %p", dev);
-
-	sgv_pool_flush(dev->pool);
-	sgv_pool_flush(dev->pool_clust);
-
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 repeat:
-	for (i = 0; i < ARRAY_SIZE(dev->ucmd_hash); i++) {
-		struct list_head *head = &dev->ucmd_hash[i];
+	for (i = 0; i < ARRAY_SIZE(q->ucmd_hash); i++) {
+		struct list_head *head = &q->ucmd_hash[i];
 
 		list_for_each_entry(ucmd, head, hash_list_entry) {
 			res++;
@@ -2771,18 +4587,36 @@ repeat:
 
 			dev_user_unjam_cmd(ucmd, 0, NULL);
 
-			spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 			ucmd_put(ucmd);
-			spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+			spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 			goto repeat;
 		}
 	}
 
-	if (dev_user_process_scst_commands(dev) != 0)
+	if (dev_user_process_scst_commands(q) != 0)
 		goto repeat;
 
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static int dev_user_unjam_dev(struct scst_user_dev *dev)
+{
+	int i, res = 0;
+
+	TRACE_ENTRY();
+
+	TRACE_MGMT_DBG("Unjamming dev %p", dev);
+
+	sgv_pool_flush(dev->pool);
+	sgv_pool_flush(dev->pool_clust);
+
+	for (i = 0; i < dev->queues_num; i++)
+		res += dev_user_unjam_queue(&dev->queues[i]);
 
 	TRACE_EXIT_RES(res);
 	return res;
@@ -2819,16 +4653,22 @@ static int dev_user_process_reply_tm_exec(struct scst_user_cmd *ucmd,
 
 static void dev_user_abort_ready_commands(struct scst_user_dev *dev)
 {
+	struct scst_user_queue *q;
 	struct scst_user_cmd *ucmd;
 	unsigned long flags;
 
 	TRACE_ENTRY();
 
-	spin_lock_irqsave(&dev->udev_cmd_threads.cmd_list_lock, flags);
+	/* Aborted commands can belong to other sessions, hence to any queue */
+	for (q = dev->queues; q < &dev->queues[dev->queues_num]; q++) {
+
+		spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock, flags);
 again:
-	list_for_each_entry(ucmd, &dev->ready_cmd_list, ready_cmd_list_entry) {
-		if ((ucmd->cmd != NULL) && !ucmd->seen_by_user &&
-		    test_bit(SCST_CMD_ABORTED, &ucmd->cmd->cmd_flags)) {
+		list_for_each_entry(ucmd, &q->ready_cmd_list,
+				    ready_cmd_list_entry) {
+			if ((ucmd->cmd == NULL) || ucmd->seen_by_user ||
+			    !test_bit(SCST_CMD_ABORTED, &ucmd->cmd->cmd_flags))
+				continue;
 			switch (ucmd->state) {
 			case UCMD_STATE_PARSING:
 			case UCMD_STATE_BUF_ALLOCING:
@@ -2839,10 +4679,10 @@ again:
 				goto again;
 			}
 		}
+		spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock,
+				       flags);
 	}
 
-	spin_unlock_irqrestore(&dev->udev_cmd_threads.cmd_list_lock, flags);
-
 	TRACE_EXIT();
 	return;
 }
@@ -2899,7 +4739,8 @@ static void __dev_user_task_mgmt_fn(struct scst_mgmt_cmd *mcmd,
 		dev_user_abort_ready_commands(dev);
 
 	/* We can't afford missing TM command due to memory shortage */
-	ucmd = dev_user_alloc_ucmd(dev, GFP_ATOMIC|__GFP_NOFAIL);
+	ucmd = dev_user_alloc_ucmd(dev_user_tgt_dev_queue(tgt_dev),
+				   GFP_ATOMIC|__GFP_NOFAIL);
 	if (ucmd == NULL) {
 		PRINT_CRIT_ERROR("Unable to allocate TM %d message "
 			"(dev %s)", mcmd->fn, dev->name);
@@ -3059,7 +4900,7 @@ static int dev_user_process_reply_sess(struct scst_user_cmd *ucmd, int status)
 
 	TRACE_MGMT_DBG("ucmd %p, cmpl %p, status %d", ucmd, ucmd->cmpl, status);
 
-	spin_lock_irqsave(&ucmd->dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_lock_irqsave(&ucmd->q->udev_cmd_threads.cmd_list_lock, flags);
 
 	if (ucmd->state == UCMD_STATE_ATTACH_SESS) {
 		TRACE_MGMT_DBG("%s", "ATTACH_SESS finished");
@@ -3072,7 +4913,7 @@ static int dev_user_process_reply_sess(struct scst_user_cmd *ucmd, int status)
 	if (ucmd->cmpl != NULL)
 		complete_all(ucmd->cmpl);
 
-	spin_unlock_irqrestore(&ucmd->dev->udev_cmd_threads.cmd_list_lock, flags);
+	spin_unlock_irqrestore(&ucmd->q->udev_cmd_threads.cmd_list_lock, flags);
 
 	ucmd_put(ucmd);
 
@@ -3080,9 +4921,41 @@ static int dev_user_process_reply_sess(struct scst_user_cmd *ucmd, int status)
 	return res;
 }
 
+/*
+ * Returns the queue for commands of the new session tgt_dev. All commands of
+ * a session go through one queue, because the SCST core processes them in
+ * tgt_dev->active_cmd_threads.
+ */
+static struct scst_user_queue *dev_user_select_queue(struct scst_user_dev *dev,
+	struct scst_tgt_dev *tgt_dev)
+{
+	struct scst_user_queue *q, *res = &dev->queues[0];
+	const char *name = tgt_dev->sess->initiator_name;
+
+	switch (dev->queue_policy) {
+	case SCST_USER_QUEUE_BY_INITIATOR:
+		res = &dev->queues[jhash(name, strlen(name), 0) %
+				   dev->queues_num];
+		break;
+	case SCST_USER_QUEUE_BY_SESSION:
+		/* Not exact under parallel attaches, but good enough */
+		for (q = dev->queues; q < &dev->queues[dev->queues_num]; q++) {
+			if (atomic_read(&q->sess_count) <
+			    atomic_read(&res->sess_count))
+				res = q;
+		}
+		break;
+	default:
+		sBUG();
+	}
+
+	return res;
+}
+
 static int dev_user_attach_tgt(struct scst_tgt_dev *tgt_dev)
 {
 	struct scst_user_dev *dev = tgt_dev->dev->dh_priv;
+	struct scst_user_queue *q;
 	int res = 0, rc;
 	struct scst_user_cmd *ucmd;
 	DECLARE_COMPLETION_ONSTACK(cmpl);
@@ -3091,7 +4964,12 @@ static int dev_user_attach_tgt(struct scst_tgt_dev *tgt_dev)
 
 	TRACE_ENTRY();
 
-	tgt_dev->active_cmd_threads = &dev->udev_cmd_threads;
+	q = dev_user_select_queue(dev, tgt_dev);
+	atomic_inc(&q->sess_count);
+	tgt_dev->active_cmd_threads = &q->udev_cmd_threads;
+
+	TRACE_MGMT_DBG("Session %s assigned to queue %d of dev %s",
+		tgt_dev->sess->initiator_name, q->idx, dev->name);
 
 	/*
 	 * We can't replace tgt_dev->pool, because it can be used to allocate
@@ -3103,7 +4981,7 @@ static int dev_user_attach_tgt(struct scst_tgt_dev *tgt_dev)
 	else
 		tgt_dev->dh_priv = dev->pool;
 
-	ucmd = dev_user_alloc_ucmd(dev, GFP_KERNEL);
+	ucmd = dev_user_alloc_ucmd(q, GFP_KERNEL);
 	if (ucmd == NULL)
 		goto out_nomem;
 
@@ -3153,13 +5031,17 @@ static int dev_user_attach_tgt(struct scst_tgt_dev *tgt_dev)
 
 	sBUG_ON(irqs_disabled());
 
-	spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
 	ucmd->cmpl = NULL;
-	spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+	spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
 
 	ucmd_put(ucmd);
 
 out:
+	/* detach_tgt() isn't called on failure */
+	if (res != 0)
+		atomic_dec(&q->sess_count);
+
 	TRACE_EXIT_RES(res);
 	return res;
 
@@ -3171,15 +5053,18 @@ out_nomem:
 static void dev_user_detach_tgt(struct scst_tgt_dev *tgt_dev)
 {
 	struct scst_user_dev *dev = tgt_dev->dev->dh_priv;
+	struct scst_user_queue *q = dev_user_tgt_dev_queue(tgt_dev);
 	struct scst_user_cmd *ucmd;
 
 	TRACE_ENTRY();
 
+	atomic_dec(&q->sess_count);
+
 	/*
 	 * We can't miss detach command due to memory shortage, because it might
 	 * lead to a memory leak in the user space handler.
 	 */
-	ucmd = dev_user_alloc_ucmd(dev, GFP_KERNEL|__GFP_NOFAIL);
+	ucmd = dev_user_alloc_ucmd(q, GFP_KERNEL|__GFP_NOFAIL);
 	if (ucmd == NULL) {
 		PRINT_CRIT_ERROR("Unable to allocate DETACH_SESS message "
 			"(dev %s)", dev->name);
@@ -3317,10 +5202,84 @@ out:
 	return res;
 }
 
+/* Returns the CPU user space is advised to serve queue idx on */
+static int dev_user_queue_cpu(unsigned int idx)
+{
+	int cpu, n = idx % num_online_cpus();
+
+	for_each_online_cpu(cpu) {
+		if (n-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+static int dev_user_alloc_queues(struct scst_user_dev *dev, int queues_num)
+{
+	int res = 0, i, j;
+
+	TRACE_ENTRY();
+
+	dev->queues = kcalloc(queues_num, sizeof(*dev->queues), GFP_KERNEL);
+	if (dev->queues == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	dev->queues_num = queues_num;
+
+	for (i = 0; i < queues_num; i++) {
+		struct scst_user_queue *q = &dev->queues[i];
+
+		INIT_LIST_HEAD(&q->ready_cmd_list);
+		for (j = 0; j < ARRAY_SIZE(q->ucmd_hash); j++)
+			INIT_LIST_HEAD(&q->ucmd_hash[j]);
+		mutex_init(&q->rings_mutex);
+		spin_lock_init(&q->done_lock);
+		INIT_LIST_HEAD(&q->done_cmd_list);
+		hrtimer_setup(&q->done_timer, dev_user_done_timer_fn,
+			CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		q->dev = dev;
+		q->idx = i;
+		q->cpu = (queues_num > 1) ? dev_user_queue_cpu(i) : -1;
+		atomic_set(&q->sess_count, 0);
+
+		scst_init_threads(&q->udev_cmd_threads);
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/* Must be called after the rings pollers have been stopped */
+static void dev_user_free_queues(struct scst_user_dev *dev)
+{
+	int i;
+
+	TRACE_ENTRY();
+
+	for (i = 0; i < dev->queues_num; i++) {
+		scst_deinit_threads(&dev->queues[i].udev_cmd_threads);
+		dev_user_free_rings(&dev->queues[i]);
+	}
+	kfree(dev->queues);
+
+	TRACE_EXIT();
+	return;
+}
+
+static void dev_user_wake_up_all(struct scst_user_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->queues_num; i++)
+		wake_up_all(&dev->queues[i].udev_cmd_threads.cmd_list_waitQ);
+}
+
 static int dev_user_register_dev(struct file *file,
 	const struct scst_user_dev_desc *dev_desc)
 {
-	int res, i;
+	int res;
 	struct scst_user_dev *dev, *d;
 	int block_size;
 
@@ -3350,6 +5309,14 @@ static int dev_user_register_dev(struct file *file,
 		break;
 	}
 
+	if ((dev_desc->queues_num > SCST_USER_MAX_QUEUES) ||
+	    (dev_desc->queue_policy > SCST_USER_MAX_QUEUE_POLICY)) {
+		PRINT_ERROR("Wrong queues number %d or policy %d",
+			dev_desc->queues_num, dev_desc->queue_policy);
+		res = -EINVAL;
+		goto out;
+	}
+
 	if (!try_module_get(THIS_MODULE)) {
 		PRINT_ERROR("%s", "Fail to get module");
 		res = -ETXTBSY;
@@ -3362,16 +5329,17 @@ static int dev_user_register_dev(struct file *file,
 		goto out_put;
 	}
 
-	INIT_LIST_HEAD(&dev->ready_cmd_list);
 	if (file->f_flags & O_NONBLOCK) {
 		TRACE_DBG("%s", "Non-blocking operations");
 		dev->blocking = 0;
 	} else
 		dev->blocking = 1;
-	for (i = 0; i < ARRAY_SIZE(dev->ucmd_hash); i++)
-		INIT_LIST_HEAD(&dev->ucmd_hash[i]);
 
-	scst_init_threads(&dev->udev_cmd_threads);
+	dev->queue_policy = dev_desc->queue_policy;
+	res = dev_user_alloc_queues(dev,
+		(dev_desc->queues_num != 0) ? dev_desc->queues_num : 1);
+	if (res != 0)
+		goto out_free_dev;
 
 	strlcpy(dev->name, dev_desc->name, sizeof(dev->name)-1);
 
@@ -3386,7 +5354,7 @@ static int dev_user_register_dev(struct file *file,
 					dev_desc->sgv_purge_interval * HZ);
 	if (dev->pool == NULL) {
 		res = -ENOMEM;
-		goto out_deinit_threads;
+		goto out_free_queues;
 	}
 	sgv_pool_set_allocator(dev->pool, dev_user_alloc_pages,
 		dev_user_free_sg_entries);
@@ -3432,6 +5400,8 @@ static int dev_user_register_dev(struct file *file,
 		dev->devtype.pr_cmds_notifications = 1;
 
 	init_completion(&dev->cleanup_cmpl);
+	spin_lock_init(&dev->reg_bufs_lock);
+	spin_lock_init(&dev->cached_resps_lock);
 	dev->def_block_size = block_size;
 
 	res = __dev_user_set_opt(dev, &dev_desc->opt);
@@ -3478,8 +5448,13 @@ static int dev_user_register_dev(struct file *file,
 	 * hence could be lockless and without READ_ONCE().
 	 */
 	file->private_data = dev;
+	dev->dev_file = file;
 	spin_unlock(&dev_list_lock);
 
+	if (dev->queues_num > 1)
+		PRINT_INFO("Registered dev %s with %d queues (policy %d)",
+			dev->name, dev->queues_num, dev->queue_policy);
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -3501,9 +5476,10 @@ out_free:
 out_free0:
 	sgv_pool_del(dev->pool);
 
-out_deinit_threads:
-	scst_deinit_threads(&dev->udev_cmd_threads);
+out_free_queues:
+	dev_user_free_queues(dev);
 
+out_free_dev:
 	kmem_cache_free(user_dev_cachep, dev);
 
 out_put:
@@ -3526,7 +5502,7 @@ static int dev_user_unregister_dev(struct file *file)
 
 	/* For backward compatibility unblock possibly blocked sync threads */
 	dev->blocking = 0;
-	wake_up_all(&dev->udev_cmd_threads.cmd_list_waitQ);
+	dev_user_wake_up_all(dev);
 
 out:
 	return res;
@@ -3570,6 +5546,9 @@ static int dev_user_capacity_changed(struct file *file)
 	if (unlikely(res != 0))
 		goto out;
 
+	/* READ CAPACITY responses and the like are stale now */
+	__dev_user_clear_cached_resps(dev);
+
 	scst_capacity_data_changed(dev->sdev);
 
 out:
@@ -3581,6 +5560,7 @@ static int dev_user_prealloc_buffer(struct file *file, void __user *arg)
 {
 	int res = 0, rc;
 	struct scst_user_dev *dev;
+	struct scst_user_queue *q;
 	union scst_user_prealloc_buffer pre;
 	aligned_u64 pbuf;
 	uint32_t bufflen;
@@ -3591,10 +5571,11 @@ static int dev_user_prealloc_buffer(struct file *file, void __user *arg)
 
 	TRACE_ENTRY();
 
-	dev = file->private_data;
-	res = dev_user_check_reg(dev);
+	q = dev_user_file_queue(file);
+	res = dev_user_check_queue(q);
 	if (unlikely(res != 0))
 		goto out;
+	dev = q->dev;
 
 	rc = copy_from_user(&pre.in, arg, sizeof(pre.in));
 	if (unlikely(rc != 0)) {
@@ -3610,7 +5591,7 @@ static int dev_user_prealloc_buffer(struct file *file, void __user *arg)
 	pbuf = pre.in.pbuf;
 	bufflen = pre.in.bufflen;
 
-	ucmd = dev_user_alloc_ucmd(dev, GFP_KERNEL);
+	ucmd = dev_user_alloc_ucmd(q, GFP_KERNEL);
 	if (ucmd == NULL) {
 		res = -ENOMEM;
 		goto out;
@@ -3680,20 +5661,34 @@ static int __dev_user_set_opt(struct scst_user_dev *dev,
 
 	TRACE_DBG("dev %s, parse_type %x, on_free_cmd_type %x, "
 		"memory_reuse_type %x, partial_transfers_type %x, "
-		"partial_len %d, opt->ext_copy_remap_supported %d",
-		dev->name, opt->parse_type, opt->on_free_cmd_type,
-		opt->memory_reuse_type, opt->partial_transfers_type,
-		opt->partial_len, opt->ext_copy_remap_supported);
+		"partial_len %d, opt->ext_copy_remap_supported %d, "
+		"internal_cmds %x, compl_coalesce_cmds %d, "
+		"compl_coalesce_usecs %d", dev->name, opt->parse_type,
+		opt->on_free_cmd_type, opt->memory_reuse_type,
+		opt->partial_transfers_type, opt->partial_len,
+		opt->ext_copy_remap_supported, opt->internal_cmds,
+		opt->compl_coalesce_cmds, opt->compl_coalesce_usecs);
 
 	if (opt->parse_type > SCST_USER_MAX_PARSE_OPT ||
 	    opt->on_free_cmd_type > SCST_USER_MAX_ON_FREE_CMD_OPT ||
 	    opt->memory_reuse_type > SCST_USER_MAX_MEM_REUSE_OPT ||
-	    opt->partial_transfers_type > SCST_USER_MAX_PARTIAL_TRANSFERS_OPT) {
+	    opt->partial_transfers_type > SCST_USER_MAX_PARTIAL_TRANSFERS_OPT ||
+	    (opt->internal_cmds & ~SCST_USER_INTERNAL_CMDS_MASK)) {
 		PRINT_ERROR("%s", "Invalid option");
 		res = -EINVAL;
 		goto out;
 	}
 
+	if ((opt->compl_coalesce_usecs > SCST_USER_MAX_COMPL_COALESCE_USECS) ||
+	    ((opt->compl_coalesce_cmds != 0) &&
+	     (opt->compl_coalesce_usecs == 0))) {
+		PRINT_ERROR("Invalid completions coalescing window (cmds %d, "
+			"usecs %d)", opt->compl_coalesce_cmds,
+			opt->compl_coalesce_usecs);
+		res = -EINVAL;
+		goto out;
+	}
+
 	if (((opt->tst != SCST_TST_0_SINGLE_TASK_SET) &&
 	     (opt->tst != SCST_TST_1_SEP_TASK_SETS)) ||
 	    (opt->tmf_only > 1) ||
@@ -3738,6 +5733,9 @@ static int __dev_user_set_opt(struct scst_user_dev *dev,
 	dev->d_sense = opt->d_sense;
 	dev->has_own_order_mgmt = opt->has_own_order_mgmt;
 	dev->ext_copy_remap_supported = opt->ext_copy_remap_supported;
+	dev->internal_cmds = opt->internal_cmds;
+	WRITE_ONCE(dev->compl_coalesce_cmds, opt->compl_coalesce_cmds);
+	WRITE_ONCE(dev->compl_coalesce_usecs, opt->compl_coalesce_usecs);
 	if (dev->sdev != NULL) {
 		dev->sdev->tst = opt->tst;
 		dev->sdev->tmf_only = opt->tmf_only;
@@ -3809,13 +5807,19 @@ static int dev_user_get_opt(struct file *file, void __user *arg)
 	opt.d_sense = dev->d_sense;
 	opt.has_own_order_mgmt = dev->has_own_order_mgmt;
 	opt.ext_copy_remap_supported = dev->ext_copy_remap_supported;
+	opt.internal_cmds = dev->internal_cmds;
+	opt.compl_coalesce_cmds = dev->compl_coalesce_cmds;
+	opt.compl_coalesce_usecs = dev->compl_coalesce_usecs;
 
 	TRACE_DBG("dev %s, parse_type %x, on_free_cmd_type %x, "
 		"memory_reuse_type %x, partial_transfers_type %x, "
-		"partial_len %d, ext_copy_remap_supported %d", dev->name,
-		opt.parse_type, opt.on_free_cmd_type, opt.memory_reuse_type,
+		"partial_len %d, ext_copy_remap_supported %d, "
+		"internal_cmds %x, compl_coalesce_cmds %d, "
+		"compl_coalesce_usecs %d", dev->name, opt.parse_type,
+		opt.on_free_cmd_type, opt.memory_reuse_type,
 		opt.partial_transfers_type, opt.partial_len,
-		opt.ext_copy_remap_supported);
+		opt.ext_copy_remap_supported, opt.internal_cmds,
+		opt.compl_coalesce_cmds, opt.compl_coalesce_usecs);
 
 	rc = copy_to_user(arg, &opt, sizeof(opt));
 	if (unlikely(rc != 0)) {
@@ -3846,7 +5850,7 @@ static int dev_user_exit_dev(struct scst_user_dev *dev)
 	spin_unlock(&dev_list_lock);
 
 	dev->blocking = 0;
-	wake_up_all(&dev->udev_cmd_threads.cmd_list_waitQ);
+	dev_user_wake_up_all(dev);
 
 	spin_lock(&cleanup_lock);
 	list_add_tail(&dev->cleanup_list_entry, &cleanup_list);
@@ -3865,15 +5869,13 @@ static int dev_user_exit_dev(struct scst_user_dev *dev)
 	dev->cleanup_done = 1;
 
 	wake_up(&cleanup_list_waitQ);
-	wake_up(&dev->udev_cmd_threads.cmd_list_waitQ);
+	dev_user_wake_up_all(dev);
 
 	wait_for_completion(&dev->cleanup_cmpl);
 
 	sgv_pool_del(dev->pool_clust);
 	sgv_pool_del(dev->pool);
 
-	scst_deinit_threads(&dev->udev_cmd_threads);
-
 	TRACE_MGMT_DBG("Releasing completed (dev %p)", dev);
 
 	module_put(THIS_MODULE);
@@ -3885,8 +5887,22 @@ static int dev_user_exit_dev(struct scst_user_dev *dev)
 static int __dev_user_release(void *arg)
 {
 	struct scst_user_dev *dev = arg;
+	int i;
+
+	for (i = 0; i < dev->queues_num; i++) {
+		if (dev->queues[i].rings_poller != NULL)
+			kthread_stop(dev->queues[i].rings_poller);
+		/* No more replies, so complete the coalesced ones now */
+		hrtimer_cancel(&dev->queues[i].done_timer);
+		dev_user_flush_done(&dev->queues[i], SCST_CONTEXT_THREAD);
+	}
 
 	dev_user_exit_dev(dev);
+	/* After the SGV pools freed all the cached buffers */
+	dev_user_free_arena(dev);
+	dev_user_free_reg_bufs(dev);
+	__dev_user_clear_cached_resps(dev);
+	dev_user_free_queues(dev);
 	kmem_cache_free(user_dev_cachep, dev);
 	return 0;
 }
@@ -3918,19 +5934,39 @@ out:
 	return 0;
 }
 
+static int dev_user_queue_release(struct inode *inode, struct file *file)
+{
+	struct scst_user_queue *q = file->private_data;
+
+	TRACE_ENTRY();
+
+	TRACE_MGMT_DBG("Closing queue %d of dev %s", q->idx, q->dev->name);
+
+	/* The last one releases the device */
+	fput(q->dev->dev_file);
+
+	TRACE_EXIT();
+	return 0;
+}
+
 #ifdef CONFIG_SCST_EXTRACHECKS
 static void dev_user_check_lost_ucmds(struct scst_user_dev *dev)
 {
+	struct scst_user_queue *q;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(dev->ucmd_hash); i++) {
-		struct list_head *head = &dev->ucmd_hash[i];
-		struct scst_user_cmd *ucmd2, *tmp;
-
-		list_for_each_entry_safe(ucmd2, tmp, head, hash_list_entry) {
-			PRINT_ERROR("Lost ucmd %p (state %x, ref %d)", ucmd2,
-				ucmd2->state, atomic_read(&ucmd2->ucmd_ref));
-			ucmd_put(ucmd2);
+	for (q = dev->queues; q < &dev->queues[dev->queues_num]; q++) {
+		for (i = 0; i < ARRAY_SIZE(q->ucmd_hash); i++) {
+			struct list_head *head = &q->ucmd_hash[i];
+			struct scst_user_cmd *ucmd2, *tmp;
+
+			list_for_each_entry_safe(ucmd2, tmp, head,
+						 hash_list_entry) {
+				PRINT_ERROR("Lost ucmd %p (state %x, ref %d)",
+					ucmd2, ucmd2->state,
+					atomic_read(&ucmd2->ucmd_ref));
+				ucmd_put(ucmd2);
+			}
 		}
 	}
 }
@@ -3942,13 +5978,14 @@ static void dev_user_check_lost_ucmds(struct scst_user_dev *dev)
 
 static int dev_user_process_cleanup(struct scst_user_dev *dev)
 {
+	struct scst_user_queue *q;
 	struct scst_user_cmd *ucmd;
 	int rc = 0, res = 1;
 
 	TRACE_ENTRY();
 
 	sBUG_ON(dev->blocking);
-	wake_up_all(&dev->udev_cmd_threads.cmd_list_waitQ); /* just in case */
+	dev_user_wake_up_all(dev); /* just in case */
 
 	while (1) {
 		int rc1;
@@ -3959,13 +5996,15 @@ static int dev_user_process_cleanup(struct scst_user_dev *dev)
 		if ((rc1 == 0) && (rc == -EAGAIN) && dev->cleanup_done)
 			break;
 
-		spin_lock_irq(&dev->udev_cmd_threads.cmd_list_lock);
-
-		rc = dev_user_get_next_cmd(dev, &ucmd, false);
-		if (rc == 0)
-			dev_user_unjam_cmd(ucmd, 1, NULL);
-
-		spin_unlock_irq(&dev->udev_cmd_threads.cmd_list_lock);
+		rc = -EAGAIN;
+		for (q = dev->queues; q < &dev->queues[dev->queues_num]; q++) {
+			spin_lock_irq(&q->udev_cmd_threads.cmd_list_lock);
+			if (dev_user_get_next_cmd(q, &ucmd, false) == 0) {
+				dev_user_unjam_cmd(ucmd, 1, NULL);
+				rc = 0;
+			}
+			spin_unlock_irq(&q->udev_cmd_threads.cmd_list_lock);
+		}
 
 		if (rc == -EAGAIN) {
 			if (!dev->cleanup_done) {
@@ -3993,6 +6032,7 @@ static ssize_t dev_user_sysfs_commands_show(struct kobject *kobj,
 	int pos = 0, ppos, i;
 	struct scst_device *dev;
 	struct scst_user_dev *udev;
+	struct scst_user_queue *q;
 	unsigned long flags;
 
 	TRACE_ENTRY();
@@ -4000,31 +6040,45 @@ static ssize_t dev_user_sysfs_commands_show(struct kobject *kobj,
 	dev = container_of(kobj, struct scst_device, dev_kobj);
 	udev = dev->dh_priv;
 
-	spin_lock_irqsave(&udev->udev_cmd_threads.cmd_list_lock, flags);
-	for (i = 0; i < ARRAY_SIZE(udev->ucmd_hash); i++) {
-		struct list_head *head = &udev->ucmd_hash[i];
-		struct scst_user_cmd *ucmd;
-
-		list_for_each_entry(ucmd, head, hash_list_entry) {
-			ppos = pos;
-			pos += scnprintf(&buf[pos],
-				SCST_SYSFS_BLOCK_SIZE - pos,
-				"ucmd %p (state %x, ref %d), "
-				"sent_to_user %d, seen_by_user %d, "
-				"aborted %d, jammed %d, scst_cmd %p\n",
-				ucmd, ucmd->state,
-				atomic_read(&ucmd->ucmd_ref),
-				ucmd->sent_to_user, ucmd->seen_by_user,
-				ucmd->aborted, ucmd->jammed, ucmd->cmd);
-			if (pos >= SCST_SYSFS_BLOCK_SIZE-1) {
-				ppos += scnprintf(&buf[ppos],
-					SCST_SYSFS_BLOCK_SIZE - ppos, "...\n");
-				pos = ppos;
-				break;
+	pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+		"Internally completed: TEST UNIT READY %ld, SYNCHRONIZE "
+		"CACHE %ld, START STOP UNIT %ld\n",
+		atomic_long_read(&udev->internal_done[
+			__ffs(SCST_USER_INTERNAL_TUR)]),
+		atomic_long_read(&udev->internal_done[
+			__ffs(SCST_USER_INTERNAL_SYNC_CACHE)]),
+		atomic_long_read(&udev->internal_done[
+			__ffs(SCST_USER_INTERNAL_START_STOP)]));
+
+	for (q = udev->queues; q < &udev->queues[udev->queues_num]; q++) {
+		spin_lock_irqsave(&q->udev_cmd_threads.cmd_list_lock, flags);
+		for (i = 0; i < ARRAY_SIZE(q->ucmd_hash); i++) {
+			struct list_head *head = &q->ucmd_hash[i];
+			struct scst_user_cmd *ucmd;
+
+			list_for_each_entry(ucmd, head, hash_list_entry) {
+				ppos = pos;
+				pos += scnprintf(&buf[pos],
+					SCST_SYSFS_BLOCK_SIZE - pos,
+					"ucmd %p (queue %d, state %x, ref %d), "
+					"sent_to_user %d, seen_by_user %d, "
+					"aborted %d, jammed %d, scst_cmd %p\n",
+					ucmd, q->idx, ucmd->state,
+					atomic_read(&ucmd->ucmd_ref),
+					ucmd->sent_to_user, ucmd->seen_by_user,
+					ucmd->aborted, ucmd->jammed, ucmd->cmd);
+				if (pos >= SCST_SYSFS_BLOCK_SIZE-1) {
+					ppos += scnprintf(&buf[ppos],
+						SCST_SYSFS_BLOCK_SIZE - ppos,
+						"...\n");
+					pos = ppos;
+					break;
+				}
 			}
 		}
+		spin_unlock_irqrestore(&q->udev_cmd_threads.cmd_list_lock,
+				       flags);
 	}
-	spin_unlock_irqrestore(&udev->udev_cmd_threads.cmd_list_lock, flags);
 
 	TRACE_EXIT_RES(pos);
 	return pos;
@@ -77,26 +77,37 @@ out:
 }
 
 /**
- * scst_dlm_lock_wait - Wait until a DLM lock has been granted
+ * scst_dlm_lock_start - Submit a DLM lock request without waiting for it
  * @ls:     DLM lock space.
  * @mode:   DLM lock mode.
  * @lksb:   DLM lock status block.
  * @flags:  DLM flags.
  * @name:   DLM lock name. Only required for non-conversion requests.
  * @bast:   AST to be invoked in case this lock blocks another one.
+ *
+ * Submitting several requests before waiting for any of them with
+ * scst_dlm_lock_finish() lets the DLM process these concurrently, such that a
+ * batch of requests costs about as much time as a single request.
  */
-static int scst_dlm_lock_wait(dlm_lockspace_t *ls, int mode,
-			      struct scst_lksb *lksb, int flags,
-			      const char *name, void (*bast)(void *, int))
+static int scst_dlm_lock_start(dlm_lockspace_t *ls, int mode,
+			       struct scst_lksb *lksb, int flags,
+			       const char *name, void (*bast)(void *, int))
+{
+	init_completion(&lksb->compl);
+	return dlm_lock(ls, mode, &lksb->lksb, flags,
+			(void *)name, name ? strlen(name) : 0, 0,
+			scst_dlm_ast, lksb, bast);
+}
+
+/*
+ * scst_dlm_lock_finish - Wait until a lock request submitted by
+ * scst_dlm_lock_start() has been granted and cancel it if that takes too long
+ */
+static int scst_dlm_lock_finish(dlm_lockspace_t *ls, struct scst_lksb *lksb,
+				int flags, const char *name)
 {
 	int res;
 
-	init_completion(&lksb->compl);
-	res = dlm_lock(ls, mode, &lksb->lksb, flags,
-			    (void *)name, name ? strlen(name) : 0, 0,
-			    scst_dlm_ast, lksb, bast);
-	if (res < 0)
-		goto out;
 	res = wait_for_completion_timeout(&lksb->compl, 60 * HZ);
 	if (res > 0)
 		res = lksb->lksb.sb_status;
@@ -109,6 +120,29 @@ static int scst_dlm_lock_wait(dlm_lockspace_t *ls, int mode,
 		     name ? : "?", lksb->lksb.sb_lkid, res2);
 	}
 
+	return res;
+}
+
+/**
+ * scst_dlm_lock_wait - Wait until a DLM lock has been granted
+ * @ls:     DLM lock space.
+ * @mode:   DLM lock mode.
+ * @lksb:   DLM lock status block.
+ * @flags:  DLM flags.
+ * @name:   DLM lock name. Only required for non-conversion requests.
+ * @bast:   AST to be invoked in case this lock blocks another one.
+ */
+static int scst_dlm_lock_wait(dlm_lockspace_t *ls, int mode,
+			      struct scst_lksb *lksb, int flags,
+			      const char *name, void (*bast)(void *, int))
+{
+	int res;
+
+	res = scst_dlm_lock_start(ls, mode, lksb, flags, name, bast);
+	if (res < 0)
+		goto out;
+	res = scst_dlm_lock_finish(ls, lksb, flags, name);
+
 out:
 	return res;
 }
@@ -161,6 +195,7 @@ static void scst_dlm_pr_init_reg(struct scst_device *dev,
 	reg->lksb.lksb.sb_lvbptr = (void *)reg->lvb;
 	reg->lksb.lksb.sb_lkid = 0;
 	reg->dlm_idx = -1;
+	reg->dlm_lkf = 0;
 }
 
 static void scst_dlm_pr_rm_reg_ls(dlm_lockspace_t *ls,
@@ -235,6 +270,21 @@ static bool scst_copy_res_from_dlm(struct scst_device *dev, struct pr_lvb *lvb)
 	return modified_lvb;
 }
 
+/*
+ * Make the next scst_copy_to_dlm() call rewrite the LVBs of all registrants,
+ * e.g. because the LVB contents cached in the registrants may be stale.
+ */
+static void scst_invalidate_reg_lvbs(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg;
+
+	scst_pr_read_lock(dev);
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry)
+		((struct pr_reg_lvb *)reg->lvb)->version = 0;
+	scst_pr_read_unlock(dev);
+}
+
 /*
  * Update local PR and registrant information from the content of the DLM LVB's.
  * Caller must hold PR_DATA_LOCK in PW mode.
@@ -249,9 +299,10 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
 	struct scst_lksb *reg_lksb = NULL;
 	struct scst_dev_registrant *reg, *tmp_reg;
-	int i, res = -ENOMEM;
+	int i, nr_submitted = 0, nr_finished = 0, res = -ENOMEM;
 	uint32_t nr_registrants;
 	void *reg_lvb_content = NULL;
+	unsigned int pr_file_seq;
 
 	lockdep_assert_held(&pr_dlm->ls_mutex);
 
@@ -269,15 +320,36 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 			nr_registrants * sizeof(*reg_lksb);
 	}
 
+	/*
+	 * Submit all lock requests before waiting for any of them such that
+	 * reading the registrant LVBs only takes a single DLM round trip.
+	 */
+	for (i = 0; i < nr_registrants; i++) {
+		char reg_name[32];
+
+		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, i);
+		reg_lksb[i].lksb.sb_lvbptr = reg_lvb_content +
+			i * PR_DLM_LVB_LEN;
+		res = scst_dlm_lock_start(ls, DLM_LOCK_PW, &reg_lksb[i],
+					  DLM_LKF_VALBLK, reg_name, NULL);
+		if (res < 0) {
+			PRINT_ERROR("locking %s.%s failed", dev->virt_name,
+				    reg_name);
+			res = -EFAULT;
+			goto cancel;
+		}
+		nr_submitted = i + 1;
+	}
+
 	for (i = 0; i < nr_registrants; i++) {
 		char reg_name[32];
 		struct pr_reg_lvb *reg_lvb;
 
 		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, i);
-		reg_lvb = reg_lvb_content + i * PR_DLM_LVB_LEN;
-		reg_lksb[i].lksb.sb_lvbptr = (void *)reg_lvb;
-		res = scst_dlm_lock_wait(ls, DLM_LOCK_PW, &reg_lksb[i],
-					 DLM_LKF_VALBLK, reg_name, NULL);
+		reg_lvb = (void *)reg_lksb[i].lksb.sb_lvbptr;
+		res = scst_dlm_lock_finish(ls, &reg_lksb[i], DLM_LKF_VALBLK,
+					   reg_name);
+		nr_finished = i + 1;
 		if (res < 0) {
 			res = -EFAULT;
 			PRINT_ERROR("locking %s.%s failed", dev->virt_name,
@@ -334,10 +406,15 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 						     rel_tgt_id, reg_lvb->key,
 						     false);
 		if (reg) {
+			if (reg->dlm_lkf) {
+				scst_dlm_lock_finish(ls, &reg->lksb,
+						     reg->dlm_lkf, NULL);
+				reg->dlm_lkf = 0;
+			}
 			scst_dlm_pr_rm_reg_ls(ls, reg);
 			reg->lksb.lksb.sb_lkid = reg_lksb[i].lksb.sb_lkid;
 			reg->dlm_idx = i;
-			memcpy(reg->lvb, reg_lvb_content, sizeof(reg->lvb));
+			memcpy(reg->lvb, reg_lvb, sizeof(reg->lvb));
 			if (reg_lvb->is_holder) {
 				if (dev->pr_is_set)
 					scst_pr_clear_holder(dev);
@@ -350,9 +427,18 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 			scst_dlm_unlock_wait(ls, &reg_lksb[i]);
 			continue;
 		}
-		scst_dlm_lock_wait(ls, DLM_LOCK_CR, &reg->lksb,
-				   DLM_LKF_CONVERT | DLM_LKF_VALBLK, NULL,
-				   NULL);
+		reg->dlm_lkf = DLM_LKF_CONVERT | DLM_LKF_VALBLK;
+		if (scst_dlm_lock_start(ls, DLM_LOCK_CR, &reg->lksb,
+					reg->dlm_lkf, NULL, NULL) < 0)
+			reg->dlm_lkf = 0;
+	}
+
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		if (!reg->dlm_lkf)
+			continue;
+		scst_dlm_lock_finish(ls, &reg->lksb, reg->dlm_lkf, NULL);
+		reg->dlm_lkf = 0;
 	}
 
 	/* Remove all registrants not found in any DLM LVB */
@@ -361,10 +447,12 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 		if (reg->lksb.lksb.sb_lkid == 0)
 			scst_pr_remove_registrant(dev, reg);
 
-	scst_pr_sync_device_file(dev);
+	pr_file_seq = scst_pr_sync_device_file(dev);
 
 	scst_pr_write_unlock(dev);
 
+	scst_pr_commit_device_file(dev, pr_file_seq);
+
 	res = 0;
 
 out:
@@ -372,9 +460,18 @@ out:
 	return res;
 
 cancel:
-	for (i = 0; i < nr_registrants; i++)
+	for (i = 0; i < nr_submitted; i++) {
+		if (i >= nr_finished)
+			scst_dlm_lock_finish(ls, &reg_lksb[i], DLM_LKF_VALBLK,
+					     NULL);
 		if (reg_lksb[i].lksb.sb_lkid)
 			scst_dlm_unlock_wait(ls, &reg_lksb[i]);
+	}
+	/*
+	 * Another node may have modified registrant LVBs that this node still
+	 * holds a lock on.
+	 */
+	scst_invalidate_reg_lvbs(dev);
 
 	goto out;
 }
@@ -416,17 +513,66 @@ static void scst_copy_res_to_dlm(struct scst_device *dev, struct pr_lvb *lvb)
 	spin_unlock_bh(&dev->dev_lock);
 }
 
+/*
+ * Whether the LVB of @reg, i.e. the value that has been written into or read
+ * from PR_REG_LOCK @reg->dlm_idx most recently, matches the state of @reg.
+ */
+static bool scst_reg_lvb_uptodate(struct scst_device *dev,
+				  struct scst_dev_registrant *reg)
+{
+	const struct pr_reg_lvb *reg_lvb = (void *)reg->lvb;
+	int tid_size;
+
+	lockdep_assert_pr_read_lock_held(dev);
+
+	tid_size = min_t(int, scst_tid_size(reg->transport_id),
+			 sizeof(reg_lvb->tid));
+	return reg_lvb->version == 1 && reg_lvb->key == reg->key &&
+		be16_to_cpu(reg_lvb->rel_tgt_id) == reg->rel_tgt_id &&
+		reg_lvb->is_holder == (dev->pr_holder == reg) &&
+		memcmp(reg_lvb->tid, reg->transport_id, tid_size) == 0;
+}
+
+/* Copy the state of @reg into its LVB. */
+static void scst_copy_reg_to_lvb(struct scst_device *dev,
+				 struct scst_dev_registrant *reg)
+{
+	struct pr_reg_lvb *reg_lvb = (void *)reg->lksb.lksb.sb_lvbptr;
+	int tid_size;
+
+	memset(reg->lvb, 0, sizeof(reg->lvb));
+	reg_lvb->key = reg->key;
+	reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
+	reg_lvb->version = 1;
+	reg_lvb->is_holder = dev->pr_holder == reg;
+	tid_size = scst_tid_size(reg->transport_id);
+#if 0
+	PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK " (len %d)",
+		   dev->virt_name, reg->dlm_idx, tid_size);
+	print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16, 1,
+		       reg->transport_id, tid_size, 1);
+#endif
+	if (WARN(tid_size > sizeof(reg_lvb->tid), "tid_size %d > %zd\n",
+		 tid_size, sizeof(reg_lvb->tid)))
+		tid_size = sizeof(reg_lvb->tid);
+	memcpy(reg_lvb->tid, reg->transport_id, tid_size);
+}
+
 /*
  * Update PR and registrant information in the DLM LVB's. Caller must hold
  * PR_DATA_LOCK in PW mode.
+ *
+ * Only the LVBs of registrants that have been added or modified since the
+ * previous update are rewritten. Since all lock requests are submitted
+ * before waiting for any of them, updating the LVBs takes two DLM round
+ * trips independent of the number of registrants.
  */
 static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 {
 	struct scst_pr_dlm_data *const pr_dlm = dev->pr_dlm;
 	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
-	struct pr_reg_lvb *reg_lvb;
 	struct scst_dev_registrant *reg;
-	int i, tid_size;
+	int i, res;
 	char reg_name[32];
 	uint32_t nr_registrants;
 
@@ -445,6 +591,7 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 	lvb->nr_registrants = cpu_to_be32(nr_registrants);
 	lvb->pr_generation = cpu_to_be32(dev->pr_generation);
 
+	/* Submit a PW lock request for each LVB that has to be written. */
 	list_for_each_entry(reg, &dev->dev_registrants_list,
 			    dev_registrants_list_entry) {
 		if (reg->dlm_idx >= nr_registrants)
@@ -452,49 +599,71 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 		if (reg->dlm_idx < 0) {
 			i = scst_get_available_dlm_idx(dev);
 			snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, i);
-			if (scst_dlm_lock_wait(ls, DLM_LOCK_NL,
-					       &reg->lksb, 0, reg_name, NULL)
-			    >= 0)
+			reg->dlm_lkf = DLM_LKF_VALBLK;
+			res = scst_dlm_lock_start(ls, DLM_LOCK_PW, &reg->lksb,
+						  reg->dlm_lkf, reg_name, NULL);
+			if (res >= 0)
 				reg->dlm_idx = i;
+		} else if (!scst_reg_lvb_uptodate(dev, reg)) {
+			snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK,
+				 reg->dlm_idx);
+			reg->dlm_lkf = DLM_LKF_VALBLK | DLM_LKF_CONVERT;
+			res = scst_dlm_lock_start(ls, DLM_LOCK_PW, &reg->lksb,
+						  reg->dlm_lkf, NULL, NULL);
+		} else {
+			continue;
+		}
+		if (res < 0) {
+			PRINT_ERROR("Failed to lock %s.%s: %d", dev->virt_name,
+				    reg_name, res);
+			reg->dlm_lkf = 0;
 		}
 	}
 
+	/*
+	 * Fill in the LVB of each lock that has been granted and submit a
+	 * down-conversion to CR to write it back.
+	 */
 	list_for_each_entry(reg, &dev->dev_registrants_list,
 			    dev_registrants_list_entry) {
-		if (WARN_ON(!reg->lksb.lksb.sb_lkid))
+		if (!reg->dlm_lkf)
 			continue;
 		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, reg->dlm_idx);
-		if (scst_dlm_lock_wait(ls, DLM_LOCK_PW, &reg->lksb,
-				       DLM_LKF_VALBLK | DLM_LKF_CONVERT,
-				       reg_name, NULL) >= 0) {
-			reg_lvb = (void *)reg->lksb.lksb.sb_lvbptr;
-			memset(reg->lvb, 0, sizeof(reg->lvb));
-			reg_lvb->key = reg->key;
-			reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
-			reg_lvb->version = 1;
-			reg_lvb->is_holder = dev->pr_holder == reg;
-			tid_size = scst_tid_size(reg->transport_id);
-#if 0
-			PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK
-				   " (len %d)", dev->virt_name, reg->dlm_idx,
-				   tid_size);
-			print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16,
-				       1, reg->transport_id, tid_size, 1);
-#endif
-			if (WARN(tid_size > sizeof(reg_lvb->tid),
-				 "tid_size %d > %zd\n", tid_size,
-				 sizeof(reg_lvb->tid)))
-				tid_size = sizeof(reg_lvb->tid);
-			memcpy(reg_lvb->tid, reg->transport_id, tid_size);
-			scst_dlm_lock_wait(ls, DLM_LOCK_CR, &reg->lksb,
-					   DLM_LKF_CONVERT | DLM_LKF_VALBLK,
-					   reg_name, NULL);
-		} else {
-			PRINT_ERROR("Failed to lock %s.%s", dev->virt_name,
-				    reg_name);
+		res = scst_dlm_lock_finish(ls, &reg->lksb, reg->dlm_lkf,
+					   reg_name);
+		if (res < 0) {
+			PRINT_ERROR("Failed to lock %s.%s: %d", dev->virt_name,
+				    reg_name, res);
+			if (!(reg->dlm_lkf & DLM_LKF_CONVERT)) {
+				reg->lksb.lksb.sb_lkid = 0;
+				reg->dlm_idx = -1;
+			}
+			reg->dlm_lkf = 0;
+			continue;
+		}
+		scst_copy_reg_to_lvb(dev, reg);
+		reg->dlm_lkf = DLM_LKF_CONVERT | DLM_LKF_VALBLK;
+		res = scst_dlm_lock_start(ls, DLM_LOCK_CR, &reg->lksb,
+					  reg->dlm_lkf, NULL, NULL);
+		if (res < 0) {
+			PRINT_ERROR("Failed to convert %s.%s to CR: %d",
+				    dev->virt_name, reg_name, res);
+			((struct pr_reg_lvb *)reg->lvb)->version = 0;
+			reg->dlm_lkf = 0;
 		}
 	}
 
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		if (!reg->dlm_lkf)
+			continue;
+		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, reg->dlm_idx);
+		if (scst_dlm_lock_finish(ls, &reg->lksb, reg->dlm_lkf,
+					 reg_name) < 0)
+			((struct pr_reg_lvb *)reg->lvb)->version = 0;
+		reg->dlm_lkf = 0;
+	}
+
 	scst_pr_write_unlock(dev);
 }
 
@@ -1201,6 +1370,8 @@ static void scst_copy_to_dlm_work(struct work_struct *work)
 		PRINT_INFO("%s.%s LVB not valid\n", dev->virt_name,
 			   PR_DATA_LOCK);
 
+	/* Rewrite all registrant LVBs, whether or not these have changed. */
+	scst_invalidate_reg_lvbs(dev);
 	scst_copy_to_dlm(dev, ls);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
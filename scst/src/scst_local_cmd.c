@@ -883,7 +883,8 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 	uint8_t *buffer;
 	int buffer_size;
 	struct scst_lksb pr_lksb;
-	bool aborted = false;
+	bool aborted = false, pr_file_synced = false;
+	unsigned int pr_file_seq = 0;
 
 	TRACE_ENTRY();
 
@@ -1007,8 +1008,10 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 		goto out_unlock;
 	}
 
-	if (cmd->status == SAM_STAT_GOOD)
-		scst_pr_sync_device_file(dev);
+	if (cmd->status == SAM_STAT_GOOD) {
+		pr_file_seq = scst_pr_sync_device_file(dev);
+		pr_file_synced = true;
+	}
 
 	if ((cmd->devt->pr_cmds_notifications) &&
 	    (cmd->status == SAM_STAT_GOOD)) /* sync file may change status */
@@ -1017,6 +1020,13 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 out_unlock:
 	dev->cl_ops->pr_write_unlock(dev, &pr_lksb);
 
+	/*
+	 * Wait for the PR journal outside of dev_pr_mutex, so that the
+	 * changes of concurrent PR OUT commands reach the disk together.
+	 */
+	if (pr_file_synced)
+		scst_pr_commit_device_file(dev, pr_file_seq);
+
 	scst_put_buf_full(cmd, buffer);
 
 out_done:
@@ -1547,6 +1547,38 @@ void sgv_pool_flush(struct sgv_pool *pool)
 }
 EXPORT_SYMBOL_GPL(sgv_pool_flush);
 
+/*
+ * sgv_pool_headroom() - returns free space of the SGV memory limit
+ *
+ * Returns the part, in percent, of the memory limit for commands data
+ * buffers (scst_max_cmd_mem) which is still available. Inactive cached
+ * objects are counted as available, because they are freed on demand.
+ * Intended as a cheap memory pressure indicator for target drivers.
+ */
+int sgv_pool_headroom(void)
+{
+	int res = 100;
+#ifndef CONFIG_SCST_NO_TOTAL_MEM_CHECKS
+	struct sgv_pool *pool;
+	int used, inactive_pages = 0;
+
+	if (sgv_hi_wmk <= 0)
+		goto out;
+
+	spin_lock_bh(&sgv_pools_lock);
+	list_for_each_entry(pool, &sgv_pools_list, sgv_pools_list_entry)
+		inactive_pages += pool->inactive_cached_pages;
+	spin_unlock_bh(&sgv_pools_lock);
+
+	used = max(0, atomic_read(&sgv_pages_total) - inactive_pages);
+	res = max(0, 100 - used / max(sgv_hi_wmk / 100, 1));
+
+out:
+#endif
+	return res;
+}
+EXPORT_SYMBOL_GPL(sgv_pool_headroom);
+
 static void sgv_pool_destroy(struct sgv_pool *pool)
 {
 	int i;
@@ -40,6 +40,9 @@
 #include <linux/version.h>
 #endif
 #include <linux/vmalloc.h>
+#include <linux/crc32.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
 #include <asm/unaligned.h>
 #include <stdarg.h>
 
@@ -65,6 +68,20 @@
 #define SCST_PR_FILE_SIGN	0xBBEEEEAAEEBBDD77LLU
 #define SCST_PR_FILE_VERSION	1LLU
 
+#define SCST_PR_JOURNAL_SIGN	0xBBEEEEAAEEBBDD78LLU
+#define SCST_PR_JOURNAL_VERSION	1LLU
+/* signature, version and CRC32 of the PR file the journal belongs to */
+#define SCST_PR_JOURNAL_HDR_LEN	20
+/* Journal size below which no compaction is done */
+#define SCST_PR_JOURNAL_MIN_SIZE	(64 * 1024)
+
+/* Journal record types. Each record carries absolute, not relative, state. */
+#define SCST_PR_JREC_REG	1	/* add or update a registrant */
+#define SCST_PR_JREC_UNREG	2	/* remove a registrant */
+#define SCST_PR_JREC_RSV	3	/* APTPL and reservation state */
+/* type and payload length */
+#define SCST_PR_JREC_HDR_LEN	3
+
 #define FILE_BUFFER_SIZE	512
 
 #ifndef isblank
@@ -278,6 +295,43 @@ out:
 
 #endif /* defined(CONFIG_SCST_DEBUG) || defined(CONFIG_SCST_TRACING) */
 
+/*
+ * Hash of a transport ID and a relative target port ID. Transport IDs equal
+ * according to tid_equal() must have the same hash, hence only the case
+ * insensitive iSCSI name without ",i,0x<ISID>" is hashed for iSCSI.
+ */
+static unsigned int scst_pr_tid_hash(const uint8_t *tid, uint16_t rel_tgt_id)
+{
+	uint32_t h = ((tid[0] & 0x0f) << 16) | rel_tgt_id;
+
+	if ((tid[0] & 0x0f) == SCSI_TRANSPORTID_PROTOCOLID_ISCSI) {
+		const uint8_t *name = &tid[4];
+		int i, max = scst_tid_size(tid) - 4;
+
+		for (i = 0; (i < max) && name[i] && (name[i] != ','); i++)
+			h = h * 31 + tolower(name[i]);
+	} else
+		h = jhash(tid, TID_COMMON_SIZE, h);
+
+	return hash_32(h, SCST_PR_REG_HASH_SHIFT);
+}
+
+static inline unsigned int scst_pr_key_hash(__be64 key)
+{
+	return hash_64((__force u64)key, SCST_PR_REG_HASH_SHIFT);
+}
+
+/* Must be called under dev_pr_mutex */
+void scst_pr_set_reg_key(struct scst_device *dev,
+	struct scst_dev_registrant *reg, __be64 key)
+{
+	scst_assert_pr_mutex_held(dev);
+
+	reg->key = key;
+	list_move_tail(&reg->key_hash_list_entry,
+		&dev->dev_registrants_key_hash[scst_pr_key_hash(key)]);
+}
+
 /* dev_pr_mutex must be locked */
 static void scst_pr_find_registrants_list_all(struct scst_device *dev,
 	struct scst_dev_registrant *exclude_reg, struct list_head *list)
@@ -319,8 +373,8 @@ static void scst_pr_find_registrants_list_key(struct scst_device *dev,
 	TRACE_PR("Finding registrants for device '%s' with key %016llx",
 		dev->virt_name, be64_to_cpu(key));
 
-	list_for_each_entry(reg, &dev->dev_registrants_list,
-				dev_registrants_list_entry) {
+	list_for_each_entry(reg, &dev->dev_registrants_key_hash[
+				scst_pr_key_hash(key)], key_hash_list_entry) {
 		if (reg->key == key) {
 			TRACE_PR("Adding registrant %s/%d (%p) to the find "
 				"list (key %016llx)",
@@ -347,8 +401,9 @@ struct scst_dev_registrant *scst_pr_find_reg(
 
 	scst_assert_pr_mutex_held(dev);
 
-	list_for_each_entry(reg, &dev->dev_registrants_list,
-				dev_registrants_list_entry) {
+	list_for_each_entry(reg, &dev->dev_registrants_tid_hash[
+			scst_pr_tid_hash(transport_id, rel_tgt_id)],
+			tid_hash_list_entry) {
 		if ((reg->rel_tgt_id == rel_tgt_id) &&
 		    tid_equal(reg->transport_id, transport_id)) {
 			res = reg;
@@ -454,6 +509,11 @@ struct scst_dev_registrant *scst_pr_add_registrant(
 
 	reg->rel_tgt_id = rel_tgt_id;
 	reg->key = key;
+	list_add_tail(&reg->tid_hash_list_entry,
+		&dev->dev_registrants_tid_hash[
+			scst_pr_tid_hash(transport_id, rel_tgt_id)]);
+	list_add_tail(&reg->key_hash_list_entry,
+		&dev->dev_registrants_key_hash[scst_pr_key_hash(key)]);
 
 	/*
 	 * We can't use scst_mutex here, because of the circular
@@ -498,6 +558,120 @@ out_free:
 	goto out;
 }
 
+/* Must be called under dev_pr_mutex */
+static void scst_pr_journal_reset(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg;
+
+	scst_assert_pr_mutex_held(dev);
+
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry)
+		reg->journaled = 0;
+
+	dev->pr_journal_holder = NULL;
+	dev->pr_journal_buf_len = 0;
+	dev->pr_journal_need_compact = 1;
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_journal_close(struct scst_device *dev)
+{
+	scst_assert_pr_mutex_held(dev);
+
+	mutex_lock(&dev->pr_journal_sync_mutex);
+	if (dev->pr_journal_file != NULL) {
+		filp_close(dev->pr_journal_file, NULL);
+		dev->pr_journal_file = NULL;
+	}
+	dev->pr_journal_size = 0;
+	/* Nothing left to fsync for the commands waiting on the old file */
+	dev->pr_journal_synced_seq = dev->pr_journal_seq;
+	mutex_unlock(&dev->pr_journal_sync_mutex);
+
+	scst_pr_journal_reset(dev);
+	return;
+}
+
+/*
+ * Appends a journal record to dev->pr_journal_buf. The record consists of
+ * its type, the payload length, the payload and a CRC32 of everything
+ * before it. The payload is @data followed by @tid and @rel_tgt_id, if
+ * @tid is not NULL.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_journal_add(struct scst_device *dev, uint8_t type,
+	const void *data, int data_len, const uint8_t *tid,
+	uint16_t rel_tgt_id)
+{
+	int res = 0;
+	int tid_size = tid ? scst_tid_size(tid) : 0;
+	int payload_len = data_len;
+	int rec_len;
+	uint8_t *p;
+	uint32_t crc;
+
+	scst_assert_pr_mutex_held(dev);
+
+	if (tid != NULL)
+		payload_len += tid_size + sizeof(rel_tgt_id);
+	rec_len = SCST_PR_JREC_HDR_LEN + payload_len + sizeof(crc);
+
+	if (dev->pr_journal_buf_len + rec_len > dev->pr_journal_buf_size) {
+		int size = max(dev->pr_journal_buf_size * 2,
+			       dev->pr_journal_buf_len + rec_len);
+		uint8_t *buf;
+
+		buf = krealloc(dev->pr_journal_buf, size, GFP_KERNEL);
+		if (buf == NULL) {
+			PRINT_ERROR("Unable to allocate PR journal buffer "
+				"(size %d)", size);
+			res = -ENOMEM;
+			goto out;
+		}
+		dev->pr_journal_buf = buf;
+		dev->pr_journal_buf_size = size;
+	}
+
+	p = &dev->pr_journal_buf[dev->pr_journal_buf_len];
+	p[0] = type;
+	put_unaligned(payload_len, (uint16_t *)&p[1]);
+	memcpy(&p[SCST_PR_JREC_HDR_LEN], data, data_len);
+	if (tid != NULL) {
+		memcpy(&p[SCST_PR_JREC_HDR_LEN + data_len], tid, tid_size);
+		put_unaligned(rel_tgt_id, (uint16_t *)&p[SCST_PR_JREC_HDR_LEN +
+			data_len + tid_size]);
+	}
+	crc = crc32_le(~0, p, SCST_PR_JREC_HDR_LEN + payload_len);
+	put_unaligned(crc, (uint32_t *)&p[SCST_PR_JREC_HDR_LEN + payload_len]);
+
+	dev->pr_journal_buf_len += rec_len;
+
+out:
+	return res;
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_journal_unreg(struct scst_device *dev,
+	struct scst_dev_registrant *reg)
+{
+	scst_assert_pr_mutex_held(dev);
+
+	if (reg == dev->pr_journal_holder) {
+		dev->pr_journal_holder = NULL;
+		dev->pr_journal_rsv_stale = 1;
+	}
+
+	if (!reg->journaled || dev->pr_journal_need_compact)
+		return;
+
+	if (scst_pr_journal_add(dev, SCST_PR_JREC_UNREG, NULL, 0,
+			reg->transport_id, reg->rel_tgt_id) != 0)
+		dev->pr_journal_need_compact = 1;
+	return;
+}
+
 /* Must be called under dev_pr_mutex */
 void scst_pr_remove_registrant(struct scst_device *dev,
 	struct scst_dev_registrant *reg)
@@ -512,6 +686,10 @@ void scst_pr_remove_registrant(struct scst_device *dev,
 		dev->virt_name);
 
 	list_del(&reg->dev_registrants_list_entry);
+	list_del(&reg->tid_hash_list_entry);
+	list_del(&reg->key_hash_list_entry);
+
+	scst_pr_journal_unreg(dev, reg);
 
 	dev->cl_ops->pr_rm_reg(dev, reg);
 
@@ -649,14 +827,617 @@ static void scst_pr_abort_reg(struct scst_device *dev,
 	}
 
 out:
-	TRACE_EXIT();
-	return;
-}
+	TRACE_EXIT();
+	return;
+}
+
+
+/* Must be called under dev_pr_mutex */
+static bool scst_pr_journal_rsv_changed(struct scst_device *dev)
+{
+	return dev->pr_journal_rsv_stale ||
+	       dev->pr_journal_aptpl != dev->pr_aptpl ||
+	       dev->pr_journal_is_set != dev->pr_is_set ||
+	       dev->pr_journal_type != dev->pr_type ||
+	       dev->pr_journal_scope != dev->pr_scope ||
+	       dev->pr_journal_holder != dev->pr_holder;
+}
+
+/*
+ * Remembers the state recorded in the journal.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static void scst_pr_journal_mark_synced(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg;
+
+	scst_assert_pr_mutex_held(dev);
+
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		reg->journal_key = reg->key;
+		reg->journaled = 1;
+	}
+
+	dev->pr_journal_rsv_stale = 0;
+	dev->pr_journal_aptpl = dev->pr_aptpl;
+	dev->pr_journal_is_set = dev->pr_is_set;
+	dev->pr_journal_type = dev->pr_type;
+	dev->pr_journal_scope = dev->pr_scope;
+	dev->pr_journal_holder = dev->pr_holder;
+	dev->pr_journal_buf_len = 0;
+	return;
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_remove_device_files(struct scst_device *dev)
+{
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	scst_pr_journal_close(dev);
+
+	if (dev->pr_file_name)
+		scst_remove_file(dev->pr_file_name);
+	if (dev->pr_file_name1)
+		scst_remove_file(dev->pr_file_name1);
+	if (dev->pr_journal_name)
+		scst_remove_file(dev->pr_journal_name);
+
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Writes the complete PR state in the legacy, i.e. journal-less, format
+ * and returns in *crc the CRC32 of the written file.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_write_device_file(struct scst_device *dev, uint32_t *crc)
+{
+	int res = 0;
+	struct file *file;
+	loff_t pos = 0, size;
+	uint64_t sign;
+	uint8_t *buf;
+	struct scst_dev_registrant *reg;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	size = sizeof(sign) + sizeof(uint64_t) + 4;
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry)
+		size += 1 + scst_tid_size(reg->transport_id) +
+			sizeof(reg->key) + sizeof(reg->rel_tgt_id);
+
+	buf = vmalloc(size);
+	if (buf == NULL) {
+		PRINT_ERROR("Unable to allocate PR file buffer (size %lld)",
+			size);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * signature, version, APTPL and reservation
+	 */
+	put_unaligned(SCST_PR_FILE_SIGN, (uint64_t *)&buf[pos]);
+	pos += sizeof(sign);
+	put_unaligned(SCST_PR_FILE_VERSION, (uint64_t *)&buf[pos]);
+	pos += sizeof(uint64_t);
+	buf[pos++] = dev->pr_aptpl;
+	buf[pos++] = dev->pr_is_set;
+	buf[pos++] = dev->pr_type;
+	buf[pos++] = dev->pr_scope;
+
+	/*
+	 * registration records
+	 */
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		int tid_size = scst_tid_size(reg->transport_id);
+
+		buf[pos++] = (dev->pr_holder == reg);
+		memcpy(&buf[pos], reg->transport_id, tid_size);
+		pos += tid_size;
+		put_unaligned(reg->key, (__be64 *)&buf[pos]);
+		pos += sizeof(reg->key);
+		put_unaligned(reg->rel_tgt_id, (uint16_t *)&buf[pos]);
+		pos += sizeof(reg->rel_tgt_id);
+	}
+
+	sBUG_ON(pos != size);
+
+	*crc = crc32_le(~0, buf, size);
+
+	scst_copy_file(dev->pr_file_name, dev->pr_file_name1);
+
+	file = filp_open(dev->pr_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (IS_ERR(file)) {
+		res = PTR_ERR(file);
+		PRINT_ERROR("Unable to (re)create PR file '%s' - error %d",
+			dev->pr_file_name, res);
+		goto out_free;
+	}
+
+	TRACE_PR("Updating pr file '%s'", dev->pr_file_name);
+
+	/*
+	 * Write everything with zero signature first and set the real one
+	 * only after the data reached the disk, so a torn file is never
+	 * taken for a valid one.
+	 */
+	sign = 0;
+	memcpy(buf, &sign, sizeof(sign));
+	pos = 0;
+	res = kernel_write(file, buf, size, &pos);
+	if (res != size)
+		goto write_error;
+
+	res = vfs_fsync(file, 1);
+	if (res != 0) {
+		PRINT_ERROR("fsync() of the PR file failed: %d", res);
+		goto write_error_close;
+	}
+
+	sign = SCST_PR_FILE_SIGN;
+	pos = 0;
+	res = kernel_write(file, &sign, sizeof(sign), &pos);
+	if (res != sizeof(sign))
+		goto write_error;
+
+	res = vfs_fsync(file, 1);
+	if (res != 0) {
+		PRINT_ERROR("fsync() of the PR file failed: %d", res);
+		goto write_error_close;
+	}
+
+	res = 0;
+
+	filp_close(file, NULL);
+
+out_free:
+	vfree(buf);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+write_error:
+	PRINT_ERROR("Error writing to '%s' - error %d", dev->pr_file_name, res);
+	if (res >= 0)
+		res = -EIO;
+
+write_error_close:
+	filp_close(file, NULL);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 39)
+	{
+		struct nameidata nd;
+		int rc;
+
+		rc = path_lookup(dev->pr_file_name, 0,	&nd);
+		if (!rc)
+			scst_vfs_unlink_and_put(&nd);
+		else
+			TRACE_PR("Unable to lookup '%s' - error %d",
+				dev->pr_file_name, rc);
+	}
+#else
+	{
+		struct path path;
+		int rc;
+
+		rc = kern_path(dev->pr_file_name, 0, &path);
+		if (!rc)
+			scst_vfs_unlink_and_put(&path);
+		else
+			TRACE_PR("Unable to lookup '%s' - error %d",
+				dev->pr_file_name, rc);
+	}
+#endif
+	goto out_free;
+}
+
+/*
+ * Writes a new PR file with the complete state and starts a new, empty,
+ * journal for it. The journal header carries the CRC32 of the PR file it
+ * belongs to, so that a journal left behind by a crash in the middle of
+ * compaction is never applied on top of a newer PR file.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_compact_device_file(struct scst_device *dev)
+{
+	int res;
+	struct file *file;
+	loff_t pos = 0;
+	uint8_t hdr[SCST_PR_JOURNAL_HDR_LEN];
+	uint32_t crc;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	mutex_lock(&dev->pr_journal_sync_mutex);
+
+	if (dev->pr_journal_file != NULL) {
+		filp_close(dev->pr_journal_file, NULL);
+		dev->pr_journal_file = NULL;
+	}
+	dev->pr_journal_size = 0;
+
+	res = scst_pr_write_device_file(dev, &crc);
+	if (res != 0)
+		goto out_unlock;
+
+	/* From now on all previous journal records are in the PR file */
+	dev->pr_journal_seq++;
+	dev->pr_journal_synced_seq = dev->pr_journal_seq;
+
+	file = filp_open(dev->pr_journal_name, O_WRONLY | O_CREAT | O_TRUNC,
+			 0644);
+	if (IS_ERR(file)) {
+		res = PTR_ERR(file);
+		PRINT_ERROR("Unable to (re)create PR journal '%s' - error %d",
+			dev->pr_journal_name, res);
+		goto out_unlock;
+	}
+
+	put_unaligned(SCST_PR_JOURNAL_SIGN, (uint64_t *)&hdr[0]);
+	put_unaligned(SCST_PR_JOURNAL_VERSION, (uint64_t *)&hdr[8]);
+	put_unaligned(crc, (uint32_t *)&hdr[16]);
+
+	res = kernel_write(file, hdr, sizeof(hdr), &pos);
+	if (res != sizeof(hdr)) {
+		PRINT_ERROR("Error writing to '%s' - error %d",
+			dev->pr_journal_name, res);
+		res = res < 0 ? res : -EIO;
+		goto out_close;
+	}
+
+	res = vfs_fsync(file, 1);
+	if (res != 0) {
+		PRINT_ERROR("fsync() of the PR journal failed: %d", res);
+		goto out_close;
+	}
+
+	dev->pr_journal_file = file;
+	dev->pr_journal_size = pos;
+
+	TRACE_PR("Compacted PR file '%s' (dev %s)", dev->pr_file_name,
+		dev->virt_name);
+
+out_unlock:
+	mutex_unlock(&dev->pr_journal_sync_mutex);
+
+	/*
+	 * Even if only the journal could not be recreated, the PR file is
+	 * complete, so the next change will try compaction again.
+	 */
+	scst_pr_journal_mark_synced(dev);
+	dev->pr_journal_need_compact = (dev->pr_journal_file == NULL);
+
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_close:
+	filp_close(file, NULL);
+	goto out_unlock;
+}
+
+/**
+ * scst_pr_sync_device_file() - record PR state changes on disk
+ * @dev: SCST device.
+ *
+ * Appends to the PR journal records for all registrants and the reservation
+ * state changed since the previous call, without waiting for them to reach
+ * the disk. Once the journal has grown large compared to the PR state, the
+ * whole state is written into the PR file instead and the journal is
+ * restarted.
+ *
+ * Returns the sequence number to pass to scst_pr_commit_device_file(), which
+ * should be called after dev_pr_mutex has been released, so that concurrent
+ * PR OUT commands share a single fsync().
+ *
+ * Must be called under dev_pr_mutex.
+ */
+unsigned int scst_pr_sync_device_file(struct scst_device *dev)
+{
+	int res = 0;
+	struct scst_dev_registrant *reg;
+	loff_t pos, state_size;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	if ((dev->pr_aptpl == 0) || list_empty(&dev->dev_registrants_list)) {
+		scst_pr_remove_device_files(dev);
+		goto out;
+	}
+
+	if (dev->pr_journal_need_compact)
+		goto compact;
+
+	state_size = 0;
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		state_size += 1 + scst_tid_size(reg->transport_id) +
+			sizeof(reg->key) + sizeof(reg->rel_tgt_id);
+		if (reg->journaled && (reg->journal_key == reg->key))
+			continue;
+		if (scst_pr_journal_add(dev, SCST_PR_JREC_REG, &reg->key,
+				sizeof(reg->key), reg->transport_id,
+				reg->rel_tgt_id) != 0)
+			goto compact;
+	}
+
+	if (scst_pr_journal_rsv_changed(dev)) {
+		uint8_t rsv[4] = { dev->pr_aptpl, dev->pr_is_set, dev->pr_type,
+				   dev->pr_scope };
+		struct scst_dev_registrant *holder = dev->pr_holder;
+
+		if (scst_pr_journal_add(dev, SCST_PR_JREC_RSV, rsv, sizeof(rsv),
+				holder ? holder->transport_id : NULL,
+				holder ? holder->rel_tgt_id : 0) != 0)
+			goto compact;
+	}
+
+	if (dev->pr_journal_buf_len == 0)
+		goto out;
+
+	if (dev->pr_journal_size + dev->pr_journal_buf_len >
+	    max_t(loff_t, SCST_PR_JOURNAL_MIN_SIZE, 4 * state_size))
+		goto compact;
+
+	pos = dev->pr_journal_size;
+	res = kernel_write(dev->pr_journal_file, dev->pr_journal_buf,
+			   dev->pr_journal_buf_len, &pos);
+	if (res != dev->pr_journal_buf_len) {
+		PRINT_ERROR("Error writing to '%s' - error %d",
+			dev->pr_journal_name, res);
+		/* A torn tail record is dropped by the loader */
+		goto compact;
+	}
+
+	TRACE_PR("Appended %d bytes to PR journal '%s'",
+		dev->pr_journal_buf_len, dev->pr_journal_name);
+
+	dev->pr_journal_size = pos;
+	scst_pr_journal_mark_synced(dev);
+	dev->pr_journal_seq++;
+	res = 0;
+
+out:
+	TRACE_EXIT_RES(res);
+	return dev->pr_journal_seq;
+
+compact:
+	res = scst_pr_compact_device_file(dev);
+	if (res != 0) {
+		PRINT_CRIT_ERROR("Unable to save persistent information "
+				 "(device %s)", dev->virt_name);
+		 /*
+		  * It's safer to not return any error to the initiator and expect
+		  * operator's intervention to be able to save the PR's state next
+		  * time, than to screw up all the interactions with this initiator.
+		  */
+	}
+	goto out;
+}
+
+/**
+ * scst_pr_commit_device_file() - wait until PR journal records are on disk
+ * @dev: SCST device.
+ * @seq: Value returned by scst_pr_sync_device_file().
+ *
+ * A single fsync() covers the records appended by all commands that got
+ * here while the previous fsync() was in progress.
+ *
+ * Must be called without dev_pr_mutex held.
+ */
+void scst_pr_commit_device_file(struct scst_device *dev, unsigned int seq)
+{
+	int res = 0;
+	unsigned int target;
+
+	TRACE_ENTRY();
+
+	mutex_lock(&dev->pr_journal_sync_mutex);
+
+	if ((int)(seq - dev->pr_journal_synced_seq) <= 0) {
+		TRACE_DBG("PR journal seq %u already synced (dev %s)", seq,
+			dev->virt_name);
+		goto out_unlock;
+	}
+
+	target = READ_ONCE(dev->pr_journal_seq);
+
+	if (dev->pr_journal_file != NULL)
+		res = vfs_fsync(dev->pr_journal_file, 1);
+	if (res != 0) {
+		PRINT_CRIT_ERROR("fsync() of the PR journal failed: %d "
+			"(device %s)", res, dev->virt_name);
+		goto out_unlock;
+	}
+
+	dev->pr_journal_synced_seq = target;
+
+out_unlock:
+	mutex_unlock(&dev->pr_journal_sync_mutex);
+
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Applies the records of the PR journal on top of the state loaded from the
+ * PR file with CRC32 @crc. Replay stops at the first incomplete or corrupted
+ * record, i.e. one that was being written during a crash.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_replay_journal(struct scst_device *dev, uint32_t crc)
+{
+	int res = 0, rc, cnt = 0;
+	struct file *file;
+	struct inode *inode;
+	uint8_t *buf = NULL;
+	loff_t file_size, pos;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	file = filp_open(dev->pr_journal_name, O_RDONLY, 0);
+	if (IS_ERR(file)) {
+		TRACE_PR("Unable to open PR journal '%s' - error %d",
+			dev->pr_journal_name, (int)PTR_ERR(file));
+		goto out;
+	}
+
+	inode = file_inode(file);
+	file_size = inode->i_size;
+	if (!S_ISREG(inode->i_mode) || (file_size < SCST_PR_JOURNAL_HDR_LEN) ||
+	    (file_size >= 15*1024*1024)) {
+		PRINT_WARNING("Ignoring PR journal '%s' (mode 0x%x, size %lld)",
+			dev->pr_journal_name, inode->i_mode, file_size);
+		goto out_close;
+	}
+
+	buf = vmalloc(file_size);
+	if (buf == NULL) {
+		res = -ENOMEM;
+		PRINT_ERROR("%s", "Unable to allocate buffer");
+		goto out_close;
+	}
+
+	pos = 0;
+	rc = kernel_read(file, buf, file_size, &pos);
+	if (rc != file_size) {
+		PRINT_ERROR("Unable to read file '%s' - error %d",
+			dev->pr_journal_name, rc);
+		res = rc < 0 ? rc : -EIO;
+		goto out_close;
+	}
+
+	if ((get_unaligned((uint64_t *)&buf[0]) != SCST_PR_JOURNAL_SIGN) ||
+	    (get_unaligned((uint64_t *)&buf[8]) != SCST_PR_JOURNAL_VERSION)) {
+		PRINT_WARNING("Invalid PR journal '%s' header, ignoring it",
+			dev->pr_journal_name);
+		goto out_close;
+	}
+
+	if (get_unaligned((uint32_t *)&buf[16]) != crc) {
+		TRACE_PR("PR journal '%s' doesn't belong to the loaded PR file",
+			dev->pr_journal_name);
+		goto out_close;
+	}
+
+	pos = SCST_PR_JOURNAL_HDR_LEN;
+	while (pos + SCST_PR_JREC_HDR_LEN <= file_size) {
+		uint8_t type = buf[pos], *p, *tid = NULL;
+		int len = get_unaligned((uint16_t *)&buf[pos + 1]);
+		int data_len;
+		uint16_t rel_tgt_id = 0;
+		struct scst_dev_registrant *reg = NULL;
+
+		if (pos + SCST_PR_JREC_HDR_LEN + len + 4 > file_size)
+			break;
+
+		p = &buf[pos + SCST_PR_JREC_HDR_LEN];
+		if (crc32_le(~0, &buf[pos], SCST_PR_JREC_HDR_LEN + len) !=
+		    get_unaligned((uint32_t *)&p[len]))
+			break;
+
+		switch (type) {
+		case SCST_PR_JREC_REG:
+			data_len = sizeof(__be64);
+			break;
+		case SCST_PR_JREC_UNREG:
+			data_len = 0;
+			break;
+		case SCST_PR_JREC_RSV:
+			data_len = 4;
+			break;
+		default:
+			data_len = -1;
+			break;
+		}
+		if ((data_len < 0) || (len < data_len))
+			break;
+
+		if (len > data_len) {
+			if (len < data_len + 4)
+				break;
+			tid = &p[data_len];
+			if (len != data_len + scst_tid_size(tid) +
+					sizeof(rel_tgt_id))
+				break;
+			rel_tgt_id = get_unaligned((uint16_t *)&p[len -
+						sizeof(rel_tgt_id)]);
+			reg = scst_pr_find_reg(dev, tid, rel_tgt_id);
+		} else if (type != SCST_PR_JREC_RSV)
+			break;
+
+		switch (type) {
+		case SCST_PR_JREC_REG:
+			if (reg == NULL) {
+				reg = scst_pr_add_registrant(dev, tid,
+					rel_tgt_id, get_unaligned((__be64 *)p),
+					false);
+				if (reg == NULL) {
+					res = -ENOMEM;
+					goto out_close;
+				}
+			} else
+				scst_pr_set_reg_key(dev, reg,
+					get_unaligned((__be64 *)p));
+			break;
+		case SCST_PR_JREC_UNREG:
+			if (reg != NULL)
+				scst_pr_remove_registrant(dev, reg);
+			break;
+		case SCST_PR_JREC_RSV:
+			dev->pr_aptpl = p[0] ? 1 : 0;
+			dev->pr_is_set = p[1] ? 1 : 0;
+			dev->pr_type = p[2];
+			dev->pr_scope = p[3];
+			dev->pr_holder = reg;
+			break;
+		}
+
+		pos += SCST_PR_JREC_HDR_LEN + len + 4;
+		cnt++;
+	}
+
+	if (pos != file_size)
+		PRINT_WARNING("Dropped incomplete tail of PR journal '%s' "
+			"(offset %lld, size %lld)", dev->pr_journal_name, pos,
+			file_size);
+
+	TRACE_PR("Replayed %d records from PR journal '%s'", cnt,
+		dev->pr_journal_name);
+
+out_close:
+	filp_close(file, NULL);
+
+out:
+	if (buf != NULL)
+		vfree(buf);
 
+	TRACE_EXIT_RES(res);
+	return res;
+}
 
 /* Called under scst_mutex */
 static int scst_pr_do_load_device_file(struct scst_device *dev,
-	const char *file_name)
+	const char *file_name, uint32_t *crc)
 {
 	int res = 0, rc;
 	struct file *file = NULL;
@@ -811,6 +1592,8 @@ static int scst_pr_do_load_device_file(struct scst_device *dev,
 			dev->pr_holder = reg;
 	}
 
+	*crc = crc32_le(~0, (uint8_t *)buf, file_size);
+
 out_close:
 	filp_close(file, NULL);
 
@@ -825,33 +1608,42 @@ out:
 static int scst_pr_load_device_file(struct scst_device *dev)
 {
 	int res, rc;
+	uint32_t crc;
 
 	TRACE_ENTRY();
 
 	scst_assert_pr_mutex_held(dev);
 
-	if (dev->pr_file_name == NULL || dev->pr_file_name1 == NULL) {
+	if (dev->pr_file_name == NULL || dev->pr_file_name1 == NULL ||
+	    dev->pr_journal_name == NULL) {
 		PRINT_ERROR("Invalid file paths for '%s'", dev->virt_name);
 		res = -EINVAL;
 		goto out;
 	}
 
-	res = scst_pr_do_load_device_file(dev, dev->pr_file_name);
+	/* The next change will write the loaded state into a new PR file */
+	scst_pr_journal_close(dev);
+
+	res = scst_pr_do_load_device_file(dev, dev->pr_file_name, &crc);
 	if (res == 0)
-		goto out_dump;
+		goto out_replay;
 	else if (res == -ENOMEM)
 		goto out;
 
 	rc = res;
 
-	res = scst_pr_do_load_device_file(dev, dev->pr_file_name1);
+	res = scst_pr_do_load_device_file(dev, dev->pr_file_name1, &crc);
 	if (res != 0) {
 		if (res == -ENOENT)
 			res = rc;
 		goto out;
 	}
 
-out_dump:
+out_replay:
+	res = scst_pr_replay_journal(dev, crc);
+	if (res != 0)
+		goto out;
+
 	scst_pr_dump_prs(dev, false);
 
 out:
@@ -859,193 +1651,6 @@ out:
 	return res;
 }
 
-static void scst_pr_remove_device_files(struct scst_device *dev)
-{
-	TRACE_ENTRY();
-
-	scst_assert_pr_mutex_held(dev);
-
-	if (dev->pr_file_name)
-		scst_remove_file(dev->pr_file_name);
-	if (dev->pr_file_name1)
-		scst_remove_file(dev->pr_file_name1);
-
-	TRACE_EXIT();
-	return;
-}
-
-/* Must be called under dev_pr_mutex */
-void scst_pr_sync_device_file(struct scst_device *dev)
-{
-	int res = 0;
-	struct file *file;
-	loff_t pos = 0;
-	uint64_t sign;
-	uint64_t version;
-	uint8_t pr_is_set, aptpl;
-	struct scst_dev_registrant *reg;
-
-	TRACE_ENTRY();
-
-	scst_assert_pr_mutex_held(dev);
-
-	if ((dev->pr_aptpl == 0) || list_empty(&dev->dev_registrants_list)) {
-		scst_pr_remove_device_files(dev);
-		goto out;
-	}
-
-	scst_copy_file(dev->pr_file_name, dev->pr_file_name1);
-
-	file = filp_open(dev->pr_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (IS_ERR(file)) {
-		res = PTR_ERR(file);
-		PRINT_ERROR("Unable to (re)create PR file '%s' - error %d",
-			dev->pr_file_name, res);
-		goto out;
-	}
-
-	TRACE_PR("Updating pr file '%s'", dev->pr_file_name);
-
-	/*
-	 * signature
-	 */
-	sign = 0;
-	pos = 0;
-	res = kernel_write(file, &sign, sizeof(sign), &pos);
-	if (res != sizeof(sign))
-		goto write_error;
-
-	/*
-	 * version
-	 */
-	version = SCST_PR_FILE_VERSION;
-	res = kernel_write(file, &version, sizeof(version), &pos);
-	if (res != sizeof(version))
-		goto write_error;
-
-	/*
-	 * APTPL
-	 */
-	aptpl = dev->pr_aptpl;
-	res = kernel_write(file, &aptpl, sizeof(aptpl), &pos);
-	if (res != sizeof(aptpl))
-		goto write_error;
-
-	/*
-	 * reservation
-	 */
-	pr_is_set = dev->pr_is_set;
-	res = kernel_write(file, &pr_is_set, sizeof(pr_is_set), &pos);
-	if (res != sizeof(pr_is_set))
-		goto write_error;
-
-	res = kernel_write(file, &dev->pr_type, sizeof(dev->pr_type), &pos);
-	if (res != sizeof(dev->pr_type))
-		goto write_error;
-
-	res = kernel_write(file, &dev->pr_scope, sizeof(dev->pr_scope), &pos);
-	if (res != sizeof(dev->pr_scope))
-		goto write_error;
-
-	/*
-	 * registration records
-	 */
-	list_for_each_entry(reg, &dev->dev_registrants_list,
-			    dev_registrants_list_entry) {
-		uint8_t is_holder = 0;
-		int size;
-
-		is_holder = (dev->pr_holder == reg);
-
-		res = kernel_write(file, &is_holder, sizeof(is_holder), &pos);
-		if (res != sizeof(is_holder))
-			goto write_error;
-
-		size = scst_tid_size(reg->transport_id);
-		res = kernel_write(file, reg->transport_id, size, &pos);
-		if (res != size)
-			goto write_error;
-
-		res = kernel_write(file, &reg->key, sizeof(reg->key), &pos);
-		if (res != sizeof(reg->key))
-			goto write_error;
-
-		res = kernel_write(file, &reg->rel_tgt_id,
-				   sizeof(reg->rel_tgt_id), &pos);
-		if (res != sizeof(reg->rel_tgt_id))
-			goto write_error;
-	}
-
-	res = vfs_fsync(file, 1);
-	if (res != 0) {
-		PRINT_ERROR("fsync() of the PR file failed: %d", res);
-		goto write_error_close;
-	}
-
-	sign = SCST_PR_FILE_SIGN;
-	pos = 0;
-	res = kernel_write(file, &sign, sizeof(sign), &pos);
-	if (res != sizeof(sign))
-		goto write_error;
-
-	res = vfs_fsync(file, 1);
-	if (res != 0) {
-		PRINT_ERROR("fsync() of the PR file failed: %d", res);
-		goto write_error_close;
-	}
-
-	res = 0;
-
-	filp_close(file, NULL);
-
-out:
-	if (res != 0) {
-		PRINT_CRIT_ERROR("Unable to save persistent information "
-				 "(device %s)", dev->virt_name);
-		 /*
-		  * It's safer to not return any error to the initiator and expect
-		  * operator's intervention to be able to save the PR's state next
-		  * time, than to screw up all the interactions with this initiator.
-		  */
-	}
-
-	TRACE_EXIT();
-	return;
-
-write_error:
-	PRINT_ERROR("Error writing to '%s' - error %d", dev->pr_file_name, res);
-
-write_error_close:
-	filp_close(file, NULL);
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 39)
-	{
-		struct nameidata nd;
-		int rc;
-
-		rc = path_lookup(dev->pr_file_name, 0,	&nd);
-		if (!rc)
-			scst_vfs_unlink_and_put(&nd);
-		else
-			TRACE_PR("Unable to lookup '%s' - error %d",
-				dev->pr_file_name, rc);
-	}
-#else
-	{
-		struct path path;
-		int rc;
-
-		rc = kern_path(dev->pr_file_name, 0, &path);
-		if (!rc)
-			scst_vfs_unlink_and_put(&path);
-		else
-			TRACE_PR("Unable to lookup '%s' - error %d",
-				dev->pr_file_name, rc);
-	}
-#endif
-	goto out;
-}
-
-
 /**
  * scst_pr_set_file_name - set name of file in which to save PR information
  * @dev:  SCST device.
@@ -1061,7 +1666,7 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 			  const char *fmt, ...)
 {
 	va_list args;
-	char *pr_file_name = NULL, *bkp = NULL;
+	char *pr_file_name = NULL, *bkp = NULL, *jrnl = NULL;
 	int file_mode, res = -EINVAL;
 
 	scst_assert_pr_mutex_held(dev);
@@ -1103,6 +1708,11 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 		PRINT_ERROR("Unable to kasprintf() backup PR file name");
 		goto out;
 	}
+	jrnl = kasprintf(GFP_KERNEL, "%s.jrnl", pr_file_name);
+	if (!jrnl) {
+		PRINT_ERROR("Unable to kasprintf() PR journal file name");
+		goto out;
+	}
 	if (prev) {
 		*prev = dev->pr_file_name;
 		dev->pr_file_name = pr_file_name;
@@ -1110,18 +1720,24 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 	} else
 		swap(dev->pr_file_name, pr_file_name);
 	swap(dev->pr_file_name1, bkp);
+	swap(dev->pr_journal_name, jrnl);
 	res = 0;
 
 out:
 	kfree(pr_file_name);
 	kfree(bkp);
+	kfree(jrnl);
 	return res;
 }
 
 /* Initialize the PR members in *dev. */
 int scst_pr_init(struct scst_device *dev)
 {
+	int i;
+
 	mutex_init(&dev->dev_pr_mutex);
+	mutex_init(&dev->pr_journal_sync_mutex);
+	dev->pr_journal_need_compact = 1;
 	dev->cl_ops = &scst_no_dlm_cl_ops;
 	dev->pr_generation = 0;
 	dev->pr_is_set = 0;
@@ -1129,6 +1745,11 @@ int scst_pr_init(struct scst_device *dev)
 	dev->pr_scope = SCOPE_LU;
 	dev->pr_type = TYPE_UNSPECIFIED;
 	INIT_LIST_HEAD(&dev->dev_registrants_list);
+	for (i = 0; i < SCST_PR_REG_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&dev->dev_registrants_tid_hash[i]);
+		INIT_LIST_HEAD(&dev->dev_registrants_key_hash[i]);
+	}
+	dev->pr_verdict_gen = 1;
 
 	return 0;
 }
@@ -1137,6 +1758,8 @@ int scst_pr_init(struct scst_device *dev)
 void scst_pr_cleanup(struct scst_device *dev)
 {
 	dev->cl_ops->pr_cleanup(dev);
+	/* No commands can reference dev anymore */
+	kfree(rcu_dereference_protected(dev->pr_snapshot, 1));
 }
 
 /* Caller must hold scst_mutex and activity must be suspended. */
@@ -1189,6 +1812,9 @@ int scst_pr_init_dev(struct scst_device *dev)
 	if (res == -ENOENT)
 		res = 0;
 
+	dev->pr_verdict_gen++;
+	scst_pr_publish_snapshot(dev);
+
 	TRACE_EXIT_RES(res);
 	return res;
 }
@@ -1200,8 +1826,15 @@ void scst_pr_clear_dev(struct scst_device *dev)
 
 	scst_pr_remove_registrants(dev);
 
+	if (dev->pr_journal_file != NULL) {
+		filp_close(dev->pr_journal_file, NULL);
+		dev->pr_journal_file = NULL;
+	}
+	kfree(dev->pr_journal_buf);
+
 	kfree(dev->pr_file_name);
 	kfree(dev->pr_file_name1);
+	kfree(dev->pr_journal_name);
 
 	TRACE_EXIT();
 	return;
@@ -1366,7 +1999,8 @@ static int scst_pr_register_with_spec_i_pt(struct scst_cmd *cmd,
 					TRACE_PR("Changing key of reg %p "
 						"(tgt_dev %p)", reg, t);
 					reg->rollback_key = reg->key;
-					reg->key = action_key;
+					scst_pr_set_reg_key(dev, reg,
+						action_key);
 				} else
 					continue;
 
@@ -1382,7 +2016,7 @@ static int scst_pr_register_with_spec_i_pt(struct scst_cmd *cmd,
 				TRACE_PR("Changing key of reg %p (tgt_dev %p)",
 					reg, reg->tgt_dev);
 				reg->rollback_key = reg->key;
-				reg->key = action_key;
+				scst_pr_set_reg_key(dev, reg, action_key);
 			} else {
 				reg = scst_pr_add_registrant(dev, transport_id,
 						rel_tgt_id, action_key, false);
@@ -1657,7 +2291,8 @@ out_rollback:
 		if (reg->rollback_key == 0)
 			scst_pr_remove_registrant(cmd->dev, reg);
 		else {
-			reg->key = reg->rollback_key;
+			scst_pr_set_reg_key(cmd->dev, reg,
+				reg->rollback_key);
 			reg->rollback_key = 0;
 		}
 	}
@@ -1737,7 +2372,7 @@ void scst_pr_register(struct scst_cmd *cmd, uint8_t *buffer, int buffer_size)
 			else
 				scst_pr_unregister(dev, reg);
 		} else
-			reg->key = action_key;
+			scst_pr_set_reg_key(dev, reg, action_key);
 	}
 
 	dev->pr_generation++;
@@ -1804,7 +2439,7 @@ void scst_pr_register_and_ignore(struct scst_cmd *cmd, uint8_t *buffer,
 			else
 				scst_pr_unregister(dev, reg);
 		} else
-			reg->key = action_key;
+			scst_pr_set_reg_key(dev, reg, action_key);
 	}
 
 	dev->pr_generation++;
@@ -1934,7 +2569,7 @@ void scst_pr_register_and_move(struct scst_cmd *cmd, uint8_t *buffer,
 		}
 	} else if (reg_move->key != action_key) {
 		TRACE_PR("Changing key for reg %p", reg);
-		reg_move->key = action_key;
+		scst_pr_set_reg_key(dev, reg_move, action_key);
 	}
 
 	TRACE_PR("Register and move: from initiator %s/%d (%p, tgt_dev %p) to "
@@ -2481,64 +3116,185 @@ out:
 
 }
 
-/* Check if command allowed in presence of reservation */
-bool scst_pr_is_cmd_allowed(struct scst_cmd *cmd)
+/*
+ * Returns which commands of the I_T nexus with registrant @reg a reservation
+ * with parameters @is_set and @type allows, as one of SCST_PR_VERDICT_*
+ * values. @is_holder tells whether that I_T nexus holds the reservation.
+ */
+static int scst_pr_verdict(bool is_set, uint8_t type, bool is_holder,
+	const struct scst_dev_registrant *reg)
 {
-	bool allowed;
-	struct scst_device *dev = cmd->dev;
-	struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
-	struct scst_dev_registrant *reg;
-	uint8_t type;
-
-	TRACE_ENTRY();
-
-	scst_pr_read_lock(dev);
-
-	TRACE_DBG("Testing if command %s (%s) from %s allowed to execute",
-		cmd->op_name, scst_get_opcode_name(cmd), cmd->sess->initiator_name);
+	int verdict;
 
-	/* Recheck, because it can change while we were waiting for the lock */
-	if (unlikely(!dev->pr_is_set)) {
-		allowed = true;
-		goto out_unlock;
+	if (!is_set) {
+		verdict = SCST_PR_VERDICT_ALL;
+		goto out;
 	}
 
-	reg = tgt_dev->registrant;
-	type = dev->pr_type;
-
 	switch (type) {
 	case TYPE_WRITE_EXCLUSIVE:
-		if (reg && reg == dev->pr_holder)
-			allowed = true;
+		if (is_holder)
+			verdict = SCST_PR_VERDICT_ALL;
 		else
-			allowed = (cmd->op_flags & SCST_WRITE_EXCL_ALLOWED) != 0;
+			verdict = SCST_PR_VERDICT_WRITE_EXCL;
 		break;
 
 	case TYPE_EXCLUSIVE_ACCESS:
-		if (reg && reg == dev->pr_holder)
-			allowed = true;
+		if (is_holder)
+			verdict = SCST_PR_VERDICT_ALL;
 		else
-			allowed = (cmd->op_flags & SCST_EXCL_ACCESS_ALLOWED) != 0;
+			verdict = SCST_PR_VERDICT_EXCL_ACCESS;
 		break;
 
 	case TYPE_WRITE_EXCLUSIVE_REGONLY:
 	case TYPE_WRITE_EXCLUSIVE_ALL_REG:
 		if (reg)
-			allowed = true;
+			verdict = SCST_PR_VERDICT_ALL;
 		else
-			allowed = (cmd->op_flags & SCST_WRITE_EXCL_ALLOWED) != 0;
+			verdict = SCST_PR_VERDICT_WRITE_EXCL;
 		break;
 
 	case TYPE_EXCLUSIVE_ACCESS_REGONLY:
 	case TYPE_EXCLUSIVE_ACCESS_ALL_REG:
 		if (reg)
-			allowed = true;
+			verdict = SCST_PR_VERDICT_ALL;
 		else
-			allowed = (cmd->op_flags & SCST_EXCL_ACCESS_ALLOWED) != 0;
+			verdict = SCST_PR_VERDICT_EXCL_ACCESS;
 		break;
 
 	default:
 		PRINT_ERROR("Invalid PR type %x", type);
+		verdict = SCST_PR_VERDICT_NONE;
+		break;
+	}
+
+out:
+	return verdict;
+}
+
+/**
+ * scst_pr_publish_snapshot() - publish the reservation state for the I/O path
+ * @dev: SCST device.
+ *
+ * Replaces dev->pr_snapshot with a copy of the current reservation state.
+ * If the copy can't be allocated, dev->pr_snapshot is cleared and
+ * scst_pr_is_cmd_allowed() falls back to dev_pr_mutex.
+ *
+ * Must be called under dev_pr_mutex or before dev is on the device list.
+ */
+void scst_pr_publish_snapshot(struct scst_device *dev)
+{
+	struct scst_dev_registrant *holder = dev->pr_holder;
+	struct scst_pr_snapshot *snap, *old;
+	int tid_size = 0;
+
+	scst_assert_pr_mutex_held(dev);
+
+	old = rcu_dereference_protected(dev->pr_snapshot, 1);
+
+	if (holder != NULL)
+		tid_size = scst_tid_size(holder->transport_id);
+
+	snap = kmalloc(sizeof(*snap) + tid_size, GFP_KERNEL);
+	if (snap != NULL) {
+		snap->gen = dev->pr_verdict_gen;
+		snap->is_set = dev->pr_is_set;
+		snap->type = dev->pr_type;
+		snap->has_holder = (holder != NULL);
+		if (holder != NULL) {
+			snap->holder_rel_tgt_id = holder->rel_tgt_id;
+			memcpy(snap->holder_tid, holder->transport_id,
+			       tid_size);
+		}
+	} else
+		PRINT_WARNING("Unable to allocate PR snapshot (dev %s), "
+			"falling back to locked PR checks", dev->virt_name);
+
+	/*
+	 * Orders the preceding updates of tgt_dev->registrant before the
+	 * new snapshot becomes visible.
+	 */
+	rcu_assign_pointer(dev->pr_snapshot, snap);
+
+	if (old != NULL)
+		kfree_rcu(old, rcu_head);
+	return;
+}
+
+/*
+ * Check if command allowed in presence of reservation.
+ *
+ * The reservation state is taken from dev->pr_snapshot without any locks.
+ * The verdict for the command's I_T nexus is additionally cached in
+ * tgt_dev->pr_verdict until the next modification of the PR data.
+ */
+bool scst_pr_is_cmd_allowed(struct scst_cmd *cmd)
+{
+	bool allowed;
+	struct scst_device *dev = cmd->dev;
+	struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
+	struct scst_pr_snapshot *snap;
+	struct scst_dev_registrant *reg;
+	unsigned long gen, cached;
+	bool is_holder;
+	int verdict;
+
+	TRACE_ENTRY();
+
+	TRACE_DBG("Testing if command %s (%s) from %s allowed to execute",
+		cmd->op_name, scst_get_opcode_name(cmd), cmd->sess->initiator_name);
+
+	rcu_read_lock();
+	snap = rcu_dereference(dev->pr_snapshot);
+	if (likely(snap != NULL)) {
+		/*
+		 * Pairs with rcu_assign_pointer() in
+		 * scst_pr_publish_snapshot(): tgt_dev->registrant must be at
+		 * least as recent as the snapshot.
+		 */
+		smp_rmb();
+		gen = snap->gen & (ULONG_MAX >> SCST_PR_VERDICT_SHIFT);
+		cached = READ_ONCE(tgt_dev->pr_verdict);
+		if (likely((cached >> SCST_PR_VERDICT_SHIFT) == gen))
+			verdict = cached & SCST_PR_VERDICT_MASK;
+		else {
+			/*
+			 * reg may be freed any time, so it's only tested for
+			 * NULL. The holder is identified by its I_T nexus,
+			 * which is the one of tgt_dev if it's registered.
+			 */
+			reg = READ_ONCE(tgt_dev->registrant);
+			is_holder = (reg != NULL) && snap->has_holder &&
+				(tgt_dev->sess->tgt->rel_tgt_id ==
+					snap->holder_rel_tgt_id) &&
+				tid_equal(tgt_dev->sess->transport_id,
+					  snap->holder_tid);
+			verdict = scst_pr_verdict(snap->is_set, snap->type,
+				is_holder, reg);
+			tgt_dev->pr_verdict = (gen << SCST_PR_VERDICT_SHIFT) |
+				verdict;
+		}
+		rcu_read_unlock();
+	} else {
+		rcu_read_unlock();
+		scst_pr_read_lock(dev);
+		reg = tgt_dev->registrant;
+		verdict = scst_pr_verdict(dev->pr_is_set, dev->pr_type,
+			(reg != NULL) && (reg == dev->pr_holder), reg);
+		scst_pr_read_unlock(dev);
+	}
+
+	switch (verdict) {
+	case SCST_PR_VERDICT_ALL:
+		allowed = true;
+		break;
+	case SCST_PR_VERDICT_WRITE_EXCL:
+		allowed = (cmd->op_flags & SCST_WRITE_EXCL_ALLOWED) != 0;
+		break;
+	case SCST_PR_VERDICT_EXCL_ACCESS:
+		allowed = (cmd->op_flags & SCST_EXCL_ACCESS_ALLOWED) != 0;
+		break;
+	default:
 		allowed = false;
 		break;
 	}
@@ -2552,9 +3308,6 @@ bool scst_pr_is_cmd_allowed(struct scst_cmd *cmd)
 			cmd->op_name, scst_get_opcode_name(cmd),
 			cmd->sess->initiator_name);
 
-out_unlock:
-	scst_pr_read_unlock(dev);
-
 	TRACE_EXIT_RES(allowed);
 	return allowed;
 }
@@ -20,6 +20,7 @@
 #define SCST_PRES_H_
 
 #include <linux/delay.h>
+#include <linux/rcupdate.h>
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst_debug.h>
 #else
@@ -54,6 +55,38 @@
 /* Persistent reservation SCOPE field */
 #define SCOPE_LU				0x00
 
+/* Values of the low bits of tgt_dev->pr_verdict */
+#define SCST_PR_VERDICT_SHIFT		2
+#define SCST_PR_VERDICT_MASK		((1 << SCST_PR_VERDICT_SHIFT) - 1)
+/* All commands allowed */
+#define SCST_PR_VERDICT_ALL		0
+/* Only commands with SCST_WRITE_EXCL_ALLOWED allowed */
+#define SCST_PR_VERDICT_WRITE_EXCL	1
+/* Only commands with SCST_EXCL_ACCESS_ALLOWED allowed */
+#define SCST_PR_VERDICT_EXCL_ACCESS	2
+/* No commands allowed */
+#define SCST_PR_VERDICT_NONE		3
+
+/*
+ * Reservation state as seen by scst_pr_is_cmd_allowed(). Never modified after
+ * having been published in dev->pr_snapshot.
+ */
+struct scst_pr_snapshot {
+	struct rcu_head rcu_head;
+	/* Value of dev->pr_verdict_gen this snapshot belongs to */
+	unsigned long gen;
+	bool is_set;
+	uint8_t type;
+	/*
+	 * I_T nexus of the holder, if has_holder is set. A copy rather than a
+	 * pointer to the registrant, because that can be freed and its memory
+	 * reused for another registrant while the snapshot is still in use.
+	 */
+	bool has_holder;
+	uint16_t holder_rel_tgt_id;
+	uint8_t holder_tid[];
+};
+
 static inline bool scst_pr_type_valid(uint8_t type)
 {
 	switch (type) {
@@ -69,6 +102,8 @@ static inline bool scst_pr_type_valid(uint8_t type)
 	}
 }
 
+void scst_pr_publish_snapshot(struct scst_device *dev);
+
 static inline void scst_pr_read_lock(struct scst_device *dev)
 {
 	mutex_lock(&dev->dev_pr_mutex);
@@ -91,6 +126,9 @@ static inline void scst_pr_write_lock(struct scst_device *dev)
 
 static inline void scst_pr_write_unlock(struct scst_device *dev)
 {
+	/* Invalidate the cached verdicts of scst_pr_is_cmd_allowed() */
+	dev->pr_verdict_gen++;
+	scst_pr_publish_snapshot(dev);
 	mutex_unlock(&dev->dev_pr_mutex);
 }
 
@@ -142,12 +180,15 @@ struct scst_dev_registrant *scst_pr_add_registrant(struct scst_device *dev,
 						   bool dev_lock_locked);
 void scst_pr_remove_registrant(struct scst_device *dev,
 			       struct scst_dev_registrant *reg);
+void scst_pr_set_reg_key(struct scst_device *dev,
+			 struct scst_dev_registrant *reg, __be64 key);
 void scst_pr_set_holder(struct scst_device *dev,
 			struct scst_dev_registrant *holder, uint8_t scope,
 			uint8_t type);
 void scst_pr_clear_holder(struct scst_device *dev);
 
-void scst_pr_sync_device_file(struct scst_device *dev);
+unsigned int scst_pr_sync_device_file(struct scst_device *dev);
+void scst_pr_commit_device_file(struct scst_device *dev, unsigned int seq);
 
 #if defined(CONFIG_SCST_DEBUG) || defined(CONFIG_SCST_TRACING)
 void scst_pr_dump_prs(struct scst_device *dev, bool force);
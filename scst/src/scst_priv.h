@@ -480,6 +480,7 @@ void scst_tg_init(void);
 void scst_tg_cleanup(void);
 int scst_dg_add(struct kobject *parent, const char *name);
 int scst_dg_remove(const char *name);
+int scst_dg_set_stpg_mode(struct scst_dev_group *dg, enum scst_stpg_mode mode);
 struct scst_dev_group *scst_lookup_dg_by_kobj(struct kobject *kobj);
 struct scst_dev_group *scst_lookup_dg_by_dev(struct scst_device *dev);
 int scst_dg_dev_add(struct scst_dev_group *dg, const char *name);
@@ -6642,6 +6642,24 @@ static struct kobj_attribute scst_tg_state =
 	__ATTR(state, S_IRUGO | S_IWUSR, scst_tg_state_show,
 	       scst_tg_state_store);
 
+static ssize_t scst_tg_stpg_stats_show(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       char *buf)
+{
+	struct scst_target_group *tg;
+
+	tg = container_of(kobj, struct scst_target_group, kobj);
+	return scnprintf(buf, PAGE_SIZE,
+			 "transitions %u\nlast_us %llu\nmax_us %llu\n"
+			 "total_us %llu\n", tg->stpg_count,
+			 (unsigned long long)tg->stpg_last_us,
+			 (unsigned long long)tg->stpg_max_us,
+			 (unsigned long long)tg->stpg_total_us);
+}
+
+static struct kobj_attribute scst_tg_stpg_stats =
+	__ATTR(stpg_stats, S_IRUGO, scst_tg_stpg_stats_show, NULL);
+
 static ssize_t scst_tg_mgmt_show(struct kobject *kobj,
 				 struct kobj_attribute *attr,
 				 char *buf)
@@ -6732,6 +6750,7 @@ static const struct attribute *scst_tg_attrs[] = {
 	&scst_tg_group_id.attr,
 	&scst_tg_preferred.attr,
 	&scst_tg_state.attr,
+	&scst_tg_stpg_stats.attr,
 	NULL,
 };
 
@@ -6860,6 +6879,90 @@ static const struct attribute *scst_dg_tgs_attrs[] = {
  ** SCST sysfs device_groups directory implementation.
  **/
 
+static const char *const scst_stpg_mode_names[] = {
+	[SCST_STPG_MODE_BLOCK]		= "block",
+	[SCST_STPG_MODE_TRANSITIONING]	= "transitioning",
+};
+
+static ssize_t scst_dg_stpg_mode_show(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      char *buf)
+{
+	struct scst_dev_group *dg;
+
+	dg = container_of(kobj, struct scst_dev_group, kobj);
+	return scnprintf(buf, PAGE_SIZE, "%s\n%s",
+			 scst_stpg_mode_names[dg->stpg_mode],
+			 dg->stpg_mode != SCST_STPG_MODE_BLOCK ?
+			 SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static int scst_dg_stpg_mode_store_work_fn(struct scst_sysfs_work_item *w)
+{
+	struct scst_dev_group *dg;
+	char *cmd, *p;
+	int i, res;
+
+	TRACE_ENTRY();
+	cmd = w->buf;
+	dg = container_of(w->kobj, struct scst_dev_group, kobj);
+	p = strchr(cmd, '\n');
+	if (p)
+		*p = '\0';
+	res = -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(scst_stpg_mode_names); i++) {
+		if (strcasecmp(cmd, scst_stpg_mode_names[i]) == 0) {
+			res = scst_dg_set_stpg_mode(dg, i);
+			break;
+		}
+	}
+
+	kobject_put(w->kobj);
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static ssize_t scst_dg_stpg_mode_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	char *cmd;
+	struct scst_sysfs_work_item *work;
+	int res;
+
+	res = -ENOMEM;
+	cmd = kasprintf(GFP_KERNEL, "%.*s", (int)count, buf);
+	if (!cmd)
+		goto out;
+
+	res = scst_alloc_sysfs_work(scst_dg_stpg_mode_store_work_fn, false,
+				    &work);
+	if (res)
+		goto out;
+
+	swap(work->buf, cmd);
+	work->kobj = kobj;
+	SCST_SET_DEP_MAP(work, &scst_dg_dep_map);
+	kobject_get(kobj);
+	res = scst_sysfs_queue_wait_work(work);
+	if (res)
+		goto out;
+	res = count;
+
+out:
+	kfree(cmd);
+	return res;
+}
+
+static struct kobj_attribute scst_dg_stpg_mode =
+	__ATTR(stpg_mode, S_IRUGO | S_IWUSR, scst_dg_stpg_mode_show,
+	       scst_dg_stpg_mode_store);
+
+static const struct attribute *scst_dg_attrs[] = {
+	&scst_dg_stpg_mode.attr,
+	NULL,
+};
+
 int scst_dg_sysfs_add(struct kobject *parent, struct scst_dev_group *dg)
 {
 	int res;
@@ -6867,6 +6970,9 @@ int scst_dg_sysfs_add(struct kobject *parent, struct scst_dev_group *dg)
 	dg->dev_kobj = NULL;
 	dg->tg_kobj = NULL;
 	res = kobject_add(&dg->kobj, parent, "%s", dg->name);
+	if (res)
+		goto err;
+	res = sysfs_create_files(&dg->kobj, scst_dg_attrs);
 	if (res)
 		goto err;
 	res = -EEXIST;
@@ -6903,6 +7009,7 @@ void scst_dg_sysfs_del(struct scst_dev_group *dg)
 		kobject_put(dg->dev_kobj);
 		dg->dev_kobj = NULL;
 	}
+	sysfs_remove_files(&dg->kobj, scst_dg_attrs);
 	kobject_del(&dg->kobj);
 }
 
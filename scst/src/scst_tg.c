@@ -525,6 +525,18 @@ static int (*scst_alua_filter[])(struct scst_cmd *cmd) = {
 	[SCST_TG_STATE_TRANSITIONING]	= scst_tg_accept_transitioning,
 };
 
+/*
+ * ALUA state that determines the filter of the LUNs of target group @tg. Since
+ * the LUNs of a target group that is being changed by an STPG in
+ * SCST_STPG_MODE_TRANSITIONING mode report the transitioning state while
+ * tg->state still holds the state from before the STPG, these two can differ.
+ */
+static enum scst_tg_state scst_tg_filter_state(struct scst_target_group *tg)
+{
+	return tg->stpg_transitioning ? SCST_TG_STATE_TRANSITIONING :
+		tg->state;
+}
+
 /*
  * Check whether the tgt_dev ALUA filter is consistent with the target group
  * ALUA state.
@@ -552,7 +564,7 @@ static void scst_check_alua_invariant(void)
 			tg = dg ?
 			    __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt) :
 			    NULL;
-			expected_state = tg ? tg->state :
+			expected_state = tg ? scst_tg_filter_state(tg) :
 				SCST_TG_STATE_OPTIMIZED;
 			if (tgt_dev->alua_filter !=
 				   scst_alua_filter[expected_state]) {
@@ -607,7 +619,8 @@ void scst_tg_init_tgt_dev(struct scst_tgt_dev *tgt_dev)
 	if (dg) {
 		tg = __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt);
 		if (tg) {
-			scst_update_tgt_dev_alua_filter(tgt_dev, tg->state);
+			scst_update_tgt_dev_alua_filter(tgt_dev,
+						scst_tg_filter_state(tg));
 			scst_check_alua_invariant();
 		}
 	}
@@ -631,7 +644,7 @@ static void scst_update_tgt_alua_filter(struct scst_target_group *tg,
 				    dev_tgt_dev_list_entry) {
 			if (tgt_dev->acg_dev->acg->tgt == tgt)
 				scst_update_tgt_dev_alua_filter(tgt_dev,
-								tg->state);
+						scst_tg_filter_state(tg));
 		}
 	}
 
@@ -662,6 +675,18 @@ static void scst_reset_tgt_alua_filter(struct scst_target_group *tg,
 	scst_check_alua_invariant();
 }
 
+/* Update the ALUA filter of all tgt_devs associated with target group @tg. */
+static void scst_update_tg_alua_filter(struct scst_target_group *tg)
+{
+	struct scst_tg_tgt *tg_tgt;
+
+	lockdep_assert_held(&scst_dg_mutex);
+
+	list_for_each_entry(tg_tgt, &tg->tgt_list, entry)
+		if (tg_tgt->tgt)
+			scst_update_tgt_alua_filter(tg, tg_tgt->tgt);
+}
+
 /*
  * scst_tg_tgt_add() - Add a target to a target group.
  */
@@ -887,6 +912,17 @@ out:
 	return res;
 }
 
+/* Account an STPG transition of target group @tg that took @us microseconds. */
+static void scst_tg_account_stpg(struct scst_target_group *tg, uint64_t us)
+{
+	lockdep_assert_held(&scst_dg_mutex);
+
+	tg->stpg_count++;
+	tg->stpg_last_us = us;
+	tg->stpg_max_us = max(tg->stpg_max_us, us);
+	tg->stpg_total_us += us;
+}
+
 static void scst_event_stpg_notify_fn(struct scst_event *event,
 				      void *priv, int status)
 {
@@ -896,6 +932,8 @@ static void scst_event_stpg_notify_fn(struct scst_event *event,
 		(struct scst_event_stpg_payload *)event->payload;
 	struct scst_event_stpg_descr *d;
 	struct scst_dg_dev *dgd;
+	struct scst_target_group *tg;
+	uint64_t duration_us;
 	int i;
 
 	TRACE_ENTRY();
@@ -923,6 +961,25 @@ static void scst_event_stpg_notify_fn(struct scst_event *event,
 		}
 	}
 
+	duration_us = ktime_to_us(ktime_sub(ktime_get(), dg->stpg_start));
+	for (i = 0, d = &p->stpg_descriptors[0]; i < p->stpg_descriptors_cnt;
+	     i++, d++) {
+		tg = __lookup_tg_by_group_id(dg, d->group_id);
+		if (tg)
+			scst_tg_account_stpg(tg, duration_us);
+	}
+
+	/*
+	 * Let the LUNs of the target groups for which user space did not set
+	 * a new state leave the transitioning state.
+	 */
+	list_for_each_entry(tg, &dg->tg_list, entry) {
+		if (!tg->stpg_transitioning)
+			continue;
+		tg->stpg_transitioning = false;
+		scst_update_tg_alua_filter(tg);
+	}
+
 	kfree(dg->stpg_transport_id);
 	dg->stpg_transport_id = NULL;
 
@@ -933,7 +990,7 @@ static void scst_event_stpg_notify_fn(struct scst_event *event,
 	}
 
 	for (i = 0, d = &p->stpg_descriptors[0]; i < p->stpg_descriptors_cnt; i++, d++) {
-		struct scst_target_group *tg = __lookup_tg_by_group_id(dg, d->group_id);
+		tg = __lookup_tg_by_group_id(dg, d->group_id);
 
 		if (!tg) {
 			PRINT_ERROR("STPG: unable to find TG %d", d->group_id);
@@ -986,6 +1043,8 @@ static void __scst_tg_set_state(struct scst_target_group *tg,
 		return;
 
 	tg->state = state;
+	/* The filters of all LUNs of @tg are updated below. */
+	tg->stpg_transitioning = false;
 
 	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
 		dev = dg_dev->dev;
@@ -1128,7 +1187,8 @@ static void scst_update_dev_alua_filter(struct scst_dev_group *dg,
 			    dev_tgt_dev_list_entry) {
 		tg = __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt);
 		if (tg)
-			scst_update_tgt_dev_alua_filter(tgt_dev, tg->state);
+			scst_update_tgt_dev_alua_filter(tgt_dev,
+						scst_tg_filter_state(tg));
 	}
 
 	scst_check_alua_invariant();
@@ -1370,6 +1430,22 @@ out:
 	return res;
 }
 
+int scst_dg_set_stpg_mode(struct scst_dev_group *dg, enum scst_stpg_mode mode)
+{
+	int res;
+
+	res = mutex_lock_interruptible(&scst_dg_mutex);
+	if (res)
+		goto out;
+	if (dg->stpg_mode != mode)
+		PRINT_INFO("Changed STPG mode of %s from %d into %d", dg->name,
+			   dg->stpg_mode, mode);
+	dg->stpg_mode = mode;
+	mutex_unlock(&scst_dg_mutex);
+out:
+	return res;
+}
+
 /*
  * Given a pointer to a device_groups/<dg>/devices or
  * device_groups/<dg>/target_groups kobject, return the pointer to the
@@ -1681,6 +1757,29 @@ struct osi {
 	enum scst_tg_state     new_state;
 };
 
+/*
+ * Let the LUNs of the target groups that are modified by an STPG report the
+ * transitioning state until user space has set the new state of their target
+ * group. Does not generate a unit attention since SPC-4 does not require one
+ * for a transition to the transitioning state.
+ */
+static void scst_stpg_set_transitioning(struct scst_dev_group *dg,
+					struct osi *osi, int tpg_desc_count)
+{
+	int j;
+
+	lockdep_assert_held(&scst_dg_mutex);
+
+	for (j = 0; j < tpg_desc_count; j++) {
+		if (osi[j].prev_state == osi[j].new_state)
+			continue;
+		TRACE_DBG("STPG: %s/%s is transitioning", dg->name,
+			  osi[j].tg->name);
+		osi[j].tg->stpg_transitioning = true;
+		scst_update_tg_alua_filter(osi[j].tg);
+	}
+}
+
 static int scst_emit_stpg_event(struct scst_cmd *cmd, struct scst_dev_group *dg,
 				struct osi *osi, int tpg_desc_count)
 {
@@ -1781,6 +1880,11 @@ static int scst_emit_stpg_event(struct scst_cmd *cmd, struct scst_dev_group *dg,
 	event_entry->notify_fn_priv = cmd;
 
 	mutex_lock(&scst_dg_mutex);
+	dg->stpg_start = ktime_get();
+	if (dg->stpg_mode == SCST_STPG_MODE_TRANSITIONING) {
+		scst_stpg_set_transitioning(dg, osi, tpg_desc_count);
+		goto unlock;
+	}
 	list_for_each_entry(dgd, &dg->dev_list, entry) {
 		int rc;
 
@@ -1809,6 +1913,7 @@ static int scst_emit_stpg_event(struct scst_cmd *cmd, struct scst_dev_group *dg,
 			break;
 		}
 	}
+unlock:
 	mutex_unlock(&scst_dg_mutex);
 
 	scst_stpg_check_blocking_done(wait);
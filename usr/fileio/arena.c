@@ -0,0 +1,184 @@
+/*
+ *  arena.c
+ *
+ *  Huge pages backed memory, from which data buffers are allocated, so
+ *  scst_user pins it only once, see SCST_USER_REGISTER_ARENA
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "arena.h"
+
+/*
+ * Maps size bytes of hugetlbfs pages or, if there aren't enough of them
+ * reserved, of transparent huge pages aligned on the huge page size.
+ */
+static int arena_map(struct arena *a)
+{
+	uint8_t *p, *aligned;
+	size_t len;
+	int res = 0;
+
+	p = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+		-1, 0);
+	if (p != MAP_FAILED) {
+		a->base = p;
+		a->hugetlb = true;
+		goto out;
+	}
+
+	len = a->size + ARENA_HUGE_PAGE_SIZE;
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		res = errno;
+		goto out;
+	}
+
+	aligned = (uint8_t *)(((uintptr_t)p + ARENA_HUGE_PAGE_SIZE - 1) &
+			      ~((uintptr_t)ARENA_HUGE_PAGE_SIZE - 1));
+	if (aligned != p)
+		munmap(p, aligned - p);
+	if (aligned + a->size != p + len)
+		munmap(aligned + a->size, p + len - (aligned + a->size));
+
+	/* Not fatal, the arena then just consists of small pages */
+	madvise(aligned, a->size, MADV_HUGEPAGE);
+
+	a->base = aligned;
+	a->hugetlb = false;
+
+out:
+	return res;
+}
+
+/* Returns 0 on success or errno */
+int arena_init(struct arena *a, size_t size)
+{
+	int res;
+
+	memset(a, 0, sizeof(*a));
+	a->size = (size + ARENA_HUGE_PAGE_SIZE - 1) &
+		  ~((size_t)ARENA_HUGE_PAGE_SIZE - 1);
+
+	a->block_orders = calloc(a->size >> ARENA_BLOCK_SHIFT,
+		sizeof(*a->block_orders));
+	if (a->block_orders == NULL) {
+		res = ENOMEM;
+		goto out;
+	}
+
+	res = arena_map(a);
+	if (res != 0)
+		goto out_free;
+
+	pthread_mutex_init(&a->mutex, NULL);
+
+out:
+	return res;
+
+out_free:
+	free(a->block_orders);
+	a->block_orders = NULL;
+	goto out;
+}
+
+void arena_exit(struct arena *a)
+{
+	munmap(a->base, a->size);
+	a->base = NULL;
+	free(a->block_orders);
+	a->block_orders = NULL;
+	pthread_mutex_destroy(&a->mutex);
+	return;
+}
+
+static int arena_order(size_t size)
+{
+	int order = 0;
+
+	while (((size_t)1 << (order + ARENA_BLOCK_SHIFT)) < size)
+		order++;
+	return order;
+}
+
+/*
+ * Returns a block of at least size bytes or NULL, if the arena is exhausted
+ * or size is too big for it. Buffers are cached by SCST, so the same sizes
+ * are requested again and again and simple per order free lists are enough.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	int order = arena_order(size);
+	size_t bsize, align;
+	uint8_t *p = NULL;
+
+	if (order >= ARENA_ORDERS)
+		goto out;
+	bsize = (size_t)1 << (order + ARENA_BLOCK_SHIFT);
+
+	pthread_mutex_lock(&a->mutex);
+
+	p = a->free_blocks[order];
+	if (p != NULL) {
+		a->free_blocks[order] = *(void **)p;
+		goto out_set;
+	}
+
+	/* So that a block doesn't cross more huge pages than necessary */
+	align = (bsize < ARENA_HUGE_PAGE_SIZE) ? bsize : ARENA_HUGE_PAGE_SIZE;
+	a->top = (a->top + align - 1) & ~(align - 1);
+	if (a->top + bsize > a->size) {
+		p = NULL;
+		goto out_unlock;
+	}
+	p = a->base + a->top;
+	a->top += bsize;
+
+out_set:
+	a->block_orders[(p - a->base) >> ARENA_BLOCK_SHIFT] = order + 1;
+
+out_unlock:
+	pthread_mutex_unlock(&a->mutex);
+
+out:
+	return p;
+}
+
+/* Returns false, if p wasn't allocated from the arena */
+bool arena_free(struct arena *a, void *p)
+{
+	size_t idx;
+	int order;
+
+	if (!arena_contains(a, p))
+		return false;
+
+	idx = ((uint8_t *)p - a->base) >> ARENA_BLOCK_SHIFT;
+
+	pthread_mutex_lock(&a->mutex);
+	order = a->block_orders[idx] - 1;
+	EXTRACHECKS_BUG_ON(order < 0);
+	a->block_orders[idx] = 0;
+	*(void **)p = a->free_blocks[order];
+	a->free_blocks[order] = p;
+	pthread_mutex_unlock(&a->mutex);
+
+	return true;
+}
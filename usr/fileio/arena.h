@@ -0,0 +1,54 @@
+/*
+ *  arena.h
+ *
+ *  Huge pages backed memory, from which data buffers are allocated, so
+ *  scst_user pins it only once, see SCST_USER_REGISTER_ARENA
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+/* Blocks are 4KB << order, larger buffers are allocated outside the arena */
+#define ARENA_BLOCK_SHIFT	12
+#define ARENA_ORDERS		14
+
+#define ARENA_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+struct arena {
+	uint8_t *base;
+	size_t size;
+	bool hugetlb;		/* hugetlbfs pages, else transparent ones */
+
+	/* Protects all below */
+	pthread_mutex_t mutex;
+	/* Never allocated memory starts here */
+	size_t top;
+	/* Freed blocks of each order, linked through their first bytes */
+	void *free_blocks[ARENA_ORDERS];
+	/* Order + 1 of the allocated block starting at each 4KB, else 0 */
+	uint8_t *block_orders;
+};
+
+int arena_init(struct arena *a, size_t size);
+void arena_exit(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+bool arena_free(struct arena *a, void *p);
+
+static inline bool arena_contains(const struct arena *a, const void *p)
+{
+	return ((const uint8_t *)p >= a->base) &&
+	       ((const uint8_t *)p < a->base + a->size);
+}
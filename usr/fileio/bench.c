@@ -0,0 +1,287 @@
+/*
+ *  bench.c
+ *
+ *  Local random read benchmark of the synchronous and io_uring I/O engines,
+ *  run directly on the backing file without SCST.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "common.h"
+#include "uring.h"
+
+#define BENCH_IO_SIZE		4096
+#define BENCH_DEF_DEPTH		32
+
+struct bench_ctx {
+	int fd;
+	uint32_t io_size;
+	uint64_t nios;		/* I/Os of io_size in the file */
+	struct timespec end;
+	uint64_t done;
+	int res;
+	pthread_t thread;
+};
+
+static uint64_t bench_rand(uint64_t *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static bool bench_time_over(const struct bench_ctx *ctx)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec > ctx->end.tv_sec) ||
+	       ((now.tv_sec == ctx->end.tv_sec) &&
+		(now.tv_nsec >= ctx->end.tv_nsec));
+}
+
+static void *bench_sync_thread(void *arg)
+{
+	struct bench_ctx *ctx = arg;
+	uint64_t seed = (uintptr_t)ctx | 1;
+	void *buf;
+	ssize_t rc;
+
+	ctx->res = posix_memalign(&buf, BENCH_IO_SIZE, ctx->io_size);
+	if (ctx->res != 0)
+		goto out;
+
+	while (!bench_time_over(ctx)) {
+		loff_t off = (bench_rand(&seed) % ctx->nios) * ctx->io_size;
+
+		rc = pread(ctx->fd, buf, ctx->io_size, off);
+		if (rc != (ssize_t)ctx->io_size) {
+			ctx->res = (rc < 0) ? errno : EIO;
+			break;
+		}
+		ctx->done++;
+	}
+
+	free(buf);
+
+out:
+	return NULL;
+}
+
+static int bench_sync(struct bench_ctx *tmpl, int threads)
+{
+	struct bench_ctx ctx[threads];
+	int res = 0, i, started;
+
+	for (i = 0; i < threads; i++) {
+		ctx[i] = *tmpl;
+		res = pthread_create(&ctx[i].thread, NULL, bench_sync_thread,
+			&ctx[i]);
+		if (res != 0) {
+			PRINT_ERROR("pthread_create() failed: %s",
+				strerror(res));
+			break;
+		}
+	}
+	started = i;
+
+	tmpl->done = 0;
+	for (i = 0; i < started; i++) {
+		pthread_join(ctx[i].thread, NULL);
+		tmpl->done += ctx[i].done;
+		if ((ctx[i].res != 0) && (res == 0))
+			res = ctx[i].res;
+	}
+
+	return res;
+}
+
+#ifdef HAVE_IO_URING
+static void bench_uring_queue(struct uring *ring, struct bench_ctx *ctx,
+	struct iovec *iov, int i, uint64_t *seed)
+{
+	/* The ring has an SQE for each buffer */
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = ctx->fd;
+	sqe->addr = (unsigned long)&iov[i];
+	sqe->len = 1;
+	sqe->off = (bench_rand(seed) % ctx->nios) * ctx->io_size;
+	sqe->user_data = i;
+	return;
+}
+
+static int bench_uring(struct bench_ctx *ctx, int depth)
+{
+	struct uring ring;
+	struct io_uring_cqe *cqe;
+	struct iovec iov[depth];
+	uint64_t seed = (uintptr_t)ctx | 1;
+	uint8_t *bufs;
+	int res, i, inflight;
+	bool stop = false;
+
+	res = posix_memalign((void **)&bufs, BENCH_IO_SIZE,
+		depth * ctx->io_size);
+	if (res != 0)
+		goto out;
+
+	res = uring_init(&ring, depth);
+	if (res != 0) {
+		PRINT_ERROR("Unable to set up io_uring: %s", strerror(res));
+		goto out_free;
+	}
+
+	ctx->done = 0;
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = bufs + i * ctx->io_size;
+		iov[i].iov_len = ctx->io_size;
+		bench_uring_queue(&ring, ctx, iov, i, &seed);
+	}
+	inflight = depth;
+
+	while (inflight > 0) {
+		res = uring_submit(&ring, 1);
+		if ((res < 0) && (res != -EINTR)) {
+			res = -res;
+			PRINT_ERROR("io_uring_enter() failed: %s",
+				strerror(res));
+			goto out_exit;
+		}
+		res = 0;
+
+		stop = stop || bench_time_over(ctx);
+		while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+			int32_t cres = cqe->res;
+
+			i = cqe->user_data;
+			uring_cqe_seen(&ring);
+			inflight--;
+
+			if (cres != (int32_t)ctx->io_size) {
+				res = (cres < 0) ? -cres : EIO;
+				stop = true;
+			} else
+				ctx->done++;
+
+			if (!stop) {
+				bench_uring_queue(&ring, ctx, iov, i, &seed);
+				inflight++;
+			}
+		}
+	}
+
+out_exit:
+	uring_exit(&ring);
+
+out_free:
+	free(bufs);
+
+out:
+	return res;
+}
+#endif
+
+static void bench_report(const char *engine, const struct bench_ctx *ctx,
+	int secs)
+{
+	uint64_t iops = ctx->done / secs;
+
+	PRINT_INFO("	%-28s %10"PRIu64" IOPS %8"PRIu64" MB/s", engine, iops,
+		iops * ctx->io_size / (1024 * 1024));
+	return;
+}
+
+/*
+ * Reads random io_size blocks of the device's file for secs seconds first by
+ * threads threads with pread(), then by one thread with io_uring. Doesn't
+ * write anything, so it's safe on a file with data.
+ */
+int bench_dev(struct vdisk_dev *dev, int threads, int secs)
+{
+	struct bench_ctx ctx;
+	char engine[64];
+	int res, flags = O_RDONLY | O_LARGEFILE;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.io_size = max(dev->block_size, (uint32_t)BENCH_IO_SIZE);
+	ctx.nios = dev->file_size / ctx.io_size;
+	if (ctx.nios == 0) {
+		PRINT_ERROR("File %s is too small to benchmark",
+			dev->file_name);
+		res = EINVAL;
+		goto out;
+	}
+
+	if (dev->o_direct_flag)
+		flags |= O_DIRECT;
+	ctx.fd = open(dev->file_name, flags);
+	if (ctx.fd < 0) {
+		res = errno;
+		PRINT_ERROR("Unable to open file %s (%s)", dev->file_name,
+			strerror(res));
+		goto out;
+	}
+
+	PRINT_INFO("Benchmarking random %d bytes reads of %s for %d "
+		"seconds each", ctx.io_size, dev->file_name, secs);
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx.end);
+	ctx.end.tv_sec += secs;
+	res = bench_sync(&ctx, threads);
+	if (res != 0) {
+		PRINT_ERROR("Synchronous benchmark failed: %s", strerror(res));
+		goto out_close;
+	}
+	snprintf(engine, sizeof(engine), "sync, %d threads", threads);
+	bench_report(engine, &ctx, secs);
+
+#ifdef HAVE_IO_URING
+	{
+		int depth = (uring_depth > 0) ? uring_depth : BENCH_DEF_DEPTH;
+
+		clock_gettime(CLOCK_MONOTONIC, &ctx.end);
+		ctx.end.tv_sec += secs;
+		res = bench_uring(&ctx, depth);
+		if (res != 0) {
+			PRINT_ERROR("io_uring benchmark failed: %s",
+				strerror(res));
+			goto out_close;
+		}
+		snprintf(engine, sizeof(engine), "io_uring, depth %d, 1 thread",
+			depth);
+		bench_report(engine, &ctx, secs);
+	}
+#else
+	PRINT_INFO("	%s", "io_uring isn't supported by this build");
+#endif
+
+out_close:
+	close(ctx.fd);
+
+out:
+	return res;
+}
@@ -28,12 +28,16 @@
 
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
 
 #include <arpa/inet.h>
 
 #include <pthread.h>
 
 #include "common.h"
+#include "uring.h"
+#include "arena.h"
+#include "journal.h"
 
 static void exec_inquiry(struct vdisk_cmd *vcmd);
 static void exec_request_sense(struct vdisk_cmd *vcmd);
@@ -48,6 +52,11 @@ static void exec_read(struct vdisk_cmd *vcmd, loff_t loff);
 static void exec_write(struct vdisk_cmd *vcmd, loff_t loff);
 static void exec_verify(struct vdisk_cmd *vcmd, loff_t loff);
 static void exec_write_same(struct vdisk_cmd *vcmd);
+#ifdef HAVE_IO_URING
+static bool uring_can_exec(const struct vdisk_cmd *vcmd);
+static void uring_exec_rw(struct vdisk_cmd *vcmd, loff_t loff, bool write,
+	bool fua);
+#endif
 
 static int open_dev_fd(struct vdisk_dev *dev)
 {
@@ -69,6 +78,32 @@ static int open_dev_fd(struct vdisk_dev *dev)
 	return res;
 }
 
+/* Data buffers come from the arena, if any, while it has room */
+void *vdisk_buf_alloc(struct vdisk_dev *dev, size_t size)
+{
+	void *res;
+
+	if (dev->arena != NULL) {
+		res = arena_alloc(dev->arena, size);
+		if (res != NULL)
+			goto out;
+		TRACE_MEM("Arena exhausted, allocating %zd bytes outside", size);
+	}
+
+	res = dev->alloc_fn(size);
+
+out:
+	return res;
+}
+
+void vdisk_buf_free(struct vdisk_dev *dev, void *buf)
+{
+	if ((dev->arena != NULL) && arena_free(dev->arena, buf))
+		return;
+	free(buf);
+	return;
+}
+
 static void set_resp_data_len(struct vdisk_cmd *vcmd, int32_t resp_data_len)
 {
 	struct scst_user_scsi_cmd_reply_exec *reply = &vcmd->reply->exec_reply;
@@ -77,7 +112,7 @@ static void set_resp_data_len(struct vdisk_cmd *vcmd, int32_t resp_data_len)
 
 	if (vcmd->may_need_to_free_pbuf && (resp_data_len == 0)) {
 		struct scst_user_scsi_cmd_exec *cmd = &vcmd->cmd->exec_cmd;
-		free((void *)(unsigned long)cmd->pbuf);
+		vdisk_buf_free(vcmd->dev, (void *)(unsigned long)cmd->pbuf);
 		cmd->pbuf = 0;
 		reply->pbuf = 0;
 	}
@@ -148,6 +183,34 @@ static void set_busy(struct vdisk_cmd *vcmd)
 	return;
 }
 
+/* Whether exec_fsync() would do anything for this device */
+static bool fsync_needed(const struct vdisk_dev *dev)
+{
+	/* Hopefully, the compiler will generate the single comparison */
+	return !(dev->nv_cache || dev->wt_flag || dev->rd_only_flag ||
+		 dev->o_direct_flag || dev->nullio ||
+		 /* Journaled WRITEs are stable, once acknowledged */
+		 (dev->journal != NULL));
+}
+
+/*
+ * SCST_USER_INTERNAL_* commands, which are no-ops for this device. Write
+ * through isn't taken into account, because MODE SELECT can turn it off.
+ */
+uint8_t internal_cmds_mask(const struct vdisk_dev *dev)
+{
+	/* TEST UNIT READY doesn't check anything */
+	uint8_t res = SCST_USER_INTERNAL_TUR;
+
+	/* SYNCHRONIZE CACHE and START STOP UNIT call exec_fsync() */
+	if (dev->nv_cache || dev->rd_only_flag || dev->o_direct_flag ||
+	    dev->nullio || (dev->journal != NULL))
+		res |= SCST_USER_INTERNAL_SYNC_CACHE |
+		       SCST_USER_INTERNAL_START_STOP;
+
+	return res;
+}
+
 static int do_parse(struct vdisk_cmd *vcmd)
 {
 	int res = 0;
@@ -273,7 +336,8 @@ static int do_exec(struct vdisk_cmd *vcmd)
 			cmd->pbuf = 0;
 		else
 #endif
-			cmd->pbuf = (unsigned long)dev->alloc_fn(cmd->alloc_len);
+			cmd->pbuf = (unsigned long)vdisk_buf_alloc(dev,
+							cmd->alloc_len);
 		vcmd->may_need_to_free_pbuf = 1;
 		TRACE_MEM("Buf %"PRIx64" alloced, len %d", cmd->pbuf,
 			cmd->alloc_len);
@@ -322,6 +386,12 @@ static int do_exec(struct vdisk_cmd *vcmd)
 	case READ_10:
 	case READ_12:
 	case READ_16:
+#ifdef HAVE_IO_URING
+		if (uring_can_exec(vcmd)) {
+			uring_exec_rw(vcmd, loff, false, false);
+			break;
+		}
+#endif
 		exec_read(vcmd, loff);
 		break;
 	case WRITE_6:
@@ -340,6 +410,12 @@ static int do_exec(struct vdisk_cmd *vcmd)
 				goto out;
 			}
 
+#ifdef HAVE_IO_URING
+			if (uring_can_exec(vcmd)) {
+				uring_exec_rw(vcmd, loff, true, fua);
+				break;
+			}
+#endif
 			exec_write(vcmd, loff);
 			/* O_DSYNC flag is used for WT devices */
 			if (fua)
@@ -484,8 +560,8 @@ static int do_alloc_mem(struct vdisk_cmd *vcmd)
 		reply->alloc_reply.pbuf = 0;
 	else
 #endif
-		reply->alloc_reply.pbuf = (unsigned long)vcmd->dev->alloc_fn(
-						cmd->alloc_cmd.alloc_len);
+		reply->alloc_reply.pbuf = (unsigned long)vdisk_buf_alloc(
+					vcmd->dev, cmd->alloc_cmd.alloc_len);
 	TRACE_MEM("Buf %"PRIx64" alloced, len %d", reply->alloc_reply.pbuf,
 		cmd->alloc_cmd.alloc_len);
 	if (reply->alloc_reply.pbuf == 0) {
@@ -508,7 +584,8 @@ static int do_cached_mem_free(struct vdisk_cmd *vcmd)
 	TRACE_MEM("Cached mem free (cmd %x, buf %"PRIx64")", cmd->cmd_h,
 		cmd->on_cached_mem_free.pbuf);
 
-	free((void *)(unsigned long)cmd->on_cached_mem_free.pbuf);
+	vdisk_buf_free(vcmd->dev,
+		(void *)(unsigned long)cmd->on_cached_mem_free.pbuf);
 
 	memset(reply, 0, sizeof(*reply));
 	reply->cmd_h = cmd->cmd_h;
@@ -537,7 +614,8 @@ static int do_on_free_cmd(struct vdisk_cmd *vcmd)
 
 	if (!cmd->on_free_cmd.buffer_cached && (cmd->on_free_cmd.pbuf != 0)) {
 		TRACE_MEM("Freeing buf %"PRIx64, cmd->on_free_cmd.pbuf);
-		free((void *)(unsigned long)cmd->on_free_cmd.pbuf);
+		vdisk_buf_free(vcmd->dev,
+			(void *)(unsigned long)cmd->on_free_cmd.pbuf);
 	}
 
 	memset(reply, 0, sizeof(*reply));
@@ -712,7 +790,8 @@ static int process_cmd(struct vdisk_cmd *vcmd)
 				cmd->exec_cmd.bufflen);
 		}
 		res = do_exec(vcmd);
-		if ((reply->exec_reply.resp_data_len != 0) && (res != 150)) {
+		if ((reply->exec_reply.resp_data_len != 0) && (res != 150) &&
+		    !vcmd->uring_queued) {
 			TRACE_BUFFER("Reply data",
 				(void *)(unsigned long)reply->exec_reply.pbuf,
 				reply->exec_reply.resp_data_len);
@@ -771,31 +850,680 @@ out:
 	return res;
 }
 
+static void multi_stat(struct vdisk_dev *dev, int cmds)
+{
+	if (cmds == 0)
+		return;
+	__atomic_fetch_add(&dev->multi_calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&dev->multi_cmds, cmds, __ATOMIC_RELAXED);
+	return;
+}
+
+/*
+ * Returns how many commands to ask for from the next
+ * SCST_USER_REPLY_AND_GET_MULTI, after got were returned for batch. Full
+ * batches mean commands are waiting, so the batch grows to save system calls.
+ * Otherwise it shrinks, so at low queue depth a thread doesn't take commands
+ * other idle threads could execute in parallel.
+ */
+static int multi_adapt_batch(struct vdisk_dev *dev, int batch, int got)
+{
+	multi_stat(dev, got);
+
+	if (got >= batch)
+		batch = min(batch * 2, multi_cmds_max);
+	else if (got < batch / 2)
+		batch = max(batch / 2, 1);
+	return batch;
+}
+
+/*
+ * How many replies can wait on the replies ring before a thread hands them
+ * to SCST by SCST_USER_RINGS_ENTER, if there is no kernel poller. They are
+ * also handed over, when a thread runs out of commands.
+ */
+#define RING_REPLIES_BATCH	4
+
+/* Called under ring_mutex */
+static bool ring_get_cmd(struct vdisk_queue *q, struct scst_user_get_cmd *cmd,
+	bool *more)
+{
+	struct scst_user_ring *r = &q->rings->cmds;
+	uint32_t head = r->head, tail;
+
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return false;
+
+	*cmd = q->ring_cmds[head & (q->ring_entries - 1)];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	*more = (head + 1 != tail);
+	return true;
+}
+
+/* Called under ring_mutex */
+static bool ring_put_reply(struct vdisk_queue *q,
+	const struct scst_user_reply_cmd *reply)
+{
+	struct scst_user_ring *r = &q->rings->replies;
+	uint32_t tail = r->tail;
+
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= q->ring_entries)
+		return false;
+
+	q->ring_replies[tail & (q->ring_entries - 1)] = *reply;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * Hands the queued replies to SCST and, if wait, waits for new commands.
+ * With the kernel poller only wakes it up, if it's sleeping.
+ */
+static int ring_enter(struct vdisk_queue *q, bool wait)
+{
+	unsigned long flags = 0;
+	int res;
+
+	if (q->ring_poll) {
+		/* Pairs with the barrier in the poller before going to sleep */
+		__sync_synchronize();
+		if (!(__atomic_load_n(&q->rings->replies.flags, __ATOMIC_RELAXED) &
+		      SCST_USER_RINGS_NEED_WAKEUP))
+			return 0;
+		flags = SCST_USER_RINGS_ENTER_WAKEUP;
+	} else if (wait)
+		flags = SCST_USER_RINGS_ENTER_WAIT;
+
+	res = ioctl(q->scst_usr_fd, SCST_USER_RINGS_ENTER, flags);
+	if (res < 0)
+		res = errno;
+	else
+		res = 0;
+	return res;
+}
+
+static int ring_wait_cmds(struct vdisk_queue *q)
+{
+	struct pollfd pl;
+	uint64_t v;
+	int res;
+
+	if (q->ring_poll) {
+		res = ring_enter(q, false);
+		if (res != 0)
+			goto out;
+		if (read(q->ring_eventfd, &v, sizeof(v)) < 0)
+			res = errno;
+		goto out;
+	}
+
+	res = ring_enter(q, true);
+	if ((res == EAGAIN) && q->dev->non_blocking) {
+		memset(&pl, 0, sizeof(pl));
+		pl.fd = q->scst_usr_fd;
+		pl.events = POLLIN;
+		if (poll(&pl, 1, -1) < 0)
+			res = errno;
+		else
+			res = 0;
+	}
+
+out:
+	return res;
+}
+
+static int ring_loop(struct vdisk_cmd *vcmd)
+{
+	struct vdisk_queue *q = vcmd->q;
+	uint64_t one = 1;
+	bool got, more = false, flush;
+	int res;
+
+	TRACE_ENTRY();
+
+	while (1) {
+		pthread_mutex_lock(&q->ring_mutex);
+		got = ring_get_cmd(q, vcmd->cmd, &more);
+		if (!got)
+			q->ring_replies_queued = 0;
+		pthread_mutex_unlock(&q->ring_mutex);
+
+		if (!got) {
+			res = ring_wait_cmds(q);
+			switch (res) {
+			case 0:
+			case EINTR:
+			case EAGAIN:
+				break;
+			default:
+				PRINT_ERROR("Waiting for commands failed: %s (%d)",
+					strerror(res), res);
+				break;
+			}
+			continue;
+		}
+
+		/* Let another thread take the rest */
+		if (more && q->ring_poll) {
+			if (write(q->ring_eventfd, &one, sizeof(one)) < 0)
+				PRINT_ERROR("eventfd write failed: %s",
+					strerror(errno));
+		}
+
+		res = process_cmd(vcmd);
+#ifdef DEBUG_TM_IGNORE
+		if (res == 150)
+			continue;
+#endif
+		if (res != 0)
+			goto out;
+
+		TRACE_BUFFER("Sending reply", vcmd->reply, sizeof(*vcmd->reply));
+
+		pthread_mutex_lock(&q->ring_mutex);
+		while (!ring_put_reply(q, vcmd->reply)) {
+			/* Full, let SCST drain it */
+			pthread_mutex_unlock(&q->ring_mutex);
+			if (q->ring_poll)
+				sched_yield();
+			ring_enter(q, false);
+			pthread_mutex_lock(&q->ring_mutex);
+		}
+		flush = !q->ring_poll &&
+			(++q->ring_replies_queued >= RING_REPLIES_BATCH);
+		if (flush)
+			q->ring_replies_queued = 0;
+		pthread_mutex_unlock(&q->ring_mutex);
+
+		if (flush || q->ring_poll)
+			ring_enter(q, false);
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+#ifdef HAVE_IO_URING
+
+/* Type of an SQE in the low bits of its user_data, the slot is above */
+#define URING_UD_RW		0
+#define URING_UD_FSYNC		1
+#define URING_UD_POLL		2
+#define URING_UD_TYPE_BITS	2
+
+/* A command being executed or waiting for its reply to be sent */
+struct uring_slot {
+	struct scst_user_get_cmd cmd;
+	struct scst_user_reply_cmd reply;
+	struct vdisk_cmd vcmd;
+	struct iovec iov;
+	loff_t loff;
+	int32_t done;		/* bytes transferred so far */
+	int pending;		/* SQEs in flight */
+	int err;		/* first error, negative errno */
+	unsigned int write:1;
+	unsigned int fua:1;
+};
+
+/* Per thread io_uring engine state */
+struct vdisk_uring {
+	struct uring ring;
+	struct uring_slot *slots;
+	int *free_slots;	/* stack of free slots indexes */
+	int free_cnt;
+	int *reply_slots;	/* slots, whose replies wait to be sent */
+	int replies_cnt;
+	struct scst_user_reply_cmd *replies;
+	struct scst_user_get_multi *multi;
+	bool fixed_bufs;
+	bool poll_armed;
+};
+
+static bool uring_can_exec(const struct vdisk_cmd *vcmd)
+{
+	return (vcmd->uring != NULL) && !vcmd->dev->nullio;
+}
+
+/* Returns index of the registered buffer containing the data or -1 */
+static int uring_buf_index(const struct vdisk_dev *dev, const uint8_t *addr,
+	uint32_t len)
+{
+	int l = 0, r = dev->arena_iov_cnt - 1;
+
+	while (l <= r) {
+		int m = (l + r) / 2;
+		const struct iovec *iov = &dev->arena_iov[m];
+		const uint8_t *base = iov->iov_base;
+
+		if (addr < base)
+			r = m - 1;
+		else if (addr >= base + iov->iov_len)
+			l = m + 1;
+		else if (addr + len <= base + iov->iov_len)
+			return m;
+		else
+			break;
+	}
+	return -1;
+}
+
+static struct io_uring_sqe *uring_get_sqe_wait(struct vdisk_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	/* SQ is sized for all slots, so it can only be waiting for submit */
+	while ((sqe = uring_get_sqe(&u->ring)) == NULL)
+		uring_submit(&u->ring, 0);
+
+	return sqe;
+}
+
+/* Queues the not yet transferred part of the slot's data, then fsync, if FUA */
+static void uring_queue_slot(struct vdisk_uring *u, int idx)
+{
+	struct uring_slot *s = &u->slots[idx];
+	struct vdisk_cmd *vcmd = &s->vcmd;
+	struct scst_user_scsi_cmd_exec *cmd = &vcmd->cmd->exec_cmd;
+	uint8_t *addr = (uint8_t *)(unsigned long)cmd->pbuf + s->done;
+	uint32_t len = cmd->bufflen - s->done;
+	struct io_uring_sqe *sqe;
+	int buf;
+
+	TRACE_DBG("%s off %"PRId64", len %d (cmd_h %x, slot %d)",
+		s->write ? "writing" : "reading", (uint64_t)s->loff + s->done,
+		len, vcmd->cmd->cmd_h, idx);
+
+	sqe = uring_get_sqe_wait(u);
+	sqe->fd = vcmd->fd;
+	sqe->off = s->loff + s->done;
+	sqe->user_data = ((uint64_t)idx << URING_UD_TYPE_BITS) | URING_UD_RW;
+
+	buf = u->fixed_bufs ? uring_buf_index(vcmd->dev, addr, len) : -1;
+	if (buf >= 0) {
+		sqe->opcode = s->write ? IORING_OP_WRITE_FIXED :
+					 IORING_OP_READ_FIXED;
+		sqe->addr = (unsigned long)addr;
+		sqe->len = len;
+		sqe->buf_index = buf;
+	} else {
+		s->iov.iov_base = addr;
+		s->iov.iov_len = len;
+		sqe->opcode = s->write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (unsigned long)&s->iov;
+		sqe->len = 1;
+	}
+	s->pending++;
+
+	if (s->fua && fsync_needed(vcmd->dev)) {
+		/* Runs only after the write has completed in full */
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = uring_get_sqe_wait(u);
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = vcmd->fd;
+		sqe->user_data = ((uint64_t)idx << URING_UD_TYPE_BITS) |
+				 URING_UD_FSYNC;
+		s->pending++;
+	}
+	return;
+}
+
+/* Called from do_exec() instead of exec_read()/exec_write() */
+static void uring_exec_rw(struct vdisk_cmd *vcmd, loff_t loff, bool write,
+	bool fua)
+{
+	struct vdisk_uring *u = vcmd->uring;
+	struct uring_slot *s = &u->slots[vcmd->uring_slot];
+
+	s->loff = loff;
+	s->done = 0;
+	s->pending = 0;
+	s->err = 0;
+	s->write = write;
+	s->fua = fua;
+
+	uring_queue_slot(u, vcmd->uring_slot);
+	vcmd->uring_queued = 1;
+	return;
+}
+
+static void uring_finish_slot(struct vdisk_uring *u, int idx)
+{
+	struct uring_slot *s = &u->slots[idx];
+	struct vdisk_cmd *vcmd = &s->vcmd;
+	struct scst_user_scsi_cmd_exec *cmd = &vcmd->cmd->exec_cmd;
+
+	if (s->err != 0) {
+		PRINT_ERROR("%s returned %d (%s) after %d of %d bytes "
+			"(cmd_h %x)", s->write ? "write" : "read", s->err,
+			strerror(-s->err), s->done, cmd->bufflen,
+			vcmd->cmd->cmd_h);
+		if (s->err == -EAGAIN)
+			set_busy(vcmd);
+		else if (s->write)
+			set_cmd_error(vcmd,
+				SCST_LOAD_SENSE(scst_sense_write_error));
+		else
+			set_cmd_error(vcmd,
+				SCST_LOAD_SENSE(scst_sense_read_error));
+	} else if (!s->write) {
+		set_resp_data_len(vcmd, cmd->bufflen);
+		TRACE_BUFFER("Reply data", (void *)(unsigned long)cmd->pbuf,
+			cmd->bufflen);
+	}
+
+	u->reply_slots[u->replies_cnt++] = idx;
+	return;
+}
+
+static void uring_complete(struct vdisk_uring *u, uint64_t user_data,
+	int32_t res)
+{
+	int type = user_data & ((1 << URING_UD_TYPE_BITS) - 1);
+	int idx = user_data >> URING_UD_TYPE_BITS;
+	struct uring_slot *s;
+
+	if (type == URING_UD_POLL) {
+		u->poll_armed = false;
+		goto out;
+	}
+
+	s = &u->slots[idx];
+	s->pending--;
+
+	if (type == URING_UD_RW) {
+		if (res > 0)
+			s->done += res;
+		else if (s->err == 0)
+			s->err = (res < 0) ? res : -EIO;
+	} else if ((res < 0) && (res != -ECANCELED) && (s->err == 0)) {
+		/* The fsync is canceled, if the write failed or was short */
+		s->err = res;
+	}
+
+	if (s->pending > 0)
+		goto out;
+
+	if ((s->err == 0) && (s->done < s->vcmd.cmd->exec_cmd.bufflen)) {
+		TRACE_MGMT_DBG("Short %s, %d of %d bytes done, restarting",
+			s->write ? "write" : "read", s->done,
+			s->vcmd.cmd->exec_cmd.bufflen);
+		uring_queue_slot(u, idx);
+		goto out;
+	}
+
+	uring_finish_slot(u, idx);
+
+out:
+	return;
+}
+
+static int uring_start_cmd(struct vdisk_uring *u,
+	const struct scst_user_get_cmd *cmd, const struct vdisk_cmd *tmpl)
+{
+	int idx = u->free_slots[--u->free_cnt];
+	struct uring_slot *s = &u->slots[idx];
+	int res;
+
+	s->cmd = *cmd;
+	s->vcmd = *tmpl;
+	s->vcmd.cmd = &s->cmd;
+	s->vcmd.reply = &s->reply;
+	s->vcmd.uring_slot = idx;
+	s->vcmd.uring_queued = 0;
+
+	res = process_cmd(&s->vcmd);
+#ifdef DEBUG_TM_IGNORE
+	if (res == 150) {
+		u->free_slots[u->free_cnt++] = idx;
+		res = 0;
+		goto out;
+	}
+#endif
+	if (res != 0) {
+		u->free_slots[u->free_cnt++] = idx;
+		goto out;
+	}
+
+	if (!s->vcmd.uring_queued) {
+		TRACE_BUFFER("Sending reply", &s->reply, sizeof(s->reply));
+		u->reply_slots[u->replies_cnt++] = idx;
+	}
+
+out:
+	return res;
+}
+
+static void uring_free(struct vdisk_uring *u)
+{
+	free(u->multi);
+	free(u->replies);
+	free(u->reply_slots);
+	free(u->free_slots);
+	free(u->slots);
+	return;
+}
+
+static int uring_setup(struct vdisk_uring *u, struct vdisk_dev *dev)
+{
+	int res, i;
+
+	memset(u, 0, sizeof(*u));
+
+	u->slots = calloc(uring_depth, sizeof(*u->slots));
+	u->free_slots = calloc(uring_depth, sizeof(*u->free_slots));
+	u->reply_slots = calloc(uring_depth, sizeof(*u->reply_slots));
+	u->replies = calloc(uring_depth, sizeof(*u->replies));
+	u->multi = calloc(1, sizeof(*u->multi) +
+			     uring_depth * sizeof(u->multi->cmds[0]));
+	if ((u->slots == NULL) || (u->free_slots == NULL) ||
+	    (u->reply_slots == NULL) || (u->replies == NULL) ||
+	    (u->multi == NULL)) {
+		res = ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < uring_depth; i++)
+		u->free_slots[i] = uring_depth - i - 1;
+	u->free_cnt = uring_depth;
+
+	/* Write and fsync for each slot plus the poll of the SCST fd */
+	res = uring_init(&u->ring, 2 * uring_depth + 1);
+	if (res != 0)
+		goto out_free;
+
+	if (dev->arena_iov_cnt > 0) {
+		res = uring_register_buffers(&u->ring, dev->arena_iov,
+			dev->arena_iov_cnt);
+		if (res == 0)
+			u->fixed_bufs = true;
+		else {
+			PRINT_INFO("Unable to register %d arena chunks, "
+				"using them unregistered: %s",
+				dev->arena_iov_cnt, strerror(res));
+			res = 0;
+		}
+	}
+
+out:
+	return res;
+
+out_free:
+	uring_free(u);
+	goto out;
+}
+
+/*
+ * Asynchronous engine: READs and WRITEs are submitted to io_uring, so one
+ * thread keeps up to uring_depth commands in flight. Completions turn into
+ * replies, which are sent in batches by the next SCST_USER_REPLY_AND_GET_MULTI
+ * together with fetching as many new commands as there are free slots. The
+ * SCST fd is non-blocking, the thread sleeps only in io_uring_enter() waiting
+ * for either an I/O completion or, by a POLL_ADD, for new commands.
+ *
+ * Returns EOPNOTSUPP, if io_uring isn't available, so the caller can fall
+ * back to synchronous I/O.
+ */
+static int uring_loop(struct vdisk_cmd *vcmd)
+{
+	struct vdisk_queue *q = vcmd->q;
+	struct vdisk_uring u;
+	struct scst_user_get_multi *multi;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int res, i, n, requested;
+	bool drained;
+
+	TRACE_ENTRY();
+
+	res = uring_setup(&u, vcmd->dev);
+	if (res != 0) {
+		PRINT_ERROR("Unable to set up io_uring: %s, falling back to "
+			"synchronous I/O", strerror(res));
+		res = EOPNOTSUPP;
+		goto out;
+	}
+	multi = u.multi;
+	vcmd->uring = &u;
+
+	while (1) {
+		while ((cqe = uring_peek_cqe(&u.ring)) != NULL) {
+			uint64_t user_data = cqe->user_data;
+			int32_t cres = cqe->res;
+
+			uring_cqe_seen(&u.ring);
+			uring_complete(&u, user_data, cres);
+		}
+
+		drained = true;
+		if ((u.replies_cnt > 0) || (u.free_cnt > 0)) {
+			for (i = 0; i < u.replies_cnt; i++)
+				u.replies[i] = u.slots[u.reply_slots[i]].reply;
+			multi->preplies = (unsigned long)u.replies;
+			multi->replies_cnt = u.replies_cnt;
+			multi->replies_done = 0;
+			multi->cmds_cnt = requested = u.free_cnt;
+
+			res = ioctl(q->scst_usr_fd,
+				SCST_USER_REPLY_AND_GET_MULTI, multi);
+			if (res != 0) {
+				res = errno;
+				multi->cmds_cnt = 0;
+			}
+
+			n = multi->replies_done;
+			switch (res) {
+			case 0:
+			case EAGAIN:
+			case EINTR:
+				break;
+			case ESRCH:
+			case EBUSY:
+				TRACE_MGMT_DBG("SCST_USER returned %d (%s)", res,
+					strerror(res));
+				/* Drop the reply SCST didn't accept */
+				if (n < u.replies_cnt)
+					n++;
+				break;
+			default:
+				PRINT_ERROR("SCST_USER failed: %s (%d)",
+					strerror(res), res);
+				if (n < u.replies_cnt)
+					n++;
+				break;
+			}
+
+			for (i = 0; i < n; i++)
+				u.free_slots[u.free_cnt++] = u.reply_slots[i];
+			u.replies_cnt -= n;
+			memmove(u.reply_slots, &u.reply_slots[n],
+				u.replies_cnt * sizeof(u.reply_slots[0]));
+
+			TRACE_DBG("cmds_cnt %d", multi->cmds_cnt);
+			multi_stat(vcmd->dev, multi->cmds_cnt);
+			for (i = 0; i < multi->cmds_cnt; i++) {
+				res = uring_start_cmd(&u, &multi->cmds[i], vcmd);
+				if (res != 0)
+					goto out_free;
+			}
+			drained = (multi->cmds_cnt < requested);
+		}
+
+		if (!drained || (u.replies_cnt > 0)) {
+			uring_submit(&u.ring, 0);
+			continue;
+		}
+
+		if (!u.poll_armed && (u.free_cnt > 0)) {
+			sqe = uring_get_sqe_wait(&u);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = q->scst_usr_fd;
+			sqe->poll_events = POLLIN;
+			sqe->user_data = URING_UD_POLL;
+			u.poll_armed = true;
+		}
+
+		res = uring_submit(&u.ring, 1);
+		if ((res < 0) && (res != -EINTR) && (res != -EAGAIN) &&
+		    (res != -EBUSY)) {
+			res = -res;
+			PRINT_ERROR("io_uring_enter() failed: %s", strerror(res));
+			goto out_free;
+		}
+	}
+
+out_free:
+	uring_exit(&u.ring);
+	uring_free(&u);
+	vcmd->uring = NULL;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+#endif /* HAVE_IO_URING */
+
 void *main_loop(void *arg)
 {
 	int res = 0, i, j;
-	struct vdisk_dev *dev = (struct vdisk_dev *)arg;
+	struct vdisk_queue *q = (struct vdisk_queue *)arg;
+	struct vdisk_dev *dev = q->dev;
 	struct scst_user_get_cmd cmd;
 	struct scst_user_reply_cmd reply;
 	struct vdisk_cmd vcmd = {
 		.fd = -1,
 		.cmd = &cmd,
 		.dev = dev,
+		.q = q,
 		.may_need_to_free_pbuf = 0,
 		.reply = &reply,
 		.sense = {0}
 	};
-	int scst_usr_fd = dev->scst_usr_fd;
+	int scst_usr_fd = q->scst_usr_fd;
 	struct pollfd pl;
-#define MULTI_CMDS_CNT 2
-	struct {
-		struct scst_user_reply_cmd replies[MULTI_CMDS_CNT];
-		struct scst_user_get_multi multi_cmd;
-		struct scst_user_get_cmd cmds[MULTI_CMDS_CNT];
-	} multi;
+	struct scst_user_reply_cmd *replies = NULL;
+	struct scst_user_get_multi *multi = NULL;
+	/* Commands to ask for, adapted between 1 and multi_cmds_max */
+	int batch = 1;
 
 	TRACE_ENTRY();
 
+	if (q->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(q->cpu, &cpus);
+		res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (res != 0) {
+			/* Not fatal, just slower */
+			PRINT_ERROR("Unable to bind thread to CPU %d: %s",
+				q->cpu, strerror(res));
+			res = 0;
+		}
+	}
+
 	vcmd.fd = open_dev_fd(dev);
 	if (vcmd.fd < 0) {
 		res = -errno;
@@ -804,14 +1532,37 @@ void *main_loop(void *arg)
 		goto out;
 	}
 
+	if (q->rings != NULL) {
+		res = ring_loop(&vcmd);
+		goto out_close;
+	}
+
+#ifdef HAVE_IO_URING
+	if (uring_depth > 0) {
+		res = uring_loop(&vcmd);
+		if (res != EOPNOTSUPP)
+			goto out_close;
+		res = 0;
+	}
+#endif
+
+	replies = calloc(multi_cmds_max, sizeof(*replies));
+	multi = calloc(1, sizeof(*multi) +
+			  multi_cmds_max * sizeof(multi->cmds[0]));
+	if ((replies == NULL) || (multi == NULL)) {
+		res = -ENOMEM;
+		PRINT_ERROR("%s", "Unable to allocate multi commands buffers");
+		goto out_close;
+	}
+
 	memset(&pl, 0, sizeof(pl));
 	pl.fd = scst_usr_fd;
 	pl.events = POLLIN;
 
 	cmd.preply = 0;
-	multi.multi_cmd.preplies = (uintptr_t)&multi.replies[0];
-	multi.multi_cmd.replies_cnt = 0;
-	multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+	multi->preplies = (uintptr_t)&replies[0];
+	multi->replies_cnt = 0;
+	multi->cmds_cnt = batch;
 
 	while(1) {
 #ifdef DEBUG_TM_IGNORE_ALL
@@ -829,10 +1580,10 @@ void *main_loop(void *arg)
 
 		if (use_multi) {
 			TRACE_DBG("preplies %p (first: %p), replies_cnt %d, "
-				"replies_done %d, cmds_cnt %d", (void *)(uintptr_t)multi.multi_cmd.preplies,
-				&multi.replies[0], multi.multi_cmd.replies_cnt,
-				multi.multi_cmd.replies_done, multi.multi_cmd.cmds_cnt);
-			res = ioctl(scst_usr_fd, SCST_USER_REPLY_AND_GET_MULTI, &multi.multi_cmd);
+				"replies_done %d, cmds_cnt %d", (void *)(uintptr_t)multi->preplies,
+				&replies[0], multi->replies_cnt,
+				multi->replies_done, multi->cmds_cnt);
+			res = ioctl(scst_usr_fd, SCST_USER_REPLY_AND_GET_MULTI, multi);
 		} else
 			res = ioctl(scst_usr_fd, SCST_USER_REPLY_AND_GET_CMD, &cmd);
 		if (res != 0) {
@@ -842,18 +1593,18 @@ void *main_loop(void *arg)
 			case EBUSY:
 				TRACE_MGMT_DBG("SCST_USER returned %d (%s)", res, strerror(res));
 				cmd.preply = 0;
-				multi.multi_cmd.preplies = (uintptr_t)&multi.replies[0];
-				multi.multi_cmd.replies_cnt = 0;
-				multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+				multi->preplies = (uintptr_t)&replies[0];
+				multi->replies_cnt = 0;
+				multi->cmds_cnt = batch;
 				/* fall through */
 			case EINTR:
 				continue;
 			case EAGAIN:
 				TRACE_DBG("SCST_USER returned EAGAIN (%d)", res);
 				cmd.preply = 0;
-				multi.multi_cmd.preplies = (uintptr_t)&multi.replies[0];
-				multi.multi_cmd.replies_cnt = 0;
-				multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+				multi->preplies = (uintptr_t)&replies[0];
+				multi->replies_cnt = 0;
+				multi->cmds_cnt = batch;
 				if (dev->non_blocking)
 					break;
 				else
@@ -862,9 +1613,9 @@ void *main_loop(void *arg)
 				PRINT_ERROR("SCST_USER failed: %s (%d)", strerror(res), res);
 #if 1
 				cmd.preply = 0;
-				multi.multi_cmd.preplies = (uintptr_t)&multi.replies[0];
-				multi.multi_cmd.replies_cnt = 0;
-				multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+				multi->preplies = (uintptr_t)&replies[0];
+				multi->replies_cnt = 0;
+				multi->cmds_cnt = batch;
 				continue;
 #else
 				goto out_close;
@@ -898,19 +1649,20 @@ again_poll:
 		}
 
 		if (use_multi) {
-			if (multi.multi_cmd.replies_done < multi.multi_cmd.replies_cnt) {
+			if (multi->replies_done < multi->replies_cnt) {
 				TRACE_MGMT_DBG("replies_done %d < replies_cnt %d (dev %s)",
-					multi.multi_cmd.replies_done, multi.multi_cmd.replies_cnt, dev->name);
-				multi.multi_cmd.preplies = (uintptr_t)&multi.replies[multi.multi_cmd.replies_done];
-				multi.multi_cmd.replies_cnt = multi.multi_cmd.replies_cnt - multi.multi_cmd.replies_done;
-				multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+					multi->replies_done, multi->replies_cnt, dev->name);
+				multi->preplies = (uintptr_t)&replies[multi->replies_done];
+				multi->replies_cnt = multi->replies_cnt - multi->replies_done;
+				multi->cmds_cnt = batch;
 				continue;
 			}
-			TRACE_DBG("cmds_cnt %d", multi.multi_cmd.cmds_cnt);
-			multi.multi_cmd.preplies = (uintptr_t)&multi.replies[0];
-			for (i = 0, j = 0; i < multi.multi_cmd.cmds_cnt; i++, j++) {
-				vcmd.cmd = &multi.cmds[i];
-				vcmd.reply = &multi.replies[j];
+			TRACE_DBG("cmds_cnt %d", multi->cmds_cnt);
+			batch = multi_adapt_batch(dev, batch, multi->cmds_cnt);
+			multi->preplies = (uintptr_t)&replies[0];
+			for (i = 0, j = 0; i < multi->cmds_cnt; i++, j++) {
+				vcmd.cmd = &multi->cmds[i];
+				vcmd.reply = &replies[j];
 				res = process_cmd(&vcmd);
 #ifdef DEBUG_TM_IGNORE
 				if (res == 150) {
@@ -922,8 +1674,8 @@ again_poll:
 					goto out_close;
 				TRACE_BUFFER("Sending reply", vcmd.reply, sizeof(reply));
 			}
-			multi.multi_cmd.replies_cnt = j;
-			multi.multi_cmd.cmds_cnt = MULTI_CMDS_CNT;
+			multi->replies_cnt = j;
+			multi->cmds_cnt = batch;
 		} else {
 			res = process_cmd(&vcmd);
 #ifdef DEBUG_TM_IGNORE
@@ -941,6 +1693,8 @@ again_poll:
 	}
 
 out_close:
+	free(multi);
+	free(replies);
 	close(vcmd.fd);
 
 out:
@@ -1482,6 +2236,9 @@ static void exec_mode_select(struct vdisk_cmd *vcmd)
 				    SCST_LOAD_SENSE(scst_sense_hardw_error));
 				goto out;
 			}
+			/* The cached caching page is stale now */
+			if (dev->cached_resps)
+				upload_cached_resps(dev);
 			break;
 		}
 		offset += address[offset + 1];
@@ -1695,9 +2452,7 @@ static int exec_fsync(struct vdisk_cmd *vcmd)
 	int res = 0;
 	struct vdisk_dev *dev = vcmd->dev;
 
-	/* Hopefully, the compiler will generate the single comparison */
-	if (dev->nv_cache || dev->wt_flag || dev->rd_only_flag ||
-	    dev->o_direct_flag || dev->nullio)
+	if (!fsync_needed(dev))
 		goto out;
 
 	/* ToDo: use sync_file_range() instead */
@@ -1722,7 +2477,18 @@ static void exec_read(struct vdisk_cmd *vcmd, loff_t loff)
 	TRACE_DBG("reading off %"PRId64", len %d", loff, length);
 	if (dev->nullio)
 		err = length;
-	else {
+	else if (dev->journal != NULL) {
+		/* Not yet destaged blocks are read from the journal */
+		err = journal_read(dev->journal, fd, address, length, loff);
+		if (err != 0) {
+			PRINT_ERROR("Journaled read of %d bytes at %"PRId64
+				" failed: %s", length, loff, strerror(err));
+			set_cmd_error(vcmd,
+			    SCST_LOAD_SENSE(scst_sense_read_error));
+			goto out;
+		}
+		err = length;
+	} else {
 		/* SEEK */
 		err = lseek64(fd, loff, 0/*SEEK_SET*/);
 		if (err != loff) {
@@ -1766,6 +2532,17 @@ static void exec_write(struct vdisk_cmd *vcmd, loff_t loff)
 
 	TRACE_ENTRY();
 
+	if (dev->journal != NULL) {
+		err = journal_write(dev->journal, address, length, loff);
+		if (err != 0) {
+			PRINT_ERROR("Journaled write of %d bytes at %"PRId64
+				" failed: %s", length, loff, strerror(err));
+			set_cmd_error(vcmd,
+			    SCST_LOAD_SENSE(scst_sense_write_error));
+		}
+		goto out;
+	}
+
 restart:
 	TRACE_DBG("writing off %"PRId64", len %d", loff, length);
 
@@ -1825,6 +2602,7 @@ static void exec_verify(struct vdisk_cmd *vcmd, loff_t loff)
 	uint8_t *address = (uint8_t *)(unsigned long)cmd->pbuf;
 	int compare;
 	int fd = vcmd->fd;
+	loff_t vloff = loff;
 	uint8_t mem_verify[128*1024];
 
 	TRACE_ENTRY();
@@ -1864,10 +2642,14 @@ static void exec_verify(struct vdisk_cmd *vcmd, loff_t loff)
 		TRACE_DBG("Verify: length %"PRId64" - len_mem %"PRId64,
 			length, len_mem);
 
-		if (!dev->nullio)
-			err = read(fd, (char *)mem_verify, len_mem);
-		else
+		if (dev->nullio)
 			err = len_mem;
+		else if (dev->journal != NULL) {
+			errno = journal_read(dev->journal, fd, mem_verify,
+				len_mem, vloff);
+			err = (errno == 0) ? len_mem : -1;
+		} else
+			err = read(fd, (char *)mem_verify, len_mem);
 		if ((err < 0) || (err < len_mem)) {
 			PRINT_ERROR("read() returned %"PRId64" from %"PRId64" "
 				"(errno %d)", (uint64_t)err, len_mem, errno);
@@ -1887,6 +2669,7 @@ static void exec_verify(struct vdisk_cmd *vcmd, loff_t loff)
 		}
 		length -= len_mem;
 		address += len_mem;
+		vloff += len_mem;
 	}
 
 	if (length < 0) {
@@ -1929,3 +2712,138 @@ out:
 	TRACE_EXIT();
 	return;
 }
+
+/*
+ * Commands, whose responses depend only on the device's configuration, so
+ * scst_user can answer them itself, see SCST_USER_SET_CACHED_RESP. The
+ * allocation lengths aren't compared, scst_user truncates the responses.
+ */
+static const struct vdisk_cached_cmd {
+	uint8_t cdb[4];
+	uint8_t cdb_mask[4];
+	void (*exec)(struct vdisk_cmd *vcmd);
+} cached_cmds[] = {
+	{ { TEST_UNIT_READY }, { 0xFF }, NULL },
+	{ { INQUIRY, 0, 0 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { INQUIRY, EVPD, 0x00 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { INQUIRY, EVPD, 0x80 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { INQUIRY, EVPD, 0x83 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { INQUIRY, EVPD, 0xB0 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { INQUIRY, EVPD, 0xB1 }, { 0xFF, EVPD | CMDDT, 0xFF }, exec_inquiry },
+	{ { READ_CAPACITY }, { 0xFF }, exec_read_capacity },
+	{ { SERVICE_ACTION_IN_16, SAI_READ_CAPACITY_16 }, { 0xFF, 0x1F },
+	  exec_read_capacity16 },
+	/* Current values of the caching, control and all pages */
+	{ { MODE_SENSE, 0, 0x08, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE, DBD, 0x08, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE, 0, 0x0A, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE, DBD, 0x0A, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE, 0, 0x3F, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE, DBD, 0x3F, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, 0, 0x08, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, DBD, 0x08, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, 0, 0x0A, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, DBD, 0x0A, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, 0, 0x3F, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+	{ { MODE_SENSE_10, DBD, 0x3F, 0 }, { 0xFF, DBD, 0xFF, 0xFF },
+	  exec_mode_sense },
+};
+
+/* Executes cc locally and uploads its response. Returns 0 or errno. */
+static int upload_cached_resp(struct vdisk_dev *dev,
+	const struct vdisk_cached_cmd *cc)
+{
+	struct scst_user_get_cmd cmd;
+	struct scst_user_reply_cmd reply;
+	struct vdisk_cmd vcmd;
+	struct scst_user_cached_resp desc;
+	uint8_t buf[MSENSE_BUF_SZ];
+	int res = 0;
+
+	TRACE_ENTRY();
+
+	memset(&cmd, 0, sizeof(cmd));
+	memset(&reply, 0, sizeof(reply));
+	memset(&vcmd, 0, sizeof(vcmd));
+	vcmd.fd = dev->scst_usr_fd;
+	vcmd.cmd = &cmd;
+	vcmd.reply = &reply;
+	vcmd.dev = dev;
+
+	cmd.subcode = SCST_USER_EXEC;
+	memcpy(cmd.exec_cmd.cdb, cc->cdb, sizeof(cc->cdb));
+	cmd.exec_cmd.cdb_len = sizeof(cc->cdb);
+	cmd.exec_cmd.pbuf = (unsigned long)buf;
+	cmd.exec_cmd.bufflen = sizeof(buf);
+	cmd.exec_cmd.data_direction = SCST_DATA_READ;
+	reply.exec_reply.resp_data_len = (cc->exec != NULL) ? sizeof(buf) : 0;
+
+	if (cc->exec != NULL)
+		cc->exec(&vcmd);
+	if (reply.exec_reply.status != 0) {
+		TRACE_DBG("Opcode %x (cdb[2] %x) isn't cached", cc->cdb[0],
+			cc->cdb[2]);
+		goto out;
+	}
+
+	memset(&desc, 0, sizeof(desc));
+	memcpy(desc.cdb, cc->cdb, sizeof(cc->cdb));
+	memcpy(desc.cdb_mask, cc->cdb_mask, sizeof(cc->cdb_mask));
+	desc.pbuf = (unsigned long)buf;
+	desc.len = reply.exec_reply.resp_data_len;
+
+	res = ioctl(dev->scst_usr_fd, SCST_USER_SET_CACHED_RESP, &desc);
+	if (res != 0) {
+		res = errno;
+		PRINT_ERROR("Unable to set cached response for opcode %x: %s",
+			cc->cdb[0], strerror(res));
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * (Re)uploads the responses of cached_cmds. Must be called each time the
+ * device's configuration, which they reflect, changes.
+ */
+int upload_cached_resps(struct vdisk_dev *dev)
+{
+	unsigned int i;
+	int res;
+
+	TRACE_ENTRY();
+
+	res = ioctl(dev->scst_usr_fd, SCST_USER_CLEAR_CACHED_RESPS, NULL);
+	if (res != 0) {
+		res = errno;
+		PRINT_ERROR("Unable to clear cached responses: %s",
+			strerror(res));
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cached_cmds); i++) {
+		res = upload_cached_resp(dev, &cached_cmds[i]);
+		if (res != 0)
+			goto out;
+	}
+
+	TRACE_DBG("%zu cached responses uploaded (dev %s)",
+		ARRAY_SIZE(cached_cmds), dev->name);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
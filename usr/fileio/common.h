@@ -19,6 +19,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include <sys/uio.h>
+
 #include <scst_user.h>
 
 #include "debug.h"
@@ -56,6 +58,29 @@ struct vdisk_tgt_dev {
 	uint64_t sess_h;
 };
 
+struct vdisk_dev;
+struct arena;
+struct journal;
+
+/* One SCST_USER_OPEN_QUEUE queue of a device, or the device fd itself */
+struct vdisk_queue {
+	int scst_usr_fd;
+	int cpu;		/* to run on, -1 if any */
+	struct vdisk_dev *dev;
+
+	/* Shared rings, if set up by SCST_USER_SETUP_RINGS */
+	struct scst_user_rings *rings;
+	struct scst_user_get_cmd *ring_cmds;
+	struct scst_user_reply_cmd *ring_replies;
+	uint32_t ring_entries;
+	bool ring_poll;
+	int ring_eventfd;
+
+	/* Protects our ends of the rings and ring_replies_queued */
+	pthread_mutex_t ring_mutex;
+	int ring_replies_queued;
+};
+
 struct vdisk_dev {
 	int scst_usr_fd;
 	uint32_t block_size;
@@ -63,6 +88,12 @@ struct vdisk_dev {
 	int block_shift;
 	loff_t file_size;	/* in bytes */
 	void *(*alloc_fn)(size_t size);
+	/* Registered by SCST_USER_REGISTER_ARENA, buffers come from it first */
+	struct arena *arena;
+	/* Static responses are uploaded by SCST_USER_SET_CACHED_RESP */
+	bool cached_resps;
+	/* If set, WRITEs go to the write-back journal */
+	struct journal *journal;
 
 	pthread_mutex_t dev_mutex;
 
@@ -90,14 +121,33 @@ struct vdisk_dev {
 	char *file_name;	/* File name */
 	char usn[MAX_USN_LEN];
 	int type;
+
+	int queues_num;
+	struct vdisk_queue queues[SCST_USER_MAX_QUEUES];
+
+	/* SCST_USER_REPLY_AND_GET_MULTI calls, which returned commands */
+	uint64_t multi_calls;
+	uint64_t multi_cmds;
+
+	/* The arena chunks sorted by address, for io_uring registration */
+	struct iovec *arena_iov;
+	int arena_iov_cnt;
 };
 
+struct vdisk_uring;
+
 struct vdisk_cmd
 {
 	int fd;
 	struct scst_user_get_cmd *cmd;
 	struct vdisk_dev *dev;
+	struct vdisk_queue *q;
+	/* Set, if served by the io_uring engine */
+	struct vdisk_uring *uring;
+	int uring_slot;
 	unsigned int may_need_to_free_pbuf:1;
+	/* Set, if submitted to io_uring, so the reply isn't ready yet */
+	unsigned int uring_queued:1;
 	struct scst_user_reply_cmd *reply;
 	uint8_t sense[SCST_SENSE_BUFFERSIZE];
 };
@@ -123,8 +173,15 @@ struct vdisk_cmd
 
 extern int vdisk_ID;
 extern bool use_multi;
+extern int multi_cmds_max;
+extern int uring_depth;
 
 uint32_t crc32buf(const char *buf, size_t len);
 
 uint64_t gen_dev_id_num(const struct vdisk_dev *dev);
 void *main_loop(void *arg);
+void *vdisk_buf_alloc(struct vdisk_dev *dev, size_t size);
+void vdisk_buf_free(struct vdisk_dev *dev, void *buf);
+int upload_cached_resps(struct vdisk_dev *dev);
+uint8_t internal_cmds_mask(const struct vdisk_dev *dev);
+int bench_dev(struct vdisk_dev *dev, int threads, int secs);
@@ -27,11 +27,14 @@
 #include <malloc.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <sys/poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include <pthread.h>
 
@@ -40,6 +43,8 @@ char *app_name;
 #include "version.h"
 #include "common.h"
 #include "debug.h"
+#include "arena.h"
+#include "journal.h"
 
 #if defined(DEBUG) || defined(TRACING)
 
@@ -74,10 +79,18 @@ bool log_daemon = false;
 #define THREADS			7
 
 #define MAX_VDEVS		10
+/* scst_user_get_multi.cmds_cnt is int16_t */
+#define URING_MAX_DEPTH		4096
+#define MULTI_CMDS_MAX		32
+#define MULTI_CMDS_MAX_LIMIT	1024
+/* io_uring limit of a registered buffer */
+#define URING_MAX_BUF_SIZE	(1024 * 1024 * 1024)
 
 static void *align_alloc(size_t size);
 
 static struct vdisk_dev devs[MAX_VDEVS];
+static struct arena arenas[MAX_VDEVS];
+static struct journal journals[MAX_VDEVS];
 static int num_devs;
 
 int vdisk_ID;
@@ -98,6 +111,18 @@ static int debug_tm_ignore;
 static int non_blocking, sgv_shared, sgv_single_alloc_pages, sgv_purge_interval;
 static int sgv_disable_clustered_pool, prealloc_buffers_num, prealloc_buffer_size;
 bool use_multi = true;
+int multi_cmds_max = MULTI_CMDS_MAX;
+static int rings_entries, rings_poll_idle = -1;
+static int queues_num = 1, queue_policy = SCST_USER_QUEUE_BY_INITIATOR;
+int uring_depth;
+static int bench_time;
+static size_t arena_size;
+static int cached_resps;
+static int internal_cmds;
+static int compl_coalesce_usecs, compl_coalesce_cmds;
+static char *journal_dir;
+static int journal_size = JOURNAL_DEF_SIZE_MB;
+static int destage_threads = JOURNAL_DEF_THREADS;
 
 static void *(*alloc_fn)(size_t size) = align_alloc;
 
@@ -124,6 +149,20 @@ static struct option const long_options[] =
 	{"prealloc_buffers", required_argument, 0, 'R'},
 	{"prealloc_buffer_size", required_argument, 0, 'Z'},
 	{"multi_cmd", required_argument, 0, 'M'},
+	{"multi_cmds_max", required_argument, 0, 'C'},
+	{"rings", required_argument, 0, 'Q'},
+	{"rings_poll", required_argument, 0, 'W'},
+	{"queues", required_argument, 0, 'N'},
+	{"queue_policy", required_argument, 0, 'A'},
+	{"uring", required_argument, 0, 'U'},
+	{"bench", required_argument, 0, 'B'},
+	{"arena", required_argument, 0, 'H'},
+	{"cached_resps", no_argument, 0, 'K'},
+	{"internal_cmds", no_argument, 0, 'X'},
+	{"compl_coalesce", required_argument, 0, 'O'},
+	{"journal", required_argument, 0, 'J'},
+	{"journal_size", required_argument, 0, 'j'},
+	{"destage_threads", required_argument, 0, 'T'},
 #if defined(DEBUG) || defined(TRACING)
 	{"debug", required_argument, 0, 'd'},
 #endif
@@ -163,6 +202,25 @@ static void usage(void)
 	printf("  -R, --prealloc_buffers=n Prealloc n buffers\n");
 	printf("  -Z, --prealloc_buffer_size=n Sets the size in KB of each prealloced buffer\n");
 	printf("  -M, --multi_cmd=v  Use or not multi-commands processing (default: 1)\n");
+	printf("  -C, --multi_cmds_max=n Max commands per multi-commands call, %d by default\n",
+		MULTI_CMDS_MAX);
+	printf("  -Q, --rings=n		Exchange commands through shared rings of n entries\n");
+	printf("  -W, --rings_poll=ms	Use kernel rings poller, which sleeps after ms idle\n");
+	printf("  -N, --queues=n		Number of queues per device, up to %d\n",
+		SCST_USER_MAX_QUEUES);
+	printf("  -A, --queue_policy=type Sessions to queues distribution, one of "
+		"\"initiator\" (default) or \"session\"\n");
+	printf("  -U, --uring=depth	Use io_uring with up to depth commands in flight per thread\n");
+	printf("  -B, --bench=secs	Benchmark sync and io_uring reads of the files and exit\n");
+	printf("  -H, --arena=MB	Allocate buffers from MB of huge pages per device\n");
+	printf("  -K, --cached_resps	Let SCST answer INQUIRY, MODE SENSE, etc. itself\n");
+	printf("  -X, --internal_cmds	Let SCST complete no-op TUR, SYNC CACHE, etc. itself\n");
+	printf("  -O, --compl_coalesce=usecs[,cmds] Let SCST complete commands in batches\n");
+	printf("  -J, --journal=dir	Acknowledge WRITEs once they are in a journal in dir\n");
+	printf("  -j, --journal_size=MB	Journal size per device, %dMB by default\n",
+		JOURNAL_DEF_SIZE_MB);
+	printf("  -T, --destage_threads=n Journal destaging threads per device, %d by default\n",
+		JOURNAL_DEF_THREADS);
 #if defined(DEBUG) || defined(TRACING)
 	printf("  -d, --debug=level	Debug tracing level\n");
 #endif
@@ -249,6 +307,9 @@ static void sigusr1_handler(int signo)
 			PRINT_ERROR("Capacity data changed failed: %s", strerror(res));
 			goto out;
 		}
+		/* SCST dropped the cached responses */
+		if (devs[i].cached_resps)
+			upload_cached_resps(&devs[i]);
 	}
 
 	TRACE_DBG("%s", "Capacity data changed done.");
@@ -258,6 +319,29 @@ out:
 	return;
 }
 
+static void sigusr2_handler(int signo)
+{
+	int i;
+
+	TRACE_ENTRY();
+
+	for (i = 0; i < num_devs; i++) {
+		uint64_t calls = __atomic_load_n(&devs[i].multi_calls,
+						 __ATOMIC_RELAXED);
+		uint64_t cmds = __atomic_load_n(&devs[i].multi_cmds,
+						__ATOMIC_RELAXED);
+		uint64_t avg100 = (calls != 0) ? cmds * 100 / calls : 0;
+
+		PRINT_INFO("Device %s: %"PRIu64" commands in %"PRIu64
+			" SCST_USER_REPLY_AND_GET_MULTI calls, average batch "
+			"%"PRIu64".%02d", devs[i].name, cmds, calls,
+			avg100 / 100, (int)(avg100 % 100));
+	}
+
+	TRACE_EXIT();
+	return;
+}
+
 static int prealloc_buffers(struct vdisk_dev *dev)
 {
 	int i, c, res = 0;
@@ -272,7 +356,8 @@ static int prealloc_buffers(struct vdisk_dev *dev)
 			union scst_user_prealloc_buffer pre;
 
 			memset(&pre, 0, sizeof(pre));
-			pre.in.pbuf = (unsigned long)alloc_fn(prealloc_buffer_size);
+			pre.in.pbuf = (unsigned long)vdisk_buf_alloc(dev,
+							prealloc_buffer_size);
 			pre.in.bufflen = prealloc_buffer_size;
 			pre.in.for_clust_pool = c;
 
@@ -288,7 +373,8 @@ static int prealloc_buffers(struct vdisk_dev *dev)
 				res = errno;
 				PRINT_ERROR("Unable to send prealloced buffer: %s",
 					strerror(res));
-				free((void *)(unsigned long)pre.in.pbuf);
+				vdisk_buf_free(dev,
+					(void *)(unsigned long)pre.in.pbuf);
 				goto out;
 			}
 			TRACE_MEM("Prealloced buffer cmd_h %x", pre.out.cmd_h);
@@ -300,11 +386,186 @@ out:
 	return res;
 }
 
+/*
+ * Maps the device's arena and registers it with SCST, which pins it once
+ * instead of pinning each buffer for each command.
+ */
+static int register_arena(struct vdisk_dev *dev, struct arena *a)
+{
+	struct scst_user_arena_desc desc;
+	size_t off;
+	int res, i;
+
+	res = arena_init(a, arena_size);
+	if (res != 0) {
+		PRINT_ERROR("Unable to map %zdMB arena: %s", arena_size >> 20,
+			strerror(res));
+		goto out;
+	}
+
+	memset(&desc, 0, sizeof(desc));
+	desc.pbuf = (unsigned long)a->base;
+	desc.len = a->size;
+	res = ioctl(dev->scst_usr_fd, SCST_USER_REGISTER_ARENA, &desc);
+	if (res != 0) {
+		res = errno;
+		PRINT_ERROR("Unable to register arena: %s", strerror(res));
+		goto out_exit;
+	}
+
+	/*
+	 * Unlike the preallocated buffers, which SCST can free on cached
+	 * memory purging, the arena stays mapped until exit, so it can be
+	 * registered with io_uring, which pins it for the ring's lifetime.
+	 */
+	if (uring_depth > 0) {
+		dev->arena_iov_cnt = (a->size + URING_MAX_BUF_SIZE - 1) /
+					URING_MAX_BUF_SIZE;
+		dev->arena_iov = calloc(dev->arena_iov_cnt,
+			sizeof(*dev->arena_iov));
+		if (dev->arena_iov == NULL) {
+			res = ENOMEM;
+			PRINT_ERROR("%s", "Unable to allocate arena chunks list");
+			goto out_exit;
+		}
+		for (i = 0, off = 0; i < dev->arena_iov_cnt;
+		     i++, off += URING_MAX_BUF_SIZE) {
+			dev->arena_iov[i].iov_base = a->base + off;
+			dev->arena_iov[i].iov_len =
+				min(a->size - off, (size_t)URING_MAX_BUF_SIZE);
+		}
+	}
+
+	dev->arena = a;
+
+	PRINT_INFO("Registered %zdMB arena of %s huge pages", a->size >> 20,
+		a->hugetlb ? "hugetlbfs" : "transparent");
+
+out:
+	return res;
+
+out_exit:
+	/* The kernel keeps its pins until the device is released */
+	arena_exit(a);
+	dev->arena_iov_cnt = 0;
+	goto out;
+}
+
+static int setup_rings(struct vdisk_queue *q)
+{
+	struct scst_user_rings_desc desc;
+	void *p;
+	int res;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.entries = rings_entries;
+	desc.eventfd = -1;
+
+	q->ring_eventfd = -1;
+	if (rings_poll_idle >= 0) {
+		q->ring_eventfd = eventfd(0, 0);
+		if (q->ring_eventfd < 0) {
+			res = errno;
+			PRINT_ERROR("eventfd() failed: %s", strerror(res));
+			goto out;
+		}
+		desc.flags = SCST_USER_RINGS_POLL;
+		desc.eventfd = q->ring_eventfd;
+		desc.poll_idle_ms = rings_poll_idle;
+		q->ring_poll = true;
+	}
+
+	res = ioctl(q->scst_usr_fd, SCST_USER_SETUP_RINGS, &desc);
+	if (res != 0) {
+		res = errno;
+		PRINT_ERROR("Unable to set up rings: %s", strerror(res));
+		goto out;
+	}
+
+	p = mmap(NULL, desc.mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		q->scst_usr_fd, 0);
+	if (p == MAP_FAILED) {
+		res = errno;
+		PRINT_ERROR("Unable to map rings: %s", strerror(res));
+		goto out;
+	}
+
+	q->ring_cmds = p + desc.cmds_off;
+	q->ring_replies = p + desc.replies_off;
+	q->ring_entries = desc.entries;
+
+	res = pthread_mutex_init(&q->ring_mutex, NULL);
+	if (res != 0) {
+		PRINT_ERROR("pthread_mutex_init() failed: %s", strerror(res));
+		munmap(p, desc.mmap_len);
+		goto out;
+	}
+
+	q->rings = p;
+
+out:
+	return res;
+}
+
+/*
+ * With several queues each of them, including queue 0, gets own fd by
+ * SCST_USER_OPEN_QUEUE, which also tells on which CPU to serve it.
+ */
+static int open_queues(struct vdisk_dev *dev)
+{
+	struct scst_user_queue_desc qdesc;
+	struct vdisk_queue *q;
+	int res = 0, i;
+
+	dev->queues_num = queues_num;
+	for (i = 0; i < dev->queues_num; i++) {
+		q = &dev->queues[i];
+		q->dev = dev;
+		q->cpu = -1;
+		q->scst_usr_fd = -1;
+	}
+
+	if (dev->queues_num == 1) {
+		dev->queues[0].scst_usr_fd = dev->scst_usr_fd;
+		goto out;
+	}
+
+	for (i = 0; i < dev->queues_num; i++) {
+		q = &dev->queues[i];
+
+		memset(&qdesc, 0, sizeof(qdesc));
+		qdesc.queue = i;
+		res = ioctl(dev->scst_usr_fd, SCST_USER_OPEN_QUEUE, &qdesc);
+		if (res < 0) {
+			res = errno;
+			PRINT_ERROR("Unable to open queue %d: %s", i,
+				strerror(res));
+			goto out;
+		}
+		q->scst_usr_fd = res;
+		q->cpu = qdesc.cpu;
+		res = 0;
+
+		if (dev->non_blocking &&
+		    (fcntl(q->scst_usr_fd, F_SETFL, O_NONBLOCK) != 0)) {
+			res = errno;
+			PRINT_ERROR("Unable to set O_NONBLOCK on queue %d: %s",
+				i, strerror(res));
+			goto out;
+		}
+
+		TRACE_DBG("Queue %d: fd %d, cpu %d", i, q->scst_usr_fd, q->cpu);
+	}
+
+out:
+	return res;
+}
+
 static int start(int argc, char **argv)
 {
 	int res = 0;
 	int fd;
-	int i, rc;
+	int i, j, rc;
 	void *rc1;
 	static struct scst_user_dev_desc desc;
 	pthread_t thread[MAX_VDEVS][threads];
@@ -314,8 +575,6 @@ static int start(int argc, char **argv)
 	i = 0;
 	optind -= 2;
 	while (1) {
-		int j;
-
 		optind += 2;
 		if (optind > (argc-2))
 			break;
@@ -357,6 +616,25 @@ static int start(int argc, char **argv)
 			devs[i].file_name, (uint64_t)devs[i].file_size/1024/1024,
 			devs[i].block_size, (uint64_t)devs[i].nblocks);
 
+		if (bench_time > 0) {
+			res = bench_dev(&devs[i], threads, bench_time);
+			if (res != 0)
+				goto out_unreg;
+			continue;
+		}
+
+		if (journal_dir != NULL) {
+			char path[PATH_MAX];
+
+			snprintf(path, sizeof(path), "%s/%s.journal",
+				journal_dir, devs[i].name);
+			res = journal_init(&journals[i], &devs[i], path,
+				(uint64_t)journal_size << 20, destage_threads);
+			if (res != 0)
+				goto out_unreg;
+			devs[i].journal = &journals[i];
+		}
+
 		snprintf(devs[i].usn, sizeof(devs[i].usn), "%"PRIx64,
 			gen_dev_id_num(&devs[i]));
 		TRACE_DBG("usn %s", devs[i].usn);
@@ -385,6 +663,8 @@ static int start(int argc, char **argv)
 		desc.sgv_disable_clustered_pool = sgv_disable_clustered_pool;
 		desc.type = devs[i].type;
 		desc.block_size = devs[i].block_size;
+		desc.queues_num = queues_num;
+		desc.queue_policy = queue_policy;
 
 		desc.opt.parse_type = parse_type;
 		desc.opt.on_free_cmd_type = on_free_cmd_type;
@@ -395,6 +675,10 @@ static int start(int argc, char **argv)
 		desc.opt.queue_alg = SCST_QUEUE_ALG_1_UNRESTRICTED_REORDER;
 		desc.opt.qerr = SCST_QERR_0_ALL_RESUME;
 		desc.opt.d_sense = SCST_D_SENSE_0_FIXED_SENSE;
+		if (internal_cmds)
+			desc.opt.internal_cmds = internal_cmds_mask(&devs[i]);
+		desc.opt.compl_coalesce_usecs = compl_coalesce_usecs;
+		desc.opt.compl_coalesce_cmds = compl_coalesce_cmds;
 #ifdef DEBUG_EXT_COPY_REMAP
 		desc.opt.ext_copy_remap_supported = 1;
 #endif
@@ -406,12 +690,25 @@ static int start(int argc, char **argv)
 			goto out_unreg;
 		}
 
+		if (arena_size > 0) {
+			res = register_arena(&devs[i], &arenas[i]);
+			if (res != 0)
+				goto out_unreg;
+		}
+
 		if ((prealloc_buffers_num > 0) && (prealloc_buffer_size > 0)) {
 			res = prealloc_buffers(&devs[i]);
 			if (res != 0)
 				goto out_unreg;
 		}
 
+		if (cached_resps) {
+			devs[i].cached_resps = true;
+			res = upload_cached_resps(&devs[i]);
+			if (res != 0)
+				goto out_unreg;
+		}
+
 #if 1
 		{
 			/* Not needed, added here only as a test */
@@ -437,6 +734,18 @@ static int start(int argc, char **argv)
 		}
 #endif
 
+		res = open_queues(&devs[i]);
+		if (res != 0)
+			goto out_unreg;
+
+		if (rings_entries > 0) {
+			for (j = 0; j < devs[i].queues_num; j++) {
+				res = setup_rings(&devs[i].queues[j]);
+				if (res != 0)
+					goto out_unreg;
+			}
+		}
+
 		res = pthread_mutex_init(&devs[i].dev_mutex, NULL);
 		if (res != 0) {
 			res = errno;
@@ -445,7 +754,8 @@ static int start(int argc, char **argv)
 		}
 
 		for (j = 0; j < threads; j++) {
-			rc = pthread_create(&thread[i][j], NULL, main_loop, &devs[i]);
+			rc = pthread_create(&thread[i][j], NULL, main_loop,
+				&devs[i].queues[j % devs[i].queues_num]);
 			if (rc != 0) {
 				res = errno;
 				PRINT_ERROR("pthread_create() failed: %s",
@@ -495,7 +805,17 @@ out_unreg:
 				/* fall through */
 			}
 		}
+		for (j = 0; j < devs[i].queues_num; j++) {
+			if (devs[i].queues[j].scst_usr_fd != devs[i].scst_usr_fd)
+				close(devs[i].queues[j].scst_usr_fd);
+		}
 		close(devs[i].scst_usr_fd);
+		/* Pinned pages stay until the kernel releases the device */
+		if (devs[i].arena != NULL)
+			arena_exit(devs[i].arena);
+		/* Destages, what it can, the rest is replayed on next start */
+		if (devs[i].journal != NULL)
+			journal_exit(devs[i].journal);
 	}
 
 	return res;
@@ -517,7 +837,7 @@ int main(int argc, char **argv)
 
 	memset(devs, 0, sizeof(devs));
 
-	while ((ch = getopt_long(argc, argv, "+b:e:trongluF:I:cp:f:m:d:vsS:P:hDR:Z:M:",
+	while ((ch = getopt_long(argc, argv, "+b:e:trongluF:I:cp:f:m:d:vsS:P:hDR:Z:M:C:Q:W:N:A:U:B:H:KXO:J:j:T:",
 			long_options, &longindex)) >= 0) {
 		switch (ch) {
 		case 'b':
@@ -592,6 +912,78 @@ int main(int argc, char **argv)
 		case 'M':
 			use_multi = atoi(optarg);
 			break;
+		case 'C':
+			multi_cmds_max = atoi(optarg);
+			if ((multi_cmds_max < 1) ||
+			    (multi_cmds_max > MULTI_CMDS_MAX_LIMIT))
+				goto out_usage;
+			break;
+		case 'Q':
+			rings_entries = atoi(optarg);
+			break;
+		case 'W':
+			rings_poll_idle = atoi(optarg);
+			break;
+		case 'N':
+			queues_num = atoi(optarg);
+			if ((queues_num < 1) ||
+			    (queues_num > SCST_USER_MAX_QUEUES))
+				goto out_usage;
+			break;
+		case 'U':
+			uring_depth = atoi(optarg);
+			if ((uring_depth < 0) || (uring_depth > URING_MAX_DEPTH))
+				goto out_usage;
+			break;
+		case 'B':
+			bench_time = atoi(optarg);
+			if (bench_time <= 0)
+				goto out_usage;
+			break;
+		case 'H':
+			if (atoi(optarg) <= 0)
+				goto out_usage;
+			arena_size = (size_t)atoi(optarg) << 20;
+			break;
+		case 'K':
+			cached_resps = 1;
+			break;
+		case 'X':
+			internal_cmds = 1;
+			break;
+		case 'O':
+			compl_coalesce_cmds = 0;
+			if ((sscanf(optarg, "%d,%d", &compl_coalesce_usecs,
+					&compl_coalesce_cmds) < 1) ||
+			    (compl_coalesce_usecs < 1) ||
+			    (compl_coalesce_usecs >
+					SCST_USER_MAX_COMPL_COALESCE_USECS) ||
+			    (compl_coalesce_cmds < 0) ||
+			    (compl_coalesce_cmds > UINT16_MAX))
+				goto out_usage;
+			break;
+		case 'J':
+			journal_dir = optarg;
+			break;
+		case 'j':
+			journal_size = atoi(optarg);
+			if (journal_size < JOURNAL_MIN_SIZE_MB)
+				goto out_usage;
+			break;
+		case 'T':
+			destage_threads = atoi(optarg);
+			if ((destage_threads < 1) ||
+			    (destage_threads > JOURNAL_MAX_THREADS))
+				goto out_usage;
+			break;
+		case 'A':
+			if (strncmp(optarg, "initiator", 9) == 0)
+				queue_policy = SCST_USER_QUEUE_BY_INITIATOR;
+			else if (strncmp(optarg, "session", 7) == 0)
+				queue_policy = SCST_USER_QUEUE_BY_SESSION;
+			else
+				goto out_usage;
+			break;
 		case 'm':
 			if (strncmp(optarg, "all", 3) == 0)
 				memory_reuse_type = SCST_USER_MEM_REUSE_ALL;
@@ -720,13 +1112,79 @@ int main(int argc, char **argv)
 		PRINT_INFO("	Prealloc %d buffers of %dKB",
 			prealloc_buffers_num, prealloc_buffer_size / 1024);
 
+	if (arena_size > 0)
+		PRINT_INFO("	Allocating buffers from %zdMB huge pages arena",
+			arena_size >> 20);
+
+	if (cached_resps)
+		PRINT_INFO("	%s", "Static responses cached in SCST");
+
+	if (internal_cmds)
+		PRINT_INFO("	%s", "No-op commands completed by SCST");
+
+	if (compl_coalesce_cmds > 0)
+		PRINT_INFO("	Coalescing completions for up to %dus or %d "
+			"commands", compl_coalesce_usecs, compl_coalesce_cmds);
+	else if (compl_coalesce_usecs > 0)
+		PRINT_INFO("	Coalescing completions for up to %dus",
+			compl_coalesce_usecs);
+
+	if (journal_dir != NULL) {
+		if (nullio || rd_only_flag || (uring_depth > 0)) {
+			PRINT_ERROR("%s", "Journal can't be used with NULLIO, "
+				"read only or io_uring modes");
+			res = -EINVAL;
+			goto out_usage;
+		}
+		PRINT_INFO("	Write-back journal in %s, %dMB, %d destage "
+			"threads", journal_dir, journal_size, destage_threads);
+	}
+
 	if (!o_direct_flag && (memory_reuse_type == SCST_USER_MEM_NO_REUSE)) {
 		PRINT_INFO("	%s", "Using unaligned buffers");
 		alloc_fn = malloc;
 	}
 
-	if (!use_multi)
+	if (rings_entries > 0) {
+		if (rings_poll_idle >= 0)
+			PRINT_INFO("	Using %d entries rings, kernel poller "
+				"idle %d ms", rings_entries, rings_poll_idle);
+		else
+			PRINT_INFO("	Using %d entries rings", rings_entries);
+	} else if (!use_multi)
 		PRINT_INFO("	%s", "Using SCST_USER_REPLY_AND_GET_CMD");
+	else if (uring_depth == 0)
+		PRINT_INFO("	Up to %d commands per SCST_USER_REPLY_AND_GET_MULTI",
+			multi_cmds_max);
+
+	if (uring_depth > 0) {
+#ifdef HAVE_IO_URING
+		if (rings_entries > 0) {
+			PRINT_ERROR("%s", "io_uring can't be used with rings");
+			res = -EINVAL;
+			goto out_usage;
+		}
+		/* The threads wait for new commands in io_uring */
+		non_blocking = 1;
+		PRINT_INFO("	Using io_uring, up to %d commands in flight "
+			"per thread", uring_depth);
+#else
+		PRINT_ERROR("%s", "io_uring isn't supported by this build");
+		res = -EINVAL;
+		goto out_usage;
+#endif
+	}
+
+	if (queues_num > 1) {
+		if (threads < queues_num) {
+			PRINT_INFO("	Increasing threads to %d, one per queue",
+				queues_num);
+			threads = queues_num;
+		}
+		PRINT_INFO("	Using %d queues, distributed by %s", queues_num,
+			(queue_policy == SCST_USER_QUEUE_BY_SESSION) ?
+				"session" : "initiator");
+	}
 
 #if defined(DEBUG_TM_IGNORE) || defined(DEBUG_TM_IGNORE_ALL)
 	if (debug_tm_ignore)
@@ -749,6 +1207,18 @@ int main(int argc, char **argv)
 		/* don't do anything */
 	}
 
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigusr2_handler;
+	act.sa_flags = SA_RESTART;
+	sigemptyset(&act.sa_mask);
+	res = sigaction(SIGUSR2, &act, NULL);
+	if (res != 0) {
+		res = errno;
+		PRINT_ERROR("sigaction() failed: %s",
+			strerror(res));
+		/* don't do anything */
+	}
+
 	if (flush_interval != 0) {
 		memset(&act, 0, sizeof(act));
 		act.sa_handler = sigalrm_handler;
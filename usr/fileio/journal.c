@@ -0,0 +1,975 @@
+/*
+ *  journal.c
+ *
+ *  Write-back journal: WRITEs are acknowledged, once they are in an append
+ *  only journal on fast local storage, and destaged to the backing file
+ *  by background threads
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <sys/uio.h>
+
+#include "common.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC		0x4c4e524a	/* "JRNL" */
+#define JOURNAL_REC_MAGIC	0x4345524a	/* "JREC" */
+
+/* Destaged records are released, once they take this part of the area */
+#define JOURNAL_CKPT_FRACTION	8
+
+/* Destaging buffers alignment, enough for O_DIRECT */
+#define JOURNAL_BUF_ALIGN	4096
+
+/*
+ * The first sector of the journal file. Records from tail_v on are
+ * replayed on the next start, the earlier ones are in the backing file.
+ */
+struct journal_sb {
+	uint32_t magic;
+	uint32_t crc;		/* of the superblock with crc 0 */
+	uint64_t epoch;
+	uint64_t area_size;
+	uint64_t tail_v;
+	uint64_t tail_seq;
+};
+
+/* Sector heading each record, followed by its data */
+struct journal_hdr {
+	uint32_t magic;
+	uint32_t crc;		/* of the header with crc 0 */
+	uint64_t epoch;
+	uint64_t seq;
+	uint64_t loff;		/* of the data in the backing file */
+	uint32_t len;
+	uint32_t data_crc;
+};
+
+struct journal_rec {
+	struct journal_rec *next;
+	uint64_t seq;
+	uint64_t v;		/* of the header */
+	loff_t loff;
+	uint32_t len;
+	/* Index entries pointing to this record */
+	uint32_t blks_num;
+	/* Reads copying data from this record in the journal */
+	int readers;
+	unsigned int written:1;
+	unsigned int destaged:1;
+};
+
+/* Index entry of a journaled block, points to its newest record */
+struct journal_blk {
+	struct journal_blk *next;
+	uint64_t blk;
+	struct journal_rec *rec;
+};
+
+/* Part of a read, which is copied from the journal */
+struct journal_ext {
+	uint32_t off;		/* in the read buffer */
+	uint32_t len;
+	uint64_t v;
+	struct journal_rec *rec;
+};
+
+static inline loff_t journal_phys(const struct journal *j, uint64_t v)
+{
+	return JOURNAL_SECTOR + (v % j->area_size);
+}
+
+/* Length of [v, v + len), which fits before the end of the area */
+static inline uint32_t journal_first_part(const struct journal *j,
+	uint64_t v, uint32_t len)
+{
+	uint64_t to_end = j->area_size - (v % j->area_size);
+
+	return (to_end < len) ? to_end : len;
+}
+
+/* Returns 0 or errno. Modifies iov. */
+static int full_pwritev(int fd, struct iovec *iov, int cnt, loff_t off)
+{
+	ssize_t rc;
+
+	while (cnt > 0) {
+		rc = pwritev(fd, iov, cnt, off);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		} else if (rc == 0)
+			return EIO;
+
+		off += rc;
+		while ((cnt > 0) && ((size_t)rc >= iov->iov_len)) {
+			rc -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + rc;
+			iov->iov_len -= rc;
+		}
+	}
+	return 0;
+}
+
+static int full_pwrite(int fd, const void *buf, size_t len, loff_t off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	return full_pwritev(fd, &iov, 1, off);
+}
+
+/* Returns 0 or errno, EIO if the file is too short */
+static int full_pread(int fd, void *buf, size_t len, loff_t off)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = pread(fd, buf, len, off);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		} else if (rc == 0)
+			return EIO;
+
+		buf = (uint8_t *)buf + rc;
+		len -= rc;
+		off += rc;
+	}
+	return 0;
+}
+
+static int journal_pread_v(struct journal *j, void *buf, uint32_t len,
+	uint64_t v)
+{
+	uint32_t first = journal_first_part(j, v, len);
+	int res;
+
+	res = full_pread(j->fd, buf, first, journal_phys(j, v));
+	if ((res == 0) && (first < len))
+		res = full_pread(j->fd, (uint8_t *)buf + first, len - first,
+			JOURNAL_SECTOR);
+	return res;
+}
+
+static int journal_write_sb(struct journal *j, uint64_t tail_v,
+	uint64_t tail_seq)
+{
+	uint8_t buf[JOURNAL_SECTOR];
+	struct journal_sb *sb = (struct journal_sb *)buf;
+
+	memset(buf, 0, sizeof(buf));
+	sb->magic = JOURNAL_MAGIC;
+	sb->epoch = j->epoch;
+	sb->area_size = j->area_size;
+	sb->tail_v = tail_v;
+	sb->tail_seq = tail_seq;
+	sb->crc = crc32buf((char *)sb, sizeof(*sb));
+
+	return full_pwrite(j->fd, buf, sizeof(buf), 0);
+}
+
+/* Writes the header and the data of rec with one call, where possible */
+static int journal_write_rec(struct journal *j, const struct journal_rec *rec,
+	const void *data)
+{
+	uint8_t buf[JOURNAL_SECTOR];
+	struct journal_hdr *hdr = (struct journal_hdr *)buf;
+	uint64_t data_v = rec->v + JOURNAL_SECTOR;
+	struct iovec iov[2];
+	uint32_t done = 0;
+	int res;
+
+	memset(buf, 0, sizeof(buf));
+	hdr->magic = JOURNAL_REC_MAGIC;
+	hdr->epoch = j->epoch;
+	hdr->seq = rec->seq;
+	hdr->loff = rec->loff;
+	hdr->len = rec->len;
+	hdr->data_crc = crc32buf(data, rec->len);
+	hdr->crc = crc32buf((char *)hdr, sizeof(*hdr));
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len = sizeof(buf);
+	/* The header never crosses the end of the area, the data can */
+	if (journal_phys(j, data_v) != journal_phys(j, rec->v) + JOURNAL_SECTOR)
+		res = full_pwritev(j->fd, iov, 1, journal_phys(j, rec->v));
+	else {
+		done = journal_first_part(j, data_v, rec->len);
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = done;
+		res = full_pwritev(j->fd, iov, 2, journal_phys(j, rec->v));
+	}
+	if ((res == 0) && (done < rec->len))
+		res = full_pwrite(j->fd, (const uint8_t *)data + done,
+			rec->len - done, journal_phys(j, data_v + done));
+
+	return res;
+}
+
+static struct journal_blk **journal_blk_slot(struct journal *j, uint64_t blk)
+{
+	struct journal_blk **p = &j->blk_hash[blk & j->blk_hash_mask];
+
+	while ((*p != NULL) && ((*p)->blk != blk))
+		p = &(*p)->next;
+	return p;
+}
+
+/*
+ * Points the index entries of rec's blocks to it. Called under mutex in
+ * seq order, once rec is durable, see journal_advance_durable().
+ */
+static void journal_index_rec(struct journal *j, struct journal_rec *rec)
+{
+	uint64_t blk = rec->loff >> j->block_shift;
+	uint64_t end = (rec->loff + rec->len) >> j->block_shift;
+
+	for ( ; blk < end; blk++) {
+		struct journal_blk **p = journal_blk_slot(j, blk);
+		struct journal_blk *b = *p;
+
+		if (b != NULL) {
+			EXTRACHECKS_BUG_ON(b->rec->seq > rec->seq);
+			b->rec->blks_num--;
+		} else {
+			/* There are as many entries, as blocks in the area */
+			b = j->free_blks;
+			sBUG_ON(b == NULL);
+			j->free_blks = b->next;
+			b->next = NULL;
+			b->blk = blk;
+			*p = b;
+			j->blks_num++;
+		}
+		b->rec = rec;
+		rec->blks_num++;
+	}
+	return;
+}
+
+/* Called under mutex */
+static void journal_unindex_rec(struct journal *j, struct journal_rec *rec)
+{
+	uint64_t blk = rec->loff >> j->block_shift;
+	uint64_t end = (rec->loff + rec->len) >> j->block_shift;
+
+	for ( ; (blk < end) && (rec->blks_num > 0); blk++) {
+		struct journal_blk **p = journal_blk_slot(j, blk);
+		struct journal_blk *b = *p;
+
+		if ((b == NULL) || (b->rec != rec))
+			continue;
+		*p = b->next;
+		b->next = j->free_blks;
+		j->free_blks = b;
+		j->blks_num--;
+		rec->blks_num--;
+	}
+	return;
+}
+
+/*
+ * Called under mutex. Returns true, if durable_seq advanced.
+ *
+ * Records are indexed only here, not as soon as they are written. Else a
+ * newer record, written ahead of an earlier one still in flight, could
+ * supersede an acknowledged record, which then would be released without
+ * being destaged, while recovery would stop at the one in flight and never
+ * reach the newer one.
+ */
+static bool journal_advance_durable(struct journal *j)
+{
+	struct journal_rec *rec;
+	bool res = false;
+
+	while ((j->durable_next != NULL) && j->durable_next->written) {
+		rec = j->durable_next;
+		/* Failed and the later ones aren't found by recovery */
+		if (rec->seq < j->broken_seq)
+			journal_index_rec(j, rec);
+		j->durable_seq = rec->seq + 1;
+		j->durable_next = rec->next;
+		res = true;
+	}
+	return res;
+}
+
+/*
+ * Appends data to the journal. Returns 0, when it and all the earlier
+ * records are in the journal, so recovery finds it, or errno.
+ */
+int journal_write(struct journal *j, const void *buf, uint32_t len,
+	loff_t loff)
+{
+	uint64_t size = JOURNAL_SECTOR + (uint64_t)len;
+	struct journal_rec *rec;
+	uint64_t seq;
+	int res;
+
+	if (((len & (JOURNAL_SECTOR - 1)) != 0) || (size > j->area_size)) {
+		PRINT_ERROR("Unable to journal %d bytes, the journal is too "
+			"small", len);
+		res = EINVAL;
+		goto out;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	if (rec == NULL) {
+		res = ENOMEM;
+		goto out;
+	}
+	rec->loff = loff;
+	rec->len = len;
+
+	pthread_mutex_lock(&j->mutex);
+
+	if (j->broken_seq != UINT64_MAX) {
+		pthread_mutex_unlock(&j->mutex);
+		free(rec);
+		res = EIO;
+		goto out;
+	}
+
+	while (j->area_size - (j->head_v - j->tail_v) < size) {
+		j->space_waiters++;
+		pthread_cond_broadcast(&j->destage_cond);
+		pthread_cond_wait(&j->space_cond, &j->mutex);
+		j->space_waiters--;
+	}
+
+	seq = j->next_seq++;
+	rec->seq = seq;
+	rec->v = j->head_v;
+	j->head_v += size;
+
+	if (j->recs_tail != NULL)
+		j->recs_tail->next = rec;
+	else
+		j->recs_head = rec;
+	j->recs_tail = rec;
+	if (j->durable_next == NULL)
+		j->durable_next = rec;
+	if (j->destage_next == NULL)
+		j->destage_next = rec;
+
+	pthread_mutex_unlock(&j->mutex);
+
+	res = journal_write_rec(j, rec, buf);
+
+	pthread_mutex_lock(&j->mutex);
+
+	rec->written = 1;
+	if (res != 0) {
+		PRINT_ERROR("Writing %d bytes to the journal failed: %s", len,
+			strerror(res));
+		/* Recovery stops at it, so the later ones fail as well */
+		if (seq < j->broken_seq)
+			j->broken_seq = seq;
+	}
+
+	if (journal_advance_durable(j)) {
+		pthread_cond_broadcast(&j->durable_cond);
+		pthread_cond_broadcast(&j->destage_cond);
+	}
+	while (seq >= j->durable_seq)
+		pthread_cond_wait(&j->durable_cond, &j->mutex);
+
+	if ((res == 0) && (j->broken_seq < seq))
+		res = EIO;
+
+	pthread_mutex_unlock(&j->mutex);
+
+out:
+	return res;
+}
+
+/*
+ * Reads from the backing file fd, then copies the journaled, but not yet
+ * destaged blocks over. Returns 0 or errno.
+ */
+int journal_read(struct journal *j, int fd, void *buf, uint32_t len,
+	loff_t loff)
+{
+	uint32_t bsize = 1 << j->block_shift;
+	struct journal_ext *exts = NULL, *e;
+	int exts_num = 0, exts_max = 0, i, res = 0;
+	bool wake = false;
+
+	pthread_mutex_lock(&j->mutex);
+	if (j->blks_num != 0) {
+		uint64_t blk = loff >> j->block_shift;
+		uint64_t end = (loff + len) >> j->block_shift;
+
+		for ( ; blk < end; blk++) {
+			struct journal_blk *b = *journal_blk_slot(j, blk);
+			uint32_t off = (blk << j->block_shift) - loff;
+			uint64_t v;
+
+			if (b == NULL)
+				continue;
+
+			v = b->rec->v + JOURNAL_SECTOR +
+				((blk << j->block_shift) - b->rec->loff);
+			if (exts_num > 0) {
+				e = &exts[exts_num - 1];
+				if ((e->rec == b->rec) &&
+				    (e->off + e->len == off)) {
+					e->len += bsize;
+					continue;
+				}
+			}
+
+			if (exts_num == exts_max) {
+				int max = exts_max ? exts_max * 2 : 8;
+
+				e = realloc(exts, max * sizeof(*exts));
+				if (e == NULL) {
+					res = ENOMEM;
+					break;
+				}
+				exts = e;
+				exts_max = max;
+			}
+			e = &exts[exts_num++];
+			e->off = off;
+			e->len = bsize;
+			e->v = v;
+			e->rec = b->rec;
+			/* Keeps its space from being reused */
+			e->rec->readers++;
+		}
+	}
+	pthread_mutex_unlock(&j->mutex);
+
+	if (res == 0)
+		res = full_pread(fd, buf, len, loff);
+	for (i = 0; (res == 0) && (i < exts_num); i++)
+		res = journal_pread_v(j, (uint8_t *)buf + exts[i].off,
+			exts[i].len, exts[i].v);
+
+	if (exts_num > 0) {
+		pthread_mutex_lock(&j->mutex);
+		for (i = 0; i < exts_num; i++) {
+			if ((--exts[i].rec->readers == 0) &&
+			    exts[i].rec->destaged)
+				wake = true;
+		}
+		if (wake && (j->space_waiters > 0))
+			pthread_cond_broadcast(&j->destage_cond);
+		pthread_mutex_unlock(&j->mutex);
+	}
+	free(exts);
+
+	return res;
+}
+
+/* Called under mutex */
+static bool journal_checkpoint_needed(const struct journal *j)
+{
+	const struct journal_rec *rec = j->recs_head;
+
+	if (j->checkpointing || (rec == NULL) || !rec->destaged ||
+	    (rec->readers != 0))
+		return false;
+
+	return (j->space_waiters > 0) ||
+	       (j->destaged_bytes >= j->area_size / JOURNAL_CKPT_FRACTION);
+}
+
+/*
+ * Releases the destaged records at the tail of the journal. Called under
+ * mutex, which is dropped while syncing. Returns true, if the tail moved.
+ */
+static bool journal_checkpoint(struct journal *j)
+{
+	struct journal_rec *rec = j->recs_head;
+	uint64_t tail_v, tail_seq;
+	bool res = false;
+	int rc;
+
+	while ((rec != NULL) && rec->destaged && (rec->readers == 0))
+		rec = rec->next;
+	if (rec != NULL) {
+		tail_v = rec->v;
+		tail_seq = rec->seq;
+	} else {
+		tail_v = j->head_v;
+		tail_seq = j->next_seq;
+	}
+	if (tail_v == j->tail_v)
+		goto out;
+
+	j->checkpointing = true;
+	pthread_mutex_unlock(&j->mutex);
+
+	/* The destaged data must be stable, before the journal forgets it */
+	rc = fdatasync(j->backing_fd);
+	if (rc != 0)
+		rc = errno;
+	else
+		rc = journal_write_sb(j, tail_v, tail_seq);
+
+	pthread_mutex_lock(&j->mutex);
+	j->checkpointing = false;
+
+	if (rc != 0) {
+		PRINT_ERROR("Journal checkpoint failed: %s", strerror(rc));
+		goto out;
+	}
+
+	while ((j->recs_head != NULL) && (j->recs_head->v != tail_v)) {
+		rec = j->recs_head;
+		j->recs_head = rec->next;
+		j->destaged_bytes -= JOURNAL_SECTOR + rec->len;
+		free(rec);
+	}
+	if (j->recs_head == NULL)
+		j->recs_tail = NULL;
+	j->tail_v = tail_v;
+	pthread_cond_broadcast(&j->space_cond);
+	res = true;
+
+out:
+	return res;
+}
+
+static bool journal_overlap(const struct journal_rec *a,
+	const struct journal_rec *b)
+{
+	return (a->loff < b->loff + b->len) && (b->loff < a->loff + a->len);
+}
+
+/* Takes the next durable record to destage, if any. Called under mutex. */
+static struct journal_rec *journal_claim(struct journal *j,
+	struct journal_thread *t)
+{
+	struct journal_rec *rec = j->destage_next;
+	int i;
+
+	if ((rec == NULL) || (rec->seq >= j->durable_seq))
+		return NULL;
+
+	/* Overlapping records go in order, else older data could win */
+	for (i = 0; (rec->blks_num > 0) && (i < j->threads_num); i++) {
+		if ((j->threads[i].rec != NULL) &&
+		    journal_overlap(j->threads[i].rec, rec))
+			return NULL;
+	}
+
+	j->destage_next = rec->next;
+	t->rec = rec;
+	return rec;
+}
+
+static int journal_destage(struct journal *j, const struct journal_rec *rec,
+	void **buf, uint32_t *buf_size)
+{
+	int res;
+
+	if (*buf_size < rec->len) {
+		free(*buf);
+		*buf = NULL;
+		*buf_size = 0;
+		res = posix_memalign(buf, JOURNAL_BUF_ALIGN, rec->len);
+		if (res != 0) {
+			*buf = NULL;
+			goto out;
+		}
+		*buf_size = rec->len;
+	}
+
+	res = journal_pread_v(j, *buf, rec->len, rec->v + JOURNAL_SECTOR);
+	if (res != 0)
+		goto out;
+
+	res = full_pwrite(j->backing_fd, *buf, rec->len, rec->loff);
+
+out:
+	return res;
+}
+
+static void *journal_destage_thread(void *arg)
+{
+	struct journal_thread *t = arg;
+	struct journal *j = t->j;
+	struct journal_rec *rec;
+	void *buf = NULL;
+	uint32_t buf_size = 0;
+	bool write;
+	int res, attempt;
+
+	pthread_mutex_lock(&j->mutex);
+	while (1) {
+		if (journal_checkpoint_needed(j) && journal_checkpoint(j))
+			continue;
+
+		rec = journal_claim(j, t);
+		if (rec == NULL) {
+			if (j->stop && ((j->destage_next == NULL) ||
+					j->destage_failed))
+				break;
+			pthread_cond_wait(&j->destage_cond, &j->mutex);
+			continue;
+		}
+
+		/* Superseded by newer records or failed to be written */
+		write = (rec->blks_num > 0);
+		pthread_mutex_unlock(&j->mutex);
+
+		res = 0;
+		attempt = 0;
+		while (write) {
+			res = journal_destage(j, rec, &buf, &buf_size);
+			if (res == 0)
+				break;
+			/* Slow network storage can recover, so keep trying */
+			if ((attempt++ % 60) == 0)
+				PRINT_ERROR("Destaging %d bytes at %"PRId64
+					" failed: %s", rec->len,
+					(int64_t)rec->loff, strerror(res));
+			if (__atomic_load_n(&j->stop, __ATOMIC_RELAXED))
+				break;
+			sleep(1);
+		}
+
+		pthread_mutex_lock(&j->mutex);
+		if (res == 0) {
+			rec->destaged = 1;
+			journal_unindex_rec(j, rec);
+			j->destaged_bytes += JOURNAL_SECTOR + rec->len;
+		} else
+			j->destage_failed = true;
+		t->rec = NULL;
+		pthread_cond_broadcast(&j->destage_cond);
+	}
+	pthread_mutex_unlock(&j->mutex);
+
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Replays the records of the previous run, which may not have been
+ * destaged, to the backing file. The chain of records ends at the first
+ * one with a wrong epoch, seq or CRC. Sets epoch and next_seq.
+ */
+static int journal_recover(struct journal *j, const char *path)
+{
+	uint8_t sb_buf[JOURNAL_SECTOR], hdr_buf[JOURNAL_SECTOR];
+	struct journal_sb *sb = (struct journal_sb *)sb_buf;
+	struct journal_hdr *hdr = (struct journal_hdr *)hdr_buf;
+	uint64_t v, seq, bytes = 0, area_size = j->area_size;
+	void *buf = NULL;
+	uint32_t buf_size = 0, crc;
+	int res, i, recs = 0;
+	ssize_t rc;
+
+	memset(sb_buf, 0, sizeof(sb_buf));
+	rc = pread(j->fd, sb_buf, sizeof(sb_buf), 0);
+	if (rc < 0) {
+		res = errno;
+		PRINT_ERROR("Unable to read journal %s: %s", path,
+			strerror(res));
+		goto out;
+	}
+
+	for (i = 0; (i < (int)sizeof(sb_buf)) && (sb_buf[i] == 0); i++)
+		;
+	if (i == sizeof(sb_buf)) {
+		TRACE_DBG("New journal %s", path);
+		j->epoch = 1;
+		j->next_seq = 1;
+		res = 0;
+		goto out;
+	}
+
+	crc = sb->crc;
+	sb->crc = 0;
+	if ((sb->magic != JOURNAL_MAGIC) ||
+	    (crc != crc32buf((char *)sb, sizeof(*sb))) ||
+	    (sb->area_size < JOURNAL_SECTOR * 2) ||
+	    ((sb->area_size & (JOURNAL_SECTOR - 1)) != 0)) {
+		PRINT_ERROR("%s isn't a valid journal, refusing to overwrite "
+			"it", path);
+		res = EINVAL;
+		goto out;
+	}
+
+	/* Records are laid out according to the previous size */
+	j->area_size = sb->area_size;
+	v = sb->tail_v;
+	seq = sb->tail_seq;
+	while (1) {
+		res = full_pread(j->fd, hdr_buf, sizeof(hdr_buf),
+			journal_phys(j, v));
+		if (res != 0)
+			break;
+
+		crc = hdr->crc;
+		hdr->crc = 0;
+		if ((hdr->magic != JOURNAL_REC_MAGIC) ||
+		    (crc != crc32buf((char *)hdr, sizeof(*hdr))) ||
+		    (hdr->epoch != sb->epoch) || (hdr->seq != seq) ||
+		    (hdr->len == 0) ||
+		    ((hdr->len & ((1 << j->block_shift) - 1)) != 0) ||
+		    (JOURNAL_SECTOR + (uint64_t)hdr->len > j->area_size) ||
+		    ((hdr->loff & ((1 << j->block_shift) - 1)) != 0) ||
+		    (hdr->loff + hdr->len > (uint64_t)j->backing_size))
+			break;
+
+		if (buf_size < hdr->len) {
+			free(buf);
+			buf = NULL;
+			buf_size = 0;
+			if (posix_memalign(&buf, JOURNAL_BUF_ALIGN,
+					hdr->len) != 0) {
+				buf = NULL;
+				res = ENOMEM;
+				goto out_free;
+			}
+			buf_size = hdr->len;
+		}
+
+		res = journal_pread_v(j, buf, hdr->len, v + JOURNAL_SECTOR);
+		if ((res != 0) || (hdr->data_crc != crc32buf(buf, hdr->len)))
+			break;
+
+		TRACE_DBG("Replaying record %"PRIu64", %d bytes at %"PRIu64,
+			seq, hdr->len, hdr->loff);
+		res = full_pwrite(j->backing_fd, buf, hdr->len, hdr->loff);
+		if (res != 0) {
+			PRINT_ERROR("Replaying journal %s failed: %s", path,
+				strerror(res));
+			goto out_free;
+		}
+
+		v += JOURNAL_SECTOR + hdr->len;
+		seq++;
+		recs++;
+		bytes += hdr->len;
+	}
+
+	if ((recs > 0) && (fdatasync(j->backing_fd) != 0)) {
+		res = errno;
+		PRINT_ERROR("Syncing replayed journal %s failed: %s", path,
+			strerror(res));
+		goto out_free;
+	}
+
+	if (recs > 0)
+		PRINT_INFO("Replayed %d records (%"PRIu64" bytes) from "
+			"journal %s", recs, bytes, path);
+
+	j->epoch = sb->epoch + 1;
+	j->next_seq = seq;
+	res = 0;
+
+out_free:
+	free(buf);
+	j->area_size = area_size;
+
+out:
+	return res;
+}
+
+/* Stops the destaging threads, once they destaged what they can */
+static void journal_stop_threads(struct journal *j)
+{
+	int i;
+
+	pthread_mutex_lock(&j->mutex);
+	j->stop = true;
+	pthread_cond_broadcast(&j->destage_cond);
+	pthread_mutex_unlock(&j->mutex);
+
+	for (i = 0; i < j->threads_num; i++)
+		pthread_join(j->threads[i].thread, NULL);
+	return;
+}
+
+static int journal_init_index(struct journal *j)
+{
+	uint64_t i, n = j->area_size >> j->block_shift;
+	uint64_t hash_size = 1;
+
+	while (hash_size < n)
+		hash_size <<= 1;
+
+	j->blk_hash = calloc(hash_size, sizeof(*j->blk_hash));
+	j->blks = calloc(n, sizeof(*j->blks));
+	if ((j->blk_hash == NULL) || (j->blks == NULL))
+		return ENOMEM;
+	j->blk_hash_mask = hash_size - 1;
+
+	for (i = 0; i < n; i++) {
+		j->blks[i].next = j->free_blks;
+		j->free_blks = &j->blks[i];
+	}
+	return 0;
+}
+
+/*
+ * Opens or creates the journal at path for dev, replays what the previous
+ * run left in it and starts the destaging threads. Returns 0 or errno.
+ */
+int journal_init(struct journal *j, const struct vdisk_dev *dev,
+	const char *path, uint64_t size, int threads)
+{
+	int res, i, flags = O_RDWR | O_LARGEFILE;
+
+	memset(j, 0, sizeof(*j));
+	j->block_shift = dev->block_shift;
+	j->backing_size = dev->file_size;
+	j->area_size = size & ~((uint64_t)JOURNAL_SECTOR - 1);
+	j->broken_seq = UINT64_MAX;
+
+	if (dev->o_direct_flag)
+		flags |= O_DIRECT;
+	j->backing_fd = open(dev->file_name, flags);
+	if (j->backing_fd < 0) {
+		res = errno;
+		PRINT_ERROR("Unable to open file %s (%s)", dev->file_name,
+			strerror(res));
+		goto out;
+	}
+
+	j->fd = open(path, O_RDWR | O_CREAT | O_LARGEFILE | O_DSYNC, 0600);
+	if (j->fd < 0) {
+		res = errno;
+		PRINT_ERROR("Unable to open journal %s (%s)", path,
+			strerror(res));
+		goto out_close_backing;
+	}
+
+	res = journal_recover(j, path);
+	if (res != 0)
+		goto out_close;
+
+	/* Empty now, so it can be laid out anew */
+	res = posix_fallocate(j->fd, 0, JOURNAL_SECTOR + j->area_size);
+	if (res != 0) {
+		PRINT_ERROR("Unable to allocate journal %s: %s", path,
+			strerror(res));
+		goto out_close;
+	}
+	res = journal_write_sb(j, 0, j->next_seq);
+	if ((res == 0) && (fsync(j->fd) != 0))
+		res = errno;
+	if (res != 0) {
+		PRINT_ERROR("Unable to write journal %s: %s", path,
+			strerror(res));
+		goto out_close;
+	}
+	j->durable_seq = j->next_seq;
+
+	res = journal_init_index(j);
+	if (res != 0)
+		goto out_free;
+
+	pthread_mutex_init(&j->mutex, NULL);
+	pthread_cond_init(&j->space_cond, NULL);
+	pthread_cond_init(&j->durable_cond, NULL);
+	pthread_cond_init(&j->destage_cond, NULL);
+
+	j->threads = calloc(threads, sizeof(*j->threads));
+	if (j->threads == NULL) {
+		res = ENOMEM;
+		goto out_destroy;
+	}
+	for (i = 0; i < threads; i++) {
+		j->threads[i].j = j;
+		res = pthread_create(&j->threads[i].thread, NULL,
+			journal_destage_thread, &j->threads[i]);
+		if (res != 0) {
+			PRINT_ERROR("pthread_create() failed: %s",
+				strerror(res));
+			goto out_stop;
+		}
+		j->threads_num++;
+	}
+
+out:
+	return res;
+
+out_stop:
+	/* No records yet, so the started threads exit right away */
+	journal_stop_threads(j);
+	free(j->threads);
+
+out_destroy:
+	pthread_cond_destroy(&j->destage_cond);
+	pthread_cond_destroy(&j->durable_cond);
+	pthread_cond_destroy(&j->space_cond);
+	pthread_mutex_destroy(&j->mutex);
+
+out_free:
+	free(j->blks);
+	free(j->blk_hash);
+
+out_close:
+	close(j->fd);
+
+out_close_backing:
+	close(j->backing_fd);
+	goto out;
+}
+
+/*
+ * Destages all records, unless the backing file fails, then releases them.
+ * What's left is replayed on the next start.
+ */
+void journal_exit(struct journal *j)
+{
+	struct journal_rec *rec;
+	int left = 0;
+
+	journal_stop_threads(j);
+
+	pthread_mutex_lock(&j->mutex);
+	journal_checkpoint(j);
+	pthread_mutex_unlock(&j->mutex);
+
+	while (j->recs_head != NULL) {
+		rec = j->recs_head;
+		j->recs_head = rec->next;
+		free(rec);
+		left++;
+	}
+	if (left > 0)
+		PRINT_INFO("%d records left in the journal, they will be "
+			"replayed on the next start", left);
+
+	free(j->threads);
+	pthread_cond_destroy(&j->destage_cond);
+	pthread_cond_destroy(&j->durable_cond);
+	pthread_cond_destroy(&j->space_cond);
+	pthread_mutex_destroy(&j->mutex);
+	free(j->blks);
+	free(j->blk_hash);
+	close(j->fd);
+	close(j->backing_fd);
+	return;
+}
@@ -0,0 +1,101 @@
+/*
+ *  journal.h
+ *
+ *  Write-back journal: WRITEs are acknowledged, once they are in an append
+ *  only journal on fast local storage, and destaged to the backing file
+ *  by background threads
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/* Journal file layout unit: the superblock and records headers */
+#define JOURNAL_SECTOR		512
+
+#define JOURNAL_DEF_SIZE_MB	256
+#define JOURNAL_MIN_SIZE_MB	16
+#define JOURNAL_DEF_THREADS	2
+#define JOURNAL_MAX_THREADS	32
+
+struct vdisk_dev;
+struct journal;
+struct journal_rec;
+struct journal_blk;
+
+struct journal_thread {
+	struct journal *j;
+	pthread_t thread;
+	/* Record being destaged, protected by j->mutex */
+	struct journal_rec *rec;
+};
+
+struct journal {
+	int fd;			/* journal file, opened with O_DSYNC */
+	int backing_fd;		/* for destaging */
+	int block_shift;
+	loff_t backing_size;
+	/* Records area after the superblock, offsets in it wrap around */
+	uint64_t area_size;
+	/* Incremented on each start, so stale records aren't replayed */
+	uint64_t epoch;
+
+	int threads_num;
+	struct journal_thread *threads;
+
+	/* Protects all below */
+	pthread_mutex_t mutex;
+	pthread_cond_t space_cond;	/* writers wait for free space */
+	pthread_cond_t durable_cond;	/* and for the earlier records */
+	pthread_cond_t destage_cond;	/* destage threads wait for work */
+
+	/* Virtual offsets, growing monotonically, see journal_phys() */
+	uint64_t head_v;
+	uint64_t tail_v;		/* as in the superblock */
+	uint64_t next_seq;
+	/* All records before it are in the journal */
+	uint64_t durable_seq;
+	/* First record failed to be written, or UINT64_MAX */
+	uint64_t broken_seq;
+
+	/* Not released records, in seq order */
+	struct journal_rec *recs_head;
+	struct journal_rec *recs_tail;
+	/* The first not yet durable and the first not yet destaged ones */
+	struct journal_rec *durable_next;
+	struct journal_rec *destage_next;
+
+	/* Bytes of destaged, but not yet released records */
+	uint64_t destaged_bytes;
+	int space_waiters;
+	bool checkpointing;
+	bool destage_failed;
+	bool stop;
+
+	/* Index of the journaled blocks, which aren't destaged yet */
+	struct journal_blk **blk_hash;
+	uint64_t blk_hash_mask;
+	struct journal_blk *blks;
+	struct journal_blk *free_blks;
+	uint64_t blks_num;
+};
+
+int journal_init(struct journal *j, const struct vdisk_dev *dev,
+	const char *path, uint64_t size, int threads);
+void journal_exit(struct journal *j);
+int journal_write(struct journal *j, const void *buf, uint32_t len,
+	loff_t loff);
+int journal_read(struct journal *j, int fd, void *buf, uint32_t len,
+	loff_t loff);
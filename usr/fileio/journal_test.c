@@ -0,0 +1,243 @@
+/*
+ *  journal_test.c
+ *
+ *  Replay test of the write-back journal: a record completes ahead of an
+ *  earlier one still in flight, the process crashes and the journal is
+ *  replayed, then no acknowledged WRITE may be lost. Run by "make check".
+ *
+ *  pwritev() is wrapped (-Wl,--wrap=pwritev), so that the test decides
+ *  when the journal and the backing file writes complete.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "journal.h"
+
+#define TEST_BLOCK_SHIFT	12
+#define TEST_BLOCK_SIZE		(1 << TEST_BLOCK_SHIFT)
+#define TEST_FILE_SIZE		(16 << 20)
+#define TEST_JOURNAL_SIZE	(16 << 20)
+
+/*
+ * Block written before the crash. The filler record is one block short of
+ * the checkpoint threshold (1/8 of the journal), so the checkpoint covers
+ * the block's record too.
+ */
+#define TEST_BLOCK_OFF		(8 << 20)
+#define TEST_FILLER_LEN		((TEST_JOURNAL_SIZE / 8) - TEST_BLOCK_SIZE)
+#define TEST_MID_OFF		(12 << 20)
+
+char *app_name = "journal_test";
+unsigned long trace_flag = 0;
+bool log_daemon = false;
+
+static struct journal journal;
+
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cond = PTHREAD_COND_INITIALIZER;
+static bool armed, backing_open, mid_stalled;
+static int journal_writes_done;
+static __thread bool stall_me;
+
+ssize_t __real_pwritev(int fd, const struct iovec *iov, int cnt, off_t off);
+
+/*
+ * Stalls the journal write of the calling thread, if it's marked, and the
+ * destaging until backing_open, and "crashes" right after a checkpoint.
+ */
+ssize_t __wrap_pwritev(int fd, const struct iovec *iov, int cnt, off_t off)
+{
+	ssize_t res;
+
+	if (!armed)
+		return __real_pwritev(fd, iov, cnt, off);
+
+	pthread_mutex_lock(&test_mutex);
+	if (stall_me) {
+		mid_stalled = true;
+		pthread_cond_broadcast(&test_cond);
+		while (1)
+			pthread_cond_wait(&test_cond, &test_mutex);
+	}
+	while ((fd == journal.backing_fd) && !backing_open)
+		pthread_cond_wait(&test_cond, &test_mutex);
+	pthread_mutex_unlock(&test_mutex);
+
+	res = __real_pwritev(fd, iov, cnt, off);
+
+	if (fd == journal.fd) {
+		if (off == 0) {
+			/* The superblock, i.e. the checkpoint is done */
+			_exit(0);
+		}
+		pthread_mutex_lock(&test_mutex);
+		journal_writes_done++;
+		pthread_cond_broadcast(&test_cond);
+		pthread_mutex_unlock(&test_mutex);
+	}
+	return res;
+}
+
+static void *mid_writer(void *arg)
+{
+	static uint8_t buf[TEST_BLOCK_SIZE];
+
+	memset(buf, 'M', sizeof(buf));
+	stall_me = true;
+	journal_write(&journal, buf, sizeof(buf), TEST_MID_OFF);
+	return NULL;
+}
+
+static void *new_writer(void *arg)
+{
+	static uint8_t buf[TEST_BLOCK_SIZE];
+
+	memset(buf, 'N', sizeof(buf));
+	/* Never acknowledged, it waits for the stalled record */
+	journal_write(&journal, buf, sizeof(buf), TEST_BLOCK_OFF);
+	return NULL;
+}
+
+static void wait_for(bool *flag, int *cnt, int n)
+{
+	pthread_mutex_lock(&test_mutex);
+	while ((flag != NULL) ? !*flag : (*cnt < n))
+		pthread_cond_wait(&test_cond, &test_mutex);
+	pthread_mutex_unlock(&test_mutex);
+	return;
+}
+
+/*
+ * Writes the filler, which occupies the only destage thread, and the
+ * acknowledged old version of the block. Then the middle record stalls,
+ * while the new version of the block completes ahead of it. Then the
+ * destaging proceeds until the checkpoint, where the process "crashes".
+ */
+static void run_crashing(struct vdisk_dev *dev, const char *journal_path)
+{
+	static uint8_t buf[TEST_FILLER_LEN];
+	pthread_t mid, new;
+	int done;
+
+	if (journal_init(&journal, dev, journal_path, TEST_JOURNAL_SIZE,
+			 1) != 0)
+		_exit(2);
+	armed = true;
+
+	memset(buf, 'F', TEST_FILLER_LEN);
+	if (journal_write(&journal, buf, TEST_FILLER_LEN, 0) != 0)
+		_exit(2);
+	memset(buf, 'O', TEST_BLOCK_SIZE);
+	if (journal_write(&journal, buf, TEST_BLOCK_SIZE, TEST_BLOCK_OFF) != 0)
+		_exit(2);
+
+	pthread_create(&mid, NULL, mid_writer, NULL);
+	wait_for(&mid_stalled, NULL, 0);
+
+	pthread_mutex_lock(&test_mutex);
+	done = journal_writes_done;
+	pthread_mutex_unlock(&test_mutex);
+	pthread_create(&new, NULL, new_writer, NULL);
+	wait_for(NULL, &journal_writes_done, done + 1);
+	/* Let it get to waiting for the stalled record */
+	usleep(100000);
+
+	pthread_mutex_lock(&test_mutex);
+	backing_open = true;
+	pthread_cond_broadcast(&test_cond);
+	pthread_mutex_unlock(&test_mutex);
+
+	sleep(10);
+	fprintf(stderr, "No checkpoint happened\n");
+	_exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/journal_test.XXXXXX";
+	char file_path[64], journal_path[64];
+	uint8_t buf[TEST_BLOCK_SIZE];
+	struct vdisk_dev dev;
+	int fd, status, res = 1;
+	pid_t pid;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		goto out;
+	}
+	snprintf(file_path, sizeof(file_path), "%s/file", dir);
+	snprintf(journal_path, sizeof(journal_path), "%s/journal", dir);
+
+	fd = open(file_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if ((fd < 0) || (ftruncate(fd, TEST_FILE_SIZE) != 0)) {
+		perror(file_path);
+		goto out_rm;
+	}
+	close(fd);
+
+	memset(&dev, 0, sizeof(dev));
+	dev.block_shift = TEST_BLOCK_SHIFT;
+	dev.block_size = TEST_BLOCK_SIZE;
+	dev.file_size = TEST_FILE_SIZE;
+	dev.file_name = file_path;
+
+	pid = fork();
+	if (pid == 0)
+		run_crashing(&dev, journal_path);
+	if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) ||
+	    (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "Crashing run failed\n");
+		goto out_rm;
+	}
+
+	/* Replays the journal */
+	if (journal_init(&journal, &dev, journal_path, TEST_JOURNAL_SIZE,
+			 1) != 0)
+		goto out_rm;
+	journal_exit(&journal);
+
+	fd = open(file_path, O_RDONLY);
+	if ((fd < 0) ||
+	    (pread(fd, buf, sizeof(buf), TEST_BLOCK_OFF) != sizeof(buf))) {
+		perror(file_path);
+		goto out_rm;
+	}
+	close(fd);
+
+	/* The new version was never acknowledged, so both are fine */
+	if ((buf[0] != 'O') && (buf[0] != 'N')) {
+		fprintf(stderr, "Acknowledged WRITE lost, block has 0x%x\n",
+			buf[0]);
+		goto out_rm;
+	}
+
+	printf("%s: OK\n", app_name);
+	res = 0;
+
+out_rm:
+	unlink(file_path);
+	unlink(journal_path);
+	rmdir(dir);
+
+out:
+	return res;
+}
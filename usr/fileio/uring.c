@@ -0,0 +1,182 @@
+/*
+ *  uring.c
+ *
+ *  Minimal io_uring support, so fileio_tgt doesn't depend on liburing
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/* Returns 0 on success or errno */
+int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	unsigned int *sq_array, i;
+	int res;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		res = errno;
+		goto out;
+	}
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED) {
+		res = errno;
+		goto out_close;
+	}
+
+	r->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (r->cq_ring == MAP_FAILED) {
+		res = errno;
+		goto out_unmap_sq;
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		res = errno;
+		goto out_unmap_cq;
+	}
+
+	r->sq_head = r->sq_ring + p.sq_off.head;
+	r->sq_tail = r->sq_ring + p.sq_off.tail;
+	r->sq_mask = *(unsigned int *)(r->sq_ring + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sqe_tail = *r->sq_tail;
+
+	sq_array = r->sq_ring + p.sq_off.array;
+	for (i = 0; i < p.sq_entries; i++)
+		sq_array[i] = i;
+
+	r->cq_head = r->cq_ring + p.cq_off.head;
+	r->cq_tail = r->cq_ring + p.cq_off.tail;
+	r->cq_mask = *(unsigned int *)(r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = r->cq_ring + p.cq_off.cqes;
+
+	res = 0;
+
+out:
+	return res;
+
+out_unmap_cq:
+	munmap(r->cq_ring, r->cq_ring_size);
+
+out_unmap_sq:
+	munmap(r->sq_ring, r->sq_ring_size);
+
+out_close:
+	close(r->fd);
+	r->fd = -1;
+	goto out;
+}
+
+void uring_exit(struct uring *r)
+{
+	munmap(r->sqes, r->sqes_size);
+	munmap(r->cq_ring, r->cq_ring_size);
+	munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	r->fd = -1;
+	return;
+}
+
+/* Returns 0 on success or errno */
+int uring_register_buffers(struct uring *r, const struct iovec *iov,
+	unsigned int nr)
+{
+	int res;
+
+	res = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+		iov, nr);
+	if (res < 0)
+		res = errno;
+	return res;
+}
+
+/* Returns a zeroed SQE or NULL, if all of them are waiting for submission */
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head;
+
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (r->sqe_tail - head >= r->sq_entries)
+		return NULL;
+
+	sqe = &r->sqes[r->sqe_tail & r->sq_mask];
+	r->sqe_tail++;
+
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/*
+ * Submits all got SQEs and waits until at least wait_nr completions are
+ * available. Returns the number of submitted SQEs or -errno.
+ */
+int uring_submit(struct uring *r, unsigned int wait_nr)
+{
+	unsigned int to_submit;
+	int res;
+
+	/* Makes the SQEs visible before the new tail */
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+	/* Including ones left from a previous partial submission */
+	to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if ((to_submit == 0) && (wait_nr == 0))
+		return 0;
+
+	res = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+		(wait_nr != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (res < 0)
+		res = -errno;
+	return res;
+}
+
+/* Returns the oldest not seen completion or NULL */
+struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r)
+{
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+	return;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,57 @@
+/*
+ *  uring.h
+ *
+ *  Minimal io_uring support, so fileio_tgt doesn't depend on liburing
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+
+	/* Submission queue, the SQ array maps entry i to SQE i */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	/* Tail of the SQEs got, but not yet submitted */
+	unsigned int sqe_tail;
+
+	/* Completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+int uring_init(struct uring *r, unsigned int entries);
+void uring_exit(struct uring *r);
+int uring_register_buffers(struct uring *r, const struct iovec *iov,
+	unsigned int nr);
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+int uring_submit(struct uring *r, unsigned int wait_nr);
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+
+#endif /* HAVE_IO_URING */